@@ -1,525 +1,844 @@
 #include "espdm.h"
-#include "espdm_mbus.h"
-#include "espdm_dlms.h"
-#include "espdm_obis.h"
-#if defined(ESP8266)
-#include <bearssl/bearssl.h>
-#endif
+#include "espdm_task.h"
+#include <cinttypes>
+#include <cstring>
 
 namespace esphome
 {
     namespace espdm
     {
-        DlmsMeter::DlmsMeter(uart::UARTComponent *parent) : uart::UARTDevice(parent) {}
+        uint32_t EsphomeClock::millis()
+        {
+            return esphome::millis();
+        }
 
-        void DlmsMeter::setup()
+        uint32_t EsphomeClock::micros()
         {
-            ESP_LOGI(TAG, "DLMS smart meter component v%s started", ESPDM_VERSION);
+            return esphome::micros();
         }
 
-        void DlmsMeter::loop()
+        uint32_t EsphomeClock::cycles()
         {
-            unsigned long currentTime = millis();
+            return arch_get_cpu_cycle_count();
+        }
 
-            while(available()) // Read while data is available
+        bool EsphomeLogger::enabled(LogLevel level)
+        {
+            switch(level)
             {
-                uint8_t c;
-                this->read_byte(&c);
-                this->receiveBuffer.push_back(c);
-
-                this->lastRead = currentTime;
-                //fix for ESPHOME 2022.12 -> added 10ms delay
-                delay(10);
+                case LogError:
+                    return ESPHOME_LOG_LEVEL >= ESPHOME_LOG_LEVEL_ERROR;
+                case LogWarning:
+                    return ESPHOME_LOG_LEVEL >= ESPHOME_LOG_LEVEL_WARN;
+                case LogInfo:
+                    return ESPHOME_LOG_LEVEL >= ESPHOME_LOG_LEVEL_INFO;
+                case LogDebug:
+                    return ESPHOME_LOG_LEVEL >= ESPHOME_LOG_LEVEL_DEBUG;
+                case LogVerbose:
+                    return ESPHOME_LOG_LEVEL >= ESPHOME_LOG_LEVEL_VERBOSE;
             }
 
-            if(!this->receiveBuffer.empty() && currentTime - this->lastRead > this->readTimeout)
+            return false;
+        }
+
+        void EsphomeLogger::log(LogLevel level, const char *message)
+        {
+            switch(level)
             {
-                log_packet(this->receiveBuffer);
+                case LogError:
+                    ESP_LOGE(this->tag, "%s", message);
+                break;
+                case LogWarning:
+                    ESP_LOGW(this->tag, "%s", message);
+                break;
+                case LogInfo:
+                    ESP_LOGI(this->tag, "%s", message);
+                break;
+                case LogDebug:
+                    ESP_LOGD(this->tag, "%s", message);
+                break;
+                case LogVerbose:
+                    ESP_LOGV(this->tag, "%s", message);
+                break;
+            }
+        }
 
-                // Verify and parse M-Bus frames
+        static AesGcmBackend sharedEngine; // AES-GCM implementation of the platform, used through DlmsMeter::sharedCrypto
 
-                ESP_LOGV(TAG, "Parsing M-Bus frames");
+        SharedCrypto DlmsMeter::sharedCrypto(sharedEngine);
+        uint8_t DlmsMeter::readBuffer[ESPDM_READ_CHUNK_SIZE];
+        MeterReading DlmsMeter::reading;
+        uint8_t DlmsMeter::reportBuffer[ESPDM_REPORT_BUFFER_SIZE];
 
-                uint16_t frameOffset = 0; // Offset is used if the M-Bus message is split into multiple frames
-                std::vector<uint8_t> mbusPayload; // Contains the data of the payload
+#if defined(ESP32)
+        struct BackgroundDecoding
+        {
+            TelegramQueue queue; // Decoded telegrams for loop()
+            QueueingListener listener; // Fills the queue on the decode task
+            uint32_t droppedEvents = 0; // Last count of dropped events that was logged
+#if ESPDM_ENABLE_STATS
+            SpscQueue<PipelineStats, 2> statsQueue; // Snapshot of the decoder stats once per ESPDM_DIAGNOSTICS_INTERVAL
+            PipelineStats stats; // Last snapshot, used by loop()
+            uint32_t lastSnapshot = 0;
+#endif
+
+            BackgroundDecoding(Clock &clock) : listener(queue, clock) {}
+        };
 
-                while(true)
+        /*
+         * Task reading and decoding the UARTs of all meters with background decoding
+         *
+         * It has its own crypto engine so it never shares one with meters decoded in loop().
+         */
+        class DecodeTask : public Task
+        {
+            public:
+                ~DecodeTask()
                 {
-                    ESP_LOGV(TAG, "MBUS: Parsing frame");
+                    stop();
+                }
 
-                    // Check start bytes
-                    if(this->receiveBuffer[frameOffset + MBUS_START1_OFFSET] != 0x68 || this->receiveBuffer[frameOffset + MBUS_START2_OFFSET] != 0x68)
-                    {
-                        ESP_LOGE(TAG, "MBUS: Start bytes do not match");
-                        return abort();
-                    }
+                bool add(DlmsMeter *meter) // Only called from the main task
+                {
+                    size_t count = this->meterCount.load(std::memory_order_relaxed);
 
-                    // Both length bytes must be identical
-                    if(this->receiveBuffer[frameOffset + MBUS_LENGTH1_OFFSET] != this->receiveBuffer[frameOffset + MBUS_LENGTH2_OFFSET])
-                    {
-                        ESP_LOGE(TAG, "MBUS: Length bytes do not match");
-                        return abort();
-                    }
+                    if(count == ESPDM_MAX_BACKGROUND_METERS)
+                        return false;
 
-                    uint8_t frameLength = this->receiveBuffer[frameOffset + MBUS_LENGTH1_OFFSET]; // Get length of this frame
+                    this->meters[count] = meter;
+                    this->meterCount.store(count + 1, std::memory_order_release); // The task only sees the meter once it is stored
 
-                    // Check if received data is enough for the given frame length
-                    if(this->receiveBuffer.size() - frameOffset < frameLength + 3)
-                    {
-                        ESP_LOGE(TAG, "MBUS: Frame too big for received data");
-                        return abort();
-                    }
+                    return true;
+                }
 
-                    if(this->receiveBuffer[frameOffset + frameLength + MBUS_HEADER_INTRO_LENGTH + MBUS_FOOTER_LENGTH - 1] != 0x16)
-                    {
-                        ESP_LOGE(TAG, "MBUS: Invalid stop byte");
-                        return abort();
-                    }
+                AesGcmBackend engine; // Only used through crypto
+                SharedCrypto crypto{engine};
 
-                    mbusPayload.insert(mbusPayload.end(), &this->receiveBuffer[frameOffset + MBUS_FULL_HEADER_LENGTH], &this->receiveBuffer[frameOffset + MBUS_HEADER_INTRO_LENGTH + frameLength]);
+            protected:
+                void run() override
+                {
+                    while(!should_stop())
+                    {
+                        size_t count = this->meterCount.load(std::memory_order_acquire);
 
-                    frameOffset += MBUS_HEADER_INTRO_LENGTH + frameLength + MBUS_FOOTER_LENGTH;
+                        for(size_t i = 0; i < count; i++)
+                            this->meters[i]->loop_background(this->readBuffer, sizeof(this->readBuffer));
 
-                    if(frameOffset >= this->receiveBuffer.size()) // No more data to read, exit loop
-                    {
-                        break;
+                        Task::sleep(ESPDM_DECODE_TASK_INTERVAL);
                     }
                 }
 
-                // Verify and parse DLMS header
+            private:
+                DlmsMeter *meters[ESPDM_MAX_BACKGROUND_METERS];
+                std::atomic<size_t> meterCount{0};
+                uint8_t readBuffer[ESPDM_READ_CHUNK_SIZE];
+        };
 
-                ESP_LOGV(TAG, "Parsing DLMS header");
+        static DecodeTask decodeTask;
 
-                if(mbusPayload.size() < 20) // If the payload is too short we need to abort
-                {
-                    ESP_LOGE(TAG, "DLMS: Payload too short");
-                    return abort();
-                }
+        struct RawTelegram // Tapped telegram waiting for loop() to publish it
+        {
+            std::atomic<bool> full{false}; // Set by the decode task once data is valid, cleared by loop() after publishing
+            size_t length = 0;
+            uint8_t data[MBUS_MAX_PAYLOAD_LENGTH];
+        };
+#endif
 
-                if(mbusPayload[DLMS_CIPHER_OFFSET] != 0xDB) // Only general-glo-ciphering is supported (0xDB)
+        struct RawTap
+        {
+            std::string topics[2]; // Encrypted and decrypted telegrams
+            uint8_t points = 0; // Enabled TapPoint bits
+            uint32_t enabledAt = 0; // millis() when the tap was switched on
+#if defined(ESP32)
+            RawTelegram *pending = NULL; // One per tap point, only with background decoding, allocated in setup()
+#endif
+        };
+
+        DlmsMeter::DlmsMeter(uart::UARTComponent *parent) : uart::UARTDevice(parent), crypto(sharedCrypto), decoder(crypto, clock, &logger), sensorFilter(policies), reportFilter(policies)
+        {
+            this->decoder.set_listener(this);
+        }
+
+        void DlmsMeter::setup()
+        {
+            ESP_LOGI(this->tag, "DLMS smart meter component v%s started", ESPDM_VERSION);
+            ESP_LOGD(this->tag, "Meter uses %u bytes of RAM, %u bytes are shared by all meters", (unsigned) sizeof(*this), (unsigned) (sizeof(sharedEngine) + sizeof(sharedCrypto) + sizeof(readBuffer) + sizeof(reading) + sizeof(reportBuffer)));
+
+#if defined(ESP32)
+            if(this->background != NULL)
+            {
+                // Everything the decode task uses is set up before add() publishes the meter to it
+                if(this->tap != NULL)
+                    this->tap->pending = new RawTelegram[2];
+
+                if(!decodeTask.add(this))
                 {
-                    ESP_LOGE(TAG, "DLMS: Unsupported cipher");
-                    return abort();
+                    ESP_LOGE(this->tag, "Only %u meters can be decoded in the background", (unsigned) ESPDM_MAX_BACKGROUND_METERS);
+                    return;
                 }
 
-                uint8_t systitleLength = mbusPayload[DLMS_SYST_OFFSET];
+                if(!decodeTask.is_running() && !decodeTask.start("espdm_decode", this->backgroundCore, ESPDM_DECODE_TASK_STACK_SIZE, ESPDM_DECODE_TASK_PRIORITY))
+                    ESP_LOGE(this->tag, "Decode task could not be started");
+                else
+                    ESP_LOGI(this->tag, "Decoding on core %d, %u bytes for the queue", this->backgroundCore, (unsigned) sizeof(BackgroundDecoding));
+            }
+#endif
+        }
+
+        void DlmsMeter::loop()
+        {
+            uint32_t loopStart = micros();
 
-                if(systitleLength != 0x08) // Only system titles with length of 8 are supported
+            this->telegramHandled = false;
+
+#if defined(ESP32)
+            if(this->background != NULL)
+            {
+                // The decode task reads the UART, only handle one decoded telegram per call
+                TelegramEvent event;
+
+                if(this->background->queue.pop(event))
+                    handle_event(event);
+
+                uint32_t dropped = this->background->listener.get_dropped();
+
+                if(dropped != this->background->droppedEvents)
                 {
-                    ESP_LOGE(TAG, "DLMS: Unsupported system title length");
-                    return abort();
+                    ESP_LOGW(this->tag, "Decode queue full, %" PRIu32 " telegrams dropped", dropped - this->background->droppedEvents);
+                    this->background->droppedEvents = dropped;
                 }
 
-                uint16_t messageLength = mbusPayload[DLMS_LENGTH_OFFSET];
-                int headerOffset = 0;
+#if ESPDM_ENABLE_STATS
+                while(this->background->statsQueue.pop(this->background->stats)) {}
+#endif
 
-                if(messageLength == 0x82)
-                {
-                    ESP_LOGV(TAG, "DLMS: Message length > 127");
+                if(this->tap != NULL && this->tap->pending != NULL)
+                    publish_raw_telegrams();
+            }
+            else
+#endif
+            {
+                // Drain at most one chunk per call and leave the rest in the UART buffer for the next iteration,
+                // this keeps the main loop responsive while the meter is sending
+                int bytesAvailable = available();
 
-                    memcpy(&messageLength, &mbusPayload[DLMS_LENGTH_OFFSET + 1], 2);
-                    messageLength = swap_uint16(messageLength);
+                if(bytesAvailable > 0)
+                {
+                    size_t chunkLength = std::min((size_t) bytesAvailable, sizeof(this->readBuffer));
 
-                    headerOffset = DLMS_HEADER_EXT_OFFSET; // Header is now 2 bytes longer due to length > 127
+                    if(this->read_array(this->readBuffer, chunkLength))
+                        this->decoder.feed(this->readBuffer, chunkLength);
                 }
                 else
                 {
-                    ESP_LOGV(TAG, "DLMS: Message length <= 127");
+                    this->decoder.poll();
                 }
+            }
 
-                messageLength -= DLMS_LENGTH_CORRECTION; // Correct message length due to part of header being included in length
+            // Sensor states of the last telegram go out over the following calls, at least one per call
+            bool flushed = false;
 
-                if(mbusPayload.size() - DLMS_HEADER_LENGTH - headerOffset != messageLength)
-                {
-                    ESP_LOGE(TAG, "DLMS: Message has invalid length");
-                    return abort();
-                }
+            if(!this->telegramHandled && this->snapshot.dirty != 0)
+            {
+                flush_sensor_states(loopStart);
+                flushed = true;
+            }
 
-                if(mbusPayload[headerOffset + DLMS_SECBYTE_OFFSET] != 0x21) // Only certain security suite is supported (0x21)
-                {
-                    ESP_LOGE(TAG, "DLMS: Unsupported security control byte");
-                    return abort();
-                }
+            uint32_t loopTime = micros() - loopStart;
 
-                // Decryption
+            if(loopTime > this->maxLoopTime)
+                this->maxLoopTime = loopTime;
 
-                ESP_LOGV(TAG, "Decrypting payload");
+            // A telegram or a batch of sensor states is the most work a single call does, everything else
+            // waits for the next call so the other meters get their turn first
+            if(this->telegramHandled || flushed)
+                return;
 
-                uint8_t iv[12]; // Reserve space for the IV, always 12 bytes
-                // Copy system title to IV (System title is before length; no header offset needed!)
-                // Add 1 to the offset in order to skip the system title length byte
-                memcpy(&iv[0], &mbusPayload[DLMS_SYST_OFFSET + 1], systitleLength);
-                memcpy(&iv[8], &mbusPayload[headerOffset + DLMS_FRAMECOUNTER_OFFSET], DLMS_FRAMECOUNTER_LENGTH); // Copy frame counter to IV
+            for(size_t i = 0; i < ESPDM_MAX_WINDOWS; i++)
+            {
+                if(this->windows[i].due(millis()))
+                    publish_aggregate(i);
+            }
 
-                uint8_t plaintext[messageLength];
+            // Stored readings go out a few at a time, the store limits how often
+            if(this->store != NULL && this->mqtt_client != NULL && !this->store->empty() && this->mqtt_client->is_connected())
+                this->store->flush(*this, millis());
 
-#if defined(ESP8266)
-                memcpy(plaintext, &mbusPayload[headerOffset + DLMS_PAYLOAD_OFFSET], messageLength);
-                br_gcm_context gcmCtx;
-                br_aes_ct_ctr_keys bc;
-                br_aes_ct_ctr_init(&bc, this->key, this->keyLength);
-                br_gcm_init(&gcmCtx, &bc.vtable, br_ghash_ctmul32);
-                br_gcm_reset(&gcmCtx, iv, sizeof(iv));
-                br_gcm_flip(&gcmCtx);
-                br_gcm_run(&gcmCtx, 0, plaintext, messageLength);
-#elif defined(ESP32)
-                mbedtls_gcm_init(&this->aes);
-                mbedtls_gcm_setkey(&this->aes, MBEDTLS_CIPHER_ID_AES, this->key, this->keyLength * 8);
+            if(millis() - this->lastDiagnostics >= ESPDM_DIAGNOSTICS_INTERVAL)
+                publish_diagnostics();
 
-                mbedtls_gcm_auth_decrypt(&this->aes, messageLength, iv, sizeof(iv), NULL, 0, NULL, 0, &mbusPayload[headerOffset + DLMS_PAYLOAD_OFFSET], plaintext);
+            if(this->tap != NULL && this->tap->points != 0 && millis() - this->tap->enabledAt >= ESPDM_TAP_DURATION)
+            {
+                ESP_LOGI(this->tag, "Raw tap switched off after %" PRIu32 " s", ESPDM_TAP_DURATION / 1000);
+                set_tap_points(0);
+            }
+        }
 
-                mbedtls_gcm_free(&this->aes);
-#else
-  #error "Invalid Platform"
+        void DlmsMeter::loop_background(uint8_t *buffer, size_t size)
+        {
+            int bytesAvailable = available();
+
+            if(bytesAvailable > 0)
+            {
+                size_t chunkLength = std::min((size_t) bytesAvailable, size);
+
+                if(this->read_array(buffer, chunkLength))
+                    this->decoder.feed(buffer, chunkLength);
+            }
+            else
+            {
+                this->decoder.poll();
+            }
+
+#if defined(ESP32) && ESPDM_ENABLE_STATS
+            // The stats are only touched on this task, loop() gets a copy
+            if(millis() - this->background->lastSnapshot >= ESPDM_DIAGNOSTICS_INTERVAL)
+            {
+                this->background->statsQueue.push(this->decoder.get_stats());
+                this->decoder.reset_stage_timers();
+                this->background->lastSnapshot = millis();
+            }
 #endif
+        }
 
-                if(plaintext[0] != 0x0F || plaintext[5] != 0x0C)
-                {
-                    ESP_LOGE(TAG, "OBIS: Packet was decrypted but data is invalid");
-                    return abort();
-                }
+        void DlmsMeter::handle_event(const TelegramEvent &event)
+        {
+            if(!event.accepted)
+            {
+                ESP_LOGW(this->tag, "Rejected telegram: %s", telegram_error_name(event.error));
+                on_error(event.error);
+                return;
+            }
 
-                // Decoding
+            this->reading = event.reading;
 
-                ESP_LOGV(TAG, "Decoding payload");
+            TelegramInfo info = { NULL, event.frameCounter, 0 };
+            on_telegram(info);
+        }
 
-                int currentPosition = DECODER_START_OFFSET;
+        uint32_t DlmsMeter::get_max_loop_time()
+        {
+            uint32_t maxLoopTime = this->maxLoopTime;
+            this->maxLoopTime = 0;
 
-                do
-                {
-                    if(plaintext[currentPosition + OBIS_TYPE_OFFSET] != DataType::OctetString)
-                    {
-                        ESP_LOGE(TAG, "OBIS: Unsupported OBIS header type");
-                        return abort();
-                    }
+            return maxLoopTime;
+        }
 
-                    uint8_t obisCodeLength = plaintext[currentPosition + OBIS_LENGTH_OFFSET];
+        void DlmsMeter::on_value(const ObisValue &value, const ObisEntry *entry)
+        {
+            if(entry == NULL) // Unsupported codes are already logged by the decoder
+                return;
 
-                    if(obisCodeLength != 0x06)
+            switch(entry->handler)
+            {
+                case ObisHandler::NumericValue:
+                    if(!value.numeric)
                     {
-                        ESP_LOGE(TAG, "OBIS: Unsupported OBIS header length");
-                        return abort();
+                        ESP_LOGW(this->tag, "OBIS: Unexpected data type for numeric value");
+                        return;
                     }
 
-                    uint8_t obisCode[obisCodeLength];
-                    memcpy(&obisCode[0], &plaintext[currentPosition + OBIS_CODE_OFFSET], obisCodeLength); // Copy OBIS code to array
+                    this->reading.set(entry->type, numeric_value(value, entry), value_decimals(value, entry)); // Published once the whole telegram was decoded
+                break;
+                case ObisHandler::TimestampValue:
+                    format_timestamp(value, this->reading.timestamp, sizeof(this->reading.timestamp));
+                break;
+                case ObisHandler::IgnoreValue:
+                break;
+            }
+        }
 
-                    currentPosition += obisCodeLength + 2; // Advance past code, position and type
+        void DlmsMeter::on_telegram(const TelegramInfo &info)
+        {
+            ESP_LOGI(this->tag, "Received valid data");
+            ESP_LOGD(this->tag, "Longest loop time since last telegram: %" PRIu32 " us", get_max_loop_time());
 
-                    uint8_t dataType = plaintext[currentPosition];
-                    currentPosition++; // Advance past data type
+            this->telegramHandled = true;
 
-                    uint8_t dataLength = 0x00;
+            uint32_t fields = report_fields();
 
-                    CodeType codeType = CodeType::Unknown;
+            this->snapshot.stage(this->reading, fields); // Sensors get the telegram as a whole, starting with the next loop() call
 
-                    if(obisCode[OBIS_A] == Medium::Electricity)
-                    {
-                        // Compare C and D against code
-                        if(memcmp(&obisCode[OBIS_C], ESPDM_VOLTAGE_L1, 2) == 0)
-                        {
-                            codeType = CodeType::VoltageL1;
-                        }
-                        else if(memcmp(&obisCode[OBIS_C], ESPDM_VOLTAGE_L2, 2) == 0)
-                        {
-                            codeType = CodeType::VoltageL2;
-                        }
-                        else if(memcmp(&obisCode[OBIS_C], ESPDM_VOLTAGE_L3, 2) == 0)
-                        {
-                            codeType = CodeType::VoltageL3;
-                        }
-
-                        else if(memcmp(&obisCode[OBIS_C], ESPDM_CURRENT_L1, 2) == 0)
-                        {
-                            codeType = CodeType::CurrentL1;
-                        }
-                        else if(memcmp(&obisCode[OBIS_C], ESPDM_CURRENT_L2, 2) == 0)
-                        {
-                            codeType = CodeType::CurrentL2;
-                        }
-                        else if(memcmp(&obisCode[OBIS_C], ESPDM_CURRENT_L3, 2) == 0)
-                        {
-                            codeType = CodeType::CurrentL3;
-                        }
-
-                        else if(memcmp(&obisCode[OBIS_C], ESPDM_ACTIVE_POWER_PLUS, 2) == 0)
-                        {
-                            codeType = CodeType::ActivePowerPlus;
-                        }
-                        else if(memcmp(&obisCode[OBIS_C], ESPDM_ACTIVE_POWER_MINUS, 2) == 0)
-                        {
-                            codeType = CodeType::ActivePowerMinus;
-                        }
-
-                        else if(memcmp(&obisCode[OBIS_C], ESPDM_ACTIVE_ENERGY_PLUS, 2) == 0)
-                        {
-                            codeType = CodeType::ActiveEnergyPlus;
-                        }
-                        else if(memcmp(&obisCode[OBIS_C], ESPDM_ACTIVE_ENERGY_MINUS, 2) == 0)
-                        {
-                            codeType = CodeType::ActiveEnergyMinus;
-                        }
-
-                        else if(memcmp(&obisCode[OBIS_C], ESPDM_REACTIVE_ENERGY_PLUS, 2) == 0)
-                        {
-                            codeType = CodeType::ReactiveEnergyPlus;
-                        }
-                        else if(memcmp(&obisCode[OBIS_C], ESPDM_REACTIVE_ENERGY_MINUS, 2) == 0)
-                        {
-                            codeType = CodeType::ReactiveEnergyMinus;
-                        }
-                        else
-                        {
-                            ESP_LOGW(TAG, "OBIS: Unsupported OBIS code");
-                        }
-                    }
-                    else if(obisCode[OBIS_A] == Medium::Abstract)
-                    {
-                        if(memcmp(&obisCode[OBIS_C], ESPDM_TIMESTAMP, 2) == 0)
-                        {
-                            codeType = CodeType::Timestamp;
-                        }
-                        else if(memcmp(&obisCode[OBIS_C], ESPDM_SERIAL_NUMBER, 2) == 0)
-                        {
-                            codeType = CodeType::SerialNumber;
-                        }
-                        else if(memcmp(&obisCode[OBIS_C], ESPDM_DEVICE_NAME, 2) == 0)
-                        {
-                            codeType = CodeType::DeviceName;
-                        }
-                        else
-                        {
-                            ESP_LOGW(TAG, "OBIS: Unsupported OBIS code");
-                        }
-                    }
-                    else
-                    {
-                        ESP_LOGE(TAG, "OBIS: Unsupported OBIS medium");
-                        return abort();
-                    }
+            for(size_t i = 0; i < ESPDM_MAX_WINDOWS; i++)
+                this->windows[i].add(this->reading, millis());
+
+            if(this->mqtt_client != NULL)
+            {
+                if(report_due(fields, millis()) && !publish_report(this->reading, fields, true) && this->store != NULL)
+                {
+                    this->store->push(this->reading);
+                    ESP_LOGD(this->tag, "MQTT: Not connected, %u readings stored", (unsigned) this->store->size());
+                }
+            }
 
-                    uint8_t uint8Value;
-                    uint16_t uint16Value;
-                    uint32_t uint32Value;
-                    float floatValue;
+            this->reading.clear();
+        }
 
-                    switch(dataType)
-                    {
-                        case DataType::DoubleLongUnsigned:
-                            dataLength = 4;
-
-                            memcpy(&uint32Value, &plaintext[currentPosition], 4); // Copy bytes to integer
-                            uint32Value = swap_uint32(uint32Value); // Swap bytes
-
-                            floatValue = uint32Value; // Ignore decimal digits for now
-
-                            if(codeType == CodeType::ActivePowerPlus && this->active_power_plus != NULL && this->active_power_plus->state != floatValue)
-                                this->active_power_plus->publish_state(floatValue);
-                            else if(codeType == CodeType::ActivePowerMinus && this->active_power_minus != NULL && this->active_power_minus->state != floatValue)
-                                this->active_power_minus->publish_state(floatValue);
-
-                            else if(codeType == CodeType::ActiveEnergyPlus && this->active_energy_plus != NULL && this->active_energy_plus->state != floatValue)
-                                this->active_energy_plus->publish_state(floatValue);
-                            else if(codeType == CodeType::ActiveEnergyMinus && this->active_energy_minus != NULL && this->active_energy_minus->state != floatValue)
-                                this->active_energy_minus->publish_state(floatValue);
-
-                            else if(codeType == CodeType::ReactiveEnergyPlus && this->reactive_energy_plus != NULL && this->reactive_energy_plus->state != floatValue)
-                                this->reactive_energy_plus->publish_state(floatValue);
-                            else if(codeType == CodeType::ReactiveEnergyMinus && this->reactive_energy_minus != NULL && this->reactive_energy_minus->state != floatValue)
-                                this->reactive_energy_minus->publish_state(floatValue);
-
-                        break;
-                        case DataType::LongUnsigned:
-                            dataLength = 2;
-
-                            memcpy(&uint16Value, &plaintext[currentPosition], 2); // Copy bytes to integer
-                            uint16Value = swap_uint16(uint16Value); // Swap bytes
-
-                            if(plaintext[currentPosition + 5] == Accuracy::SingleDigit)
-                                floatValue = uint16Value / 10.0; // Divide by 10 to get decimal places
-                            else if(plaintext[currentPosition + 5] == Accuracy::DoubleDigit)
-                                floatValue = uint16Value / 100.0; // Divide by 100 to get decimal places
-                            else
-                                floatValue = uint16Value; // No decimal places
-
-                            if(codeType == CodeType::VoltageL1 && this->voltage_l1 != NULL && this->voltage_l1->state != floatValue)
-                                this->voltage_l1->publish_state(floatValue);
-                            else if(codeType == CodeType::VoltageL2 && this->voltage_l2 != NULL && this->voltage_l2->state != floatValue)
-                                this->voltage_l2->publish_state(floatValue);
-                            else if(codeType == CodeType::VoltageL3 && this->voltage_l3 != NULL && this->voltage_l3->state != floatValue)
-                                this->voltage_l3->publish_state(floatValue);
-
-                            else if(codeType == CodeType::CurrentL1 && this->current_l1 != NULL && this->current_l1->state != floatValue)
-                                this->current_l1->publish_state(floatValue);
-                            else if(codeType == CodeType::CurrentL2 && this->current_l2 != NULL && this->current_l2->state != floatValue)
-                                this->current_l2->publish_state(floatValue);
-                            else if(codeType == CodeType::CurrentL3 && this->current_l3 != NULL && this->current_l3->state != floatValue)
-                                this->current_l3->publish_state(floatValue);
-
-                        break;
-                        case DataType::OctetString:
-                            dataLength = plaintext[currentPosition];
-                            currentPosition++; // Advance past string length
-
-                            if(codeType == CodeType::Timestamp) // Handle timestamp generation
-                            {
-                                char timestamp[21]; // 0000-00-00T00:00:00Z
-
-                                uint16_t year;
-                                uint8_t month;
-                                uint8_t day;
-
-                                uint8_t hour;
-                                uint8_t minute;
-                                uint8_t second;
-
-                                memcpy(&uint16Value, &plaintext[currentPosition], 2);
-                                year = swap_uint16(uint16Value);
-
-                                memcpy(&month, &plaintext[currentPosition + 2], 1);
-                                memcpy(&day, &plaintext[currentPosition + 3], 1);
-
-                                memcpy(&hour, &plaintext[currentPosition + 5], 1);
-                                memcpy(&minute, &plaintext[currentPosition + 6], 1);
-                                memcpy(&second, &plaintext[currentPosition + 7], 1);
-
-                                sprintf(timestamp, "%04u-%02u-%02uT%02u:%02u:%02uZ", year, month, day, hour, minute, second);
-
-                                this->timestamp->publish_state(timestamp);
-                            }
-
-                        break;
-                        default:
-                            ESP_LOGE(TAG, "OBIS: Unsupported OBIS data type");
-                            return abort();
-                        break;
-                    }
+        void DlmsMeter::on_error(TelegramError error)
+        {
+            this->reading.clear(); // Values of a rejected telegram are never reported
 
-                    currentPosition += dataLength; // Skip data length
+            if(error == ErrorDuplicate)
+                this->duplicateTelegrams++;
+            else if(error == ErrorStale)
+                this->staleTelegrams++;
 
-                    currentPosition += 2; // Skip break after data
+            if(error == ErrorDuplicate && this->duplicate_telegrams != NULL)
+                this->duplicate_telegrams->publish_state(this->duplicateTelegrams);
+            else if(error == ErrorStale && this->stale_telegrams != NULL)
+                this->stale_telegrams->publish_state(this->staleTelegrams);
+        }
 
-                    if(plaintext[currentPosition] == 0x0F) // There is still additional data for this type, skip it
-                        currentPosition += 6; // Skip additional data and additional break; this will jump out of bounds on last frame
-                }
-                while (currentPosition <= messageLength); // Loop until arrived at end
+        bool DlmsMeter::publish_reading(const MeterReading &reading)
+        {
+            // Stored readings always carry the meter timestamp, they are published long after they were taken
+            return publish_report(reading, report_fields() | (1UL << CodeType::Timestamp), false);
+        }
+
+        void DlmsMeter::on_raw_telegram(TapPoint point, const uint8_t *data, size_t length)
+        {
+            int index = point == TapEncrypted ? 0 : 1;
+
+#if defined(ESP32)
+            if(this->background != NULL)
+            {
+                // On the decode task, hand the telegram to loop(). If the last one was not published yet, this one is skipped.
+                RawTelegram &raw = this->tap->pending[index];
+
+                if(raw.full.load(std::memory_order_acquire) || length > sizeof(raw.data))
+                    return;
+
+                memcpy(raw.data, data, length);
+                raw.length = length;
+                raw.full.store(true, std::memory_order_release);
+                return;
+            }
+#endif
+
+            if(this->mqtt_client->is_connected())
+                this->mqtt_client->publish(this->tap->topics[index], (const char *) data, length);
+        }
+
+        void DlmsMeter::publish_raw_telegrams()
+        {
+#if defined(ESP32)
+            for(int i = 0; i < 2; i++)
+            {
+                RawTelegram &raw = this->tap->pending[i];
+
+                if(!raw.full.load(std::memory_order_acquire))
+                    continue;
+
+                if(this->mqtt_client->is_connected())
+                    this->mqtt_client->publish(this->tap->topics[i], (const char *) raw.data, raw.length);
+
+                raw.full.store(false, std::memory_order_release);
+            }
+#endif
+        }
+
+        void DlmsMeter::set_tap_points(uint8_t points)
+        {
+            this->tap->points = points;
+            this->tap->enabledAt = millis();
+            this->decoder.set_tap_points(points);
+        }
+
+        bool DlmsMeter::publish_report(const MeterReading &reading, uint32_t fields, bool withDiagnostics)
+        {
+            if(!this->mqtt_client->is_connected())
+                return false;
+
+            ReportWriter writer(this->reportFormat, this->reportBuffer, sizeof(this->reportBuffer));
+            writer.add_reading(reading, fields);
+#if ESPDM_ENABLE_STATS
+            if(withDiagnostics)
+                writer.add_diagnostics(current_stats());
+#endif
+            size_t reportLength = writer.finish();
+
+            if(reportLength == 0) // Would never fit, storing it does not help
+            {
+                ESP_LOGW(this->tag, "MQTT report does not fit into %u bytes", (unsigned) sizeof(this->reportBuffer));
+                return true;
+            }
+
+            return this->mqtt_client->publish(this->topic, (const char *) this->reportBuffer, reportLength);
+        }
+
+        uint32_t DlmsMeter::report_fields()
+        {
+            // Only report values which have a sensor configured
+            uint32_t fields = 0;
+
+            for(int i = 0; i < CodeType::CodeTypeCount; i++)
+            {
+                if(value_channel_enabled((CodeType) i) && this->sensors[channel_slot((CodeType) i)] != NULL)
+                    fields |= 1UL << i;
+            }
+
+            if(this->timestamp != NULL)
+                fields |= 1UL << CodeType::Timestamp;
+
+            return fields;
+        }
+
+        bool DlmsMeter::report_due(uint32_t fields, uint32_t now)
+        {
+            bool hasValues = false;
+            bool due = false;
+
+            for(int i = 0; i < CodeType::CodeTypeCount; i++)
+            {
+                if(!(fields & (1UL << i)) || !this->reading.has((CodeType) i))
+                    continue;
+
+                hasValues = true;
+
+                if(this->reportFilter.check((CodeType) i, this->reading.get((CodeType) i), now))
+                    due = true;
+            }
+
+            if(hasValues && !due) // Reports without any values (e.g. only the timestamp) are always due
+            {
+                this->reportFilter.count_suppressed();
+                return false;
+            }
+
+            // The report is a snapshot of all values, remember all of them as published
+            for(int i = 0; i < CodeType::CodeTypeCount; i++)
+            {
+                if((fields & (1UL << i)) && this->reading.has((CodeType) i))
+                    this->reportFilter.commit((CodeType) i, this->reading.get((CodeType) i), now);
+            }
+
+            return true;
+        }
+
+        void DlmsMeter::publish_aggregate(size_t index)
+        {
+            WindowAggregator &window = this->windows[index];
+
+            if(this->mqtt_client != NULL)
+            {
+                ReportWriter writer(this->reportFormat, this->reportBuffer, sizeof(this->reportBuffer));
+                writer.add_aggregate(window, report_fields());
+                size_t reportLength = writer.finish();
+
+                if(reportLength > 0)
+                    this->mqtt_client->publish(this->windowTopics[index], (const char *) this->reportBuffer, reportLength);
+                else
+                    ESP_LOGW(this->tag, "MQTT aggregate does not fit into %u bytes", (unsigned) sizeof(this->reportBuffer));
+            }
+
+            window.close(millis());
+        }
+
+        void DlmsMeter::publish_diagnostics()
+        {
+            if(this->suppressed_states != NULL)
+                this->suppressed_states->publish_state(this->sensorFilter.get_suppressed());
+
+            if(this->suppressed_reports != NULL)
+                this->suppressed_reports->publish_state(this->reportFilter.get_suppressed());
+
+            if(this->store != NULL && this->stored_readings != NULL)
+                this->stored_readings->publish_state(this->store->size());
 
-                this->receiveBuffer.clear(); // Reset buffer
+            if(this->store != NULL && this->dropped_readings != NULL)
+                this->dropped_readings->publish_state(this->store->get_dropped());
 
-                ESP_LOGI(TAG, "Received valid data");
+#if ESPDM_ENABLE_STATS
+            const PipelineStats &stats = current_stats();
+
+            float values[DiagnosticType::DiagnosticTypeCount];
+            values[DiagnosticType::DiagnosticBytesReceived] = stats.bytesReceived;
+            values[DiagnosticType::DiagnosticFramesAccepted] = stats.framesAccepted;
+            values[DiagnosticType::DiagnosticTelegramsPerMinute] = stats.telegramsPerMinute;
+            values[DiagnosticType::DiagnosticRejectedTelegrams] = stats.rejected_total();
+            values[DiagnosticType::DiagnosticFramingTime] = stats.framing.average();
+            values[DiagnosticType::DiagnosticDecryptionTime] = stats.decryption.average();
+            values[DiagnosticType::DiagnosticDecodingTime] = stats.decoding.average();
+            values[DiagnosticType::DiagnosticPublishingTime] = stats.publishing.average();
+
+            for(int i = 0; i < DiagnosticType::DiagnosticTypeCount; i++)
+            {
+                if(this->diagnostics[i] != NULL)
+                    this->diagnostics[i]->publish_state(values[i]);
+            }
 
-                if(this->mqtt_client != NULL)
+            ESP_LOGD(this->tag, "Diagnostics: %" PRIu32 " telegrams/min, %" PRIu32 " rejected, framing %" PRIu32 "/%" PRIu32 "/%" PRIu32 " us, decryption %" PRIu32 "/%" PRIu32 "/%" PRIu32 " us, decoding %" PRIu32 "/%" PRIu32 "/%" PRIu32 " us, publishing %" PRIu32 "/%" PRIu32 "/%" PRIu32 " us (min/avg/max)",
+                stats.telegramsPerMinute, stats.rejected_total(),
+                stats.framing.min, stats.framing.average(), stats.framing.max,
+                stats.decryption.min, stats.decryption.average(), stats.decryption.max,
+                stats.decoding.min, stats.decoding.average(), stats.decoding.max,
+                stats.publishing.min, stats.publishing.average(), stats.publishing.max);
+
+            if(this->background == NULL) // The decode task resets its own timers
+                this->decoder.reset_stage_timers();
+#endif
+
+            this->lastDiagnostics = millis();
+        }
+
+#if ESPDM_ENABLE_STATS
+        const PipelineStats &DlmsMeter::current_stats()
+        {
+#if defined(ESP32)
+            if(this->background != NULL)
+                return this->background->stats;
+#endif
+
+            return this->decoder.get_stats();
+        }
+#endif
+
+        void DlmsMeter::flush_sensor_states(uint32_t loopStart)
+        {
+            do
+            {
+                CodeType codeType = this->snapshot.take();
+
+                if(codeType == CodeType::Timestamp)
                 {
-                    this->mqtt_client->publish_json(this->topic, [=](JsonObject root)
-                    {
-                        if(this->voltage_l1 != NULL)
-                        {
-                            root["voltage_l1"] = this->voltage_l1->state;
-                            root["voltage_l2"] = this->voltage_l2->state;
-                            root["voltage_l3"] = this->voltage_l3->state;
-                        }
-
-                        if(this->current_l1 != NULL)
-                        {
-                            root["current_l1"] = this->current_l1->state;
-                            root["current_l2"] = this->current_l2->state;
-                            root["current_l3"] = this->current_l3->state;
-                        }
-
-                        if(this->active_power_plus != NULL)
-                        {
-                            root["active_power_plus"] = this->active_power_plus->state;
-                            root["active_power_minus"] = this->active_power_minus->state;
-                        }
-
-                        if(this->active_energy_plus != NULL)
-                        {
-                            root["active_energy_plus"] = this->active_energy_plus->state;
-                            root["active_energy_minus"] = this->active_energy_minus->state;
-                        }
-
-                        if(this->reactive_energy_plus != NULL)
-                        {
-                            root["reactive_energy_plus"] = this->reactive_energy_plus->state;
-                            root["reactive_energy_minus"] = this->reactive_energy_minus->state;
-                        }
-
-                        if(this->timestamp != NULL)
-                        {
-                            root["timestamp"] = this->timestamp->state;
-                        }
-                    });
+                    if(this->timestamp != NULL)
+                        this->timestamp->publish_state(this->snapshot.reading.timestamp);
+                }
+                else
+                {
+                    publish_value(codeType, this->snapshot.reading.get(codeType));
                 }
             }
+            while(this->snapshot.dirty != 0 && micros() - loopStart < ESPDM_PUBLISH_BUDGET);
         }
 
-        void DlmsMeter::abort()
+        void DlmsMeter::publish_value(CodeType codeType, float value)
         {
-            this->receiveBuffer.clear();
+            if(!value_channel_enabled(codeType))
+                return;
+
+            sensor::Sensor *sensor = this->sensors[channel_slot(codeType)];
+
+            if(sensor != NULL && this->sensorFilter.filter(codeType, value, millis()))
+                sensor->publish_state(value);
         }
 
-        uint16_t DlmsMeter::swap_uint16(uint16_t val)
+        void DlmsMeter::set_key(uint8_t key[], size_t keyLength)
         {
-            return (val << 8) | (val >> 8);
+            this->decoder.set_key(key, keyLength);
         }
 
-        uint32_t DlmsMeter::swap_uint32(uint32_t val)
+        void DlmsMeter::set_authentication_key(uint8_t key[])
         {
-            val = ((val << 8) & 0xFF00FF00) | ((val >> 8) & 0xFF00FF);
-            return (val << 16) | (val >> 16);
+            this->decoder.set_authentication_key(key);
         }
 
-        void DlmsMeter::set_key(uint8_t key[], size_t keyLength)
+        void DlmsMeter::set_transport(TransportType transport)
+        {
+            this->decoder.set_transport(transport);
+        }
+
+        void DlmsMeter::enable_background_decoding(int core)
+        {
+#if defined(ESP32)
+            if(this->background != NULL)
+                return;
+
+            this->background = new BackgroundDecoding(this->clock);
+            this->backgroundCore = core;
+
+            // From now on the decoder belongs to the decode task: it must not log or call into ESPHome
+            this->decoder.set_listener(&this->background->listener);
+            this->decoder.set_logger(NULL);
+            this->crypto.attach(decodeTask.crypto);
+#else
+            ESP_LOGE(this->tag, "Background decoding is only supported on the ESP32");
+#endif
+        }
+
+        void DlmsMeter::set_name(const char *name)
         {
-            memcpy(&this->key[0], &key[0], keyLength);
-            this->keyLength = keyLength;
+            this->tag = name;
+            this->logger.tag = name;
         }
 
         void DlmsMeter::set_voltage_sensors(sensor::Sensor *voltage_l1, sensor::Sensor *voltage_l2, sensor::Sensor *voltage_l3)
         {
-            this->voltage_l1 = voltage_l1;
-            this->voltage_l2 = voltage_l2;
-            this->voltage_l3 = voltage_l3;
+            set_sensor(CodeType::VoltageL1, voltage_l1);
+            set_sensor(CodeType::VoltageL2, voltage_l2);
+            set_sensor(CodeType::VoltageL3, voltage_l3);
         }
         void DlmsMeter::set_current_sensors(sensor::Sensor *current_l1, sensor::Sensor *current_l2, sensor::Sensor *current_l3)
         {
-            this->current_l1 = current_l1;
-            this->current_l2 = current_l2;
-            this->current_l3 = current_l3;
+            set_sensor(CodeType::CurrentL1, current_l1);
+            set_sensor(CodeType::CurrentL2, current_l2);
+            set_sensor(CodeType::CurrentL3, current_l3);
         }
 
         void DlmsMeter::set_active_power_sensors(sensor::Sensor *active_power_plus, sensor::Sensor *active_power_minus)
         {
-            this->active_power_plus = active_power_plus;
-            this->active_power_minus = active_power_minus;
+            set_sensor(CodeType::ActivePowerPlus, active_power_plus);
+            set_sensor(CodeType::ActivePowerMinus, active_power_minus);
         }
 
         void DlmsMeter::set_active_energy_sensors(sensor::Sensor *active_energy_plus, sensor::Sensor *active_energy_minus)
         {
-            this->active_energy_plus = active_energy_plus;
-            this->active_energy_minus = active_energy_minus;
+            set_sensor(CodeType::ActiveEnergyPlus, active_energy_plus);
+            set_sensor(CodeType::ActiveEnergyMinus, active_energy_minus);
         }
 
         void DlmsMeter::set_reactive_energy_sensors(sensor::Sensor *reactive_energy_plus, sensor::Sensor *reactive_energy_minus)
         {
-            this->reactive_energy_plus = reactive_energy_plus;
-            this->reactive_energy_minus = reactive_energy_minus;
+            set_sensor(CodeType::ReactiveEnergyPlus, reactive_energy_plus);
+            set_sensor(CodeType::ReactiveEnergyMinus, reactive_energy_minus);
+        }
+
+        void DlmsMeter::set_sensor(CodeType codeType, sensor::Sensor *sensor)
+        {
+            if(value_channel_enabled(codeType))
+                this->sensors[channel_slot(codeType)] = sensor;
+            else if(sensor != NULL)
+                ESP_LOGE(this->tag, "%s is not in ESPDM_CHANNELS, its sensor is never published", CODE_TYPE_NAMES[codeType]);
         }
 
         void DlmsMeter::set_timestamp_sensor(text_sensor::TextSensor *timestamp)
         {
+            if(!channel_enabled(CodeType::Timestamp) && timestamp != NULL)
+                ESP_LOGE(this->tag, "timestamp is not in ESPDM_CHANNELS, its sensor is never published");
+
             this->timestamp = timestamp;
         }
 
-        void DlmsMeter::enable_mqtt(mqtt::MQTTClientComponent *mqtt_client, const char *topic)
+        void DlmsMeter::set_rejected_telegram_sensors(sensor::Sensor *duplicate_telegrams, sensor::Sensor *stale_telegrams)
+        {
+            this->duplicate_telegrams = duplicate_telegrams;
+            this->stale_telegrams = stale_telegrams;
+        }
+
+#if ESPDM_ENABLE_STATS
+        void DlmsMeter::set_diagnostic_counter_sensors(sensor::Sensor *bytes_received, sensor::Sensor *frames_accepted, sensor::Sensor *telegrams_per_minute, sensor::Sensor *rejected_telegrams)
+        {
+            this->diagnostics[DiagnosticType::DiagnosticBytesReceived] = bytes_received;
+            this->diagnostics[DiagnosticType::DiagnosticFramesAccepted] = frames_accepted;
+            this->diagnostics[DiagnosticType::DiagnosticTelegramsPerMinute] = telegrams_per_minute;
+            this->diagnostics[DiagnosticType::DiagnosticRejectedTelegrams] = rejected_telegrams;
+        }
+
+        void DlmsMeter::set_diagnostic_time_sensors(sensor::Sensor *framing_time, sensor::Sensor *decryption_time, sensor::Sensor *decoding_time, sensor::Sensor *publishing_time)
+        {
+            this->diagnostics[DiagnosticType::DiagnosticFramingTime] = framing_time;
+            this->diagnostics[DiagnosticType::DiagnosticDecryptionTime] = decryption_time;
+            this->diagnostics[DiagnosticType::DiagnosticDecodingTime] = decoding_time;
+            this->diagnostics[DiagnosticType::DiagnosticPublishingTime] = publishing_time;
+        }
+#endif
+
+        void DlmsMeter::set_deadband(SensorGroup group, float absolute_deadband, float relative_deadband)
+        {
+            this->policies[group].absoluteDeadband = absolute_deadband;
+            this->policies[group].relativeDeadband = relative_deadband;
+        }
+
+        void DlmsMeter::set_publish_interval(SensorGroup group, uint32_t min_interval, uint32_t max_interval)
+        {
+            this->policies[group].minInterval = min_interval;
+            this->policies[group].maxInterval = max_interval;
+        }
+
+        void DlmsMeter::set_on_change_only(SensorGroup group)
+        {
+            this->policies[group].onChangeOnly = true;
+        }
+
+        void DlmsMeter::set_suppressed_publish_sensors(sensor::Sensor *suppressed_states, sensor::Sensor *suppressed_reports)
+        {
+            this->suppressed_states = suppressed_states;
+            this->suppressed_reports = suppressed_reports;
+        }
+
+        void DlmsMeter::enable_mqtt(mqtt::MQTTClientComponent *mqtt_client, const char *topic, ReportFormat format)
         {
             this->mqtt_client = mqtt_client;
             this->topic = topic;
+            this->reportFormat = format;
+        }
+
+        void DlmsMeter::enable_aggregation(uint32_t window_length, const char *topic)
+        {
+            for(size_t i = 0; i < ESPDM_MAX_WINDOWS; i++)
+            {
+                if(this->windows[i].get_length() == 0)
+                {
+                    this->windows[i].set_length(window_length);
+                    this->windowTopics[i] = topic;
+                    return;
+                }
+            }
+
+            ESP_LOGE(this->tag, "Only %u aggregation windows are supported", (unsigned) ESPDM_MAX_WINDOWS);
         }
 
-        void DlmsMeter::log_packet(std::vector<uint8_t> data)
+        void DlmsMeter::enable_store(const char *path)
         {
-            ESP_LOGV(TAG, format_hex_pretty(data).c_str());
+            if(this->store == NULL)
+                this->store = new ReadingStore();
+
+            if(path == NULL)
+                return;
+
+#if defined(ESP32)
+            this->store->set_backing(new FileBacking(path));
+            ESP_LOGI(this->tag, "Restored %u stored readings from %s", (unsigned) this->store->size(), path);
+#else
+            ESP_LOGE(this->tag, "Storing readings in a file is only supported on the ESP32, keeping them in RAM");
+#endif
+        }
+
+        void DlmsMeter::set_store_sensors(sensor::Sensor *stored_readings, sensor::Sensor *dropped_readings)
+        {
+            this->stored_readings = stored_readings;
+            this->dropped_readings = dropped_readings;
+        }
+
+        void DlmsMeter::enable_raw_tap(const char *topic)
+        {
+            if(this->mqtt_client == NULL)
+            {
+                ESP_LOGE(this->tag, "Raw tap needs enable_mqtt()");
+                return;
+            }
+
+            if(this->tap != NULL)
+                return;
+
+            this->tap = new RawTap();
+            this->tap->topics[0] = std::string(topic) + "/encrypted";
+            this->tap->topics[1] = std::string(topic) + "/decrypted";
+
+            this->decoder.set_tap(this);
+
+            // Off until switched on, then every telegram costs a copy and a publish
+            this->mqtt_client->subscribe(std::string(topic) + "/set", [this](const std::string &controlTopic, const std::string &payload)
+            {
+                uint8_t points;
+
+                if(payload == "off")
+                    points = 0;
+                else if(payload == "encrypted")
+                    points = TapEncrypted;
+                else if(payload == "decrypted")
+                    points = TapDecrypted;
+                else if(payload == "both")
+                    points = TapEncrypted | TapDecrypted;
+                else
+                {
+                    ESP_LOGW(this->tag, "Raw tap: Unknown mode '%s', use off, encrypted, decrypted or both", payload.c_str());
+                    return;
+                }
+
+                ESP_LOGI(this->tag, "Raw tap: %s", payload.c_str());
+                set_tap_points(points);
+            });
         }
     }
 }
@@ -1,16 +1,66 @@
 #include "esphome.h"
-#if defined(ESP32)
-#include "mbedtls/gcm.h"
-#endif
+#include "espdm_decoder.h"
+#include "espdm_pipeline.h"
+#include "espdm_policy.h"
+#include "espdm_report.h"
+#include "espdm_store.h"
 
 static const char* ESPDM_VERSION = "0.9.0";
 static const char* TAG = "espdm";
 
+static const size_t ESPDM_READ_CHUNK_SIZE = 64; // Maximum number of bytes read from the UART per loop iteration
+static const uint32_t ESPDM_PUBLISH_BUDGET = 10000; // Time in us a loop iteration may spend on sensor states, well below the time after which ESPHome warns about a blocking component
+
+static const uint32_t ESPDM_DIAGNOSTICS_INTERVAL = 60000; // Interval diagnostic sensors are published and stage timers are reset in, in ms
+
+static const size_t ESPDM_MAX_BACKGROUND_METERS = 4; // Meters the decode task can serve
+static const uint32_t ESPDM_DECODE_TASK_STACK_SIZE = 4096; // Stack of the decode task in bytes
+static const int ESPDM_DECODE_TASK_PRIORITY = 1; // Same as the ESPHome loop task
+static const uint32_t ESPDM_DECODE_TASK_INTERVAL = 10; // Time the decode task sleeps between two passes over the meters in ms
+
+static const uint32_t ESPDM_TAP_DURATION = 600000; // Raw tap switches itself off after this time in ms, so a forgotten tap does not keep publishing
+
 namespace esphome
 {
     namespace espdm
     {
-        class DlmsMeter : public Component, public uart::UARTDevice
+        class EsphomeClock : public Clock
+        {
+            public:
+                uint32_t millis() override;
+                uint32_t micros() override;
+                uint32_t cycles() override;
+        };
+
+        class EsphomeLogger : public Logger
+        {
+            public:
+                bool enabled(LogLevel level) override;
+                void log(LogLevel level, const char *message) override;
+
+                const char *tag = TAG; // Log tag of the meter
+        };
+
+        struct BackgroundDecoding; // State of a meter decoded on the decode task, only on the ESP32
+        struct RawTap; // Topics and state of the raw telegram tap, see enable_raw_tap()
+
+#if ESPDM_ENABLE_STATS
+        enum DiagnosticType
+        {
+            DiagnosticBytesReceived,
+            DiagnosticFramesAccepted,
+            DiagnosticTelegramsPerMinute,
+            DiagnosticRejectedTelegrams,
+            DiagnosticFramingTime, // Average in microseconds
+            DiagnosticDecryptionTime,
+            DiagnosticDecodingTime,
+            DiagnosticPublishingTime,
+
+            DiagnosticTypeCount
+        };
+#endif
+
+        class DlmsMeter : public Component, public uart::UARTDevice, public MeterListener, public ReadingSink, public TelegramTap
         {
             public:
                 DlmsMeter(uart::UARTComponent *parent);
@@ -18,6 +68,12 @@ namespace esphome
                 void setup() override;
                 void loop() override;
 
+                void on_value(const ObisValue &value, const ObisEntry *entry) override;
+                void on_telegram(const TelegramInfo &info) override;
+                void on_error(TelegramError error) override;
+                bool publish_reading(const MeterReading &reading) override; // Publishes a stored reading, false while MQTT is down
+                void on_raw_telegram(TapPoint point, const uint8_t *data, size_t length) override;
+
                 void set_voltage_sensors(sensor::Sensor *voltage_l1, sensor::Sensor *voltage_l2, sensor::Sensor *voltage_l3);
                 void set_current_sensors(sensor::Sensor *current_l1, sensor::Sensor *current_l2, sensor::Sensor *current_l3);
 
@@ -25,50 +81,105 @@ namespace esphome
                 void set_active_energy_sensors(sensor::Sensor *active_energy_plus, sensor::Sensor *active_energy_minus);
                 void set_reactive_energy_sensors(sensor::Sensor *reactive_energy_plus, sensor::Sensor *reactive_energy_minus);
                 void set_timestamp_sensor(text_sensor::TextSensor *timestamp);
+                void set_rejected_telegram_sensors(sensor::Sensor *duplicate_telegrams, sensor::Sensor *stale_telegrams);
+#if ESPDM_ENABLE_STATS
+                void set_diagnostic_counter_sensors(sensor::Sensor *bytes_received, sensor::Sensor *frames_accepted, sensor::Sensor *telegrams_per_minute, sensor::Sensor *rejected_telegrams);
+                void set_diagnostic_time_sensors(sensor::Sensor *framing_time, sensor::Sensor *decryption_time, sensor::Sensor *decoding_time, sensor::Sensor *publishing_time);
+#endif
+
+                void set_deadband(SensorGroup group, float absolute_deadband, float relative_deadband = 0); // Suppress changes up to the larger of both deadbands
+                void set_publish_interval(SensorGroup group, uint32_t min_interval, uint32_t max_interval = 0); // In ms, max_interval forces a heartbeat publish
+                void set_on_change_only(SensorGroup group); // Publish every change but never without one, for energy counters
+                void set_suppressed_publish_sensors(sensor::Sensor *suppressed_states, sensor::Sensor *suppressed_reports);
 
-                void enable_mqtt(mqtt::MQTTClientComponent *mqtt_client, const char *topic);
+                void enable_mqtt(mqtt::MQTTClientComponent *mqtt_client, const char *topic, ReportFormat format = ReportFormat::ReportJson);
+                void enable_aggregation(uint32_t window_length, const char *topic); // Publish aggregates over window_length ms to topic, needs enable_mqtt()
+                void enable_store(const char *path = NULL); // Keep reports while MQTT is down, path of a file on a mounted filesystem to survive restarts (ESP32 only)
+                void set_store_sensors(sensor::Sensor *stored_readings, sensor::Sensor *dropped_readings);
+                void enable_raw_tap(const char *topic); // Raw telegrams as binary on topic/encrypted and topic/decrypted while switched on through topic/set, needs enable_mqtt()
 
                 void set_key(uint8_t key[], size_t keyLength);
+                void set_authentication_key(uint8_t key[]); // 16 bytes, telegrams must then carry a matching GCM tag
+                void set_transport(TransportType transport); // Link layer of the meter, M-Bus by default, call before enable_background_decoding()
+                void set_name(const char *name); // Log tag of this meter, to tell several meters apart
+                void enable_background_decoding(int core = 0); // Read and decode on a task pinned to core, loop() only publishes (ESP32 only)
+
+                void loop_background(uint8_t *buffer, size_t size); // Called by the decode task with its read buffer
+
+                uint32_t get_max_loop_time(); // Returns the longest time spent in loop() in microseconds and resets it
 
             private:
-                std::vector<uint8_t> receiveBuffer; // Stores the packet currently being received
-                unsigned long lastRead = 0; // Timestamp when data was last read
-                int readTimeout = 100; // Time to wait after last byte before considering data complete
+                EsphomeClock clock; // Time source for the decoder
+                EsphomeLogger logger; // Forwards decoder messages to the ESPHome log
+                SharedCryptoKey crypto; // Key of this meter, the AES-GCM engine is shared
+                MeterDecoder decoder; // Framing, decryption and decoding of the telegrams
 
-                uint8_t key[16]; // Stores the decryption key
-                size_t keyLength; // Stores the decryption key length (usually 16 bytes)
+                // Shared by all meters, a telegram is decoded and published within a single loop() call
+                static SharedCrypto sharedCrypto; // AES-GCM engine, re-keyed when the next telegram is from another meter
+                static uint8_t readBuffer[ESPDM_READ_CHUNK_SIZE]; // Chunk of bytes read from the UART in one go
+                static MeterReading reading; // Values of the telegram being decoded, only complete in on_telegram()
+                static uint8_t reportBuffer[ESPDM_REPORT_BUFFER_SIZE]; // MQTT report is serialized into this buffer
+
+                const char *tag = TAG; // Log tag, see set_name()
+                uint32_t maxLoopTime = 0; // Longest time spent in loop() in microseconds
+                bool telegramHandled = false; // A telegram was decoded in the current loop() call
+
+                BackgroundDecoding *background = NULL; // Set by enable_background_decoding()
+                int backgroundCore = 0; // Core of the decode task
 
                 const char *topic; // Stores the MQTT topic
 
-#if defined(ESP32)
-                mbedtls_gcm_context aes; // AES context used for decryption
-#endif
+                sensor::Sensor *sensors[VALUE_SLOT_COUNT] = {}; // Sensors indexed by channel_slot(), NULL if not configured
+                TelegramSnapshot snapshot; // Sensor states of the last telegram, published over the following loop() calls
 
-                sensor::Sensor *voltage_l1 = NULL; // Voltage L1
-                sensor::Sensor *voltage_l2 = NULL; // Voltage L2
-                sensor::Sensor *voltage_l3 = NULL; // Voltage L3
+                text_sensor::TextSensor *timestamp = NULL; // Text sensor for the timestamp value
 
-                sensor::Sensor *current_l1 = NULL; // Current L1
-                sensor::Sensor *current_l2 = NULL; // Current L2
-                sensor::Sensor *current_l3 = NULL; // Current L3
+                sensor::Sensor *duplicate_telegrams = NULL; // Number of duplicate telegrams rejected
+                sensor::Sensor *stale_telegrams = NULL; // Number of stale or replayed telegrams rejected
+                uint32_t duplicateTelegrams = 0; // Counted here instead of in the decoder, which may run on another task
+                uint32_t staleTelegrams = 0;
 
-                sensor::Sensor *active_power_plus = NULL; // Active power taken from grid
-                sensor::Sensor *active_power_minus = NULL; // Active power put into grid
+                mqtt::MQTTClientComponent *mqtt_client = NULL;
+                ReportFormat reportFormat = ReportFormat::ReportJson; // Encoding of the MQTT report
 
-                sensor::Sensor *active_energy_plus = NULL; // Active energy taken from grid
-                sensor::Sensor *active_energy_minus = NULL; // Active energy put into grid
+                WindowAggregator windows[ESPDM_MAX_WINDOWS]; // Aggregation windows, unused ones have a length of 0
+                const char *windowTopics[ESPDM_MAX_WINDOWS] = {}; // MQTT topic of each window
 
-                sensor::Sensor *reactive_energy_plus = NULL; // Reactive energy taken from grid
-                sensor::Sensor *reactive_energy_minus = NULL; // Reactive energy put into grid
+                PublishPolicy policies[SensorGroup::SensorGroupCount]; // Publish policy per sensor group
+                PublishFilter sensorFilter; // Applies the policies to the sensors
+                PublishFilter reportFilter; // Applies the policies to the MQTT report
 
-                text_sensor::TextSensor *timestamp = NULL; // Text sensor for the timestamp value
+                sensor::Sensor *suppressed_states = NULL; // Number of sensor states suppressed by the publish policy
+                sensor::Sensor *suppressed_reports = NULL; // Number of MQTT reports suppressed by the publish policy
 
-                mqtt::MQTTClientComponent *mqtt_client = NULL;
+                ReadingStore *store = NULL; // Reports which could not be published, allocated by enable_store()
+                RawTap *tap = NULL; // Allocated by enable_raw_tap()
+                sensor::Sensor *stored_readings = NULL; // Number of readings waiting in the store
+                sensor::Sensor *dropped_readings = NULL; // Number of readings lost because the store was full
+
+                uint32_t lastDiagnostics = 0; // Timestamp when diagnostics were last published
+
+#if ESPDM_ENABLE_STATS
+                sensor::Sensor *diagnostics[DiagnosticType::DiagnosticTypeCount] = {}; // Diagnostic sensors indexed by type, NULL if not configured
+#endif
+
+                void handle_event(const TelegramEvent &event); // Decoded telegram from the decode task
+#if ESPDM_ENABLE_STATS
+                const PipelineStats &current_stats();
+#endif
+
+                uint32_t report_fields();
+                bool report_due(uint32_t fields, uint32_t now);
+                bool publish_report(const MeterReading &reading, uint32_t fields, bool withDiagnostics);
+                void publish_aggregate(size_t index);
+                void publish_diagnostics();
+
+                void set_tap_points(uint8_t points);
+                void publish_raw_telegrams(); // Tapped telegrams from the decode task
 
-                uint16_t swap_uint16(uint16_t val);
-                uint32_t swap_uint32(uint32_t val);
-                void log_packet(std::vector<uint8_t> data);
-                void abort();
+                void flush_sensor_states(uint32_t loopStart); // Publishes dirty sensor states until ESPDM_PUBLISH_BUDGET is used up
+                void publish_value(CodeType codeType, float value);
+                void set_sensor(CodeType codeType, sensor::Sensor *sensor);
         };
     }
 }
@@ -0,0 +1,131 @@
+#include "espdm_aggregate.h"
+#include "espdm_policy.h"
+#include "espdm_report.h"
+#include <cstring>
+
+namespace esphome
+{
+    namespace espdm
+    {
+        bool is_counter(CodeType type)
+        {
+            SensorGroup group = sensor_group(type);
+
+            return group == GroupActiveEnergy || group == GroupReactiveEnergy;
+        }
+
+        void ChannelAggregate::add(float value, uint8_t decimals)
+        {
+            if(this->count == 0 || value < this->min)
+                this->min = value;
+
+            if(this->count == 0 || value > this->max)
+                this->max = value;
+
+            if(!this->hasBaseline) // First value ever seen, deltas start from here
+            {
+                this->baseline = value;
+                this->hasBaseline = true;
+            }
+            else if(value < this->last) // Counter went down, e.g. a replaced meter, keep the delta so far and continue from the new value
+            {
+                this->baseline = value - (this->last - this->baseline);
+            }
+
+            this->sum += value;
+            this->last = value;
+            this->decimals = decimals;
+            this->count++;
+        }
+
+        float ChannelAggregate::mean() const
+        {
+            return this->count > 0 ? this->sum / this->count : 0;
+        }
+
+        float ChannelAggregate::delta() const
+        {
+            return this->last - this->baseline;
+        }
+
+        void WindowAggregator::set_length(uint32_t length)
+        {
+            this->length = length;
+        }
+
+        uint32_t WindowAggregator::get_length() const
+        {
+            return this->length;
+        }
+
+        void WindowAggregator::add(const MeterReading &reading, uint32_t now)
+        {
+            if(this->length == 0)
+                return;
+
+            if(!this->started)
+            {
+                this->start = now;
+                this->started = true;
+            }
+
+            for(int i = 0; i < CodeType::CodeTypeCount; i++)
+            {
+                if(!reading.has((CodeType) i))
+                    continue;
+
+                this->channels[channel_slot((CodeType) i)].add(reading.get((CodeType) i), reading.get_decimals((CodeType) i));
+                this->present |= 1UL << i;
+            }
+
+            if(reading.timestamp[0] != '\0')
+                memcpy(this->timestamp, reading.timestamp, sizeof(this->timestamp));
+
+            this->samples++;
+        }
+
+        bool WindowAggregator::due(uint32_t now) const
+        {
+            return this->length > 0 && this->started && this->samples > 0 && now - this->start >= this->length;
+        }
+
+        void WindowAggregator::close(uint32_t now)
+        {
+            for(size_t i = 0; i < VALUE_SLOT_COUNT; i++)
+            {
+                ChannelAggregate &channel = this->channels[i];
+
+                if(channel.count > 0)
+                    channel.baseline = channel.last; // Next delta starts where this window ended
+
+                channel.sum = 0;
+                channel.count = 0;
+            }
+
+            this->start += (now - this->start) / this->length * this->length; // Skip windows without any readings
+            this->present = 0;
+            this->samples = 0;
+            this->timestamp[0] = '\0';
+        }
+
+        bool WindowAggregator::has(CodeType type) const
+        {
+            return this->present & (1UL << type);
+        }
+
+        const ChannelAggregate &WindowAggregator::channel(CodeType type) const
+        {
+            return this->channels[channel_slot(type)];
+        }
+
+        uint32_t WindowAggregator::get_samples() const
+        {
+            return this->samples;
+        }
+
+        const char *WindowAggregator::get_timestamp() const
+        {
+            return this->timestamp;
+        }
+    }
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include "espdm_obis.h"
+
+#ifndef ESPDM_MAX_WINDOWS
+#define ESPDM_MAX_WINDOWS 2 // Maximum number of aggregation windows per meter
+#endif
+
+namespace esphome
+{
+    namespace espdm
+    {
+        struct MeterReading;
+
+        bool is_counter(CodeType type); // True for energy counters, these are aggregated as deltas
+
+        /*
+         * Running aggregate of one value over a window, constant size regardless of the number of samples
+         */
+        struct ChannelAggregate
+        {
+            float min;
+            float max;
+            double sum = 0;
+            float last;
+            float baseline; // Last value of the previous window, counters report last - baseline, moved down if a counter restarts
+            uint32_t count = 0;
+            uint8_t decimals = 0; // Decimals of the values as sent by the meter
+            bool hasBaseline = false;
+
+            void add(float value, uint8_t decimals);
+            float mean() const;
+            float delta() const;
+        };
+
+        /*
+         * Aggregates readings over a fixed window
+         *
+         * Measurements keep min, max, mean and last value, energy counters the delta over the window. A
+         * window closes once its length elapsed, close() starts the next one. Boundaries stay on the
+         * original grid even when a window is closed late, so windows do not drift.
+         */
+        class WindowAggregator
+        {
+            public:
+                void set_length(uint32_t length); // In ms, 0 disables the window
+                uint32_t get_length() const;
+
+                void add(const MeterReading &reading, uint32_t now);
+                bool due(uint32_t now) const; // True if the window elapsed and contains samples
+                void close(uint32_t now);
+
+                bool has(CodeType type) const; // True if the channel received samples in this window
+                const ChannelAggregate &channel(CodeType type) const;
+                uint32_t get_samples() const;
+                const char *get_timestamp() const; // Meter timestamp of the last reading, empty if none was sent
+
+            private:
+                uint32_t length = 0;
+                uint32_t start = 0; // Start of the current window
+                bool started = false;
+
+                ChannelAggregate channels[VALUE_SLOT_COUNT]; // Indexed by channel_slot()
+                uint32_t present = 0; // Bit per channel with samples in this window
+                uint32_t samples = 0; // Readings added to this window
+                char timestamp[21] = "";
+        };
+    }
+}
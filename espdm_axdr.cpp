@@ -0,0 +1,301 @@
+#include "espdm_axdr.h"
+#include "espdm_obis.h"
+#include <cstring>
+
+namespace esphome
+{
+    namespace espdm
+    {
+        float apply_scaler(float value, int8_t scaler)
+        {
+            for(; scaler > 0; scaler--)
+                value *= 10;
+
+            for(; scaler < 0; scaler++)
+                value /= 10;
+
+            return value;
+        }
+
+        AxdrStatus AxdrDecoder::decode(const ByteView &view, size_t offset, ObisVisitor &visitor)
+        {
+            this->depth = 0;
+            this->obis = NULL;
+            this->hasPending = false;
+
+            size_t position = offset;
+
+            while(position < view.length())
+            {
+                uint8_t type = view.get_uint8(position);
+                position++; // Advance past data type
+
+                if(type == DataType::Array || type == DataType::Structure)
+                {
+                    // A structure of { Integer, Enum } right after a value holds its scaler and unit
+                    if(type == DataType::Structure && this->hasPending && view.get_uint8(position) == 2 && view.get_uint8(position + 1) == DataType::Integer && view.get_uint8(position + 3) == DataType::Enum)
+                    {
+                        if(!view.contains(position, 5))
+                            return AxdrErrorTruncated;
+
+                        this->pending.hasScaler = true;
+                        this->pending.scaler = (int8_t) view.get_uint8(position + 2);
+                        this->pending.unit = view.get_uint8(position + 4);
+
+                        position += 5; // Advance past count, scaler and unit
+
+                        flush(visitor);
+                        element_done();
+                        continue;
+                    }
+
+                    size_t count;
+
+                    if(!read_axdr_length(view, position, count))
+                        return AxdrErrorTruncated;
+
+                    if(count == 0) // Empty container is complete right away
+                    {
+                        element_done();
+                        continue;
+                    }
+
+                    if(this->depth >= ESPDM_AXDR_MAX_DEPTH)
+                        return AxdrErrorTooDeep;
+
+                    this->remaining[this->depth++] = count;
+                    continue;
+                }
+
+                // An octet string of 6 bytes is an OBIS code unless a code is already waiting for its value
+                if(type == DataType::OctetString && this->obis == NULL && view.get_uint8(position) == OBIS_CODE_LENGTH)
+                {
+                    if(!view.contains(position + 1, OBIS_CODE_LENGTH))
+                        return AxdrErrorTruncated;
+
+                    flush(visitor); // The previous value did not have a scaler
+
+                    this->obis = view.pointer(position + 1);
+                    position += 1 + OBIS_CODE_LENGTH; // Advance past length and code
+
+                    element_done();
+                    continue;
+                }
+
+                ObisValue value;
+                AxdrStatus status = read_axdr_value(view, type, position, value);
+
+                if(status != AxdrOk)
+                    return status;
+
+                if(this->obis != NULL) // Values without an OBIS code in front of them are skipped
+                {
+                    flush(visitor);
+
+                    value.obis = this->obis;
+                    this->pending = value;
+                    this->hasPending = true;
+                    this->obis = NULL;
+                }
+
+                element_done();
+            }
+
+            if(this->depth > 0) // Data ended before all containers were complete
+                return AxdrErrorTruncated;
+
+            flush(visitor);
+
+            return AxdrOk;
+        }
+
+        bool read_axdr_length(const ByteView &view, size_t &position, size_t &length)
+        {
+            if(!view.contains(position, 1))
+                return false;
+
+            uint8_t first = view.get_uint8(position);
+
+            if(first < 0x80) // Short form
+            {
+                length = first;
+                position += 1;
+            }
+            else if(first == 0x81)
+            {
+                if(!view.contains(position, 2))
+                    return false;
+
+                length = view.get_uint8(position + 1);
+                position += 2;
+            }
+            else if(first == 0x82)
+            {
+                if(!view.contains(position, 3))
+                    return false;
+
+                length = view.get_uint16(position + 1);
+                position += 3;
+            }
+            else // Longer lengths never fit into a telegram
+            {
+                return false;
+            }
+
+            return true;
+        }
+
+        AxdrStatus read_axdr_value(const ByteView &view, uint8_t type, size_t &position, ObisValue &value)
+        {
+            memset(&value, 0, sizeof(value));
+            value.type = type;
+            value.offset = position - 1;
+
+            size_t length;
+            bool isSigned = false;
+            bool isFloat = false;
+            bool numeric = true;
+
+            switch(type)
+            {
+                case DataType::NullData:
+                    length = 0;
+                    numeric = false;
+                break;
+                case DataType::Boolean:
+                case DataType::Unsigned:
+                case DataType::Enum:
+                case DataType::BinaryCodedDecimal:
+                    length = 1;
+                break;
+                case DataType::Integer:
+                    length = 1;
+                    isSigned = true;
+                break;
+                case DataType::LongUnsigned:
+                    length = 2;
+                break;
+                case DataType::Long:
+                    length = 2;
+                    isSigned = true;
+                break;
+                case DataType::DoubleLongUnsigned:
+                    length = 4;
+                break;
+                case DataType::DoubleLong:
+                    length = 4;
+                    isSigned = true;
+                break;
+                case DataType::Long64Unsigned:
+                    length = 8;
+                break;
+                case DataType::Long64:
+                    length = 8;
+                    isSigned = true;
+                break;
+                case DataType::Float32:
+                    length = 4;
+                    isFloat = true;
+                break;
+                case DataType::Float64:
+                    length = 8;
+                    isFloat = true;
+                break;
+                case DataType::DateTime:
+                    length = 12;
+                    numeric = false;
+                break;
+                case DataType::Date:
+                    length = 5;
+                    numeric = false;
+                break;
+                case DataType::Time:
+                    length = 4;
+                    numeric = false;
+                break;
+                case DataType::OctetString:
+                case DataType::VisibleString:
+                case DataType::Utf8String:
+                    if(!read_axdr_length(view, position, length))
+                        return AxdrErrorTruncated;
+
+                    numeric = false;
+                break;
+                case DataType::BitString:
+                    if(!read_axdr_length(view, position, length))
+                        return AxdrErrorTruncated;
+
+                    length = (length + 7) / 8; // Length is given in bits
+                    numeric = false;
+                break;
+                default:
+                    return AxdrErrorUnsupportedType;
+            }
+
+            if(!view.contains(position, length))
+                return AxdrErrorTruncated;
+
+            value.data = view.pointer(position);
+            value.length = length;
+            value.numeric = numeric;
+
+            if(numeric)
+            {
+                uint64_t bits = 0;
+
+                for(size_t i = 0; i < length; i++) // Values are big endian
+                    bits = (bits << 8) | value.data[i];
+
+                if(isFloat && length == 4)
+                {
+                    uint32_t bits32 = bits;
+                    float floatValue;
+                    memcpy(&floatValue, &bits32, sizeof(floatValue));
+                    value.value = floatValue;
+                }
+                else if(isFloat)
+                {
+                    double doubleValue;
+                    memcpy(&doubleValue, &bits, sizeof(doubleValue));
+                    value.value = doubleValue;
+                }
+                else
+                {
+                    if(isSigned && length < 8 && (bits & ((uint64_t) 1 << (length * 8 - 1)))) // Sign extend
+                        bits |= ~(uint64_t) 0 << (length * 8);
+
+                    value.raw = (int64_t) bits;
+                    value.value = isSigned ? (float) value.raw : (float) bits;
+                }
+            }
+
+            position += length;
+
+            return AxdrOk;
+        }
+
+        void AxdrDecoder::flush(ObisVisitor &visitor)
+        {
+            if(!this->hasPending)
+                return;
+
+            if(this->pending.hasScaler && this->pending.numeric)
+                this->pending.value = apply_scaler(this->pending.value, this->pending.scaler);
+
+            this->hasPending = false;
+            visitor.on_value(this->pending);
+        }
+
+        void AxdrDecoder::element_done()
+        {
+            // Count the element against its container, a completed container counts against its parent
+            while(this->depth > 0)
+            {
+                if(--this->remaining[this->depth - 1] > 0)
+                    return;
+
+                this->depth--;
+            }
+        }
+    }
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include "espdm_view.h"
+
+#ifndef ESPDM_AXDR_MAX_DEPTH
+#define ESPDM_AXDR_MAX_DEPTH 8 // Maximum nesting depth of arrays and structures
+#endif
+
+static const int OBIS_CODE_LENGTH = 6; // Length of an OBIS code octet string (A-F)
+
+namespace esphome
+{
+    namespace espdm
+    {
+        enum AxdrStatus
+        {
+            AxdrOk,
+            AxdrErrorTruncated, // Data ended in the middle of an element or container
+            AxdrErrorUnsupportedType, // Data type is unknown or not supported (e.g. compact arrays)
+            AxdrErrorTooDeep // Containers are nested deeper than ESPDM_AXDR_MAX_DEPTH
+        };
+
+        float apply_scaler(float value, int8_t scaler); // Multiplies value by 10^scaler
+
+        struct ObisValue;
+
+        bool read_axdr_length(const ByteView &view, size_t &position, size_t &length); // Reads a length in short or 0x81/0x82 long form and advances past it
+        AxdrStatus read_axdr_value(const ByteView &view, uint8_t type, size_t &position, ObisValue &value); // Reads a value of type, position is right after the type byte
+
+        /*
+         * A single decoded value together with the OBIS code it belongs to
+         *
+         * All pointers point into the decoded buffer and are only valid during the callback.
+         */
+        struct ObisValue
+        {
+            const uint8_t *obis; // Full OBIS code (A-F)
+            uint8_t type; // Data type of the value as per DataType
+            size_t offset; // Offset of the type byte in the decoded buffer
+            const uint8_t *data; // Raw value bytes, for strings without the length prefix
+            size_t length; // Length of the raw value in bytes
+
+            bool numeric; // True if raw and value hold a number
+            int64_t raw; // Integer value as sent, without scaler (64 bit unsigned values are stored as is)
+            float value; // Numeric value, with scaler applied if hasScaler is set
+
+            bool hasScaler; // True if the telegram sent a scaler/unit structure for this value
+            int8_t scaler; // Decimal exponent applied to the value
+            uint8_t unit; // Unit enum as per specification, 0 if not sent
+        };
+
+        class ObisVisitor
+        {
+            public:
+                virtual void on_value(const ObisValue &value) = 0;
+        };
+
+        /*
+         * Non-recursive A-XDR decoder
+         *
+         * Walks the data starting at offset and treats every 6 byte octet string as an OBIS code.
+         * The next value after a code is reported to the visitor, a following structure of
+         * { Integer scaler, Enum unit } is applied to it first. Arrays and structures are tracked on
+         * a fixed-depth stack, nothing is allocated.
+         */
+        class AxdrDecoder
+        {
+            public:
+                AxdrStatus decode(const ByteView &view, size_t offset, ObisVisitor &visitor);
+
+            private:
+                void flush(ObisVisitor &visitor);
+                void element_done();
+
+                size_t remaining[ESPDM_AXDR_MAX_DEPTH]; // Elements left in each open container
+                int depth = 0; // Number of open containers
+
+                const uint8_t *obis = NULL; // OBIS code waiting for its value
+                ObisValue pending; // Value waiting for a possible scaler/unit structure
+                bool hasPending = false;
+        };
+    }
+}
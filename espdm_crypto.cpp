@@ -0,0 +1,123 @@
+#include "espdm_crypto.h"
+#include <cstring>
+
+namespace esphome
+{
+    namespace espdm
+    {
+        SharedCrypto::SharedCrypto(CryptoBackend &engine) : engine(engine) {}
+
+        bool SharedCrypto::decrypt(const uint8_t *key, size_t keyLength, const uint8_t *iv, size_t ivLength, const uint8_t *aad, size_t aadLength, uint8_t *data, size_t length, const uint8_t *tag, size_t tagLength)
+        {
+            if(keyLength == 0 || keyLength > sizeof(this->key))
+                return false;
+
+            if(keyLength != this->keyLength || memcmp(key, this->key, keyLength) != 0)
+            {
+                this->engine.set_key(key, keyLength);
+
+                memcpy(this->key, key, keyLength);
+                this->keyLength = keyLength;
+                this->keyChanges++;
+            }
+
+            return this->engine.decrypt(iv, ivLength, aad, aadLength, data, length, tag, tagLength);
+        }
+
+        uint32_t SharedCrypto::get_key_changes() const
+        {
+            return this->keyChanges;
+        }
+
+        SharedCryptoKey::SharedCryptoKey(SharedCrypto &shared) : shared(&shared) {}
+
+        void SharedCryptoKey::attach(SharedCrypto &shared)
+        {
+            this->shared = &shared;
+        }
+
+        void SharedCryptoKey::set_key(const uint8_t *key, size_t keyLength)
+        {
+            this->keyLength = keyLength <= sizeof(this->key) ? keyLength : 0; // Longer keys are not valid for AES, decryption then fails
+
+            memcpy(this->key, key, this->keyLength);
+        }
+
+        bool SharedCryptoKey::decrypt(const uint8_t *iv, size_t ivLength, const uint8_t *aad, size_t aadLength, uint8_t *data, size_t length, const uint8_t *tag, size_t tagLength)
+        {
+            return this->shared->decrypt(this->key, this->keyLength, iv, ivLength, aad, aadLength, data, length, tag, tagLength);
+        }
+
+#if defined(ESPDM_HAVE_MBEDTLS)
+        MbedtlsGcmBackend::MbedtlsGcmBackend()
+        {
+            mbedtls_gcm_init(&this->aes);
+        }
+
+        MbedtlsGcmBackend::~MbedtlsGcmBackend()
+        {
+            mbedtls_gcm_free(&this->aes);
+        }
+
+        void MbedtlsGcmBackend::set_key(const uint8_t *key, size_t keyLength)
+        {
+            mbedtls_gcm_setkey(&this->aes, MBEDTLS_CIPHER_ID_AES, key, keyLength * 8);
+        }
+
+        bool MbedtlsGcmBackend::decrypt(const uint8_t *iv, size_t ivLength, const uint8_t *aad, size_t aadLength, uint8_t *data, size_t length, const uint8_t *tag, size_t tagLength)
+        {
+            if(tag == NULL) // Plain decryption, auth_decrypt rejects tags shorter than 4 bytes
+            {
+                uint8_t unused[16];
+
+                return mbedtls_gcm_crypt_and_tag(&this->aes, MBEDTLS_GCM_DECRYPT, length, iv, ivLength, aad, aadLength, data, data, sizeof(unused), unused) == 0;
+            }
+
+            return mbedtls_gcm_auth_decrypt(&this->aes, length, iv, ivLength, aad, aadLength, tag, tagLength, data, data) == 0;
+        }
+#endif
+
+#if defined(ESPDM_HAVE_OPENSSL)
+        OpensslGcmBackend::OpensslGcmBackend()
+        {
+            this->ctx = EVP_CIPHER_CTX_new();
+        }
+
+        OpensslGcmBackend::~OpensslGcmBackend()
+        {
+            EVP_CIPHER_CTX_free(this->ctx);
+        }
+
+        void OpensslGcmBackend::set_key(const uint8_t *key, size_t keyLength)
+        {
+            const EVP_CIPHER *cipher = keyLength == 32 ? EVP_aes_256_gcm() : keyLength == 24 ? EVP_aes_192_gcm() : EVP_aes_128_gcm();
+
+            EVP_DecryptInit_ex(this->ctx, cipher, NULL, key, NULL);
+        }
+
+        bool OpensslGcmBackend::decrypt(const uint8_t *iv, size_t ivLength, const uint8_t *aad, size_t aadLength, uint8_t *data, size_t length, const uint8_t *tag, size_t tagLength)
+        {
+            int outLength;
+
+            // Passing no cipher and no key keeps the expanded key, only the IV is reset
+            if(EVP_CIPHER_CTX_ctrl(this->ctx, EVP_CTRL_GCM_SET_IVLEN, ivLength, NULL) != 1 || EVP_DecryptInit_ex(this->ctx, NULL, NULL, NULL, iv) != 1)
+                return false;
+
+            if(aad != NULL && EVP_DecryptUpdate(this->ctx, NULL, &outLength, aad, aadLength) != 1)
+                return false;
+
+            if(EVP_DecryptUpdate(this->ctx, data, &outLength, data, length) != 1)
+                return false;
+
+            if(tag == NULL)
+                return true;
+
+            // OpenSSL only reads the tag, the cast is part of its API
+            if(EVP_CIPHER_CTX_ctrl(this->ctx, EVP_CTRL_GCM_SET_TAG, tagLength, (void *) tag) != 1)
+                return false;
+
+            return EVP_DecryptFinal_ex(this->ctx, data + length, &outLength) == 1; // GCM writes nothing here
+        }
+#endif
+    }
+}
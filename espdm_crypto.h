@@ -0,0 +1,188 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+/*
+ * AES-GCM implementations, pick one with -DESPDM_CRYPTO_BACKEND=ESPDM_CRYPTO_...
+ */
+#define ESPDM_CRYPTO_MBEDTLS 1 // mbedtls, on the ESP32 it uses the AES hardware (default there)
+#define ESPDM_CRYPTO_BEARSSL_CT 2 // BearSSL constant time AES for 32 bit CPUs (default on the ESP8266)
+#define ESPDM_CRYPTO_BEARSSL_SMALL 3 // BearSSL table based AES, small and fast but not constant time
+#define ESPDM_CRYPTO_BEARSSL_CT64 4 // BearSSL constant time AES for 64 bit CPUs
+#define ESPDM_CRYPTO_OPENSSL 5 // OpenSSL, uses AES-NI and carry-less multiplication where the CPU has them (default on the host)
+
+// Libraries available on the platform, host builds get the others from CMake if they are installed
+#if defined(ESP32) && !defined(ESPDM_HAVE_MBEDTLS)
+#define ESPDM_HAVE_MBEDTLS
+#endif
+#if defined(ESP8266) && !defined(ESPDM_HAVE_BEARSSL)
+#define ESPDM_HAVE_BEARSSL
+#endif
+#if defined(ESPDM_HOST) && !defined(ESPDM_HAVE_OPENSSL)
+#define ESPDM_HAVE_OPENSSL
+#endif
+
+#ifndef ESPDM_CRYPTO_BACKEND
+#if defined(ESP32)
+#define ESPDM_CRYPTO_BACKEND ESPDM_CRYPTO_MBEDTLS
+#elif defined(ESP8266)
+#define ESPDM_CRYPTO_BACKEND ESPDM_CRYPTO_BEARSSL_CT
+#elif defined(ESPDM_HOST)
+#define ESPDM_CRYPTO_BACKEND ESPDM_CRYPTO_OPENSSL
+#else
+  #error "Invalid Platform"
+#endif
+#endif
+
+#if defined(ESPDM_HAVE_MBEDTLS)
+#include "mbedtls/gcm.h"
+#endif
+#if defined(ESPDM_HAVE_BEARSSL)
+#include <bearssl/bearssl.h>
+#endif
+#if defined(ESPDM_HAVE_OPENSSL)
+#include <openssl/evp.h>
+#endif
+
+static const size_t CRYPTO_MAX_KEY_LENGTH = 32; // AES-256
+
+namespace esphome
+{
+    namespace espdm
+    {
+        /*
+         * AES-GCM decryption used for the DLMS payload
+         *
+         * The key is expanded once in set_key(), every decrypt() call only resets the IV. The additional
+         * authenticated data and the tag are optional (NULL), the tag may be truncated. Without a tag the
+         * data is only decrypted and nothing is verified.
+         */
+        class CryptoBackend
+        {
+            public:
+                virtual void set_key(const uint8_t *key, size_t keyLength) = 0;
+                virtual bool decrypt(const uint8_t *iv, size_t ivLength, const uint8_t *aad, size_t aadLength, uint8_t *data, size_t length, const uint8_t *tag, size_t tagLength) = 0; // Decrypts data in place, false if the tag does not match
+        };
+
+        /*
+         * Crypto engine shared by several meters
+         *
+         * The engine is only re-keyed when a telegram is decrypted with a different key than the one
+         * before, so a single meter still expands its key only once.
+         */
+        class SharedCrypto
+        {
+            public:
+                SharedCrypto(CryptoBackend &engine);
+
+                bool decrypt(const uint8_t *key, size_t keyLength, const uint8_t *iv, size_t ivLength, const uint8_t *aad, size_t aadLength, uint8_t *data, size_t length, const uint8_t *tag, size_t tagLength);
+                uint32_t get_key_changes() const; // Number of times the engine was re-keyed
+
+            private:
+                CryptoBackend &engine;
+                uint8_t key[CRYPTO_MAX_KEY_LENGTH]; // Key the engine is currently set up with
+                size_t keyLength = 0; // 0 until the engine was keyed
+                uint32_t keyChanges = 0;
+        };
+
+        /*
+         * Key of one meter on top of a SharedCrypto engine
+         */
+        class SharedCryptoKey : public CryptoBackend
+        {
+            public:
+                SharedCryptoKey(SharedCrypto &shared);
+
+                void attach(SharedCrypto &shared); // Moves the key to another engine, e.g. one owned by a background task
+                void set_key(const uint8_t *key, size_t keyLength) override; // Only copies the key, it is expanded when first used
+                bool decrypt(const uint8_t *iv, size_t ivLength, const uint8_t *aad, size_t aadLength, uint8_t *data, size_t length, const uint8_t *tag, size_t tagLength) override;
+
+            private:
+                SharedCrypto *shared;
+                uint8_t key[CRYPTO_MAX_KEY_LENGTH];
+                size_t keyLength = 0;
+        };
+
+#if defined(ESPDM_HAVE_MBEDTLS)
+        class MbedtlsGcmBackend : public CryptoBackend
+        {
+            public:
+                MbedtlsGcmBackend();
+                ~MbedtlsGcmBackend();
+
+                void set_key(const uint8_t *key, size_t keyLength) override;
+                bool decrypt(const uint8_t *iv, size_t ivLength, const uint8_t *aad, size_t aadLength, uint8_t *data, size_t length, const uint8_t *tag, size_t tagLength) override;
+
+            private:
+                mbedtls_gcm_context aes; // AES context used for decryption, key is only expanded in set_key()
+        };
+#endif
+
+#if defined(ESPDM_HAVE_BEARSSL)
+        /*
+         * BearSSL GCM on top of one of its AES counter mode implementations
+         */
+        template<typename Keys, void (*Init)(Keys *, const void *, size_t), br_ghash Ghash>
+        class BearSslGcmBackend : public CryptoBackend
+        {
+            public:
+                void set_key(const uint8_t *key, size_t keyLength) override
+                {
+                    Init(&this->aesKeys, key, keyLength);
+                    br_gcm_init(&this->gcmCtx, &this->aesKeys.vtable, Ghash);
+                }
+
+                bool decrypt(const uint8_t *iv, size_t ivLength, const uint8_t *aad, size_t aadLength, uint8_t *data, size_t length, const uint8_t *tag, size_t tagLength) override
+                {
+                    br_gcm_reset(&this->gcmCtx, iv, ivLength); // Key schedule and GHASH key are reused, only the IV changes
+
+                    if(aad != NULL)
+                        br_gcm_aad_inject(&this->gcmCtx, aad, aadLength);
+
+                    br_gcm_flip(&this->gcmCtx);
+                    br_gcm_run(&this->gcmCtx, 0, data, length);
+
+                    return tag == NULL || br_gcm_check_tag_trunc(&this->gcmCtx, tag, tagLength) == 1;
+                }
+
+            private:
+                Keys aesKeys; // Expanded AES key, only set up in set_key()
+                br_gcm_context gcmCtx; // GCM context used for decryption, only set up in set_key()
+        };
+
+        typedef BearSslGcmBackend<br_aes_ct_ctr_keys, br_aes_ct_ctr_init, br_ghash_ctmul32> BearSslCtGcmBackend;
+        typedef BearSslGcmBackend<br_aes_small_ctr_keys, br_aes_small_ctr_init, br_ghash_ctmul32> BearSslSmallGcmBackend;
+        typedef BearSslGcmBackend<br_aes_ct64_ctr_keys, br_aes_ct64_ctr_init, br_ghash_ctmul64> BearSslCt64GcmBackend;
+#endif
+
+#if defined(ESPDM_HAVE_OPENSSL)
+        class OpensslGcmBackend : public CryptoBackend
+        {
+            public:
+                OpensslGcmBackend();
+                ~OpensslGcmBackend();
+
+                void set_key(const uint8_t *key, size_t keyLength) override;
+                bool decrypt(const uint8_t *iv, size_t ivLength, const uint8_t *aad, size_t aadLength, uint8_t *data, size_t length, const uint8_t *tag, size_t tagLength) override;
+
+            private:
+                EVP_CIPHER_CTX *ctx; // Cipher context holding the expanded key
+        };
+#endif
+
+#if ESPDM_CRYPTO_BACKEND == ESPDM_CRYPTO_MBEDTLS && defined(ESPDM_HAVE_MBEDTLS)
+        typedef MbedtlsGcmBackend AesGcmBackend; // Backend used by the meters
+#elif ESPDM_CRYPTO_BACKEND == ESPDM_CRYPTO_BEARSSL_CT && defined(ESPDM_HAVE_BEARSSL)
+        typedef BearSslCtGcmBackend AesGcmBackend;
+#elif ESPDM_CRYPTO_BACKEND == ESPDM_CRYPTO_BEARSSL_SMALL && defined(ESPDM_HAVE_BEARSSL)
+        typedef BearSslSmallGcmBackend AesGcmBackend;
+#elif ESPDM_CRYPTO_BACKEND == ESPDM_CRYPTO_BEARSSL_CT64 && defined(ESPDM_HAVE_BEARSSL)
+        typedef BearSslCt64GcmBackend AesGcmBackend;
+#elif ESPDM_CRYPTO_BACKEND == ESPDM_CRYPTO_OPENSSL && defined(ESPDM_HAVE_OPENSSL)
+        typedef OpensslGcmBackend AesGcmBackend;
+#else
+  #error "ESPDM_CRYPTO_BACKEND is not available on this platform"
+#endif
+    }
+}
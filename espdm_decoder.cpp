@@ -0,0 +1,507 @@
+#include "espdm_decoder.h"
+#include "espdm_dlms.h"
+#include "espdm_view.h"
+#include <cinttypes>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+
+namespace esphome
+{
+    namespace espdm
+    {
+        const char *telegram_error_name(TelegramError error)
+        {
+            switch(error)
+            {
+                case ErrorMbusStartByte: return "mbus_start_byte";
+                case ErrorMbusLength: return "mbus_length";
+                case ErrorMbusChecksum: return "mbus_checksum";
+                case ErrorMbusStopByte: return "mbus_stop_byte";
+                case ErrorMbusOverflow: return "mbus_overflow";
+                case ErrorMbusIncomplete: return "mbus_incomplete";
+                case ErrorDlmsTooShort: return "dlms_too_short";
+                case ErrorDlmsCipher: return "dlms_cipher";
+                case ErrorDlmsSystemTitle: return "dlms_system_title";
+                case ErrorDlmsLength: return "dlms_length";
+                case ErrorDlmsSecurityByte: return "dlms_security_byte";
+                case ErrorDuplicate: return "duplicate";
+                case ErrorStale: return "stale";
+                case ErrorDecryption: return "decryption";
+                case ErrorInvalidPlaintext: return "invalid_plaintext";
+                case ErrorObisTruncated: return "obis_truncated";
+                case ErrorObisUnsupportedType: return "obis_unsupported_type";
+                case ErrorObisTooDeep: return "obis_too_deep";
+                case ErrorHdlcFormat: return "hdlc_format";
+                case ErrorHdlcLength: return "hdlc_length";
+                case ErrorHdlcChecksum: return "hdlc_checksum";
+                case ErrorHdlcOverflow: return "hdlc_overflow";
+                case ErrorHdlcIncomplete: return "hdlc_incomplete";
+                case ErrorAuthentication: return "dlms_tag";
+                case TelegramErrorCount: break;
+            }
+
+            return "unknown";
+        }
+
+        float numeric_value(const ObisValue &value, const ObisEntry *entry)
+        {
+            if(value.hasScaler || entry == NULL)
+                return value.value;
+
+            return apply_scaler(value.value, entry->scaler); // Telegram did not send a scaler, use the default of the code
+        }
+
+        bool format_timestamp(const ObisValue &value, char *buffer, size_t size)
+        {
+            if((value.type != DataType::OctetString && value.type != DataType::DateTime) || value.length < 8)
+                return false;
+
+            ByteView dateTime(value.data, value.length);
+
+            uint16_t year = dateTime.get_uint16(0);
+            uint8_t month = dateTime.get_uint8(2);
+            uint8_t day = dateTime.get_uint8(3);
+
+            uint8_t hour = dateTime.get_uint8(5);
+            uint8_t minute = dateTime.get_uint8(6);
+            uint8_t second = dateTime.get_uint8(7);
+
+            snprintf(buffer, size, "%04u-%02u-%02uT%02u:%02u:%02uZ", year, month, day, hour, minute, second);
+
+            return true;
+        }
+
+        MeterDecoder::MeterDecoder(CryptoBackend &crypto, Clock &clock, Logger *logger) : crypto(crypto), clock(clock), logger(logger), mbusParser(payloadBuffer, sizeof(payloadBuffer)), hdlcParser(payloadBuffer, sizeof(payloadBuffer)), transport(&mbusParser) {}
+
+        void MeterDecoder::set_key(const uint8_t *key, size_t keyLength)
+        {
+            this->crypto.set_key(key, keyLength); // Expand the key once, every telegram only resets the IV
+            this->hasFrameCounter = false; // Frame counters are only meaningful for the key they were sent with
+            this->staleRun = 0;
+            this->layoutCache.clear(); // A new key usually means another meter
+        }
+
+        void MeterDecoder::set_authentication_key(const uint8_t *key)
+        {
+            this->hasAuthenticationKey = key != NULL;
+
+            if(key != NULL)
+                memcpy(this->authenticationKey, key, sizeof(this->authenticationKey));
+        }
+
+        void MeterDecoder::set_listener(MeterListener *listener)
+        {
+            this->listener = listener;
+        }
+
+        void MeterDecoder::set_logger(Logger *logger)
+        {
+            this->logger = logger;
+        }
+
+        void MeterDecoder::set_read_timeout(uint32_t readTimeout)
+        {
+            this->readTimeout = readTimeout;
+        }
+
+        void MeterDecoder::set_tap(TelegramTap *tap)
+        {
+            this->tap = tap;
+        }
+
+        void MeterDecoder::set_tap_points(uint8_t points)
+        {
+            this->tapPoints.store(this->tap != NULL ? points : 0, std::memory_order_relaxed);
+        }
+
+        void MeterDecoder::set_transport(TransportType type)
+        {
+            this->transport->reset();
+            this->transport = type == TransportHdlc ? (Transport *) &this->hdlcParser : (Transport *) &this->mbusParser;
+        }
+
+        void MeterDecoder::feed(const uint8_t *data, size_t length)
+        {
+            this->lastRead = this->clock.millis();
+
+            ESPDM_STATS(this->stats.bytesReceived += length);
+            ESPDM_STATS(uint32_t framingStart = this->clock.micros());
+
+            size_t position = 0;
+
+            while(position < length)
+            {
+                size_t consumed;
+                FrameStatus status = this->transport->feed(&data[position], length - position, consumed);
+
+                position += consumed;
+
+                switch(status)
+                {
+                    case FrameNeedMore:
+                    break;
+                    case FrameComplete:
+                        ESPDM_STATS(this->stats.framesAccepted++);
+                    break;
+                    case FrameTelegramComplete:
+                        log(LogVerbose, "%s: Telegram complete", this->transport->name());
+
+                        ESPDM_STATS(this->stats.framesAccepted++);
+                        ESPDM_STATS(this->framingTime += this->clock.micros() - framingStart);
+
+                        handle_telegram();
+
+                        ESPDM_STATS(framingStart = this->clock.micros());
+                    break;
+                    default:
+                        fail_frame(status);
+                    break;
+                }
+            }
+
+            ESPDM_STATS(this->framingTime += this->clock.micros() - framingStart);
+        }
+
+        void MeterDecoder::poll()
+        {
+            // Fall back to the read timeout for meters which do not mark their last frame
+            if(this->clock.millis() - this->lastRead <= this->readTimeout)
+                return;
+
+            if(this->transport->empty())
+            {
+                this->transport->idle();
+                return;
+            }
+
+            FrameStatus status = this->transport->timeout();
+
+            if(status == FrameTelegramComplete)
+            {
+                log(LogVerbose, "%s: Telegram complete after read timeout", this->transport->name());
+                handle_telegram();
+            }
+            else
+            {
+                fail_frame(status);
+            }
+        }
+
+#if ESPDM_ENABLE_STATS
+        const PipelineStats &MeterDecoder::get_stats() const
+        {
+            return this->stats;
+        }
+
+        void MeterDecoder::reset_stage_timers()
+        {
+            this->stats.framing.reset();
+            this->stats.decryption.reset();
+            this->stats.decoding.reset();
+            this->stats.publishing.reset();
+        }
+
+        void MeterDecoder::count_telegram()
+        {
+            uint32_t now = this->clock.millis();
+            uint32_t elapsed = now - this->rateWindowStart;
+
+            this->stats.telegramsAccepted++;
+            this->rateWindowTelegrams++;
+
+            if(elapsed >= STATS_RATE_WINDOW)
+            {
+                this->stats.telegramsPerMinute = (uint64_t) this->rateWindowTelegrams * 60000 / elapsed;
+                this->rateWindowStart = now;
+                this->rateWindowTelegrams = 0;
+            }
+        }
+#endif
+
+        void MeterDecoder::handle_telegram()
+        {
+            uint8_t *payload = this->transport->payload(); // Contains the data of the payload without link layer headers and footers
+            size_t payloadLength = this->transport->payload_length();
+            uint8_t tapPoints = this->tapPoints.load(std::memory_order_relaxed);
+
+            if(tapPoints & TapEncrypted)
+                this->tap->on_raw_telegram(TapEncrypted, payload, payloadLength);
+
+            log(LogVerbose, "Received telegram with %u bytes of payload", (unsigned) payloadLength);
+
+            ESPDM_STATS(this->stats.framing.add(this->framingTime));
+            ESPDM_STATS(this->framingTime = 0);
+
+            // Verify and parse DLMS header
+
+            log(LogVerbose, "Parsing DLMS header");
+
+            DlmsHeader header;
+
+            switch(parse_dlms_header(payload, payloadLength, header))
+            {
+                case DlmsOk:
+                break;
+                case DlmsErrorTooShort:
+                    return fail(ErrorDlmsTooShort, LogError, "DLMS: Payload too short");
+                case DlmsErrorCipher:
+                    return fail(ErrorDlmsCipher, LogError, "DLMS: Unsupported cipher");
+                case DlmsErrorSystemTitle:
+                    return fail(ErrorDlmsSystemTitle, LogError, "DLMS: Unsupported system title length");
+                case DlmsErrorLength:
+                    return fail(ErrorDlmsLength, LogError, "DLMS: Message has invalid length");
+                case DlmsErrorSecurityByte:
+                    return fail(ErrorDlmsSecurityByte, LogError, "DLMS: Unsupported security control byte");
+            }
+
+            // Reject repeated and out of order telegrams before spending any time on decryption
+
+            const uint8_t *systemTitle = header.systemTitle;
+            uint32_t frameCounter = header.frameCounter;
+
+            if(this->hasFrameCounter && memcmp(systemTitle, this->lastSystemTitle, sizeof(this->lastSystemTitle)) == 0)
+            {
+                if(frameCounter == this->lastFrameCounter)
+                {
+                    log(LogWarning, "DLMS: Duplicate telegram with frame counter %" PRIu32, frameCounter);
+
+                    return fail(ErrorDuplicate, LogVerbose, NULL);
+                }
+
+                if(frameCounter < this->lastFrameCounter)
+                {
+                    // A meter whose counter restarted (firmware update, replaced meter, wraparound) sends stale
+                    // telegrams that count up again. Follow it after a few of them instead of rejecting it for good.
+                    this->staleRun = this->staleRun > 0 && frameCounter > this->staleFrameCounter ? this->staleRun + 1 : 1;
+                    this->staleFrameCounter = frameCounter;
+
+                    if(this->staleRun < ESPDM_FRAME_COUNTER_RESYNC)
+                    {
+                        log(LogWarning, "DLMS: Stale telegram with frame counter %" PRIu32 " (last was %" PRIu32 ")", frameCounter, this->lastFrameCounter);
+
+                        return fail(ErrorStale, LogVerbose, NULL);
+                    }
+
+                    log(LogWarning, "DLMS: Frame counter restarted at %" PRIu32 " (last was %" PRIu32 ")", frameCounter, this->lastFrameCounter);
+                }
+            }
+
+            // Decryption
+
+            log(LogVerbose, "Decrypting payload");
+
+            uint8_t iv[DLMS_IV_LENGTH];
+            build_dlms_iv(header, iv);
+
+            uint8_t *plaintext = header.payload; // Payload is decrypted in place
+            size_t messageLength = header.payloadLength;
+
+            // The tag is only checked with the authentication key, without it the payload is just decrypted
+            uint8_t aad[1 + DLMS_AUTHENTICATION_KEY_LENGTH];
+            const uint8_t *tag = NULL;
+
+            if(this->hasAuthenticationKey)
+            {
+                if(header.tag == NULL)
+                    return fail(ErrorAuthentication, LogError, "DLMS: Telegram is not authenticated");
+
+                build_dlms_aad(header, this->authenticationKey, aad);
+                tag = header.tag;
+            }
+
+            ESPDM_STATS(uint32_t decryptStart = this->clock.cycles());
+            ESPDM_STATS(uint32_t decryptionStart = this->clock.micros());
+
+            if(!this->crypto.decrypt(iv, sizeof(iv), tag != NULL ? aad : NULL, sizeof(aad), plaintext, messageLength, tag, header.tagLength))
+            {
+                if(tag != NULL)
+                    return fail(ErrorAuthentication, LogError, "DLMS: Authentication tag does not match");
+
+                return fail(ErrorDecryption, LogError, "DLMS: Decryption failed");
+            }
+
+            ESPDM_STATS(this->stats.decryption.add(this->clock.micros() - decryptionStart));
+
+#if ESPDM_ENABLE_STATS
+            uint32_t decryptCycles = this->clock.cycles() - decryptStart;
+            uint32_t cyclesPerByte = messageLength > 0 ? (uint64_t) decryptCycles * 100 / messageLength : 0; // In hundredths
+
+            log(LogDebug, "Decryption took %" PRIu32 " cycles (%" PRIu32 ".%02" PRIu32 " per byte%s)", decryptCycles, cyclesPerByte / 100, cyclesPerByte % 100, tag != NULL ? ", tag verified" : "");
+#endif
+
+            if(tapPoints & TapDecrypted)
+                this->tap->on_raw_telegram(TapDecrypted, plaintext, messageLength);
+
+            ByteView view(plaintext, messageLength); // All reads from the decrypted payload are checked against its length
+
+            if(view.get_uint8(0) != 0x0F || view.get_uint8(5) != 0x0C)
+                return fail(ErrorInvalidPlaintext, LogError, "OBIS: Packet was decrypted but data is invalid");
+
+            // Decoding
+
+            log(LogVerbose, "Decoding payload");
+
+            ESPDM_STATS(uint32_t decodingStart = this->clock.micros());
+            ESPDM_STATS(this->publishingTime = 0);
+
+            if(this->layoutCache.matches(view, DECODER_START_OFFSET))
+            {
+                // Same layout as the last telegram, read the values at their known offsets
+                log(LogVerbose, "OBIS: Using cached layout");
+
+                ObisValue value;
+                const ObisEntry *obisEntry;
+
+                for(size_t i = 0; i < this->layoutCache.size(); i++)
+                {
+                    if(!this->layoutCache.read(view, i, value, obisEntry))
+                        return fail(ErrorObisTruncated, LogError, "OBIS: Payload truncated");
+
+                    emit(value, obisEntry);
+                }
+            }
+            else
+            {
+                this->layoutCache.learn();
+                this->decodingView = &view;
+
+                switch(this->axdrDecoder.decode(view, DECODER_START_OFFSET, *this))
+                {
+                    case AxdrOk:
+                    break;
+                    case AxdrErrorTruncated:
+                        return fail(ErrorObisTruncated, LogError, "OBIS: Payload truncated");
+                    case AxdrErrorUnsupportedType:
+                        return fail(ErrorObisUnsupportedType, LogError, "OBIS: Unsupported OBIS data type");
+                    case AxdrErrorTooDeep:
+                        return fail(ErrorObisTooDeep, LogError, "OBIS: Data nested too deep");
+                }
+
+                this->layoutCache.commit(view, DECODER_START_OFFSET);
+                log(LogDebug, "OBIS: Learned layout of %u values", (unsigned) this->layoutCache.size());
+            }
+
+            ESPDM_STATS(this->stats.decoding.add(this->clock.micros() - decodingStart - this->publishingTime));
+            ESPDM_STATS(count_telegram());
+
+            // Only remember the frame counter once the telegram decoded successfully
+            memcpy(this->lastSystemTitle, systemTitle, sizeof(this->lastSystemTitle));
+            this->lastFrameCounter = frameCounter;
+            this->hasFrameCounter = true;
+            this->staleRun = 0;
+
+            if(this->listener != NULL)
+            {
+                TelegramInfo info;
+                info.systemTitle = this->lastSystemTitle;
+                info.frameCounter = frameCounter;
+                info.length = messageLength;
+
+                ESPDM_STATS(uint32_t publishingStart = this->clock.micros());
+
+                this->listener->on_telegram(info);
+
+                ESPDM_STATS(this->stats.publishing.add(this->publishingTime + this->clock.micros() - publishingStart));
+            }
+
+            this->transport->reset(); // Reset buffer
+        }
+
+        void MeterDecoder::on_value(const ObisValue &value)
+        {
+            const ObisEntry *obisEntry = find_obis_entry(value.obis); // Look up the full OBIS code in the registry
+
+            this->layoutCache.record(*this->decodingView, value, obisEntry);
+            emit(value, obisEntry);
+        }
+
+        void MeterDecoder::emit(const ObisValue &value, const ObisEntry *entry)
+        {
+            if(entry == NULL)
+                log(LogWarning, "OBIS: Unsupported OBIS code");
+
+            if(this->listener != NULL)
+            {
+                ESPDM_STATS(uint32_t publishingStart = this->clock.micros());
+
+                this->listener->on_value(value, entry);
+
+                ESPDM_STATS(this->publishingTime += this->clock.micros() - publishingStart);
+            }
+        }
+
+        void MeterDecoder::fail_frame(FrameStatus status)
+        {
+            if(this->transport->type() == TransportHdlc)
+            {
+                switch(status)
+                {
+                    case FrameErrorStart:
+                    case FrameErrorStop:
+                        return fail(ErrorHdlcFormat, LogError, "HDLC: Missing flag");
+                    case FrameErrorFormat:
+                        return fail(ErrorHdlcFormat, LogError, "HDLC: Unsupported frame format or LLC header");
+                    case FrameErrorLength:
+                        return fail(ErrorHdlcLength, LogError, "HDLC: Frame too short for its header");
+                    case FrameErrorChecksum:
+                        return fail(ErrorHdlcChecksum, LogError, "HDLC: Invalid checksum");
+                    case FrameErrorOverflow:
+                        return fail(ErrorHdlcOverflow, LogError, "HDLC: Telegram too big for receive buffer");
+                    case FrameErrorIncomplete:
+                        return fail(ErrorHdlcIncomplete, LogError, "HDLC: Last segment missing after read timeout");
+                    default:
+                        return;
+                }
+            }
+
+            switch(status)
+            {
+                case FrameErrorStart:
+                case FrameErrorFormat:
+                    return fail(ErrorMbusStartByte, LogError, "MBUS: Start bytes do not match");
+                case FrameErrorLength:
+                    return fail(ErrorMbusLength, LogError, "MBUS: Length bytes do not match");
+                case FrameErrorChecksum:
+                    return fail(ErrorMbusChecksum, LogError, "MBUS: Invalid checksum");
+                case FrameErrorStop:
+                    return fail(ErrorMbusStopByte, LogError, "MBUS: Invalid stop byte");
+                case FrameErrorOverflow:
+                    return fail(ErrorMbusOverflow, LogError, "MBUS: Telegram too big for receive buffer");
+                case FrameErrorIncomplete:
+                    return fail(ErrorMbusIncomplete, LogError, "MBUS: Frame too big for received data");
+                default:
+                    return;
+            }
+        }
+
+        void MeterDecoder::fail(TelegramError error, LogLevel level, const char *message)
+        {
+            if(message != NULL)
+                log(level, "%s", message);
+
+            this->transport->reset();
+
+            ESPDM_STATS(this->stats.rejected[error]++);
+            ESPDM_STATS(this->framingTime = 0);
+
+            if(this->listener != NULL)
+                this->listener->on_error(error);
+        }
+
+        void MeterDecoder::log(LogLevel level, const char *format, ...)
+        {
+            if(this->logger == NULL || !this->logger->enabled(level))
+                return;
+
+            char message[128];
+
+            va_list args;
+            va_start(args, format);
+            vsnprintf(message, sizeof(message), format, args);
+            va_end(args);
+
+            this->logger->log(level, message);
+        }
+    }
+}
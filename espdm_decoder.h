@@ -0,0 +1,209 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include "espdm_platform.h"
+#include "espdm_crypto.h"
+#include "espdm_mbus.h"
+#include "espdm_hdlc.h"
+#include "espdm_dlms.h"
+#include "espdm_axdr.h"
+#include "espdm_layout.h"
+#include "espdm_obis.h"
+#include "espdm_stats.h"
+
+#ifndef ESPDM_FRAME_COUNTER_RESYNC
+#define ESPDM_FRAME_COUNTER_RESYNC 3 // Stale telegrams in a row with rising frame counters after which the meter is taken to have restarted its counter
+#endif
+
+namespace esphome
+{
+    namespace espdm
+    {
+        enum TelegramError
+        {
+            ErrorMbusStartByte, // M-Bus start bytes do not match
+            ErrorMbusLength, // M-Bus length bytes do not match
+            ErrorMbusChecksum, // M-Bus checksum does not match
+            ErrorMbusStopByte, // Invalid M-Bus stop byte
+            ErrorMbusOverflow, // Telegram too big for the receive buffer
+            ErrorMbusIncomplete, // Read timeout hit in the middle of a frame
+
+            ErrorDlmsTooShort, // Payload too short for a DLMS header
+            ErrorDlmsCipher, // Unsupported cipher
+            ErrorDlmsSystemTitle, // Unsupported system title length
+            ErrorDlmsLength, // Message length does not match the payload
+            ErrorDlmsSecurityByte, // Unsupported security control byte
+
+            ErrorDuplicate, // Frame counter was already seen
+            ErrorStale, // Frame counter moved backwards
+
+            ErrorDecryption, // Crypto backend failed
+            ErrorInvalidPlaintext, // Packet was decrypted but data is invalid
+
+            ErrorObisTruncated, // Decrypted payload ended in the middle of an object
+            ErrorObisUnsupportedType, // Unsupported A-XDR data type
+            ErrorObisTooDeep, // Data nested deeper than the decoder supports
+
+            ErrorHdlcFormat, // Unsupported HDLC frame format, address or LLC header, or a flag is missing
+            ErrorHdlcLength, // HDLC frame too short for its header
+            ErrorHdlcChecksum, // HDLC header or frame checksum does not match
+            ErrorHdlcOverflow, // Telegram too big for the receive buffer
+            ErrorHdlcIncomplete, // Read timeout hit before the last segment
+
+            ErrorAuthentication, // GCM tag does not match or the telegram is not authenticated
+
+            TelegramErrorCount // Number of errors, used to size counters
+        };
+
+        struct TelegramInfo
+        {
+            const uint8_t *systemTitle; // System title of the meter (8 bytes)
+            uint32_t frameCounter; // Frame counter of the telegram
+            size_t length; // Length of the decrypted payload
+        };
+
+#if ESPDM_ENABLE_STATS
+        /*
+         * Counters and stage timers of the pipeline
+         *
+         * Counters run since boot and wrap around, the stage timers are reset by the caller to look at an interval.
+         */
+        struct PipelineStats
+        {
+            uint32_t bytesReceived = 0;
+            uint32_t framesAccepted = 0; // M-Bus frames with valid checksum and stop byte
+            uint32_t telegramsAccepted = 0; // Telegrams decoded successfully
+            uint32_t rejected[TelegramErrorCount] = {}; // Rejected frames and telegrams by reason
+            uint32_t telegramsPerMinute = 0; // Rate over the last complete STATS_RATE_WINDOW
+
+            StageTimer framing; // Receiving and verifying the M-Bus frames of a telegram
+            StageTimer decryption;
+            StageTimer decoding; // OBIS decoding without the time spent in the listener
+            StageTimer publishing; // Time spent in the listener
+
+            uint32_t rejected_total() const
+            {
+                uint32_t total = 0;
+
+                for(int i = 0; i < TelegramErrorCount; i++)
+                    total += this->rejected[i];
+
+                return total;
+            }
+        };
+#endif
+
+        /*
+         * Receives the results of the decoder
+         *
+         * on_value() is called for every value of a telegram, on_telegram() once the whole telegram was decoded.
+         */
+        class MeterListener
+        {
+            public:
+                virtual void on_value(const ObisValue &value, const ObisEntry *entry) = 0; // entry is NULL for unsupported codes
+                virtual void on_telegram(const TelegramInfo &info) {}
+                virtual void on_error(TelegramError error) {}
+        };
+
+        enum TapPoint
+        {
+            TapEncrypted = 0x01, // DLMS payload as received, before the header is checked
+            TapDecrypted = 0x02 // Plaintext after successful decryption, before OBIS decoding
+        };
+
+        /*
+         * Receives raw telegrams for diagnostics, see MeterDecoder::set_tap_points()
+         *
+         * Called on the thread the decoder runs on, data is only valid during the call.
+         */
+        class TelegramTap
+        {
+            public:
+                virtual void on_raw_telegram(TapPoint point, const uint8_t *data, size_t length) = 0;
+        };
+
+        const char *telegram_error_name(TelegramError error); // Short name of the error, e.g. "mbus_checksum"
+        float numeric_value(const ObisValue &value, const ObisEntry *entry); // Value with the telegram scaler or the default scaler of the code
+        bool format_timestamp(const ObisValue &value, char *buffer, size_t size); // Formats a date-time as 0000-00-00T00:00:00Z, buffer needs 21 bytes
+
+        /*
+         * Platform independent telegram pipeline: M-Bus or HDLC framing, DLMS header validation, decryption and OBIS decoding
+         *
+         * Bytes go in through feed(), decoded values come out through the listener. Time, logging and
+         * decryption are provided by the caller so the same code runs on the device and on the host.
+         * Both transports collect the telegram into the same buffer, which is then decrypted in place.
+         */
+        class MeterDecoder : private ObisVisitor
+        {
+            public:
+                MeterDecoder(CryptoBackend &crypto, Clock &clock, Logger *logger = NULL);
+
+                void set_key(const uint8_t *key, size_t keyLength);
+                void set_authentication_key(const uint8_t *key); // DLMS_AUTHENTICATION_KEY_LENGTH bytes, NULL skips the tag check
+                void set_listener(MeterListener *listener);
+                void set_logger(Logger *logger); // NULL disables logging, e.g. when the decoder runs on a task that must not log
+                void set_read_timeout(uint32_t readTimeout);
+                void set_transport(TransportType type); // M-Bus by default
+                void set_tap(TelegramTap *tap); // Set before any tap points are enabled
+                void set_tap_points(uint8_t points); // TapPoint bits passed to the tap, 0 disables it, may be called from another thread
+
+                void feed(const uint8_t *data, size_t length); // Process received bytes, completed telegrams are decoded right away
+                void poll(); // Check the read timeout, call when no bytes were received
+
+#if ESPDM_ENABLE_STATS
+                const PipelineStats &get_stats() const;
+                void reset_stage_timers(); // Start a new interval for the min/avg/max stage times
+#endif
+
+            private:
+                void on_value(const ObisValue &value) override;
+                void emit(const ObisValue &value, const ObisEntry *entry); // Passes a decoded value to the listener
+
+                void handle_telegram();
+                void fail_frame(FrameStatus status);
+                void fail(TelegramError error, LogLevel level, const char *message);
+                void log(LogLevel level, const char *format, ...) __attribute__((format(printf, 3, 4)));
+#if ESPDM_ENABLE_STATS
+                void count_telegram();
+#endif
+
+                CryptoBackend &crypto;
+                Clock &clock;
+                Logger *logger;
+                MeterListener *listener = NULL;
+                TelegramTap *tap = NULL;
+                std::atomic<uint8_t> tapPoints{0}; // Enabled TapPoint bits, a single load per telegram when nothing is tapped
+
+                uint8_t payloadBuffer[MBUS_MAX_PAYLOAD_LENGTH]; // Telegram payload without link layer headers, shared by the transports. Per meter, the frames arrive over many loop() calls
+                MbusParser mbusParser; // Verifies M-Bus frames as they arrive and collects the telegram payload
+                HdlcParser hdlcParser; // Same for HDLC frames
+                Transport *transport; // One of the parsers above
+                AxdrDecoder axdrDecoder; // Decodes the OBIS values from the decrypted payload
+                LayoutCache layoutCache; // Offsets of the values in the last fully decoded telegram
+                const ByteView *decodingView = NULL; // Payload the AxdrDecoder is working on, for the layout cache
+
+                uint32_t lastRead = 0; // Timestamp when data was last read
+                uint32_t readTimeout = 100; // Time to wait after last byte before considering data complete if the last frame was not marked
+
+                uint8_t authenticationKey[DLMS_AUTHENTICATION_KEY_LENGTH]; // Part of the additional authenticated data
+                bool hasAuthenticationKey = false; // Tags are only verified and required if the key is set
+
+                uint8_t lastSystemTitle[8]; // System title of the last accepted telegram
+                uint32_t lastFrameCounter = 0; // Frame counter of the last accepted telegram
+                bool hasFrameCounter = false; // Whether a telegram was accepted since the key was set
+                uint32_t staleFrameCounter = 0; // Frame counter of the last stale telegram
+                uint8_t staleRun = 0; // Stale telegrams in a row with rising frame counters
+
+#if ESPDM_ENABLE_STATS
+                PipelineStats stats;
+                uint32_t framingTime = 0; // Time spent on the frames of the current telegram in microseconds
+                uint32_t publishingTime = 0; // Time spent in the listener for the current telegram in microseconds
+                uint32_t rateWindowStart = 0; // Start of the current telegrams per minute window
+                uint32_t rateWindowTelegrams = 0; // Telegrams accepted in the current window
+#endif
+        };
+    }
+}
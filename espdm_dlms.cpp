@@ -0,0 +1,80 @@
+#include "espdm_dlms.h"
+#include "espdm_view.h"
+#include <cstring>
+
+namespace esphome
+{
+    namespace espdm
+    {
+        DlmsStatus parse_dlms_header(uint8_t *data, size_t length, DlmsHeader &header)
+        {
+            ByteView view(data, length);
+
+            if(length < DLMS_MIN_PAYLOAD_LENGTH) // If the payload is too short we need to abort
+                return DlmsErrorTooShort;
+
+            if(data[DLMS_CIPHER_OFFSET] != DLMS_GENERAL_GLO_CIPHERING)
+                return DlmsErrorCipher;
+
+            if(data[DLMS_SYST_OFFSET] != DLMS_SYSTEM_TITLE_LENGTH)
+                return DlmsErrorSystemTitle;
+
+            uint16_t messageLength = data[DLMS_LENGTH_OFFSET];
+            int headerOffset = 0;
+
+            header.extendedLength = messageLength == DLMS_LENGTH_EXTENDED;
+
+            if(header.extendedLength) // Message length > 127
+            {
+                messageLength = view.get_uint16(DLMS_LENGTH_OFFSET + 1);
+                headerOffset = DLMS_HEADER_EXT_OFFSET; // Header is now 2 bytes longer due to length > 127
+            }
+
+            messageLength -= DLMS_LENGTH_CORRECTION; // Correct message length due to part of header being included in length
+
+            if(length - DLMS_HEADER_LENGTH - headerOffset != messageLength)
+                return DlmsErrorLength;
+
+            header.securityControl = data[headerOffset + DLMS_SECBYTE_OFFSET];
+
+            if(header.securityControl != DLMS_SECURITY_CONTROL && header.securityControl != DLMS_SECURITY_CONTROL_AUTHENTICATED)
+                return DlmsErrorSecurityByte;
+
+            header.tag = NULL;
+            header.tagLength = 0;
+
+            if(header.securityControl == DLMS_SECURITY_CONTROL_AUTHENTICATED) // Tag is part of the message length
+            {
+                if(messageLength < DLMS_TAG_LENGTH)
+                    return DlmsErrorLength;
+
+                messageLength -= DLMS_TAG_LENGTH;
+                header.tag = &data[headerOffset + DLMS_PAYLOAD_OFFSET + messageLength];
+                header.tagLength = DLMS_TAG_LENGTH;
+            }
+
+            header.systemTitle = &data[DLMS_SYST_OFFSET + 1]; // Skip the system title length byte
+            header.frameCounter = view.get_uint32(headerOffset + DLMS_FRAMECOUNTER_OFFSET);
+            header.payload = &data[headerOffset + DLMS_PAYLOAD_OFFSET];
+            header.payloadLength = messageLength;
+
+            return DlmsOk;
+        }
+
+        void build_dlms_iv(const DlmsHeader &header, uint8_t *iv)
+        {
+            memcpy(&iv[0], header.systemTitle, DLMS_SYSTEM_TITLE_LENGTH); // System title is before length; no header offset needed
+
+            iv[8] = header.frameCounter >> 24; // Frame counter in big endian
+            iv[9] = header.frameCounter >> 16;
+            iv[10] = header.frameCounter >> 8;
+            iv[11] = header.frameCounter;
+        }
+
+        void build_dlms_aad(const DlmsHeader &header, const uint8_t *authenticationKey, uint8_t *aad)
+        {
+            aad[0] = header.securityControl;
+            memcpy(&aad[1], authenticationKey, DLMS_AUTHENTICATION_KEY_LENGTH);
+        }
+    }
+}
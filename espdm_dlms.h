@@ -1,3 +1,8 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
 /*
  * Data structure
  */
@@ -19,3 +24,46 @@ static const int DLMS_FRAMECOUNTER_OFFSET = 12; // Offset of the frame counter
 static const int DLMS_FRAMECOUNTER_LENGTH = 4; // Length of the frame counter (always 4)
 
 static const int DLMS_PAYLOAD_OFFSET = 16; // Offset at which the encrypted payload begins
+
+static const int DLMS_IV_LENGTH = 12; // Length of the GCM IV (system title and frame counter)
+static const int DLMS_MIN_PAYLOAD_LENGTH = 20; // Shortest payload accepted as a DLMS message
+
+static const uint8_t DLMS_GENERAL_GLO_CIPHERING = 0xDB; // Only general-glo-ciphering is supported
+static const uint8_t DLMS_SYSTEM_TITLE_LENGTH = 0x08; // Only system titles with length of 8 are supported
+static const uint8_t DLMS_LENGTH_EXTENDED = 0x82; // Length field is followed by two length bytes
+static const uint8_t DLMS_SECURITY_CONTROL = 0x21; // Security suite 0, encrypted
+static const uint8_t DLMS_SECURITY_CONTROL_AUTHENTICATED = 0x31; // Security suite 0, authenticated and encrypted
+static const int DLMS_TAG_LENGTH = 12; // Authenticated messages end with a truncated GCM tag
+static const int DLMS_AUTHENTICATION_KEY_LENGTH = 16; // Authentication key, part of the additional authenticated data
+
+namespace esphome
+{
+    namespace espdm
+    {
+        enum DlmsStatus
+        {
+            DlmsOk,
+            DlmsErrorTooShort, // Payload too short for a DLMS header
+            DlmsErrorCipher, // Unsupported cipher
+            DlmsErrorSystemTitle, // Unsupported system title length
+            DlmsErrorLength, // Message length does not match the payload
+            DlmsErrorSecurityByte // Unsupported security control byte
+        };
+
+        struct DlmsHeader
+        {
+            const uint8_t *systemTitle; // System title of the meter (DLMS_SYSTEM_TITLE_LENGTH bytes)
+            uint32_t frameCounter; // Frame counter of the message
+            uint8_t securityControl; // Security control byte
+            bool extendedLength; // True if the message length was sent with DLMS_LENGTH_EXTENDED
+            uint8_t *payload; // Encrypted payload, points into the parsed buffer
+            size_t payloadLength; // Length of the encrypted payload without the tag
+            const uint8_t *tag; // GCM tag after the payload, NULL if the message is not authenticated
+            size_t tagLength;
+        };
+
+        DlmsStatus parse_dlms_header(uint8_t *data, size_t length, DlmsHeader &header); // Verifies the header of a general-glo-ciphering message
+        void build_dlms_iv(const DlmsHeader &header, uint8_t *iv); // Writes the DLMS_IV_LENGTH bytes of the GCM IV
+        void build_dlms_aad(const DlmsHeader &header, const uint8_t *authenticationKey, uint8_t *aad); // Writes the 1 + DLMS_AUTHENTICATION_KEY_LENGTH bytes of the additional authenticated data
+    }
+}
@@ -0,0 +1,298 @@
+#include "espdm_hdlc.h"
+#include <algorithm>
+#include <cstring>
+
+static const uint16_t HDLC_FCS_TABLE[256] = // CRC-16/X.25 (reflected polynomial 0x8408) of every byte value
+{
+    0x0000, 0x1189, 0x2312, 0x329B, 0x4624, 0x57AD, 0x6536, 0x74BF,
+    0x8C48, 0x9DC1, 0xAF5A, 0xBED3, 0xCA6C, 0xDBE5, 0xE97E, 0xF8F7,
+    0x1081, 0x0108, 0x3393, 0x221A, 0x56A5, 0x472C, 0x75B7, 0x643E,
+    0x9CC9, 0x8D40, 0xBFDB, 0xAE52, 0xDAED, 0xCB64, 0xF9FF, 0xE876,
+    0x2102, 0x308B, 0x0210, 0x1399, 0x6726, 0x76AF, 0x4434, 0x55BD,
+    0xAD4A, 0xBCC3, 0x8E58, 0x9FD1, 0xEB6E, 0xFAE7, 0xC87C, 0xD9F5,
+    0x3183, 0x200A, 0x1291, 0x0318, 0x77A7, 0x662E, 0x54B5, 0x453C,
+    0xBDCB, 0xAC42, 0x9ED9, 0x8F50, 0xFBEF, 0xEA66, 0xD8FD, 0xC974,
+    0x4204, 0x538D, 0x6116, 0x709F, 0x0420, 0x15A9, 0x2732, 0x36BB,
+    0xCE4C, 0xDFC5, 0xED5E, 0xFCD7, 0x8868, 0x99E1, 0xAB7A, 0xBAF3,
+    0x5285, 0x430C, 0x7197, 0x601E, 0x14A1, 0x0528, 0x37B3, 0x263A,
+    0xDECD, 0xCF44, 0xFDDF, 0xEC56, 0x98E9, 0x8960, 0xBBFB, 0xAA72,
+    0x6306, 0x728F, 0x4014, 0x519D, 0x2522, 0x34AB, 0x0630, 0x17B9,
+    0xEF4E, 0xFEC7, 0xCC5C, 0xDDD5, 0xA96A, 0xB8E3, 0x8A78, 0x9BF1,
+    0x7387, 0x620E, 0x5095, 0x411C, 0x35A3, 0x242A, 0x16B1, 0x0738,
+    0xFFCF, 0xEE46, 0xDCDD, 0xCD54, 0xB9EB, 0xA862, 0x9AF9, 0x8B70,
+    0x8408, 0x9581, 0xA71A, 0xB693, 0xC22C, 0xD3A5, 0xE13E, 0xF0B7,
+    0x0840, 0x19C9, 0x2B52, 0x3ADB, 0x4E64, 0x5FED, 0x6D76, 0x7CFF,
+    0x9489, 0x8500, 0xB79B, 0xA612, 0xD2AD, 0xC324, 0xF1BF, 0xE036,
+    0x18C1, 0x0948, 0x3BD3, 0x2A5A, 0x5EE5, 0x4F6C, 0x7DF7, 0x6C7E,
+    0xA50A, 0xB483, 0x8618, 0x9791, 0xE32E, 0xF2A7, 0xC03C, 0xD1B5,
+    0x2942, 0x38CB, 0x0A50, 0x1BD9, 0x6F66, 0x7EEF, 0x4C74, 0x5DFD,
+    0xB58B, 0xA402, 0x9699, 0x8710, 0xF3AF, 0xE226, 0xD0BD, 0xC134,
+    0x39C3, 0x284A, 0x1AD1, 0x0B58, 0x7FE7, 0x6E6E, 0x5CF5, 0x4D7C,
+    0xC60C, 0xD785, 0xE51E, 0xF497, 0x8028, 0x91A1, 0xA33A, 0xB2B3,
+    0x4A44, 0x5BCD, 0x6956, 0x78DF, 0x0C60, 0x1DE9, 0x2F72, 0x3EFB,
+    0xD68D, 0xC704, 0xF59F, 0xE416, 0x90A9, 0x8120, 0xB3BB, 0xA232,
+    0x5AC5, 0x4B4C, 0x79D7, 0x685E, 0x1CE1, 0x0D68, 0x3FF3, 0x2E7A,
+    0xE70E, 0xF687, 0xC41C, 0xD595, 0xA12A, 0xB0A3, 0x8238, 0x93B1,
+    0x6B46, 0x7ACF, 0x4854, 0x59DD, 0x2D62, 0x3CEB, 0x0E70, 0x1FF9,
+    0xF78F, 0xE606, 0xD49D, 0xC514, 0xB1AB, 0xA022, 0x92B9, 0x8330,
+    0x7BC7, 0x6A4E, 0x58D5, 0x495C, 0x3DE3, 0x2C6A, 0x1EF1, 0x0F78
+};
+
+namespace esphome
+{
+    namespace espdm
+    {
+        uint16_t hdlc_fcs(uint16_t fcs, const uint8_t *data, size_t length)
+        {
+            for(size_t i = 0; i < length; i++)
+                fcs = (fcs >> 8) ^ HDLC_FCS_TABLE[(fcs ^ data[i]) & 0xFF];
+
+            return fcs;
+        }
+
+        HdlcParser::HdlcParser(uint8_t *buffer, size_t size) : Transport(buffer, size) {}
+
+        TransportType HdlcParser::type() const
+        {
+            return TransportHdlc;
+        }
+
+        const char *HdlcParser::name() const
+        {
+            return "HDLC";
+        }
+
+        FrameStatus HdlcParser::feed(const uint8_t *data, size_t length, size_t &consumed)
+        {
+            size_t i = 0;
+
+            while(i < length)
+            {
+                if(this->state == ReadInformation && this->llcPosition == sizeof(HDLC_LLC_HEADER))
+                {
+                    // Bulk of the frame, copy as much of the information field as is there and run the FCS over it in one go
+                    size_t run = std::min(length - i, (size_t) (this->frameLength - HDLC_CHECKSUM_LENGTH - this->framePosition));
+
+                    if(run > this->size - this->dataLength)
+                    {
+                        consumed = i + 1;
+                        return fail(FrameErrorOverflow, data[i]);
+                    }
+
+                    memcpy(&this->data[this->dataLength], &data[i], run);
+                    this->fcs = hdlc_fcs(this->fcs, &data[i], run);
+
+                    this->dataLength += run;
+                    this->framePosition += run;
+                    i += run;
+
+                    if(this->framePosition == this->frameLength - HDLC_CHECKSUM_LENGTH)
+                        this->state = ReadFrameChecksum;
+
+                    continue;
+                }
+
+                FrameStatus status = step(data[i++]);
+
+                if(status != FrameNeedMore)
+                {
+                    consumed = i;
+                    return status;
+                }
+            }
+
+            consumed = length;
+
+            return FrameNeedMore;
+        }
+
+        FrameStatus HdlcParser::step(uint8_t c)
+        {
+            switch(this->state)
+            {
+                case WaitFlag:
+                    if(c != HDLC_FLAG)
+                    {
+                        if(this->dataLength == 0) // Skip noise between telegrams
+                            return FrameNeedMore;
+
+                        return fail(FrameErrorStart, c); // Garbage between segments of the same telegram
+                    }
+
+                    this->state = WaitFormat1;
+                break;
+                case WaitFormat1:
+                    if(c == HDLC_FLAG) // Frames may be separated by more than one flag
+                        break;
+
+                    if((c & HDLC_FORMAT_TYPE_MASK) != HDLC_FORMAT_TYPE)
+                        return fail(FrameErrorFormat, c);
+
+                    this->segmented = c & HDLC_SEGMENTATION_BIT;
+                    this->frameLength = (c << 8) & HDLC_LENGTH_MASK;
+                    this->framePosition = 1;
+                    this->fcs = hdlc_fcs(HDLC_FCS_INIT, &c, 1);
+                    this->state = WaitFormat2;
+                break;
+                case WaitFormat2:
+                    this->frameLength |= c;
+                    this->framePosition++;
+                    this->fcs = hdlc_fcs(this->fcs, &c, 1);
+
+                    if(this->frameLength < HDLC_MIN_FRAME_LENGTH)
+                        return fail(FrameErrorLength, c);
+
+                    this->fieldPosition = 0;
+                    this->state = ReadDestination;
+                break;
+                case ReadDestination:
+                case ReadSource:
+                    this->framePosition++;
+                    this->fieldPosition++;
+                    this->fcs = hdlc_fcs(this->fcs, &c, 1);
+
+                    if(c & 0x01) // Last byte of the address
+                    {
+                        this->fieldPosition = 0;
+                        this->state = this->state == ReadDestination ? ReadSource : WaitControl;
+                    }
+                    else if(this->fieldPosition == HDLC_MAX_ADDRESS_LENGTH)
+                    {
+                        return fail(FrameErrorFormat, c);
+                    }
+                break;
+                case WaitControl:
+                    this->framePosition++;
+                    this->fcs = hdlc_fcs(this->fcs, &c, 1);
+
+                    if(this->framePosition + HDLC_CHECKSUM_LENGTH > this->frameLength)
+                        return fail(FrameErrorLength, c);
+
+                    // Only frames with an information field have a header checksum
+                    this->hasInformation = this->framePosition + HDLC_CHECKSUM_LENGTH < this->frameLength;
+
+                    if(this->hasInformation && this->framePosition + 2 * HDLC_CHECKSUM_LENGTH > this->frameLength)
+                        return fail(FrameErrorLength, c);
+
+                    this->state = this->hasInformation ? ReadHeaderChecksum : ReadFrameChecksum;
+                break;
+                case ReadHeaderChecksum:
+                    this->framePosition++;
+                    this->fieldPosition++;
+                    this->fcs = hdlc_fcs(this->fcs, &c, 1);
+
+                    if(this->fieldPosition < HDLC_CHECKSUM_LENGTH)
+                        break;
+
+                    if(this->fcs != HDLC_FCS_GOOD)
+                        return fail(FrameErrorChecksum, c);
+
+                    this->fieldPosition = 0;
+                    this->state = this->framePosition + HDLC_CHECKSUM_LENGTH < this->frameLength ? ReadInformation : ReadFrameChecksum;
+                break;
+                case ReadInformation: // Only byte by byte while checking the LLC header, see feed()
+                    this->framePosition++;
+                    this->fcs = hdlc_fcs(this->fcs, &c, 1);
+
+                    if(this->skipSegments)
+                    {
+                        // Only checked for its FCS
+                    }
+                    else if(this->llcPosition < sizeof(HDLC_LLC_HEADER))
+                    {
+                        if(c != HDLC_LLC_HEADER[this->llcPosition++])
+                            return fail(FrameErrorFormat, c);
+                    }
+                    else
+                    {
+                        if(this->dataLength >= this->size)
+                            return fail(FrameErrorOverflow, c);
+
+                        this->data[this->dataLength++] = c;
+                    }
+
+                    if(this->framePosition + HDLC_CHECKSUM_LENGTH == this->frameLength)
+                        this->state = ReadFrameChecksum;
+                break;
+                case ReadFrameChecksum:
+                    this->framePosition++;
+                    this->fieldPosition++;
+                    this->fcs = hdlc_fcs(this->fcs, &c, 1);
+
+                    if(this->fieldPosition < HDLC_CHECKSUM_LENGTH)
+                        break;
+
+                    if(this->fcs != HDLC_FCS_GOOD)
+                        return fail(FrameErrorChecksum, c);
+
+                    this->state = WaitCloseFlag;
+                break;
+                case WaitCloseFlag:
+                    if(c != HDLC_FLAG)
+                        return fail(FrameErrorStop, c);
+
+                    this->state = WaitFormat1; // The closing flag may also open the next frame
+                    this->errorReported = false;
+
+                    if(this->skipSegments && this->hasInformation)
+                    {
+                        this->skipSegments = this->segmented; // Telegram is over after its last segment
+                        return FrameNeedMore;
+                    }
+
+                    if(!this->hasInformation) // Nothing for the DLMS layer, e.g. a receive ready frame
+                        return FrameNeedMore;
+
+                    return this->segmented ? FrameComplete : FrameTelegramComplete;
+            }
+
+            return FrameNeedMore;
+        }
+
+        FrameStatus HdlcParser::timeout()
+        {
+            // The segmentation bit always marks the last segment, a telegram without it is never complete
+            return fail(FrameErrorIncomplete, 0);
+        }
+
+        void HdlcParser::idle()
+        {
+            // The broken telegram is over
+            this->skipSegments = false;
+            this->errorReported = false;
+        }
+
+        FrameStatus HdlcParser::fail(FrameStatus status, uint8_t c)
+        {
+            bool moreSegments = this->segmented && this->state > WaitFormat1; // Format of the failed frame was read
+            bool reported = this->errorReported;
+
+            reset();
+
+            this->skipSegments = moreSegments && status != FrameErrorIncomplete;
+
+            // Resyncing on flags within the rest of the broken telegram fails again, count it only once.
+            // After the read timeout the next byte starts a new telegram.
+            this->errorReported = status != FrameErrorIncomplete;
+
+            this->state = c == HDLC_FLAG ? WaitFormat1 : WaitFlag; // Resync on the offending byte if it could start a new frame
+
+            return reported ? FrameNeedMore : status;
+        }
+
+        void HdlcParser::reset()
+        {
+            Transport::reset();
+
+            this->llcPosition = 0; // The next segment starts a new telegram, unless the remaining segments of a broken one are skipped
+
+            if(this->state != WaitFormat1) // A flag that was already seen still opens the next frame
+                this->state = WaitFlag;
+        }
+
+        bool HdlcParser::at_frame_boundary() const
+        {
+            return this->state == WaitFlag || this->state == WaitFormat1;
+        }
+    }
+}
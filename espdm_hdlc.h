@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include "espdm_transport.h"
+
+/*
+ * Data structure
+ */
+
+static const uint8_t HDLC_FLAG = 0x7E; // Opening and closing flag of every frame
+static const uint8_t HDLC_FORMAT_TYPE = 0xA0; // Frame format type 3, upper nibble of the first format byte
+static const uint8_t HDLC_FORMAT_TYPE_MASK = 0xF0;
+static const uint8_t HDLC_SEGMENTATION_BIT = 0x08; // Set in the first format byte if more segments follow
+static const uint16_t HDLC_LENGTH_MASK = 0x07FF; // Frame length, from the format field to the FCS
+
+static const int HDLC_MAX_ADDRESS_LENGTH = 4; // Addresses are 1, 2 or 4 bytes, the last byte has bit 0 set
+static const int HDLC_MIN_FRAME_LENGTH = 7; // Format (2), destination and source address (1 each), control and FCS (2)
+static const int HDLC_CHECKSUM_LENGTH = 2; // HCS and FCS are both CRC-16/X.25, sent low byte first
+
+static const uint16_t HDLC_FCS_INIT = 0xFFFF;
+static const uint16_t HDLC_FCS_GOOD = 0xF0B8; // Remainder after running the FCS over the data and the FCS itself
+
+static const uint8_t HDLC_LLC_HEADER[] = { 0xE6, 0xE7, 0x00 }; // Destination and source LSAP and quality, only in the first segment of a telegram
+
+namespace esphome
+{
+    namespace espdm
+    {
+        uint16_t hdlc_fcs(uint16_t fcs, const uint8_t *data, size_t length); // Continues a CRC-16/X.25 register, start with HDLC_FCS_INIT
+
+        /*
+         * Streaming parser for HDLC frames as per IEC 62056-46 (7E A0 L dst src ctrl HCS info FCS 7E)
+         *
+         * Header and frame are checked against their HCS and FCS as the bytes arrive, using a table driven
+         * CRC-16/X.25. Frames are delimited by their length, flags inside a frame are data. The
+         * information fields of all segments of a telegram are collected without the LLC header, the
+         * segmentation bit marks all but the last segment. If a segment is invalid, the remaining segments
+         * of that telegram are skipped without further errors. Frames without an information field (e.g.
+         * receive ready) are skipped. The closing flag may also open the next frame.
+         */
+        class HdlcParser : public Transport
+        {
+            public:
+                HdlcParser(uint8_t *buffer, size_t size);
+
+                TransportType type() const override;
+                const char *name() const override;
+
+                FrameStatus feed(const uint8_t *data, size_t length, size_t &consumed) override;
+                FrameStatus timeout() override;
+                void idle() override;
+
+                void reset() override;
+                bool at_frame_boundary() const override;
+
+            private:
+                enum State
+                {
+                    WaitFlag, // Skipping bytes until the next flag
+                    WaitFormat1, // Flag seen, more flags or the first format byte may follow
+                    WaitFormat2,
+                    ReadDestination,
+                    ReadSource,
+                    WaitControl,
+                    ReadHeaderChecksum,
+                    ReadInformation,
+                    ReadFrameChecksum,
+                    WaitCloseFlag
+                };
+
+                FrameStatus step(uint8_t c); // Everything but the bulk of the information field
+                FrameStatus fail(FrameStatus status, uint8_t c);
+
+                State state = WaitFlag;
+
+                uint16_t fcs = HDLC_FCS_INIT; // Running CRC-16/X.25 over the current frame
+                uint16_t frameLength = 0; // Length from the format field, without flags
+                uint16_t framePosition = 0; // Bytes of the current frame read so far, without flags
+                uint8_t fieldPosition = 0; // Bytes of the current address or checksum read so far
+                uint8_t llcPosition = 0; // Bytes of the LLC header checked so far, kept across the segments of a telegram
+                bool segmented = false; // More segments of the telegram follow this frame
+                bool hasInformation = false; // Frame has an information field and a header checksum
+                bool skipSegments = false; // A segment of the telegram was invalid, skip its other segments
+                bool errorReported = false; // An error was reported, further errors until the next valid frame belong to the same telegram
+        };
+    }
+}
@@ -0,0 +1,74 @@
+#if defined(ESPDM_HOST)
+
+#include "espdm_host.h"
+#include <chrono>
+#include <cstdio>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+namespace esphome
+{
+    namespace espdm
+    {
+        uint32_t HostClock::millis()
+        {
+            return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+
+        uint32_t HostClock::micros()
+        {
+            return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+
+        uint32_t HostClock::cycles()
+        {
+#if defined(__x86_64__) || defined(__i386__)
+            return __rdtsc();
+#else
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count(); // No cycle counter, use nanoseconds instead
+#endif
+        }
+
+        uint32_t ManualClock::millis()
+        {
+            return this->now / 1000;
+        }
+
+        uint32_t ManualClock::micros()
+        {
+            return this->now;
+        }
+
+        uint32_t ManualClock::cycles()
+        {
+            return this->now; // No cycles on a simulated clock, use microseconds instead
+        }
+
+        void ManualClock::set_micros(uint64_t now)
+        {
+            this->now = now;
+        }
+
+        uint64_t ManualClock::get_micros() const
+        {
+            return this->now;
+        }
+
+        HostLogger::HostLogger(LogLevel level) : level(level) {}
+
+        bool HostLogger::enabled(LogLevel level)
+        {
+            return level <= this->level;
+        }
+
+        void HostLogger::log(LogLevel level, const char *message)
+        {
+            static const char *LEVEL_NAMES[] = { "", "E", "W", "I", "D", "V" };
+
+            fprintf(stderr, "[%s][espdm] %s\n", LEVEL_NAMES[level], message);
+        }
+    }
+}
+
+#endif
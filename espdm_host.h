@@ -0,0 +1,56 @@
+#pragma once
+
+#if defined(ESPDM_HOST)
+
+#include "espdm_platform.h"
+
+namespace esphome
+{
+    namespace espdm
+    {
+        /*
+         * Clock based on std::chrono::steady_clock for host builds
+         */
+        class HostClock : public Clock
+        {
+            public:
+                uint32_t millis() override;
+                uint32_t micros() override;
+                uint32_t cycles() override;
+        };
+
+        /*
+         * Clock that only moves when the caller advances it, used to replay captures and simulate time
+         */
+        class ManualClock : public Clock
+        {
+            public:
+                uint32_t millis() override;
+                uint32_t micros() override;
+                uint32_t cycles() override;
+
+                void set_micros(uint64_t now);
+                uint64_t get_micros() const;
+
+            private:
+                uint64_t now = 0; // Microseconds since the start of the replay
+        };
+
+        /*
+         * Logger writing to stderr for host builds
+         */
+        class HostLogger : public Logger
+        {
+            public:
+                HostLogger(LogLevel level = LogInfo);
+
+                bool enabled(LogLevel level) override;
+                void log(LogLevel level, const char *message) override;
+
+            private:
+                LogLevel level; // Highest level that is printed
+        };
+    }
+}
+
+#endif
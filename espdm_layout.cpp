@@ -0,0 +1,124 @@
+#include "espdm_layout.h"
+#include <cstring>
+
+namespace esphome
+{
+    namespace espdm
+    {
+        void LayoutCache::clear()
+        {
+            this->valid = false;
+            this->fieldCount = 0;
+        }
+
+        void LayoutCache::learn()
+        {
+            clear();
+            this->overflow = false;
+        }
+
+        void LayoutCache::record(const ByteView &view, const ObisValue &value, const ObisEntry *entry)
+        {
+            if(this->overflow)
+                return;
+
+            size_t dataOffset = value.data - view.pointer(0);
+
+            // Values have to be in order and fit the 16 bit offsets, otherwise the telegram is not cached
+            if(this->fieldCount == ESPDM_LAYOUT_MAX_FIELDS || dataOffset + value.length > UINT16_MAX ||
+               (this->fieldCount > 0 && dataOffset < (size_t) this->fields[this->fieldCount - 1].dataOffset + this->fields[this->fieldCount - 1].dataLength))
+            {
+                this->overflow = true;
+                return;
+            }
+
+            LayoutField &field = this->fields[this->fieldCount++];
+            field.valueOffset = value.offset + 1;
+            field.obisOffset = value.obis - view.pointer(0);
+            field.dataOffset = dataOffset;
+            field.dataLength = value.length;
+            field.type = value.type;
+            field.hasScaler = value.hasScaler;
+            field.scaler = value.scaler;
+            field.unit = value.unit;
+            field.entry = entry;
+        }
+
+        void LayoutCache::commit(const ByteView &view, size_t offset)
+        {
+            if(this->overflow || this->fieldCount == 0)
+                return;
+
+            // Copy every byte from offset to the end except the raw value bytes
+            size_t skeletonLength = 0;
+            size_t position = offset;
+
+            for(size_t i = 0; i <= this->fieldCount; i++)
+            {
+                size_t end = i < this->fieldCount ? this->fields[i].dataOffset : view.length();
+
+                if(skeletonLength + (end - position) > sizeof(this->skeleton))
+                    return;
+
+                memcpy(&this->skeleton[skeletonLength], view.pointer(position), end - position);
+                skeletonLength += end - position;
+
+                if(i < this->fieldCount)
+                    position = end + this->fields[i].dataLength;
+            }
+
+            this->length = view.length();
+            this->valid = true;
+        }
+
+        bool LayoutCache::matches(const ByteView &view, size_t offset) const
+        {
+            if(!this->valid || view.length() != this->length)
+                return false;
+
+            const uint8_t *skeleton = this->skeleton;
+            size_t position = offset;
+
+            for(size_t i = 0; i <= this->fieldCount; i++)
+            {
+                size_t end = i < this->fieldCount ? this->fields[i].dataOffset : view.length();
+
+                if(memcmp(skeleton, view.pointer(position), end - position) != 0)
+                    return false;
+
+                skeleton += end - position;
+
+                if(i < this->fieldCount)
+                    position = end + this->fields[i].dataLength;
+            }
+
+            return true;
+        }
+
+        size_t LayoutCache::size() const
+        {
+            return this->valid ? this->fieldCount : 0;
+        }
+
+        bool LayoutCache::read(const ByteView &view, size_t index, ObisValue &value, const ObisEntry *&entry) const
+        {
+            const LayoutField &field = this->fields[index];
+            size_t position = field.valueOffset;
+
+            if(read_axdr_value(view, field.type, position, value) != AxdrOk)
+                return false;
+
+            value.obis = view.pointer(field.obisOffset);
+            value.hasScaler = field.hasScaler;
+            value.scaler = field.scaler;
+            value.unit = field.unit;
+
+            if(value.hasScaler && value.numeric) // Same as the full decoder does when it sees the scaler structure
+                value.value = apply_scaler(value.value, value.scaler);
+
+            entry = field.entry;
+
+            return true;
+        }
+    }
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include "espdm_axdr.h"
+#include "espdm_obis.h"
+
+#ifndef ESPDM_LAYOUT_MAX_FIELDS
+#define ESPDM_LAYOUT_MAX_FIELDS 16 // Values the layout cache can hold, telegrams with more are always fully decoded
+#endif
+
+#ifndef ESPDM_LAYOUT_MAX_SKELETON
+#define ESPDM_LAYOUT_MAX_SKELETON 256 // Bytes around the values the layout cache can hold, about 200 for a Kaifa telegram
+#endif
+
+namespace esphome
+{
+    namespace espdm
+    {
+        /*
+         * Position and scaling of one value in a learned layout
+         */
+        struct LayoutField
+        {
+            uint16_t valueOffset; // Right after the type byte, where read_axdr_value() starts
+            uint16_t obisOffset;
+            uint16_t dataOffset; // Raw value bytes, these are left out of the skeleton
+            uint16_t dataLength;
+            uint8_t type;
+            bool hasScaler;
+            int8_t scaler;
+            uint8_t unit;
+            const ObisEntry *entry; // Registry entry of the code, NULL for unsupported codes
+        };
+
+        /*
+         * Layout of the last fully decoded telegram for a fixed-offset fast path
+         *
+         * Meters send the same objects in the same order every time, only the value bytes change. After
+         * a full decode the cache knows where every value is and keeps a copy of all other bytes (types,
+         * lengths, OBIS codes, scalers and units), the skeleton. The full decoder only looks at those
+         * bytes to find its way, so a telegram of the same length with the same skeleton is read
+         * directly at the cached offsets. Anything else goes through the full decoder.
+         */
+        class LayoutCache
+        {
+            public:
+                void clear();
+
+                void learn(); // Starts recording the values of a full decode
+                void record(const ByteView &view, const ObisValue &value, const ObisEntry *entry);
+                void commit(const ByteView &view, size_t offset); // Full decode succeeded, the recorded layout becomes valid
+
+                bool matches(const ByteView &view, size_t offset) const; // Same length and skeleton as the cached layout
+                size_t size() const;
+                bool read(const ByteView &view, size_t index, ObisValue &value, const ObisEntry *&entry) const; // Value at the cached offsets, only after matches()
+
+            private:
+                LayoutField fields[ESPDM_LAYOUT_MAX_FIELDS];
+                size_t fieldCount = 0;
+                size_t length = 0; // Length of the telegram payload the layout was learned from
+                uint8_t skeleton[ESPDM_LAYOUT_MAX_SKELETON]; // Bytes between the values, in order
+                bool valid = false;
+                bool overflow = false; // The telegram being learned does not fit into the cache
+        };
+    }
+}
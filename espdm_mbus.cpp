@@ -0,0 +1,162 @@
+#include "espdm_mbus.h"
+
+namespace esphome
+{
+    namespace espdm
+    {
+        MbusParser::MbusParser(uint8_t *buffer, size_t size) : Transport(buffer, size) {}
+
+        TransportType MbusParser::type() const
+        {
+            return TransportMbus;
+        }
+
+        const char *MbusParser::name() const
+        {
+            return "MBUS";
+        }
+
+        FrameStatus MbusParser::feed(const uint8_t *data, size_t length, size_t &consumed)
+        {
+            for(size_t i = 0; i < length; i++)
+            {
+                FrameStatus status = feed(data[i]);
+
+                if(status != FrameNeedMore)
+                {
+                    consumed = i + 1;
+                    return status;
+                }
+            }
+
+            consumed = length;
+
+            return FrameNeedMore;
+        }
+
+        FrameStatus MbusParser::feed(uint8_t c)
+        {
+            switch(this->state)
+            {
+                case WaitStart1:
+                    if(c != MBUS_START_BYTE)
+                    {
+                        if(this->dataLength == 0) // Skip noise between telegrams
+                            return FrameNeedMore;
+
+                        return fail(FrameErrorStart, c); // Garbage between frames of the same telegram
+                    }
+
+                    this->state = WaitLength1;
+                break;
+                case WaitLength1:
+                    this->frameLength = c;
+                    this->state = WaitLength2;
+                break;
+                case WaitLength2:
+                    // Both length bytes must be identical and the frame must at least contain the full header
+                    if(c != this->frameLength || this->frameLength < MBUS_FULL_HEADER_LENGTH - MBUS_HEADER_INTRO_LENGTH)
+                        return fail(FrameErrorLength, c);
+
+                    this->state = WaitStart2;
+                break;
+                case WaitStart2:
+                    if(c != MBUS_START_BYTE)
+                        return fail(FrameErrorStart, c);
+
+                    this->bodyPosition = 0;
+                    this->checksum = 0;
+                    this->frameStart = this->dataLength;
+                    this->state = ReadBody;
+                break;
+                case ReadBody:
+                    this->checksum += c;
+
+                    if(this->bodyPosition == MBUS_CI_OFFSET - MBUS_HEADER_INTRO_LENGTH)
+                        this->controlInformation = c;
+
+                    if(this->bodyPosition >= MBUS_FULL_HEADER_LENGTH - MBUS_HEADER_INTRO_LENGTH) // Only keep the payload, skip the remaining header
+                    {
+                        if(this->dataLength >= this->size)
+                            return fail(FrameErrorOverflow, c);
+
+                        this->data[this->dataLength++] = c;
+                    }
+
+                    this->bodyPosition++;
+
+                    if(this->bodyPosition == this->frameLength)
+                        this->state = WaitChecksum;
+                break;
+                case WaitChecksum:
+                    if(c != this->checksum)
+                        return fail(FrameErrorChecksum, c);
+
+                    this->state = WaitStop;
+                break;
+                case WaitStop:
+                    if(c != MBUS_STOP_BYTE)
+                        return fail(FrameErrorStop, c);
+
+                    this->state = WaitStart1;
+                    this->skipTelegram = false;
+
+                    // Rest of a telegram whose first frame was broken or missed, e.g. right after boot
+                    if(this->frameStart == 0 && (this->controlInformation & MBUS_CI_SEQUENCE_MASK) != 0)
+                    {
+                        this->dataLength = 0;
+                        return FrameNeedMore;
+                    }
+
+                    // The last frame either has the final segment bit set or is shorter than a full frame
+                    if((this->controlInformation & MBUS_CI_FINAL_SEGMENT) || this->frameLength < MBUS_MAX_FRAME_LENGTH)
+                        return FrameTelegramComplete;
+
+                    return FrameComplete;
+            }
+
+            return FrameNeedMore;
+        }
+
+        FrameStatus MbusParser::timeout()
+        {
+            // Meters which do not mark their last frame are complete once nothing arrives between two frames
+            if(at_frame_boundary())
+                return FrameTelegramComplete;
+
+            return fail(FrameErrorIncomplete, 0);
+        }
+
+        void MbusParser::idle()
+        {
+            this->skipTelegram = false; // The broken telegram is over
+        }
+
+        FrameStatus MbusParser::fail(FrameStatus status, uint8_t c)
+        {
+            bool reported = this->skipTelegram;
+
+            reset();
+
+            // Resyncing on start bytes within the payload of the broken telegram fails again, count it only once.
+            // After the read timeout the next byte starts a new telegram.
+            this->skipTelegram = status != FrameErrorIncomplete;
+
+            if(c == MBUS_START_BYTE) // Resync on the offending byte if it could start a new frame
+                this->state = WaitLength1;
+
+            return reported ? FrameNeedMore : status;
+        }
+
+        void MbusParser::reset()
+        {
+            Transport::reset();
+            this->state = WaitStart1;
+        }
+
+        bool MbusParser::at_frame_boundary() const
+        {
+            return this->state == WaitStart1;
+        }
+    }
+}
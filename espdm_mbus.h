@@ -1,3 +1,13 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include "espdm_transport.h"
+
+#ifndef ESPDM_MAX_FRAME_COUNT
+#define ESPDM_MAX_FRAME_COUNT 4 // Maximum number of M-Bus frames a telegram can be split into
+#endif
+
 /*
  * Data structure
  */
@@ -12,3 +22,69 @@ static const int MBUS_START1_OFFSET = 0; // Offset of first start byte
 static const int MBUS_LENGTH1_OFFSET = 1; // Offset of first length byte
 static const int MBUS_LENGTH2_OFFSET = 2; // Offset of (duplicated) second length byte
 static const int MBUS_START2_OFFSET = 3; // Offset of (duplicated) second start byte
+
+static const int MBUS_CI_OFFSET = 6; // Offset of the control information field, carries the segmentation info
+
+static const uint8_t MBUS_START_BYTE = 0x68; // Start byte of a long frame
+static const uint8_t MBUS_STOP_BYTE = 0x16; // Stop byte of a long frame
+static const size_t MBUS_MAX_PAYLOAD_LENGTH = MBUS_MAX_FRAME_LENGTH * ESPDM_MAX_FRAME_COUNT; // Payload buffer needed for a whole telegram
+
+static const uint8_t MBUS_CI_FINAL_SEGMENT = 0x10; // Set in the CI field on the last frame of a telegram
+static const uint8_t MBUS_CI_SEQUENCE_MASK = 0x0F; // Number of the frame within its telegram, 0 for the first one
+
+namespace esphome
+{
+    namespace espdm
+    {
+        /*
+         * Streaming parser for M-Bus long frames (0x68 L L 0x68 ... CS 0x16)
+         *
+         * The payload of all frames belonging to one telegram (everything after the full header) is
+         * collected without the M-Bus headers and footers. On an invalid frame the parser resyncs on
+         * the next start byte. Meters which do not mark their last frame are decoded after the read
+         * timeout.
+         *
+         * A broken telegram is reported once: after an error, start bytes within the rest of it fail
+         * silently, and continuation frames without an accepted first frame are dropped.
+         */
+        class MbusParser : public Transport
+        {
+            public:
+                MbusParser(uint8_t *buffer, size_t size);
+
+                TransportType type() const override;
+                const char *name() const override;
+
+                FrameStatus feed(const uint8_t *data, size_t length, size_t &consumed) override;
+                FrameStatus feed(uint8_t c);
+                FrameStatus timeout() override;
+                void idle() override;
+
+                void reset() override;
+                bool at_frame_boundary() const override;
+
+            private:
+                enum State
+                {
+                    WaitStart1,
+                    WaitLength1,
+                    WaitLength2,
+                    WaitStart2,
+                    ReadBody,
+                    WaitChecksum,
+                    WaitStop
+                };
+
+                FrameStatus fail(FrameStatus status, uint8_t c);
+
+                State state = WaitStart1;
+
+                uint8_t frameLength = 0; // Length field of the current frame (control field up to end of data)
+                uint8_t bodyPosition = 0; // Bytes of the body read so far
+                uint8_t checksum = 0; // Running checksum of the body
+                uint8_t controlInformation = 0; // CI field of the current frame
+                size_t frameStart = 0; // Offset of the payload of the current frame, 0 for the first frame of a telegram
+                bool skipTelegram = false; // An error was reported, further errors until the next valid frame belong to the same telegram
+        };
+    }
+}
@@ -1,3 +1,8 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
 /*
  * Data types as per specification
  */
@@ -57,25 +62,78 @@ enum CodeType
     ActiveEnergyPlus,
     ActiveEnergyMinus,
     ReactiveEnergyPlus,
-    ReactiveEnergyMinus
+    ReactiveEnergyMinus,
+
+    CodeTypeCount // Number of code types, used to size lookup tables
 };
 
-enum Accuracy
+static const char *const CODE_TYPE_NAMES[] = // Names used in reports, indexed by CodeType
 {
-    SingleDigit = 0xFF,
-    DoubleDigit = 0xFE
+    "unknown",
+    "timestamp",
+    "serial_number",
+    "device_name",
+    "voltage_l1",
+    "voltage_l2",
+    "voltage_l3",
+    "current_l1",
+    "current_l2",
+    "current_l3",
+    "active_power_plus",
+    "active_power_minus",
+    "active_energy_plus",
+    "active_energy_minus",
+    "reactive_energy_plus",
+    "reactive_energy_minus"
 };
 
+static_assert(sizeof(CODE_TYPE_NAMES) / sizeof(CODE_TYPE_NAMES[0]) == CodeType::CodeTypeCount, "CODE_TYPE_NAMES must name every CodeType");
+
 /*
- * Data structure
+ * Channels compiled into the firmware
+ *
+ * ESPDM_CHANNELS is a mask of ESPDM_CHANNEL() bits, e.g. -DESPDM_CHANNELS="ESPDM_CHANNEL(ActivePowerPlus)|ESPDM_CHANNEL(ActivePowerMinus)".
+ * Codes of disabled channels are still recognized but ignored like the serial number. Readings, sensors,
+ * publish policies and aggregation windows only have room for the enabled values, see channel_slot().
  */
 
-static const int DECODER_START_OFFSET = 20; // Offset for start of OBIS decoding, skip header, timestamp and break block
+#define ESPDM_CHANNEL(type) (1UL << CodeType::type)
+
+#ifndef ESPDM_CHANNELS
+#define ESPDM_CHANNELS 0xFFFFFFFFUL // All channels
+#endif
+
+static constexpr uint32_t ENABLED_CHANNELS = (ESPDM_CHANNELS) & ((1UL << CodeType::CodeTypeCount) - 1) & ~ESPDM_CHANNEL(Unknown);
+static constexpr uint32_t ENABLED_VALUE_CHANNELS = ENABLED_CHANNELS & ~((1UL << CodeType::VoltageL1) - 1); // Numeric values, without timestamp and metadata
+static constexpr size_t VALUE_SLOT_COUNT = __builtin_popcountl(ENABLED_VALUE_CHANNELS) > 0 ? __builtin_popcountl(ENABLED_VALUE_CHANNELS) : 1; // Size of per value arrays, never 0
+
+static constexpr bool channel_enabled(CodeType type)
+{
+    return ENABLED_CHANNELS & (1UL << type);
+}
+
+static constexpr bool value_channel_enabled(CodeType type) // Enabled numeric value, has a slot
+{
+    return ENABLED_VALUE_CHANNELS & (1UL << type);
+}
+
+static constexpr size_t channel_slot(CodeType type) // Index of an enabled value in per value arrays
+{
+    return __builtin_popcountl(ENABLED_VALUE_CHANNELS & ((1UL << type) - 1));
+}
+
+enum ObisHandler
+{
+    IgnoreValue, // Value is known but not exposed
+    NumericValue, // Value is published to the sensor of its code type
+    TimestampValue // Value is a date-time octet string published to the timestamp text sensor
+};
 
-static const int OBIS_TYPE_OFFSET = 0;
-static const int OBIS_LENGTH_OFFSET = 1;
+/*
+ * Data structure
+ */
 
-static const int OBIS_CODE_OFFSET = 2;
+static const int DECODER_START_OFFSET = 18; // Offset for start of OBIS decoding, skip header and timestamp
 
 static const int OBIS_A = 0;
 static const int OBIS_B = 1;
@@ -85,98 +143,127 @@ static const int OBIS_E = 4;
 static const int OBIS_F = 5;
 
 /*
- * Metadata
+ * Registry of supported OBIS codes
+ *
+ * Every entry maps a full OBIS code (A-F) to its code type, a handler and the decimal scaler used when
+ * the telegram does not carry one. Lookups go through a perfect hash built from the rows at compile time.
+ * Adding support for a new value only requires a new row here and a new CodeType.
  */
 
-static uint8_t ESPDM_TIMESTAMP[]
+struct ObisEntry
 {
-    0x01, 0x00
+    uint64_t key; // OBIS code A-F packed into an integer, see obis_key()
+    CodeType type;
+    ObisHandler handler;
+    int8_t scaler;
 };
 
-static const uint8_t ESPDM_SERIAL_NUMBER[]
+static constexpr uint64_t obis_key(uint8_t a, uint8_t b, uint8_t c, uint8_t d, uint8_t e, uint8_t f)
 {
-    0x60, 0x01
-};
+    return ((uint64_t) a << 40) | ((uint64_t) b << 32) | ((uint64_t) c << 24) | ((uint64_t) d << 16) | ((uint64_t) e << 8) | f;
+}
 
-static const uint8_t ESPDM_DEVICE_NAME[]
+static inline uint64_t obis_key(const uint8_t *code)
 {
-    0x2A, 0x00
-};
-
-/*
- * Voltage
- */
+    return obis_key(code[OBIS_A], code[OBIS_B], code[OBIS_C], code[OBIS_D], code[OBIS_E], code[OBIS_F]);
+}
 
-static uint8_t ESPDM_VOLTAGE_L1[]
+static constexpr ObisEntry obis_entry(uint64_t key, CodeType type, ObisHandler handler, int8_t scaler)
 {
-    0x20, 0x07
-};
+    return { key, type, channel_enabled(type) ? handler : ObisHandler::IgnoreValue, scaler }; // Disabled channels are never converted or published
+}
 
-static const uint8_t ESPDM_VOLTAGE_L2[]
+static constexpr ObisEntry OBIS_REGISTRY[]
 {
-    0x34, 0x07
-};
+    // Metadata
+    obis_entry(obis_key(Medium::Abstract, 0x00, 0x01, 0x00, 0x00, 0xFF), CodeType::Timestamp, ObisHandler::TimestampValue, 0),
+    obis_entry(obis_key(Medium::Abstract, 0x00, 0x2A, 0x00, 0x00, 0xFF), CodeType::DeviceName, ObisHandler::IgnoreValue, 0),
+    obis_entry(obis_key(Medium::Abstract, 0x00, 0x60, 0x01, 0x00, 0xFF), CodeType::SerialNumber, ObisHandler::IgnoreValue, 0),
 
-static const uint8_t ESPDM_VOLTAGE_L3[]
-{
-    0x48, 0x07
+    // Power and energy
+    obis_entry(obis_key(Medium::Electricity, 0x00, 0x01, 0x07, 0x00, 0xFF), CodeType::ActivePowerPlus, ObisHandler::NumericValue, 0),
+    obis_entry(obis_key(Medium::Electricity, 0x00, 0x01, 0x08, 0x00, 0xFF), CodeType::ActiveEnergyPlus, ObisHandler::NumericValue, 0),
+    obis_entry(obis_key(Medium::Electricity, 0x00, 0x02, 0x07, 0x00, 0xFF), CodeType::ActivePowerMinus, ObisHandler::NumericValue, 0),
+    obis_entry(obis_key(Medium::Electricity, 0x00, 0x02, 0x08, 0x00, 0xFF), CodeType::ActiveEnergyMinus, ObisHandler::NumericValue, 0),
+    obis_entry(obis_key(Medium::Electricity, 0x00, 0x03, 0x08, 0x00, 0xFF), CodeType::ReactiveEnergyPlus, ObisHandler::NumericValue, 0),
+    obis_entry(obis_key(Medium::Electricity, 0x00, 0x04, 0x08, 0x00, 0xFF), CodeType::ReactiveEnergyMinus, ObisHandler::NumericValue, 0),
+
+    // Current and voltage
+    obis_entry(obis_key(Medium::Electricity, 0x00, 0x1F, 0x07, 0x00, 0xFF), CodeType::CurrentL1, ObisHandler::NumericValue, 0),
+    obis_entry(obis_key(Medium::Electricity, 0x00, 0x20, 0x07, 0x00, 0xFF), CodeType::VoltageL1, ObisHandler::NumericValue, 0),
+    obis_entry(obis_key(Medium::Electricity, 0x00, 0x33, 0x07, 0x00, 0xFF), CodeType::CurrentL2, ObisHandler::NumericValue, 0),
+    obis_entry(obis_key(Medium::Electricity, 0x00, 0x34, 0x07, 0x00, 0xFF), CodeType::VoltageL2, ObisHandler::NumericValue, 0),
+    obis_entry(obis_key(Medium::Electricity, 0x00, 0x47, 0x07, 0x00, 0xFF), CodeType::CurrentL3, ObisHandler::NumericValue, 0),
+    obis_entry(obis_key(Medium::Electricity, 0x00, 0x48, 0x07, 0x00, 0xFF), CodeType::VoltageL3, ObisHandler::NumericValue, 0)
 };
 
+static const size_t OBIS_REGISTRY_SIZE = sizeof(OBIS_REGISTRY) / sizeof(OBIS_REGISTRY[0]);
+
 /*
- * Current
+ * Perfect hash over C and D of the registry
+ *
+ * C and D tell every supported code apart, so a lookup is one table read and one compare of the
+ * full code. The multiplier is searched at compile time, a new row that collides with all multipliers
+ * stops the build and needs a bigger table.
  */
 
-static const uint8_t ESPDM_CURRENT_L1[]
-{
-    0x1F, 0x07
-};
+static const size_t OBIS_HASH_SIZE = 32; // Power of two
 
-static const uint8_t ESPDM_CURRENT_L2[]
+static constexpr size_t obis_hash(uint8_t c, uint8_t d, uint8_t multiplier)
 {
-    0x33, 0x07
-};
+    return (size_t) (c * multiplier + d) & (OBIS_HASH_SIZE - 1);
+}
 
-static const uint8_t ESPDM_CURRENT_L3[]
+static constexpr size_t obis_entry_hash(size_t index, uint8_t multiplier)
 {
-    0x47, 0x07
-};
+    return obis_hash((uint8_t) (OBIS_REGISTRY[index].key >> 24), (uint8_t) (OBIS_REGISTRY[index].key >> 16), multiplier);
+}
 
-/*
- * Power
- */
+static constexpr bool obis_hash_collides(size_t first, size_t second, uint8_t multiplier) // Whether any pair from first on collides
+{
+    return first >= OBIS_REGISTRY_SIZE ? false :
+        second >= OBIS_REGISTRY_SIZE ? obis_hash_collides(first + 1, first + 2, multiplier) :
+        obis_entry_hash(first, multiplier) == obis_entry_hash(second, multiplier) || obis_hash_collides(first, second + 1, multiplier);
+}
 
-static const uint8_t ESPDM_ACTIVE_POWER_PLUS[]
+static constexpr uint8_t obis_hash_multiplier(unsigned multiplier) // 0 if no multiplier works
 {
-    0x01, 0x07
-};
+    return multiplier > 0xFF ? 0 : !obis_hash_collides(0, 1, multiplier) ? multiplier : obis_hash_multiplier(multiplier + 1);
+}
+
+static constexpr uint8_t OBIS_HASH_MULTIPLIER = obis_hash_multiplier(1);
+
+static_assert(OBIS_HASH_MULTIPLIER != 0, "OBIS_REGISTRY needs a bigger OBIS_HASH_SIZE");
 
-static const uint8_t ESPDM_ACTIVE_POWER_MINUS[]
+static constexpr uint8_t obis_hash_slot(size_t hash, size_t index) // Registry index with this hash, OBIS_REGISTRY_SIZE for none
 {
-    0x02, 0x07
-};
+    return index >= OBIS_REGISTRY_SIZE || obis_entry_hash(index, OBIS_HASH_MULTIPLIER) == hash ? index : obis_hash_slot(hash, index + 1);
+}
 
-/*
- * Active energy
- */
+template<size_t... I> struct ObisIndexList {};
+template<size_t N, size_t... I> struct ObisIndexRange : ObisIndexRange<N - 1, N - 1, I...> {};
+template<size_t... I> struct ObisIndexRange<0, I...> { typedef ObisIndexList<I...> type; };
 
-static const uint8_t ESPDM_ACTIVE_ENERGY_PLUS[]
+struct ObisHashTable
 {
-    0x01, 0x08
+    uint8_t slots[OBIS_HASH_SIZE];
 };
-static const uint8_t ESPDM_ACTIVE_ENERGY_MINUS[]
+
+template<size_t... I> static constexpr ObisHashTable obis_hash_table(ObisIndexList<I...>)
 {
-    0x02, 0x08
-};
+    return { { obis_hash_slot(I, 0)... } };
+}
 
-/*
- * Reactive energy
- */
+static constexpr ObisHashTable OBIS_HASH_TABLE = obis_hash_table(ObisIndexRange<OBIS_HASH_SIZE>::type());
 
-static const uint8_t ESPDM_REACTIVE_ENERGY_PLUS[]
-{
-    0x03, 0x08
-};
-static const uint8_t ESPDM_REACTIVE_ENERGY_MINUS[]
+static_assert(OBIS_REGISTRY_SIZE < 0xFF, "OBIS_HASH_TABLE stores registry indices in a byte");
+
+static inline const ObisEntry *find_obis_entry(const uint8_t *code) // Returns NULL for unsupported codes
 {
-    0x04, 0x08
-};
+    size_t slot = OBIS_HASH_TABLE.slots[obis_hash(code[OBIS_C], code[OBIS_D], OBIS_HASH_MULTIPLIER)];
+
+    if(slot < OBIS_REGISTRY_SIZE && OBIS_REGISTRY[slot].key == obis_key(code))
+        return &OBIS_REGISTRY[slot];
+
+    return NULL;
+}
@@ -0,0 +1,59 @@
+#include "espdm_pipeline.h"
+
+namespace esphome
+{
+    namespace espdm
+    {
+        QueueingListener::QueueingListener(TelegramQueue &queue, Clock &clock) : queue(queue), clock(clock) {}
+
+        void QueueingListener::on_value(const ObisValue &value, const ObisEntry *entry)
+        {
+            if(entry == NULL)
+                return;
+
+            if(entry->handler == ObisHandler::NumericValue && value.numeric)
+                this->event.reading.set(entry->type, numeric_value(value, entry), value_decimals(value, entry));
+            else if(entry->handler == ObisHandler::TimestampValue)
+                format_timestamp(value, this->event.reading.timestamp, sizeof(this->event.reading.timestamp));
+        }
+
+        void QueueingListener::on_telegram(const TelegramInfo &info)
+        {
+            this->event.frameCounter = info.frameCounter;
+            this->event.accepted = true;
+
+            push();
+        }
+
+        void QueueingListener::on_error(TelegramError error)
+        {
+            this->event.reading.clear(); // Values of a rejected telegram are never reported
+            this->event.frameCounter = 0;
+            this->event.accepted = false;
+            this->event.error = error;
+
+            push();
+        }
+
+        uint32_t QueueingListener::get_dropped() const
+        {
+            return this->dropped.load(std::memory_order_relaxed);
+        }
+
+        void QueueingListener::push()
+        {
+            this->event.time = this->clock.millis();
+
+            while(!this->queue.push(this->event))
+            {
+                if(!wait_for_space())
+                {
+                    this->dropped.fetch_add(1, std::memory_order_relaxed);
+                    break;
+                }
+            }
+
+            this->event.reading.clear();
+        }
+    }
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstdint>
+#include <atomic>
+#include "espdm_decoder.h"
+#include "espdm_queue.h"
+#include "espdm_report.h"
+
+#ifndef ESPDM_QUEUE_LENGTH
+#define ESPDM_QUEUE_LENGTH 4 // Decoded telegrams waiting for the main loop, must be a power of two
+#endif
+
+namespace esphome
+{
+    namespace espdm
+    {
+        /*
+         * Outcome of one telegram, handed from the decoding task to the main loop
+         */
+        struct TelegramEvent
+        {
+            MeterReading reading; // Values of the telegram, empty if it was rejected
+            uint32_t frameCounter;
+            uint32_t time; // millis() when the telegram was decoded
+            bool accepted; // False if the telegram was rejected, see error
+            TelegramError error;
+        };
+
+        typedef SpscQueue<TelegramEvent, ESPDM_QUEUE_LENGTH> TelegramQueue;
+
+        /*
+         * Listener which collects the values of a telegram and queues it as a single event
+         *
+         * Runs on the decoding task, the main loop pops the events. If the main loop falls behind and
+         * the queue is full, the newest events are dropped unless wait_for_space() makes room.
+         */
+        class QueueingListener : public MeterListener
+        {
+            public:
+                QueueingListener(TelegramQueue &queue, Clock &clock);
+
+                void on_value(const ObisValue &value, const ObisEntry *entry) override;
+                void on_telegram(const TelegramInfo &info) override;
+                void on_error(TelegramError error) override;
+
+                uint32_t get_dropped() const; // Safe to call from the main loop
+
+            protected:
+                virtual bool wait_for_space() { return false; } // Called while the queue is full, return true to retry instead of dropping the event
+
+            private:
+                void push();
+
+                TelegramQueue &queue;
+                Clock &clock;
+                TelegramEvent event; // Event being collected
+                std::atomic<uint32_t> dropped{0}; // Events lost because the queue was full
+        };
+    }
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstdint>
+
+namespace esphome
+{
+    namespace espdm
+    {
+        enum LogLevel
+        {
+            LogError = 1,
+            LogWarning = 2,
+            LogInfo = 3,
+            LogDebug = 4,
+            LogVerbose = 5
+        };
+
+        /*
+         * Time source used by the core, implemented by the ESPHome adapter and the host tools
+         */
+        class Clock
+        {
+            public:
+                virtual uint32_t millis() = 0; // Milliseconds since an arbitrary point, wraps around
+                virtual uint32_t micros() = 0; // Microseconds since an arbitrary point, wraps around
+                virtual uint32_t cycles() = 0; // CPU cycle counter (or the finest tick available), wraps around
+        };
+
+        /*
+         * Log sink used by the core
+         *
+         * Messages are only formatted if enabled() returns true for their level.
+         */
+        class Logger
+        {
+            public:
+                virtual bool enabled(LogLevel level) = 0;
+                virtual void log(LogLevel level, const char *message) = 0;
+        };
+    }
+}
@@ -0,0 +1,102 @@
+#include "espdm_policy.h"
+#include <algorithm>
+#include <cmath>
+
+namespace esphome
+{
+    namespace espdm
+    {
+        SensorGroup sensor_group(CodeType type)
+        {
+            switch(type)
+            {
+                case CodeType::VoltageL1:
+                case CodeType::VoltageL2:
+                case CodeType::VoltageL3:
+                    return GroupVoltage;
+                case CodeType::CurrentL1:
+                case CodeType::CurrentL2:
+                case CodeType::CurrentL3:
+                    return GroupCurrent;
+                case CodeType::ActivePowerPlus:
+                case CodeType::ActivePowerMinus:
+                    return GroupActivePower;
+                case CodeType::ActiveEnergyPlus:
+                case CodeType::ActiveEnergyMinus:
+                    return GroupActiveEnergy;
+                case CodeType::ReactiveEnergyPlus:
+                case CodeType::ReactiveEnergyMinus:
+                    return GroupReactiveEnergy;
+                default:
+                    return SensorGroupCount;
+            }
+        }
+
+        PublishFilter::PublishFilter(const PublishPolicy *policies) : policies(policies) {}
+
+        bool PublishFilter::check(CodeType type, float value, uint32_t now) const
+        {
+            SensorGroup group = sensor_group(type);
+
+            if(group == SensorGroupCount || !value_channel_enabled(type))
+                return true;
+
+            const PublishState &state = this->states[channel_slot(type)];
+
+            if(!state.published || std::isnan(state.value))
+                return true;
+
+            const PublishPolicy &policy = this->policies[group];
+            uint32_t elapsed = now - state.time;
+            bool changed = value != state.value;
+
+            if(policy.onChangeOnly)
+                return changed && elapsed >= policy.minInterval;
+
+            if(policy.maxInterval > 0 && elapsed >= policy.maxInterval) // Heartbeat
+                return true;
+
+            if(!changed || elapsed < policy.minInterval)
+                return false;
+
+            float threshold = std::max(policy.absoluteDeadband, policy.relativeDeadband * std::fabs(state.value));
+
+            return std::fabs(value - state.value) > threshold;
+        }
+
+        void PublishFilter::commit(CodeType type, float value, uint32_t now)
+        {
+            if(!value_channel_enabled(type))
+                return;
+
+            PublishState &state = this->states[channel_slot(type)];
+
+            state.value = value;
+            state.time = now;
+            state.published = true;
+        }
+
+        bool PublishFilter::filter(CodeType type, float value, uint32_t now)
+        {
+            if(!check(type, value, now))
+            {
+                this->suppressed++;
+                return false;
+            }
+
+            commit(type, value, now);
+
+            return true;
+        }
+
+        void PublishFilter::count_suppressed()
+        {
+            this->suppressed++;
+        }
+
+        uint32_t PublishFilter::get_suppressed() const
+        {
+            return this->suppressed;
+        }
+    }
+}
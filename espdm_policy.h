@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include "espdm_obis.h"
+
+namespace esphome
+{
+    namespace espdm
+    {
+        enum SensorGroup
+        {
+            GroupVoltage,
+            GroupCurrent,
+            GroupActivePower,
+            GroupActiveEnergy,
+            GroupReactiveEnergy,
+
+            SensorGroupCount // Number of groups, also returned for codes without a group
+        };
+
+        SensorGroup sensor_group(CodeType type); // Group a code type belongs to, SensorGroupCount for metadata like the timestamp
+
+        /*
+         * Decides when a changed value is worth publishing
+         *
+         * The default publishes every change, like a plain comparison with the last state.
+         */
+        struct PublishPolicy
+        {
+            float absoluteDeadband = 0; // Changes up to this amount are suppressed
+            float relativeDeadband = 0; // Changes up to this fraction of the last published value are suppressed
+            uint32_t minInterval = 0; // Minimum time between two publishes in ms
+            uint32_t maxInterval = 0; // Publish at least this often in ms even without a change (heartbeat), 0 to disable
+            bool onChangeOnly = false; // Publish every change regardless of the deadbands but never without one, for energy counters
+        };
+
+        /*
+         * Applies the publish policy of each group to the values of a telegram
+         *
+         * Keeps the last published value and time per code type. For the sensors every value is checked
+         * on its own, for the grouped report the whole reading is published if any of its values is due.
+         */
+        class PublishFilter
+        {
+            public:
+                PublishFilter(const PublishPolicy *policies); // One policy per SensorGroup, owned by the caller
+
+                bool check(CodeType type, float value, uint32_t now) const; // True if the value is due, does not change any state
+                void commit(CodeType type, float value, uint32_t now); // Remember a value as published
+
+                bool filter(CodeType type, float value, uint32_t now); // check() and commit(), counts suppressed values
+
+                void count_suppressed();
+                uint32_t get_suppressed() const;
+
+            private:
+                struct PublishState
+                {
+                    float value; // Last published value
+                    uint32_t time; // Time of the last publish
+                    bool published = false;
+                };
+
+                const PublishPolicy *policies;
+                PublishState states[VALUE_SLOT_COUNT]; // Indexed by channel_slot()
+                uint32_t suppressed = 0; // Publishes suppressed by the policy
+        };
+    }
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+
+namespace esphome
+{
+    namespace espdm
+    {
+        /*
+         * Wait-free single producer, single consumer queue of Length items
+         *
+         * push() may only be called from one thread and pop() from one other thread. Neither blocks or
+         * allocates, a full queue makes push() fail. head and tail run freely and wrap around, Length
+         * has to be a power of two so the slot index stays correct across the wrap.
+         */
+        template<typename T, size_t Length>
+        class SpscQueue
+        {
+            static_assert(Length >= 2 && (Length & (Length - 1)) == 0, "SpscQueue length must be a power of two");
+
+            public:
+                bool push(const T &item) // Producer only, false if the queue is full
+                {
+                    size_t tail = this->tail.load(std::memory_order_relaxed);
+
+                    if(tail - this->head.load(std::memory_order_acquire) == Length)
+                        return false;
+
+                    this->items[tail & (Length - 1)] = item;
+                    this->tail.store(tail + 1, std::memory_order_release); // Publishes the item to the consumer
+
+                    return true;
+                }
+
+                bool pop(T &item) // Consumer only, false if the queue is empty
+                {
+                    size_t head = this->head.load(std::memory_order_relaxed);
+
+                    if(head == this->tail.load(std::memory_order_acquire))
+                        return false;
+
+                    item = this->items[head & (Length - 1)];
+                    this->head.store(head + 1, std::memory_order_release); // Hands the slot back to the producer
+
+                    return true;
+                }
+
+                bool empty() const
+                {
+                    return this->head.load(std::memory_order_acquire) == this->tail.load(std::memory_order_acquire);
+                }
+
+            private:
+                T items[Length];
+                std::atomic<size_t> head{0}; // Next item to pop, only written by the consumer
+                std::atomic<size_t> tail{0}; // Next slot to push to, only written by the producer
+        };
+    }
+}
@@ -0,0 +1,323 @@
+#include "espdm_report.h"
+#include <cinttypes>
+#include <cmath>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+
+static const uint8_t CBOR_UNSIGNED = 0;
+static const uint8_t CBOR_TEXT = 3;
+static const uint8_t CBOR_ARRAY = 4;
+static const uint8_t CBOR_MAP_INDEFINITE = 0xBF;
+static const uint8_t CBOR_BREAK = 0xFF;
+static const uint8_t CBOR_FLOAT32 = 0xFA;
+
+namespace esphome
+{
+    namespace espdm
+    {
+        uint8_t value_decimals(const ObisValue &value, const ObisEntry *entry)
+        {
+            int8_t scaler = value.hasScaler || entry == NULL ? value.scaler : entry->scaler;
+
+            return scaler < 0 ? -scaler : 0;
+        }
+
+        ReportWriter::ReportWriter(ReportFormat format, uint8_t *buffer, size_t size) : format(format), buffer(buffer), size(size)
+        {
+            if(this->format == ReportJson)
+                append("{", 1);
+            else
+                append(&CBOR_MAP_INDEFINITE, 1);
+        }
+
+        void ReportWriter::add_reading(const MeterReading &reading, uint32_t fields)
+        {
+            for(int i = CodeType::VoltageL1; i < CodeType::CodeTypeCount; i++)
+            {
+                if(!(fields & (1UL << i)) || !reading.has((CodeType) i))
+                    continue;
+
+                key(CODE_TYPE_NAMES[i], i);
+                write_float(reading.get((CodeType) i), reading.get_decimals((CodeType) i));
+            }
+
+            if((fields & (1UL << CodeType::Timestamp)) && reading.timestamp[0] != '\0')
+            {
+                key(CODE_TYPE_NAMES[CodeType::Timestamp], CodeType::Timestamp);
+                write_text(reading.timestamp);
+            }
+        }
+
+        void ReportWriter::add_aggregate(const WindowAggregator &window, uint32_t fields)
+        {
+            key("window", REPORT_KEY_WINDOW);
+            write_uint(window.get_length() / 1000);
+            key("samples", REPORT_KEY_SAMPLES);
+            write_uint(window.get_samples());
+
+            if((fields & (1UL << CodeType::Timestamp)) && window.get_timestamp()[0] != '\0')
+            {
+                key(CODE_TYPE_NAMES[CodeType::Timestamp], CodeType::Timestamp);
+                write_text(window.get_timestamp());
+            }
+
+            for(int i = CodeType::VoltageL1; i < CodeType::CodeTypeCount; i++)
+            {
+                if(!(fields & (1UL << i)) || !window.has((CodeType) i))
+                    continue;
+
+                const ChannelAggregate &channel = window.channel((CodeType) i);
+
+                if(is_counter((CodeType) i))
+                {
+                    begin_values(CODE_TYPE_NAMES[i], i, 2);
+                    value("delta", channel.delta(), channel.decimals);
+                    value("last", channel.last, channel.decimals);
+                }
+                else
+                {
+                    begin_values(CODE_TYPE_NAMES[i], i, 4);
+                    value("min", channel.min, channel.decimals);
+                    value("max", channel.max, channel.decimals);
+                    value("mean", channel.mean(), channel.decimals + 1); // One more decimal than the samples
+                    value("last", channel.last, channel.decimals);
+                }
+
+                if(this->format == ReportJson)
+                    end_map();
+            }
+        }
+
+#if ESPDM_ENABLE_STATS
+        void ReportWriter::add_diagnostics(const PipelineStats &stats)
+        {
+            begin_map("diagnostics", REPORT_KEY_DIAGNOSTICS);
+
+            key("bytes_received", 0);
+            write_uint(stats.bytesReceived);
+            key("frames_accepted", 1);
+            write_uint(stats.framesAccepted);
+            key("telegrams_per_minute", 2);
+            write_uint(stats.telegramsPerMinute);
+
+            begin_map("rejected", 3);
+
+            for(int i = 0; i < TelegramErrorCount; i++)
+            {
+                if(stats.rejected[i] == 0) // Only list reasons that actually happened
+                    continue;
+
+                key(telegram_error_name((TelegramError) i), i);
+                write_uint(stats.rejected[i]);
+            }
+
+            end_map();
+
+            const StageTimer *timers[] = { &stats.framing, &stats.decryption, &stats.decoding, &stats.publishing };
+            const char *timerNames[] = { "framing_us", "decryption_us", "decoding_us", "publishing_us" };
+
+            for(int i = 0; i < 4; i++)
+            {
+                if(this->format == ReportJson)
+                {
+                    key(timerNames[i], 0);
+                    printf("{\"min\":%" PRIu32 ",\"avg\":%" PRIu32 ",\"max\":%" PRIu32 "}", timers[i]->min, timers[i]->average(), timers[i]->max);
+                }
+                else
+                {
+                    write_uint(4 + i);
+                    write_cbor_head(CBOR_ARRAY, 3);
+                    write_uint(timers[i]->min);
+                    write_uint(timers[i]->average());
+                    write_uint(timers[i]->max);
+                }
+            }
+
+            end_map();
+        }
+#endif
+
+        size_t ReportWriter::finish()
+        {
+            if(this->format == ReportJson)
+                append("}", 1);
+            else
+                append(&CBOR_BREAK, 1);
+
+            return this->overflow ? 0 : this->length;
+        }
+
+        void ReportWriter::key(const char *name, uint32_t id)
+        {
+            if(this->format == ReportJson)
+            {
+                printf("%s\"%s\":", this->first ? "" : ",", name);
+                this->first = false;
+            }
+            else
+            {
+                write_uint(id);
+            }
+        }
+
+        void ReportWriter::begin_map(const char *name, uint32_t id)
+        {
+            key(name, id);
+
+            if(this->format == ReportJson)
+            {
+                append("{", 1);
+                this->first = true;
+            }
+            else
+            {
+                append(&CBOR_MAP_INDEFINITE, 1);
+            }
+        }
+
+        void ReportWriter::end_map()
+        {
+            if(this->format == ReportJson)
+            {
+                append("}", 1);
+                this->first = false;
+            }
+            else
+            {
+                append(&CBOR_BREAK, 1);
+            }
+        }
+
+        void ReportWriter::begin_values(const char *name, uint32_t id, size_t count)
+        {
+            if(this->format == ReportJson)
+            {
+                begin_map(name, id);
+            }
+            else
+            {
+                key(name, id);
+                write_cbor_head(CBOR_ARRAY, count);
+            }
+        }
+
+        void ReportWriter::value(const char *name, float value, uint8_t decimals)
+        {
+            if(this->format == ReportJson)
+                key(name, 0);
+
+            write_float(value, decimals);
+        }
+
+        void ReportWriter::write_uint(uint32_t value)
+        {
+            if(this->format == ReportJson)
+                printf("%" PRIu32, value);
+            else
+                write_cbor_head(CBOR_UNSIGNED, value);
+        }
+
+        void ReportWriter::write_float(float value, uint8_t decimals)
+        {
+            if(this->format == ReportJson)
+            {
+                if(std::isfinite(value))
+                    printf("%.*f", decimals, value);
+                else
+                    append("null", 4); // JSON has no NaN or infinity, CBOR does
+            }
+            else
+            {
+                uint32_t bits;
+                memcpy(&bits, &value, sizeof(bits));
+
+                uint8_t encoded[] = { CBOR_FLOAT32, (uint8_t) (bits >> 24), (uint8_t) (bits >> 16), (uint8_t) (bits >> 8), (uint8_t) bits };
+                append(encoded, sizeof(encoded));
+            }
+        }
+
+        void ReportWriter::write_text(const char *text)
+        {
+            if(this->format == ReportJson)
+            {
+                printf("\"%s\"", text); // Only used for the timestamp, nothing to escape
+            }
+            else
+            {
+                size_t textLength = strlen(text);
+
+                write_cbor_head(CBOR_TEXT, textLength);
+                append(text, textLength);
+            }
+        }
+
+        void ReportWriter::write_cbor_head(uint8_t major, uint32_t value)
+        {
+            uint8_t head[5];
+            size_t headLength;
+
+            major <<= 5;
+
+            if(value < 24)
+            {
+                head[0] = major | value;
+                headLength = 1;
+            }
+            else if(value <= 0xFF)
+            {
+                head[0] = major | 24;
+                head[1] = value;
+                headLength = 2;
+            }
+            else if(value <= 0xFFFF)
+            {
+                head[0] = major | 25;
+                head[1] = value >> 8;
+                head[2] = value;
+                headLength = 3;
+            }
+            else
+            {
+                head[0] = major | 26;
+                head[1] = value >> 24;
+                head[2] = value >> 16;
+                head[3] = value >> 8;
+                head[4] = value;
+                headLength = 5;
+            }
+
+            append(head, headLength);
+        }
+
+        void ReportWriter::append(const void *data, size_t length)
+        {
+            if(this->overflow || length > this->size - this->length)
+            {
+                this->overflow = true;
+                return;
+            }
+
+            memcpy(&this->buffer[this->length], data, length);
+            this->length += length;
+        }
+
+        void ReportWriter::printf(const char *format, ...)
+        {
+            if(this->overflow)
+                return;
+
+            size_t available = this->size - this->length;
+
+            va_list args;
+            va_start(args, format);
+            int written = vsnprintf((char *) &this->buffer[this->length], available, format, args);
+            va_end(args);
+
+            if(written < 0 || (size_t) written >= available) // vsnprintf needs room for the terminator as well
+                this->overflow = true;
+            else
+                this->length += written;
+        }
+    }
+}
@@ -0,0 +1,156 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include "espdm_aggregate.h"
+#include "espdm_decoder.h"
+
+#ifndef ESPDM_REPORT_BUFFER_SIZE
+#define ESPDM_REPORT_BUFFER_SIZE 768 // Size of the buffer the MQTT report is written to, enough for all values and diagnostics as JSON
+#endif
+
+static const uint32_t REPORT_KEY_DIAGNOSTICS = 32; // CBOR key of the diagnostics map, values use their CodeType as key
+static const uint32_t REPORT_KEY_WINDOW = 33; // CBOR key of the window length in seconds
+static const uint32_t REPORT_KEY_SAMPLES = 34; // CBOR key of the number of readings in a window
+
+static_assert(CodeType::CodeTypeCount <= 32, "MeterReading uses a 32 bit mask for its values");
+
+namespace esphome
+{
+    namespace espdm
+    {
+        enum ReportFormat
+        {
+            ReportJson, // Compact JSON object with the same keys as before
+            ReportCbor // CBOR map with fixed integer keys, see ReportWriter
+        };
+
+        /*
+         * Values of one telegram as they are reported
+         */
+        struct MeterReading
+        {
+            float values[VALUE_SLOT_COUNT]; // Indexed by channel_slot(), only valid if the bit of the code type is set in present
+            uint8_t decimals[VALUE_SLOT_COUNT]; // Decimals of the value as sent by the meter
+            uint32_t present = 0; // Bit per CodeType
+            char timestamp[21] = ""; // 0000-00-00T00:00:00Z
+
+            void set(CodeType type, float value, uint8_t decimals)
+            {
+                if(!value_channel_enabled(type)) // E.g. a stored reading of a build with more channels
+                    return;
+
+                this->values[channel_slot(type)] = value;
+                this->decimals[channel_slot(type)] = decimals;
+                this->present |= 1UL << type;
+            }
+
+            bool has(CodeType type) const
+            {
+                return this->present & (1UL << type);
+            }
+
+            float get(CodeType type) const // Only meaningful if has()
+            {
+                return value_channel_enabled(type) ? this->values[channel_slot(type)] : 0;
+            }
+
+            uint8_t get_decimals(CodeType type) const
+            {
+                return value_channel_enabled(type) ? this->decimals[channel_slot(type)] : 0;
+            }
+
+            void clear()
+            {
+                this->present = 0;
+                this->timestamp[0] = '\0';
+            }
+        };
+
+        /*
+         * Sensor states of accepted telegrams that were not published yet
+         *
+         * A telegram is staged as a whole once it was decoded completely, so the sensors never see a
+         * part of a telegram. dirty has a bit per CodeType until its state was published. If another
+         * telegram is staged before all states went out, its values replace the older ones.
+         */
+        struct TelegramSnapshot
+        {
+            MeterReading reading; // Latest value of every channel, only valid where reading.has()
+            uint32_t dirty = 0; // Bit per CodeType, including the timestamp
+
+            void stage(const MeterReading &telegram, uint32_t fields) // Only the CodeType bits in fields are kept
+            {
+                for(int i = 0; i < CodeType::CodeTypeCount; i++)
+                {
+                    if((fields & (1UL << i)) && telegram.has((CodeType) i))
+                        this->reading.set((CodeType) i, telegram.get((CodeType) i), telegram.get_decimals((CodeType) i));
+                }
+
+                this->dirty |= telegram.present & fields;
+
+                if((fields & (1UL << CodeType::Timestamp)) && telegram.timestamp[0] != '\0')
+                {
+                    memcpy(this->reading.timestamp, telegram.timestamp, sizeof(this->reading.timestamp));
+                    this->dirty |= 1UL << CodeType::Timestamp;
+                }
+            }
+
+            CodeType take() // Next dirty CodeType, its bit is cleared, only call while dirty is not 0
+            {
+                int type = __builtin_ctz(this->dirty);
+                this->dirty &= this->dirty - 1;
+
+                return (CodeType) type;
+            }
+        };
+
+        uint8_t value_decimals(const ObisValue &value, const ObisEntry *entry); // Number of decimals implied by the scaler of a value
+
+        /*
+         * Writes a report into a fixed buffer, nothing is allocated
+         *
+         * JSON uses the names from CODE_TYPE_NAMES as keys. CBOR uses an indefinite length map with the
+         * CodeType as key, the timestamp as text and all other values as float32. Diagnostics are a
+         * nested map under REPORT_KEY_DIAGNOSTICS with the keys 0 bytes received, 1 frames accepted,
+         * 2 telegrams per minute, 3 rejected (map of TelegramError to count) and 4-7 framing, decryption,
+         * decoding and publishing time as [min, avg, max] in microseconds.
+         *
+         * Aggregates contain the window length and sample count, then an object per value with min,
+         * max, mean and last (CBOR: an array in this order) or for energy counters delta and last.
+         */
+        class ReportWriter
+        {
+            public:
+                ReportWriter(ReportFormat format, uint8_t *buffer, size_t size);
+
+                void add_reading(const MeterReading &reading, uint32_t fields); // Only values which are present and selected in fields are written
+                void add_aggregate(const WindowAggregator &window, uint32_t fields);
+#if ESPDM_ENABLE_STATS
+                void add_diagnostics(const PipelineStats &stats);
+#endif
+                size_t finish(); // Closes the report, returns its length or 0 if the buffer was too small
+
+            private:
+                void key(const char *name, uint32_t id);
+                void begin_map(const char *name, uint32_t id);
+                void end_map();
+                void begin_values(const char *name, uint32_t id, size_t count); // JSON object or CBOR array of count values
+                void value(const char *name, float value, uint8_t decimals);
+                void write_uint(uint32_t value);
+                void write_float(float value, uint8_t decimals);
+                void write_text(const char *text);
+                void write_cbor_head(uint8_t major, uint32_t value);
+                void append(const void *data, size_t length);
+                void printf(const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+                ReportFormat format;
+                uint8_t *buffer;
+                size_t size;
+                size_t length = 0;
+                bool overflow = false;
+                bool first = true; // No member written yet in the current JSON object
+        };
+    }
+}
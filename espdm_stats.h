@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstdint>
+
+#ifndef ESPDM_ENABLE_STATS
+#define ESPDM_ENABLE_STATS 1 // Set to 0 to compile out all pipeline counters and timers
+#endif
+
+#if ESPDM_ENABLE_STATS
+#define ESPDM_STATS(statement) statement
+#else
+#define ESPDM_STATS(statement)
+#endif
+
+static const uint32_t STATS_RATE_WINDOW = 60000; // Length of the window telegrams per minute are counted in, in ms
+
+namespace esphome
+{
+    namespace espdm
+    {
+        /*
+         * Minimum, average and maximum duration of a pipeline stage in microseconds
+         */
+        struct StageTimer
+        {
+            uint32_t count = 0;
+            uint32_t min = 0;
+            uint32_t max = 0;
+            uint64_t total = 0;
+
+            void add(uint32_t duration)
+            {
+                if(this->count == 0 || duration < this->min)
+                    this->min = duration;
+
+                if(duration > this->max)
+                    this->max = duration;
+
+                this->total += duration;
+                this->count++;
+            }
+
+            uint32_t average() const
+            {
+                return this->count > 0 ? this->total / this->count : 0;
+            }
+
+            void reset()
+            {
+                *this = StageTimer();
+            }
+        };
+    }
+}
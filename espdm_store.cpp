@@ -0,0 +1,266 @@
+#include "espdm_store.h"
+#include "espdm_view.h"
+#include <cstring>
+
+static const uint8_t STORE_FILE_MAGIC[] = { 'E', 'D', 'R', 'S' };
+static const int STORE_FILE_HEADER_LENGTH = 16; // Magic, capacity, record size, head, count and reserved bytes
+
+namespace esphome
+{
+    namespace espdm
+    {
+        static void put_uint16(uint8_t *data, uint16_t value)
+        {
+            data[0] = value >> 8;
+            data[1] = value;
+        }
+
+        static void put_uint32(uint8_t *data, uint32_t value)
+        {
+            data[0] = value >> 24;
+            data[1] = value >> 16;
+            data[2] = value >> 8;
+            data[3] = value;
+        }
+
+        void encode_reading(const MeterReading &reading, uint8_t *record)
+        {
+            unsigned year = 2000, month = 0, day = 0, hour = 0, minute = 0, second = 0;
+
+            if(reading.timestamp[0] != '\0')
+                sscanf(reading.timestamp, "%4u-%2u-%2uT%2u:%2u:%2u", &year, &month, &day, &hour, &minute, &second);
+
+            uint32_t packed = ((year - 2000) & 0x3F) << 26 | (month & 0x0F) << 22 | (day & 0x1F) << 17 | (hour & 0x1F) << 12 | (minute & 0x3F) << 6 | (second & 0x3F);
+            uint16_t present = 0;
+            uint32_t decimals = 0;
+
+            put_uint32(&record[0], reading.timestamp[0] != '\0' ? packed : 0);
+
+            for(int i = 0; i < STORE_VALUE_COUNT; i++)
+            {
+                CodeType type = (CodeType) (CodeType::VoltageL1 + i);
+                uint32_t bits = 0;
+
+                if(reading.has(type))
+                {
+                    present |= 1 << i;
+                    float value = reading.get(type);
+
+                    decimals |= (uint32_t) (reading.get_decimals(type) & 0x03) << (2 * i);
+                    memcpy(&bits, &value, sizeof(bits));
+                }
+
+                put_uint32(&record[10 + 4 * i], bits);
+            }
+
+            put_uint16(&record[4], present);
+            put_uint32(&record[6], decimals);
+        }
+
+        void decode_reading(const uint8_t *record, MeterReading &reading)
+        {
+            ByteView view(record, STORE_RECORD_SIZE);
+
+            reading.clear();
+
+            uint32_t packed = view.get_uint32(0);
+            uint16_t present = view.get_uint16(4);
+            uint32_t decimals = view.get_uint32(6);
+
+            if(packed != 0)
+                snprintf(reading.timestamp, sizeof(reading.timestamp), "%04u-%02u-%02uT%02u:%02u:%02uZ", (unsigned) (packed >> 26) + 2000, (unsigned) (packed >> 22) & 0x0F, (unsigned) (packed >> 17) & 0x1F, (unsigned) (packed >> 12) & 0x1F, (unsigned) (packed >> 6) & 0x3F, (unsigned) packed & 0x3F);
+
+            for(int i = 0; i < STORE_VALUE_COUNT; i++)
+            {
+                if(!(present & (1 << i)))
+                    continue;
+
+                uint32_t bits = view.get_uint32(10 + 4 * i);
+                float value;
+                memcpy(&value, &bits, sizeof(value));
+
+                reading.set((CodeType) (CodeType::VoltageL1 + i), value, (decimals >> (2 * i)) & 0x03);
+            }
+        }
+
+#if defined(ESP32) || defined(ESPDM_HOST)
+        FileBacking::FileBacking(const char *path) : path(path) {}
+
+        FileBacking::~FileBacking()
+        {
+            if(this->file != NULL)
+                fclose(this->file);
+        }
+
+        bool FileBacking::open()
+        {
+            if(this->file != NULL)
+                return true;
+
+            this->file = fopen(this->path, "r+b");
+
+            if(this->file == NULL)
+                this->file = fopen(this->path, "w+b");
+
+            return this->file != NULL;
+        }
+
+        bool FileBacking::load(uint8_t *records, size_t capacity, size_t &head, size_t &count)
+        {
+            if(!open())
+                return false;
+
+            uint8_t header[STORE_FILE_HEADER_LENGTH];
+
+            if(fseek(this->file, 0, SEEK_SET) != 0 || fread(header, 1, sizeof(header), this->file) != sizeof(header))
+                return false;
+
+            ByteView view(header, sizeof(header));
+
+            // Records of a different layout or capacity are dropped rather than misread
+            if(memcmp(header, STORE_FILE_MAGIC, sizeof(STORE_FILE_MAGIC)) != 0 || view.get_uint16(4) != capacity || view.get_uint16(6) != STORE_RECORD_SIZE)
+                return false;
+
+            size_t storedHead = view.get_uint16(8);
+            size_t storedCount = view.get_uint16(10);
+
+            if(storedHead >= capacity || storedCount > capacity)
+                return false;
+
+            if(fread(records, STORE_RECORD_SIZE, capacity, this->file) != capacity)
+                return false;
+
+            head = storedHead;
+            count = storedCount;
+
+            return true;
+        }
+
+        bool FileBacking::save_record(size_t slot, const uint8_t *record)
+        {
+            if(this->file == NULL || fseek(this->file, STORE_FILE_HEADER_LENGTH + slot * STORE_RECORD_SIZE, SEEK_SET) != 0)
+                return false;
+
+            return fwrite(record, STORE_RECORD_SIZE, 1, this->file) == 1 && fflush(this->file) == 0;
+        }
+
+        bool FileBacking::save_state(size_t head, size_t count)
+        {
+            uint8_t header[STORE_FILE_HEADER_LENGTH] = {};
+
+            memcpy(header, STORE_FILE_MAGIC, sizeof(STORE_FILE_MAGIC));
+            put_uint16(&header[4], ESPDM_STORE_CAPACITY);
+            put_uint16(&header[6], STORE_RECORD_SIZE);
+            put_uint16(&header[8], head);
+            put_uint16(&header[10], count);
+
+            if(this->file == NULL || fseek(this->file, 0, SEEK_SET) != 0)
+                return false;
+
+            return fwrite(header, sizeof(header), 1, this->file) == 1 && fflush(this->file) == 0;
+        }
+#endif
+
+        void ReadingStore::set_backing(StoreBacking *backing)
+        {
+            this->backing = backing;
+
+            if(backing == NULL)
+                return;
+
+            if(!backing->load(&this->records[0][0], ESPDM_STORE_CAPACITY, this->head, this->count))
+            {
+                // Start over with an empty store and make sure the backing is fully sized
+                this->head = 0;
+                this->count = 0;
+
+                memset(this->records, 0, sizeof(this->records));
+
+                for(size_t i = 0; i < ESPDM_STORE_CAPACITY; i++)
+                    backing->save_record(i, this->records[i]);
+
+                backing->save_state(this->head, this->count);
+            }
+
+            this->unsavedChanges = 0;
+        }
+
+        void ReadingStore::push(const MeterReading &reading)
+        {
+            size_t slot = (this->head + this->count) % ESPDM_STORE_CAPACITY;
+
+            if(this->count == ESPDM_STORE_CAPACITY) // Full, overwrite the oldest reading
+            {
+                this->head = (this->head + 1) % ESPDM_STORE_CAPACITY;
+                this->dropped++;
+            }
+            else
+            {
+                this->count++;
+            }
+
+            encode_reading(reading, this->records[slot]);
+
+            if(this->backing != NULL)
+            {
+                this->backing->save_record(slot, this->records[slot]);
+                save_state(1);
+            }
+        }
+
+        size_t ReadingStore::flush(ReadingSink &sink, uint32_t now)
+        {
+            if(this->count == 0 || now - this->lastFlush < ESPDM_STORE_FLUSH_INTERVAL)
+                return 0;
+
+            this->lastFlush = now;
+
+            size_t delivered = 0;
+            MeterReading reading;
+
+            while(this->count > 0 && delivered < ESPDM_STORE_FLUSH_BATCH)
+            {
+                decode_reading(this->records[this->head], reading);
+
+                if(!sink.publish_reading(reading)) // Keep the reading and retry with the next flush
+                    break;
+
+                this->head = (this->head + 1) % ESPDM_STORE_CAPACITY;
+                this->count--;
+                delivered++;
+            }
+
+            if(delivered > 0 && this->backing != NULL)
+                save_state(delivered);
+
+            return delivered;
+        }
+
+        void ReadingStore::save_state(size_t changes)
+        {
+            this->unsavedChanges += changes;
+
+            // An empty store is saved right away, otherwise everything delivered would come back after a restart
+            if(this->unsavedChanges < ESPDM_STORE_STATE_INTERVAL && this->count > 0)
+                return;
+
+            this->backing->save_state(this->head, this->count);
+            this->unsavedChanges = 0;
+        }
+
+        size_t ReadingStore::size() const
+        {
+            return this->count;
+        }
+
+        bool ReadingStore::empty() const
+        {
+            return this->count == 0;
+        }
+
+        uint32_t ReadingStore::get_dropped() const
+        {
+            return this->dropped;
+        }
+    }
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstdio>
+#include "espdm_report.h"
+
+#ifndef ESPDM_STORE_CAPACITY
+#define ESPDM_STORE_CAPACITY 64 // Readings kept while MQTT is disconnected, STORE_RECORD_SIZE bytes each
+#endif
+
+#ifndef ESPDM_STORE_FLUSH_BATCH
+#define ESPDM_STORE_FLUSH_BATCH 4 // Readings published per flush
+#endif
+
+#ifndef ESPDM_STORE_FLUSH_INTERVAL
+#define ESPDM_STORE_FLUSH_INTERVAL 250 // Minimum time between two flushes in ms
+#endif
+
+#ifndef ESPDM_STORE_STATE_INTERVAL
+#define ESPDM_STORE_STATE_INTERVAL 8 // Readings stored or delivered before head and count are saved to the backing again
+#endif
+
+static const int STORE_VALUE_COUNT = CodeType::CodeTypeCount - CodeType::VoltageL1; // Numeric values kept per reading
+static const int STORE_RECORD_SIZE = 4 + 2 + 4 + 4 * STORE_VALUE_COUNT; // Timestamp, present mask, decimals and values
+
+namespace esphome
+{
+    namespace espdm
+    {
+        /*
+         * Compact binary record of a reading (big endian)
+         *
+         * 4 bytes meter timestamp packed as (year - 2000) << 26 | month << 22 | day << 17 | hour << 12 | minute << 6 | second,
+         * 2 bytes mask of the values present (bit 0 is VoltageL1), 4 bytes decimals (2 bits per value) and a
+         * float32 per value in CodeType order.
+         */
+        void encode_reading(const MeterReading &reading, uint8_t *record);
+        void decode_reading(const uint8_t *record, MeterReading &reading);
+
+        /*
+         * Receives readings when the store is flushed, returns false if the reading could not be delivered
+         */
+        class ReadingSink
+        {
+            public:
+                virtual bool publish_reading(const MeterReading &reading) = 0;
+        };
+
+        /*
+         * Optional persistent copy of the store, e.g. on flash
+         */
+        class StoreBacking
+        {
+            public:
+                virtual ~StoreBacking() {}
+
+                virtual bool load(uint8_t *records, size_t capacity, size_t &head, size_t &count) = 0; // Restores records and state, false if nothing was stored
+                virtual bool save_record(size_t slot, const uint8_t *record) = 0;
+                virtual bool save_state(size_t head, size_t count) = 0;
+        };
+
+#if defined(ESP32) || defined(ESPDM_HOST)
+        /*
+         * Backing in a single file through stdio, on the ESP32 this works on any mounted VFS like LittleFS
+         */
+        class FileBacking : public StoreBacking
+        {
+            public:
+                FileBacking(const char *path);
+                ~FileBacking();
+
+                bool load(uint8_t *records, size_t capacity, size_t &head, size_t &count) override;
+                bool save_record(size_t slot, const uint8_t *record) override;
+                bool save_state(size_t head, size_t count) override;
+
+            private:
+                bool open();
+
+                const char *path;
+                FILE *file = NULL;
+        };
+#endif
+
+        /*
+         * Fixed size ring buffer of readings that could not be published
+         *
+         * When full the oldest reading is overwritten. flush() delivers the oldest readings in small
+         * batches at a bounded rate so a reconnect does not stall the main loop.
+         *
+         * Every reading is written to the backing right away, head and count only every
+         * ESPDM_STORE_STATE_INTERVAL changes and when the store runs empty. On flash this saves a write
+         * per reading, the price is that a restart can lose up to ESPDM_STORE_STATE_INTERVAL - 1 of the
+         * newest readings or deliver as many again.
+         */
+        class ReadingStore
+        {
+            public:
+                void set_backing(StoreBacking *backing); // Restores readings left from before a restart
+
+                void push(const MeterReading &reading);
+                size_t flush(ReadingSink &sink, uint32_t now); // Returns the number of readings delivered
+
+                size_t size() const;
+                bool empty() const;
+                uint32_t get_dropped() const; // Readings overwritten because the store was full
+
+            private:
+                void save_state(size_t changes); // Saves head and count once enough changes piled up
+
+                uint8_t records[ESPDM_STORE_CAPACITY][STORE_RECORD_SIZE];
+                size_t head = 0; // Slot of the oldest reading
+                size_t count = 0;
+
+                StoreBacking *backing = NULL;
+                size_t unsavedChanges = 0; // Pushes and deliveries since head and count were last saved
+                uint32_t lastFlush = 0;
+                uint32_t dropped = 0;
+        };
+    }
+}
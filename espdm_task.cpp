@@ -0,0 +1,95 @@
+#if defined(ESP32) || defined(ESPDM_HOST)
+
+#include "espdm_task.h"
+
+#if defined(ESPDM_HOST)
+#include <chrono>
+#endif
+
+namespace esphome
+{
+    namespace espdm
+    {
+        Task::~Task()
+        {
+            stop();
+        }
+
+        bool Task::start(const char *name, int core, uint32_t stackSize, int priority)
+        {
+            if(this->running)
+                return false;
+
+            this->stopRequested = false;
+            this->running = true;
+
+#if defined(ESP32)
+            if(xTaskCreatePinnedToCore(&Task::entry, name, stackSize, this, priority, NULL, core < 0 ? tskNO_AFFINITY : core) != pdPASS)
+            {
+                this->running = false;
+                return false;
+            }
+#elif defined(ESPDM_HOST)
+            if(this->thread.joinable()) // run() of the previous start already returned
+                this->thread.join();
+
+            this->thread = std::thread([this]()
+            {
+                run();
+                this->running = false;
+            });
+#endif
+
+            return true;
+        }
+
+        void Task::stop()
+        {
+            this->stopRequested = true;
+
+#if defined(ESP32)
+            while(this->running)
+                vTaskDelay(1);
+#elif defined(ESPDM_HOST)
+            if(this->thread.joinable())
+                this->thread.join();
+#endif
+        }
+
+        bool Task::is_running() const
+        {
+            return this->running;
+        }
+
+        bool Task::should_stop() const
+        {
+            return this->stopRequested;
+        }
+
+        void Task::sleep(uint32_t milliseconds)
+        {
+#if defined(ESP32)
+            vTaskDelay(milliseconds / portTICK_PERIOD_MS > 0 ? milliseconds / portTICK_PERIOD_MS : 1);
+#elif defined(ESPDM_HOST)
+            if(milliseconds == 0)
+                std::this_thread::yield();
+            else
+                std::this_thread::sleep_for(std::chrono::milliseconds(milliseconds));
+#endif
+        }
+
+#if defined(ESP32)
+        void Task::entry(void *task)
+        {
+            Task *self = static_cast<Task *>(task);
+
+            self->run();
+            self->running = false;
+
+            vTaskDelete(NULL);
+        }
+#endif
+    }
+}
+
+#endif
@@ -0,0 +1,54 @@
+#pragma once
+
+#if defined(ESP32) || defined(ESPDM_HOST)
+
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+
+#if defined(ESP32)
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#elif defined(ESPDM_HOST)
+#include <thread>
+#endif
+
+namespace esphome
+{
+    namespace espdm
+    {
+        /*
+         * Background task, a FreeRTOS task pinned to a core on the ESP32 and a std::thread on the host
+         *
+         * run() is called once on the new task and should return when should_stop() becomes true.
+         * Derived classes have to call stop() in their destructor, run() must not outlive them.
+         */
+        class Task
+        {
+            public:
+                virtual ~Task();
+
+                bool start(const char *name, int core = -1, uint32_t stackSize = 4096, int priority = 1); // core -1 lets the scheduler decide, ignored on the host
+                void stop(); // Asks run() to return and waits until it did
+                bool is_running() const;
+
+                static void sleep(uint32_t milliseconds); // Gives the CPU to other tasks
+
+            protected:
+                virtual void run() = 0;
+                bool should_stop() const;
+
+            private:
+                std::atomic<bool> stopRequested{false};
+                std::atomic<bool> running{false};
+
+#if defined(ESP32)
+                static void entry(void *task);
+#elif defined(ESPDM_HOST)
+                std::thread thread;
+#endif
+        };
+    }
+}
+
+#endif
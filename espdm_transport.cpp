@@ -0,0 +1,29 @@
+#include "espdm_transport.h"
+
+namespace esphome
+{
+    namespace espdm
+    {
+        Transport::Transport(uint8_t *buffer, size_t size) : data(buffer), size(size) {}
+
+        void Transport::reset()
+        {
+            this->dataLength = 0;
+        }
+
+        bool Transport::empty() const
+        {
+            return at_frame_boundary() && this->dataLength == 0;
+        }
+
+        uint8_t *Transport::payload()
+        {
+            return this->data;
+        }
+
+        size_t Transport::payload_length() const
+        {
+            return this->dataLength;
+        }
+    }
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+namespace esphome
+{
+    namespace espdm
+    {
+        enum TransportType
+        {
+            TransportMbus, // M-Bus long frames, e.g. Kaifa MA309M at 2400 baud
+            TransportHdlc // HDLC frames as per IEC 62056-46, e.g. push meters at 115200 baud
+        };
+
+        enum FrameStatus
+        {
+            FrameNeedMore, // Bytes were consumed, telegram is not complete yet
+            FrameComplete, // Frame was verified, more frames of the telegram follow
+            FrameTelegramComplete, // Last frame of a telegram was received, payload is ready
+            FrameErrorStart, // Unexpected byte where a start byte or flag was expected
+            FrameErrorLength, // Length bytes do not match or are too short for a header
+            FrameErrorChecksum, // Checksum does not match the frame contents
+            FrameErrorStop, // Invalid stop byte or closing flag
+            FrameErrorFormat, // Unsupported frame format, address or LLC header
+            FrameErrorOverflow, // Telegram does not fit into the payload buffer
+            FrameErrorIncomplete // Read timeout hit before the telegram was complete
+        };
+
+        /*
+         * Streaming decoder for the link layer a meter sends its DLMS telegrams with
+         *
+         * Frames are verified as they arrive. The DLMS payload of all frames of one telegram is collected
+         * without link layer headers into a buffer owned by the caller, so the DLMS stage can decrypt it
+         * in place. Nothing is allocated. On an invalid frame the collected telegram is dropped and the
+         * transport resyncs on the next frame.
+         */
+        class Transport
+        {
+            public:
+                Transport(uint8_t *buffer, size_t size);
+                virtual ~Transport() {}
+
+                virtual TransportType type() const = 0;
+                virtual const char *name() const = 0; // Prefix of log messages, e.g. "MBUS"
+
+                // Feeds bytes until a frame completes or fails, consumed is set to the number of bytes used up to
+                // and including that byte. Call again with the rest of the data.
+                virtual FrameStatus feed(const uint8_t *data, size_t length, size_t &consumed) = 0;
+                virtual FrameStatus timeout() = 0; // No bytes arrived for the read timeout, FrameTelegramComplete if the payload should be decoded anyway
+                virtual void idle() {} // No bytes arrived for the read timeout while empty, the next byte starts a new telegram
+
+                virtual void reset(); // Drop the current frame and all frames collected so far
+                virtual bool at_frame_boundary() const = 0; // True if no frame is partially received
+
+                bool empty() const; // True if no frame has been started or collected
+
+                uint8_t *payload(); // Payload can be modified in place, e.g. for decryption
+                size_t payload_length() const;
+
+            protected:
+                uint8_t *data; // Payload of all frames of the current telegram
+                size_t size; // Capacity of data
+                size_t dataLength = 0; // Bytes of payload collected so far
+        };
+    }
+}
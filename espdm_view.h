@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+namespace esphome
+{
+    namespace espdm
+    {
+        /*
+         * Read-only, bounds-checked view into a buffer owned by someone else
+         *
+         * Values are read directly from the underlying buffer in big endian byte order.
+         * Reads outside of the view return 0, use contains() to check before relying on a value.
+         */
+        class ByteView
+        {
+            public:
+                ByteView(const uint8_t *data, size_t length) : data(data), viewLength(length) {}
+
+                size_t length() const { return this->viewLength; }
+
+                bool contains(size_t offset, size_t count) const // True if count bytes starting at offset are inside the view
+                {
+                    return offset <= this->viewLength && count <= this->viewLength - offset;
+                }
+
+                const uint8_t *pointer(size_t offset) const // Pointer into the buffer, only valid if contains() was checked
+                {
+                    return &this->data[offset];
+                }
+
+                uint8_t get_uint8(size_t offset) const
+                {
+                    return contains(offset, 1) ? this->data[offset] : 0;
+                }
+
+                uint16_t get_uint16(size_t offset) const
+                {
+                    if(!contains(offset, 2))
+                        return 0;
+
+                    return ((uint16_t) this->data[offset] << 8) | this->data[offset + 1];
+                }
+
+                uint32_t get_uint32(size_t offset) const
+                {
+                    if(!contains(offset, 4))
+                        return 0;
+
+                    return ((uint32_t) this->data[offset] << 24) | ((uint32_t) this->data[offset + 1] << 16) | ((uint32_t) this->data[offset + 2] << 8) | this->data[offset + 3];
+                }
+
+            private:
+                const uint8_t *data;
+                size_t viewLength;
+        };
+    }
+}
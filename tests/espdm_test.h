@@ -0,0 +1,179 @@
+#pragma once
+
+#if defined(ESPDM_HOST)
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <vector>
+#include "espdm_decoder.h"
+#include "espdm_host.h"
+#include "espdm_telegram.h"
+
+/*
+ * Checks for the host tests, every test is an executable run by ctest that exits with 1 if a check failed
+ */
+
+static int testFailures = 0;
+
+#define CHECK(condition) \
+    do \
+    { \
+        if(!(condition)) \
+        { \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+            testFailures++; \
+        } \
+    } while(0)
+
+#define CHECK_EQUAL(expected, actual) \
+    do \
+    { \
+        unsigned long long expectedValue = (expected), actualValue = (actual); \
+        if(expectedValue != actualValue) \
+        { \
+            fprintf(stderr, "%s:%d: CHECK_EQUAL(%s, %s) failed: %llu != %llu\n", __FILE__, __LINE__, #expected, #actual, expectedValue, actualValue); \
+            testFailures++; \
+        } \
+    } while(0)
+
+namespace esphome
+{
+    namespace espdm
+    {
+        static const uint8_t TEST_KEY[] = { 0x36, 0xC6, 0x66, 0x39, 0xE4, 0x8A, 0x8C, 0xA4, 0xD6, 0xBC, 0x8B, 0x28, 0x2A, 0x79, 0x3B, 0xBB };
+        static const uint8_t TEST_SYSTEM_TITLE[] = { 0x4B, 0x46, 0x4D, 0x10, 0x20, 0x00, 0x12, 0x34 };
+
+        /*
+         * One line of a capture in the timestamped format of espdm_replay
+         */
+        struct CaptureChunk
+        {
+            uint64_t time; // ms
+            Bytes data;
+        };
+
+        inline bool read_capture(const char *path, std::vector<CaptureChunk> &chunks)
+        {
+            FILE *file = fopen(path, "r");
+
+            if(file == NULL)
+            {
+                fprintf(stderr, "%s: Cannot open\n", path);
+                return false;
+            }
+
+            char *line = NULL;
+            size_t capacity = 0;
+            bool ok = true;
+
+            while(getline(&line, &capacity, file) >= 0)
+            {
+                if(line[0] == '#' || line[strspn(line, " \t\r\n")] == '\0')
+                    continue;
+
+                CaptureChunk chunk;
+                char *hex = NULL;
+
+                chunk.time = strtoull(line, &hex, 10);
+                hex[strcspn(hex, "\r\n")] = '\0';
+
+                if(hex == line || !parse_hex(hex, chunk.data))
+                    ok = false;
+                else
+                    chunks.push_back(chunk);
+            }
+
+            free(line);
+            fclose(file);
+
+            return ok && !chunks.empty();
+        }
+
+        /*
+         * Formats every message like a device logger would, without keeping it
+         */
+        class DiscardingLogger : public Logger
+        {
+            public:
+                bool enabled(LogLevel level) override { return true; }
+                void log(LogLevel level, const char *message) override { this->messages++; }
+
+                uint64_t messages = 0;
+        };
+
+        /*
+         * Counts what the decoder reports, also as its raw tap
+         */
+        class CountingListener : public MeterListener, public TelegramTap
+        {
+            public:
+                void on_value(const ObisValue &value, const ObisEntry *entry) override { this->values++; }
+                void on_telegram(const TelegramInfo &info) override { this->telegrams++; this->lastFrameCounter = info.frameCounter; }
+                void on_error(TelegramError error) override { this->errors++; this->lastError = error; }
+                void on_raw_telegram(TapPoint point, const uint8_t *data, size_t length) override { this->tapped++; }
+
+                uint64_t values = 0;
+                uint64_t telegrams = 0;
+                uint64_t errors = 0;
+                uint64_t tapped = 0;
+                uint32_t lastFrameCounter = 0; // Of the last accepted telegram
+                TelegramError lastError = TelegramErrorCount; // TelegramErrorCount until an error was reported
+        };
+
+        /*
+         * Decoder with the test key and a clock that only moves when a stream is fed
+         */
+        struct TestMeter
+        {
+            TestMeter(TransportType transport = TransportMbus, const uint8_t *authenticationKey = NULL) : decoder(crypto, clock, &logger)
+            {
+                this->decoder.set_key(TEST_KEY, sizeof(TEST_KEY));
+                this->decoder.set_authentication_key(authenticationKey);
+                this->decoder.set_transport(transport);
+                this->decoder.set_listener(&this->listener);
+            }
+
+            void enable_tap()
+            {
+                this->decoder.set_tap(&this->listener);
+                this->decoder.set_tap_points(TapEncrypted | TapDecrypted);
+            }
+
+            void feed(const Bytes &stream) // In reads of 1 to 64 bytes as in DlmsMeter::loop(), then the read timeout
+            {
+                for(size_t i = 0, chunk = 1; i < stream.size(); i += chunk, chunk = chunk % 64 + 7)
+                {
+                    this->time += 1000;
+                    this->clock.set_micros(this->time);
+                    this->decoder.feed(stream.data() + i, std::min(chunk, stream.size() - i));
+                }
+
+                this->time += 200000;
+                this->clock.set_micros(this->time);
+                this->decoder.poll();
+            }
+
+            OpensslGcmBackend crypto;
+            ManualClock clock;
+            DiscardingLogger logger;
+            CountingListener listener;
+            MeterDecoder decoder;
+            uint64_t time = 0;
+        };
+
+        inline int test_result(const char *name)
+        {
+            if(testFailures > 0)
+                fprintf(stderr, "%s: %d checks failed\n", name, testFailures);
+            else
+                printf("%s: OK\n", name);
+
+            return testFailures > 0 ? 1 : 0;
+        }
+    }
+}
+
+#endif
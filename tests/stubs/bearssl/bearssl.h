@@ -0,0 +1,44 @@
+#pragma once
+
+#if defined(ESPDM_STUBS)
+
+// Declarations of the BearSSL API used by the ESP8266 crypto backends, only to compile them on the host
+
+#include <cstddef>
+#include <cstdint>
+
+typedef struct br_block_ctr_class_
+{
+    size_t context_size;
+} br_block_ctr_class;
+
+typedef struct
+{
+    const br_block_ctr_class *vtable;
+    unsigned char skey[240];
+} br_aes_ct_ctr_keys;
+
+typedef br_aes_ct_ctr_keys br_aes_small_ctr_keys;
+typedef br_aes_ct_ctr_keys br_aes_ct64_ctr_keys;
+
+typedef void (*br_ghash)(void *y, const void *h, const void *data, size_t len);
+
+typedef struct
+{
+    const void *vtable;
+    unsigned char state[100];
+} br_gcm_context;
+
+void br_aes_ct_ctr_init(br_aes_ct_ctr_keys *ctx, const void *key, size_t len);
+void br_aes_small_ctr_init(br_aes_small_ctr_keys *ctx, const void *key, size_t len);
+void br_aes_ct64_ctr_init(br_aes_ct64_ctr_keys *ctx, const void *key, size_t len);
+void br_ghash_ctmul32(void *y, const void *h, const void *data, size_t len);
+void br_ghash_ctmul64(void *y, const void *h, const void *data, size_t len);
+void br_gcm_init(br_gcm_context *ctx, const br_block_ctr_class **bctx, br_ghash gh);
+void br_gcm_reset(br_gcm_context *ctx, const void *iv, size_t len);
+void br_gcm_aad_inject(br_gcm_context *ctx, const void *data, size_t len);
+void br_gcm_flip(br_gcm_context *ctx);
+void br_gcm_run(br_gcm_context *ctx, int encrypt, void *data, size_t len);
+uint32_t br_gcm_check_tag_trunc(br_gcm_context *ctx, const void *tag, size_t len);
+
+#endif
@@ -0,0 +1,203 @@
+#pragma once
+
+#if defined(ESPDM_STUBS)
+
+/*
+ * Minimal stand-in for the parts of ESPHome the component uses, to build espdm.cpp on the host
+ *
+ * Time is simulated: millis() and micros() only move when a test advances them or a sensor
+ * publishes, the UART hands out the bytes a test queued and MQTT records what was published.
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#define ESPHOME_LOG_LEVEL_NONE 0
+#define ESPHOME_LOG_LEVEL_ERROR 1
+#define ESPHOME_LOG_LEVEL_WARN 2
+#define ESPHOME_LOG_LEVEL_INFO 3
+#define ESPHOME_LOG_LEVEL_CONFIG 4
+#define ESPHOME_LOG_LEVEL_DEBUG 5
+#define ESPHOME_LOG_LEVEL_VERBOSE 6
+#define ESPHOME_LOG_LEVEL_VERY_VERBOSE 7
+
+#ifndef ESPHOME_LOG_LEVEL
+#define ESPHOME_LOG_LEVEL ESPHOME_LOG_LEVEL_DEBUG
+#endif
+
+// Arguments are checked against the format but not evaluated, like with a log level that is compiled out
+#define ESP_LOGE(tag, ...) ((void) sizeof(printf(__VA_ARGS__)))
+#define ESP_LOGW(tag, ...) ((void) sizeof(printf(__VA_ARGS__)))
+#define ESP_LOGI(tag, ...) ((void) sizeof(printf(__VA_ARGS__)))
+#define ESP_LOGD(tag, ...) ((void) sizeof(printf(__VA_ARGS__)))
+#define ESP_LOGV(tag, ...) ((void) sizeof(printf(__VA_ARGS__)))
+
+namespace esphome
+{
+    namespace stubs
+    {
+        inline uint64_t &now() // Simulated time in microseconds
+        {
+            static uint64_t now = 0;
+            return now;
+        }
+
+        inline uint32_t &publish_cost() // Simulated time a sensor state takes to publish in microseconds
+        {
+            static uint32_t cost = 0;
+            return cost;
+        }
+    }
+
+    inline uint32_t millis() { return stubs::now() / 1000; }
+    inline uint32_t micros() { return stubs::now(); }
+    inline void delay(uint32_t ms) { stubs::now() += (uint64_t) ms * 1000; }
+    inline uint32_t arch_get_cpu_cycle_count() { return stubs::now() * 240; } // 240 MHz
+
+    namespace setup_priority
+    {
+        static const float DATA = 600.0f;
+        static const float LATE = -100.0f;
+    }
+
+    class Component
+    {
+        public:
+            virtual ~Component() {}
+
+            virtual void setup() {}
+            virtual void loop() {}
+            virtual void dump_config() {}
+            virtual float get_setup_priority() const { return 0.0f; }
+    };
+
+    namespace uart
+    {
+        class UARTComponent
+        {
+            public:
+                std::deque<uint8_t> received; // Bytes waiting to be read
+                size_t reads = 0;
+                size_t largestRead = 0; // Most bytes taken by a single read_array()
+        };
+
+        class UARTDevice
+        {
+            public:
+                UARTDevice(UARTComponent *parent) : parent_(parent) {}
+
+                int available() { return this->parent_->received.size(); }
+
+                bool read_byte(uint8_t *data) { return read_array(data, 1); }
+
+                bool read_array(uint8_t *data, size_t length)
+                {
+                    if(length > this->parent_->received.size())
+                        return false;
+
+                    for(size_t i = 0; i < length; i++)
+                    {
+                        data[i] = this->parent_->received.front();
+                        this->parent_->received.pop_front();
+                    }
+
+                    this->parent_->reads++;
+                    this->parent_->largestRead = std::max(this->parent_->largestRead, length);
+
+                    return true;
+                }
+
+            protected:
+                UARTComponent *parent_;
+        };
+    }
+
+    namespace sensor
+    {
+        class Sensor
+        {
+            public:
+                void publish_state(float state)
+                {
+                    this->state = state;
+                    this->publishes++;
+                    stubs::now() += stubs::publish_cost();
+                }
+
+                float state = 0;
+                size_t publishes = 0;
+        };
+    }
+
+    namespace text_sensor
+    {
+        class TextSensor
+        {
+            public:
+                void publish_state(const std::string &state)
+                {
+                    this->state = state;
+                    this->publishes++;
+                    stubs::now() += stubs::publish_cost();
+                }
+
+                std::string state;
+                size_t publishes = 0;
+        };
+    }
+
+    namespace mqtt
+    {
+        typedef std::function<void(const std::string &, const std::string &)> mqtt_callback_t;
+
+        class MQTTClientComponent
+        {
+            public:
+                bool is_connected() { return this->connected; }
+
+                bool publish(const std::string &topic, const std::string &payload, uint8_t qos = 0, bool retain = false)
+                {
+                    if(!this->connected)
+                        return false;
+
+                    this->published.push_back(std::make_pair(topic, payload));
+                    return true;
+                }
+
+                bool publish(const std::string &topic, const char *payload, size_t length, uint8_t qos = 0, bool retain = false)
+                {
+                    return publish(topic, std::string(payload, length), qos, retain);
+                }
+
+                void subscribe(const std::string &topic, mqtt_callback_t callback, uint8_t qos = 0)
+                {
+                    this->subscriptions.push_back(std::make_pair(topic, callback));
+                }
+
+                void receive(const std::string &topic, const std::string &payload) // Delivers a message to the subscribers of topic
+                {
+                    for(auto &subscription : this->subscriptions)
+                    {
+                        if(subscription.first == topic)
+                            subscription.second(topic, payload);
+                    }
+                }
+
+                bool connected = true;
+                std::vector<std::pair<std::string, std::string>> published; // Topic and payload
+                std::vector<std::pair<std::string, mqtt_callback_t>> subscriptions;
+        };
+    }
+}
+
+using namespace esphome;
+
+#endif
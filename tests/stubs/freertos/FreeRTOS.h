@@ -0,0 +1,17 @@
+#pragma once
+
+#if defined(ESPDM_STUBS)
+
+// Declarations of the FreeRTOS API used by espdm_task.h, only to compile the ESP32 code on the host
+
+#include <cstdint>
+
+typedef void *TaskHandle_t;
+typedef int BaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdPASS 1
+#define tskNO_AFFINITY 0x7FFFFFFF
+#define portTICK_PERIOD_MS 1
+
+#endif
@@ -0,0 +1,11 @@
+#pragma once
+
+#if defined(ESPDM_STUBS)
+
+#include "FreeRTOS.h"
+
+BaseType_t xTaskCreatePinnedToCore(void (*task)(void *), const char *name, uint32_t stackDepth, void *parameters, int priority, TaskHandle_t *handle, int core);
+void vTaskDelay(TickType_t ticks);
+void vTaskDelete(TaskHandle_t task);
+
+#endif
@@ -0,0 +1,24 @@
+#pragma once
+
+#if defined(ESPDM_STUBS)
+
+// Declarations of the mbedtls GCM API used by the ESP32 crypto backend, only to compile it on the host
+
+#include <cstddef>
+
+typedef struct
+{
+    unsigned char state[400];
+} mbedtls_gcm_context;
+
+#define MBEDTLS_CIPHER_ID_AES 2
+#define MBEDTLS_GCM_DECRYPT 0
+#define MBEDTLS_GCM_ENCRYPT 1
+
+void mbedtls_gcm_init(mbedtls_gcm_context *ctx);
+int mbedtls_gcm_setkey(mbedtls_gcm_context *ctx, int cipher, const unsigned char *key, unsigned int keybits);
+void mbedtls_gcm_free(mbedtls_gcm_context *ctx);
+int mbedtls_gcm_auth_decrypt(mbedtls_gcm_context *ctx, size_t length, const unsigned char *iv, size_t iv_len, const unsigned char *add, size_t add_len, const unsigned char *tag, size_t tag_len, const unsigned char *input, unsigned char *output);
+int mbedtls_gcm_crypt_and_tag(mbedtls_gcm_context *ctx, int mode, size_t length, const unsigned char *iv, size_t iv_len, const unsigned char *add, size_t add_len, const unsigned char *input, unsigned char *output, size_t tag_len, unsigned char *tag);
+
+#endif
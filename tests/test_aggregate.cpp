@@ -0,0 +1,212 @@
+#if defined(ESPDM_HOST)
+
+/*
+ * WindowAggregator: statistics of measurements, deltas of energy counters and window boundaries
+ */
+
+#include "espdm_aggregate.h"
+#include "espdm_report.h"
+#include "espdm_test.h"
+
+using namespace esphome::espdm;
+
+static const uint32_t WINDOW_LENGTH = 60000;
+
+static void add(WindowAggregator &window, uint32_t now, float voltage, float energy)
+{
+    MeterReading reading;
+    reading.set(CodeType::VoltageL1, voltage, 1);
+    reading.set(CodeType::ActiveEnergyPlus, energy, 3);
+
+    window.add(reading, now);
+}
+
+static void test_disabled()
+{
+    WindowAggregator window;
+
+    add(window, 0, 230, 100);
+
+    CHECK_EQUAL(0, window.get_samples());
+    CHECK(!window.due(WINDOW_LENGTH));
+    CHECK(!window.has(CodeType::VoltageL1));
+}
+
+static void test_measurements()
+{
+    WindowAggregator window;
+    window.set_length(WINDOW_LENGTH);
+
+    add(window, 0, 230, 100);
+    add(window, 10000, 228, 100);
+    add(window, 20000, 235, 100);
+    add(window, 30000, 231, 100);
+
+    const ChannelAggregate &voltage = window.channel(CodeType::VoltageL1);
+
+    CHECK_EQUAL(4, window.get_samples());
+    CHECK(window.has(CodeType::VoltageL1));
+    CHECK(!window.has(CodeType::VoltageL2));
+    CHECK(voltage.min == 228);
+    CHECK(voltage.max == 235);
+    CHECK(voltage.mean() == 231);
+    CHECK(voltage.last == 231);
+    CHECK_EQUAL(1, voltage.decimals);
+
+    // The next window starts over
+    window.close(WINDOW_LENGTH);
+    add(window, WINDOW_LENGTH, 240, 100);
+
+    CHECK_EQUAL(1, window.get_samples());
+    CHECK(voltage.min == 240);
+    CHECK(voltage.max == 240);
+    CHECK(voltage.mean() == 240);
+}
+
+static void test_first_sample()
+{
+    WindowAggregator window;
+    window.set_length(WINDOW_LENGTH);
+
+    // Without an earlier reading the first window counts from its first sample
+    add(window, 5000, 230, 1000.5f);
+
+    CHECK(window.channel(CodeType::ActiveEnergyPlus).delta() == 0);
+    CHECK(window.channel(CodeType::ActiveEnergyPlus).last == 1000.5f);
+
+    add(window, 15000, 230, 1001.25f);
+    add(window, 25000, 230, 1003);
+
+    CHECK(window.channel(CodeType::ActiveEnergyPlus).delta() == 2.5f);
+
+    // The next window counts from the last reading of this one
+    window.close(WINDOW_LENGTH + 5000);
+    add(window, WINDOW_LENGTH + 5000, 230, 1004);
+
+    CHECK(window.channel(CodeType::ActiveEnergyPlus).delta() == 1);
+
+    // A counter that shows up later starts from its own first sample
+    MeterReading reading;
+    reading.set(CodeType::ActiveEnergyMinus, 50, 3);
+    window.add(reading, WINDOW_LENGTH + 6000);
+    reading.set(CodeType::ActiveEnergyMinus, 51, 3);
+    window.add(reading, WINDOW_LENGTH + 7000);
+
+    CHECK(window.channel(CodeType::ActiveEnergyMinus).delta() == 1);
+}
+
+static void test_counter_decrease()
+{
+    WindowAggregator window;
+    window.set_length(WINDOW_LENGTH);
+
+    // The meter was replaced during the window, the energy before and after is counted, the gap is lost
+    add(window, 0, 230, 1000);
+    add(window, 10000, 230, 1010);
+    add(window, 20000, 230, 2);
+    add(window, 30000, 230, 5);
+
+    CHECK(window.channel(CodeType::ActiveEnergyPlus).delta() == 13);
+    CHECK(window.channel(CodeType::ActiveEnergyPlus).last == 5);
+
+    // Between two windows
+    window.close(WINDOW_LENGTH);
+    add(window, WINDOW_LENGTH, 230, 1);
+
+    CHECK(window.channel(CodeType::ActiveEnergyPlus).delta() == 0);
+
+    add(window, WINDOW_LENGTH + 10000, 230, 4);
+
+    CHECK(window.channel(CodeType::ActiveEnergyPlus).delta() == 3);
+}
+
+static void test_rollover()
+{
+    WindowAggregator window;
+    window.set_length(WINDOW_LENGTH);
+
+    CHECK(!window.due(WINDOW_LENGTH)); // Never started
+
+    add(window, 1000, 230, 100);
+
+    CHECK(!window.due(WINDOW_LENGTH));
+    CHECK(!window.due(WINDOW_LENGTH + 999));
+    CHECK(window.due(WINDOW_LENGTH + 1000));
+
+    // Closed late, the next window still ends on the original grid
+    window.close(WINDOW_LENGTH + 5000);
+
+    CHECK_EQUAL(0, window.get_samples());
+    CHECK(!window.has(CodeType::VoltageL1));
+    CHECK(!window.due(2 * WINDOW_LENGTH + 1000)); // No samples
+
+    add(window, WINDOW_LENGTH + 6000, 230, 101);
+
+    CHECK(!window.due(2 * WINDOW_LENGTH + 999));
+    CHECK(window.due(2 * WINDOW_LENGTH + 1000));
+
+    // Windows without readings are skipped, not reported empty
+    window.close(2 * WINDOW_LENGTH + 1000);
+    add(window, 5 * WINDOW_LENGTH + 30000, 230, 110);
+
+    CHECK(window.due(5 * WINDOW_LENGTH + 30000));
+    CHECK(window.channel(CodeType::ActiveEnergyPlus).delta() == 9); // Over the gap
+
+    window.close(5 * WINDOW_LENGTH + 30000);
+    add(window, 5 * WINDOW_LENGTH + 40000, 230, 111);
+
+    CHECK(!window.due(6 * WINDOW_LENGTH + 999));
+    CHECK(window.due(6 * WINDOW_LENGTH + 1000));
+}
+
+static void test_time_wraparound()
+{
+    WindowAggregator window;
+    window.set_length(WINDOW_LENGTH);
+
+    // millis() wraps after 49 days
+    add(window, 0xFFFFF000, 230, 100);
+
+    CHECK(!window.due(0xFFFFF000 + WINDOW_LENGTH - 1));
+    CHECK(window.due(0xFFFFF000 + WINDOW_LENGTH));
+
+    window.close(0xFFFFF000 + WINDOW_LENGTH);
+    add(window, 0xFFFFF000 + WINDOW_LENGTH + 1000, 230, 100);
+
+    CHECK(!window.due(0xFFFFF000 + 2 * WINDOW_LENGTH - 1));
+    CHECK(window.due(0xFFFFF000 + 2 * WINDOW_LENGTH));
+}
+
+static void test_timestamp()
+{
+    WindowAggregator window;
+    window.set_length(WINDOW_LENGTH);
+
+    MeterReading reading;
+    strcpy(reading.timestamp, "2021-01-25T15:33:20Z");
+    window.add(reading, 0);
+
+    // A reading without a timestamp keeps the last one
+    window.add(MeterReading(), 1000);
+
+    CHECK(strcmp(window.get_timestamp(), "2021-01-25T15:33:20Z") == 0);
+
+    window.close(WINDOW_LENGTH);
+
+    CHECK(window.get_timestamp()[0] == '\0');
+}
+
+int main()
+{
+    test_disabled();
+    test_measurements();
+    test_first_sample();
+    test_counter_decrease();
+    test_rollover();
+    test_time_wraparound();
+    test_timestamp();
+
+    return test_result("test_aggregate");
+}
+
+#endif
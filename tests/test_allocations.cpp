@@ -0,0 +1,137 @@
+#if defined(ESPDM_HOST)
+
+/*
+ * The decoder must not allocate once it is set up
+ *
+ * Replaces the global operator new and delete and fails on any allocation while the synthetic
+ * stream in tests/data and generated telegrams run through MeterDecoders for both transports: all Kaifa layouts, corrupted,
+ * duplicate and authenticated telegrams, with logging and the raw tap enabled. Everything the test
+ * itself needs is built before the counter is armed. The host crypto backend (OpenSSL) uses malloc
+ * and is not counted, the device backends do not allocate.
+ *
+ * Usage: test_allocations STREAM
+ */
+
+#include "espdm_test.h"
+#include <cstdlib>
+#include <new>
+
+using namespace esphome::espdm;
+
+static bool armed = false;
+static uint64_t allocations = 0;
+
+static void *counted_alloc(size_t size)
+{
+    if(armed)
+        allocations++;
+
+    void *pointer = malloc(size > 0 ? size : 1);
+
+    if(pointer == NULL)
+        throw std::bad_alloc();
+
+    return pointer;
+}
+
+void *operator new(size_t size) { return counted_alloc(size); }
+void *operator new[](size_t size) { return counted_alloc(size); }
+void operator delete(void *pointer) noexcept { free(pointer); }
+void operator delete[](void *pointer) noexcept { free(pointer); }
+
+static const uint8_t TEST_AUTHENTICATION_KEY[] = { 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F };
+
+int main(int argc, char **argv)
+{
+    if(argc != 2)
+    {
+        fprintf(stderr, "Usage: test_allocations STREAM\n");
+        return 2;
+    }
+
+    std::vector<CaptureChunk> capture;
+
+    if(!read_capture(argv[1], capture))
+    {
+        fprintf(stderr, "%s: Invalid stream\n", argv[1]);
+        return 2;
+    }
+
+    TestMeter streamed(TransportMbus);
+    TestMeter mbus(TransportMbus);
+    TestMeter hdlc(TransportHdlc);
+    TestMeter authenticated(TransportMbus, TEST_AUTHENTICATION_KEY);
+
+    // Everything the decoders need is set up before the counter is armed
+    streamed.enable_tap();
+    mbus.enable_tap();
+    hdlc.enable_tap();
+    authenticated.enable_tap();
+
+    std::vector<Bytes> mbusStreams;
+    std::vector<Bytes> hdlcStreams;
+    std::vector<Bytes> authenticatedStreams;
+    uint32_t frameCounter = 1;
+
+    for(const KaifaLayout &layout : KAIFA_LAYOUTS)
+    {
+        KaifaReading reading;
+        Bytes message = build_dlms_message(TEST_KEY, TEST_SYSTEM_TITLE, frameCounter, build_kaifa_plaintext(reading, layout, frameCounter));
+        Bytes corrupted = build_mbus_frames(build_dlms_message(TEST_KEY, TEST_SYSTEM_TITLE, frameCounter + 1, build_kaifa_plaintext(reading, layout, frameCounter)));
+
+        corrupted[corrupted.size() / 2] ^= 0x40;
+
+        mbusStreams.push_back(build_mbus_frames(message));
+        mbusStreams.push_back(build_mbus_frames(message)); // Duplicate
+        mbusStreams.push_back(corrupted);
+        hdlcStreams.push_back(build_hdlc_frames(message));
+        hdlcStreams.push_back(build_hdlc_frames(message));
+
+        Bytes signedMessage = build_dlms_message(TEST_KEY, TEST_SYSTEM_TITLE, frameCounter, build_kaifa_plaintext(reading, layout, frameCounter), TEST_AUTHENTICATION_KEY);
+        Bytes forged = build_mbus_frames(build_dlms_message(TEST_KEY, TEST_SYSTEM_TITLE, frameCounter + 1, build_kaifa_plaintext(reading, layout, frameCounter), TEST_KEY));
+
+        authenticatedStreams.push_back(build_mbus_frames(signedMessage));
+        authenticatedStreams.push_back(forged); // Tag with the wrong key
+        authenticatedStreams.push_back(mbusStreams[mbusStreams.size() - 3]); // Not authenticated at all
+
+        frameCounter += 2;
+    }
+
+    armed = true;
+
+    for(const CaptureChunk &chunk : capture)
+    {
+        streamed.clock.set_micros(chunk.time * 1000);
+        streamed.decoder.feed(chunk.data.data(), chunk.data.size());
+        streamed.clock.set_micros(chunk.time * 1000 + 200000);
+        streamed.decoder.poll();
+    }
+
+    for(const Bytes &stream : mbusStreams)
+        mbus.feed(stream);
+
+    for(const Bytes &stream : hdlcStreams)
+        hdlc.feed(stream);
+
+    for(const Bytes &stream : authenticatedStreams)
+        authenticated.feed(stream);
+
+    armed = false;
+
+    CHECK_EQUAL(0, allocations);
+
+    // Every path was taken
+    CHECK(streamed.listener.telegrams >= 4);
+    CHECK(streamed.listener.errors >= 1);
+    CHECK_EQUAL(4, mbus.listener.telegrams);
+    CHECK(mbus.listener.errors >= 8);
+    CHECK_EQUAL(4, hdlc.listener.telegrams);
+    CHECK_EQUAL(4, hdlc.listener.errors);
+    CHECK_EQUAL(4, authenticated.listener.telegrams);
+    CHECK(authenticated.listener.errors >= 8);
+    CHECK(mbus.listener.values > 0 && mbus.listener.tapped > 0 && mbus.logger.messages > 0);
+
+    return test_result("test_allocations");
+}
+
+#endif
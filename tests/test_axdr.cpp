@@ -0,0 +1,171 @@
+#if defined(ESPDM_HOST)
+
+/*
+ * A-XDR decoder: every supported type, the scaler/unit structure, nesting up to and past
+ * ESPDM_AXDR_MAX_DEPTH, truncated data and unsupported types
+ */
+
+#include "espdm_axdr.h"
+#include "espdm_obis.h"
+#include "espdm_test.h"
+#include <cmath>
+#include <vector>
+
+using namespace esphome::espdm;
+
+#define CODE "0906 0100010700FF " // OBIS code of the active power, the value after it is reported
+#define SCALER "0202 0FFF 161B " // { Integer -1, Enum 27 (W) }
+
+static const uint8_t POWER_CODE[OBIS_CODE_LENGTH] = { 0x01, 0x00, 0x01, 0x07, 0x00, 0xFF };
+
+struct AxdrCase
+{
+    const char *name;
+    const char *hex;
+    AxdrStatus status;
+    size_t values; // Values reported to the visitor, the first one is checked against the fields below
+    uint8_t type;
+    bool numeric;
+    int64_t raw;
+    float value;
+    size_t length; // Of the raw value
+    bool hasScaler;
+    int8_t scaler;
+    uint8_t unit;
+};
+
+static const AxdrCase AXDR_CASES[] =
+{
+    // Every supported type
+    { "null_data", CODE "00", AxdrOk, 1, DataType::NullData, false, 0, 0, 0 },
+    { "boolean", CODE "03 01", AxdrOk, 1, DataType::Boolean, true, 1, 1, 1 },
+    { "unsigned", CODE "11 FF", AxdrOk, 1, DataType::Unsigned, true, 255, 255, 1 },
+    { "enum", CODE "16 1B", AxdrOk, 1, DataType::Enum, true, 27, 27, 1 },
+    { "bcd", CODE "0D 12", AxdrOk, 1, DataType::BinaryCodedDecimal, true, 0x12, 0x12, 1 },
+    { "integer", CODE "0F FE", AxdrOk, 1, DataType::Integer, true, -2, -2, 1 },
+    { "long_unsigned", CODE "12 FFFE", AxdrOk, 1, DataType::LongUnsigned, true, 65534, 65534, 2 },
+    { "long", CODE "10 FF38", AxdrOk, 1, DataType::Long, true, -200, -200, 2 },
+    { "double_long_unsigned", CODE "06 FFFFFFFE", AxdrOk, 1, DataType::DoubleLongUnsigned, true, 4294967294LL, 4294967294.0f, 4 },
+    { "double_long", CODE "05 FFFFFC18", AxdrOk, 1, DataType::DoubleLong, true, -1000, -1000, 4 },
+    { "long64_unsigned", CODE "15 0000000100000000", AxdrOk, 1, DataType::Long64Unsigned, true, 4294967296LL, 4294967296.0f, 8 },
+    { "long64", CODE "14 FFFFFFFFFFFFFFFF", AxdrOk, 1, DataType::Long64, true, -1, -1, 8 },
+    { "float32", CODE "17 40490FDB", AxdrOk, 1, DataType::Float32, true, 0, 3.1415927f, 4 },
+    { "float64", CODE "18 400921FB54442D18", AxdrOk, 1, DataType::Float64, true, 0, 3.1415927f, 8 },
+    { "date_time", CODE "19 07E5011901000000FF800000", AxdrOk, 1, DataType::DateTime, false, 0, 0, 12 },
+    { "date", CODE "1A 07E5011901", AxdrOk, 1, DataType::Date, false, 0, 0, 5 },
+    { "time", CODE "1B 0F212000", AxdrOk, 1, DataType::Time, false, 0, 0, 4 },
+    { "octet_string", CODE "09 03 414243", AxdrOk, 1, DataType::OctetString, false, 0, 0, 3 },
+    { "octet_string_81", CODE "09 8103 414243", AxdrOk, 1, DataType::OctetString, false, 0, 0, 3 },
+    { "octet_string_82", CODE "09 820003 414243", AxdrOk, 1, DataType::OctetString, false, 0, 0, 3 },
+    { "visible_string", CODE "0A 02 4142", AxdrOk, 1, DataType::VisibleString, false, 0, 0, 2 },
+    { "utf8_string", CODE "0C 01 41", AxdrOk, 1, DataType::Utf8String, false, 0, 0, 1 },
+    { "bit_string", CODE "04 09 FF80", AxdrOk, 1, DataType::BitString, false, 0, 0, 2 }, // Length in bits
+
+    // Scaler and unit
+    { "scaler", CODE "12 0904 " SCALER, AxdrOk, 1, DataType::LongUnsigned, true, 2308, 230.8f, 2, true, -1, 27 },
+    { "scaler_positive", CODE "06 00000460 0202 0F02 161E", AxdrOk, 1, DataType::DoubleLongUnsigned, true, 1120, 112000, 4, true, 2, 30 },
+    { "kaifa_element", "0203 " CODE "12 0904 " SCALER, AxdrOk, 1, DataType::LongUnsigned, true, 2308, 230.8f, 2, true, -1, 27 },
+    { "structure_not_scaler", CODE "12 0904 0202 1200 01 161B", AxdrOk, 1, DataType::LongUnsigned, true, 2308, 2308, 2 }, // { LongUnsigned, Enum }
+    { "structure_swapped", CODE "12 0904 0202 161B 0FFF", AxdrOk, 1, DataType::LongUnsigned, true, 2308, 2308, 2 }, // { Enum, Integer }
+    { "structure_three", CODE "12 0904 0203 0FFF 161B 1100", AxdrOk, 1, DataType::LongUnsigned, true, 2308, 2308, 2 },
+    { "scaler_without_value", "0202 0FFF 161B " CODE "11 05", AxdrOk, 1, DataType::Unsigned, true, 5, 5, 1 },
+    { "two_values", CODE "11 05 " CODE "11 06", AxdrOk, 2, DataType::Unsigned, true, 5, 5, 1 },
+    { "value_without_code", "11 05 " CODE "11 06", AxdrOk, 1, DataType::Unsigned, true, 6, 6, 1 },
+
+    // Nesting, the innermost structure holds the code and its value
+    { "depth_8", "0101 0101 0101 0101 0101 0101 0101 0202 " CODE "11 05", AxdrOk, 1, DataType::Unsigned, true, 5, 5, 1 },
+    { "depth_9", "0101 0101 0101 0101 0101 0101 0101 0101 0202 " CODE "11 05", AxdrErrorTooDeep, 0 },
+    { "empty_containers", "0100 0200 " CODE "11 05", AxdrOk, 1, DataType::Unsigned, true, 5, 5, 1 },
+    { "array_long_count", "01 8102 " CODE "11 05", AxdrOk, 1, DataType::Unsigned, true, 5, 5, 1 },
+
+    // Truncated
+    { "truncated_value", CODE "06 0000", AxdrErrorTruncated, 0 },
+    { "truncated_string", CODE "09 05 4142", AxdrErrorTruncated, 0 },
+    { "truncated_length_81", CODE "09 81", AxdrErrorTruncated, 0 },
+    { "truncated_length_82", CODE "09 8200", AxdrErrorTruncated, 0 },
+    { "length_83", CODE "09 83000003 414243", AxdrErrorTruncated, 0 }, // Longer lengths never fit into a telegram
+    { "truncated_code", "0906 010001", AxdrErrorTruncated, 0 },
+    { "truncated_count", "01 82 00", AxdrErrorTruncated, 0 },
+    { "truncated_container", "0203 " CODE "11 05", AxdrErrorTruncated, 0 }, // Third element missing
+    { "truncated_scaler", CODE "12 0904 0202 0FFF 16", AxdrErrorTruncated, 0 },
+
+    // Unsupported
+    { "compact_array", CODE "13 00", AxdrErrorUnsupportedType, 0 },
+    { "unknown_type", CODE "FF 00", AxdrErrorUnsupportedType, 0 },
+    { "unknown_type_without_code", "07 00", AxdrErrorUnsupportedType, 0 }
+};
+
+class RecordingVisitor : public ObisVisitor
+{
+    public:
+        void on_value(const ObisValue &value) override
+        {
+            if(this->values.empty())
+            {
+                this->first = value;
+                this->firstIsPower = memcmp(value.obis, POWER_CODE, sizeof(POWER_CODE)) == 0;
+            }
+
+            this->values.push_back(value);
+        }
+
+        std::vector<ObisValue> values;
+        ObisValue first;
+        bool firstIsPower = false;
+};
+
+static bool same_float(float expected, float actual)
+{
+    return fabsf(expected - actual) <= fabsf(expected) * 1e-6f;
+}
+
+static void test_case(const AxdrCase &test)
+{
+    Bytes data;
+
+    if(!parse_hex(test.hex, data))
+    {
+        fprintf(stderr, "%s: Invalid hex\n", test.name);
+        CHECK(!"Invalid hex");
+        return;
+    }
+
+    AxdrDecoder decoder;
+    RecordingVisitor visitor;
+    AxdrStatus status = decoder.decode(ByteView(data.data(), data.size()), 0, visitor);
+
+    bool ok = status == test.status && (test.status != AxdrOk || visitor.values.size() == test.values);
+
+    if(ok && test.values > 0)
+    {
+        const ObisValue &value = visitor.first;
+
+        ok = visitor.firstIsPower && value.type == test.type && value.numeric == test.numeric && value.length == test.length;
+        ok = ok && value.hasScaler == test.hasScaler && (!test.hasScaler || (value.scaler == test.scaler && value.unit == test.unit));
+
+        if(test.numeric)
+            ok = ok && same_float(test.value, value.value) && (test.type == DataType::Float32 || test.type == DataType::Float64 || value.raw == test.raw);
+    }
+
+    if(!ok)
+    {
+        fprintf(stderr, "%s: status %d, %zu values", test.name, (int) status, visitor.values.size());
+
+        if(!visitor.values.empty())
+            fprintf(stderr, ", type 0x%02X raw %lld value %g length %zu scaler %d unit %u", visitor.first.type, (long long) visitor.first.raw, visitor.first.value, visitor.first.length, visitor.first.hasScaler ? visitor.first.scaler : 0, visitor.first.unit);
+
+        fprintf(stderr, "\n");
+    }
+
+    CHECK(ok);
+}
+
+int main()
+{
+    for(const AxdrCase &test : AXDR_CASES)
+        test_case(test);
+
+    return test_result("test_axdr");
+}
+
+#endif
@@ -0,0 +1,245 @@
+#if defined(ESPDM_HOST)
+
+/*
+ * Sensor states of a telegram go out over several loop() calls, see DlmsMeter::flush_sensor_states()
+ *
+ * Runs the ESPHome component against the stubs in tests/stubs, every sensor state costs the whole
+ * ESPDM_PUBLISH_BUDGET so each loop() call publishes one. A second telegram arrives while the states
+ * of the first one are still going out. Checks that no sensor publishes a value of the first telegram
+ * once values of the second one went out, that every sensor ends up with the value of the latest
+ * telegram that carried it, and that no state is lost or published twice for the same telegram.
+ */
+
+#include "espdm.h"
+#include "espdm_test.h"
+
+using namespace esphome::espdm;
+
+static const uint32_t LOOP_INTERVAL = 2000; // Time between two loop() calls in us
+static const size_t SENSOR_COUNT = 12;
+static const size_t MAX_CALLS = 500; // Both telegrams are read and published well before
+
+/*
+ * A meter with all sensors on its own UART
+ */
+struct TestComponent
+{
+    uart::UARTComponent uart;
+    sensor::Sensor sensors[SENSOR_COUNT];
+    text_sensor::TextSensor timestamp;
+    uint8_t key[sizeof(TEST_KEY)];
+    DlmsMeter meter;
+
+    TestComponent() : meter(&uart)
+    {
+        memcpy(this->key, TEST_KEY, sizeof(this->key));
+
+        this->meter.set_key(this->key, sizeof(this->key));
+        this->meter.set_voltage_sensors(&this->sensors[0], &this->sensors[1], &this->sensors[2]);
+        this->meter.set_current_sensors(&this->sensors[3], &this->sensors[4], &this->sensors[5]);
+        this->meter.set_active_power_sensors(&this->sensors[6], &this->sensors[7]);
+        this->meter.set_active_energy_sensors(&this->sensors[8], &this->sensors[9]);
+        this->meter.set_reactive_energy_sensors(&this->sensors[10], &this->sensors[11]);
+        this->meter.set_timestamp_sensor(&this->timestamp);
+        this->meter.setup();
+    }
+
+    void send(const Bytes &frames)
+    {
+        this->uart.received.insert(this->uart.received.end(), frames.begin(), frames.end());
+    }
+
+    void loop()
+    {
+        this->meter.loop();
+        stubs::now() += LOOP_INTERVAL;
+    }
+
+    size_t publishes() const
+    {
+        size_t publishes = this->timestamp.publishes;
+
+        for(const sensor::Sensor &sensor : this->sensors)
+            publishes += sensor.publishes;
+
+        return publishes;
+    }
+};
+
+/*
+ * Every value of telegram n differs from the same value of any other telegram
+ */
+static Bytes build_telegram(uint32_t n, const KaifaLayout &layout)
+{
+    KaifaReading reading;
+    reading.second = n;
+
+    for(int phase = 0; phase < 3; phase++)
+    {
+        reading.voltage[phase] = 2300 + 10 * phase + n;
+        reading.current[phase] = 100 + 10 * phase + n;
+    }
+
+    reading.activePowerPlus = 1000 + n;
+    reading.activePowerMinus = n;
+    reading.activeEnergyPlus = 4531200 + n;
+    reading.activeEnergyMinus = 12 + n;
+    reading.reactiveEnergyPlus = 23980 + n;
+    reading.reactiveEnergyMinus = 881032 + n;
+
+    return build_mbus_frames(build_dlms_message(TEST_KEY, TEST_SYSTEM_TITLE, n, build_kaifa_plaintext(reading, layout, n)));
+}
+
+/*
+ * States of a telegram published on its own, sensors without a value in it have none
+ */
+struct TelegramStates
+{
+    bool has[SENSOR_COUNT + 1]; // Sensors, then the timestamp
+    float values[SENSOR_COUNT];
+    std::string timestamp;
+};
+
+static TelegramStates publish_alone(const Bytes &telegram)
+{
+    TestComponent component;
+    component.send(telegram);
+
+    for(size_t i = 0; i < MAX_CALLS; i++)
+        component.loop();
+
+    TelegramStates states;
+
+    for(size_t i = 0; i < SENSOR_COUNT; i++)
+    {
+        states.has[i] = component.sensors[i].publishes > 0;
+        states.values[i] = component.sensors[i].state;
+    }
+
+    states.has[SENSOR_COUNT] = component.timestamp.publishes > 0;
+    states.timestamp = component.timestamp.state;
+
+    return states;
+}
+
+/*
+ * Which telegram a published state belongs to: 1 or 2, 0 for neither
+ */
+static int telegram_of(const TelegramStates *telegrams, size_t sensor, const TestComponent &component)
+{
+    for(int n = 0; n < 2; n++)
+    {
+        const TelegramStates &states = telegrams[n];
+
+        if(!states.has[sensor])
+            continue;
+
+        if(sensor < SENSOR_COUNT ? states.values[sensor] == component.sensors[sensor].state : states.timestamp == component.timestamp.state)
+            return n + 1;
+    }
+
+    return 0;
+}
+
+static void test_second_telegram(const KaifaLayout &secondLayout)
+{
+    Bytes first = build_telegram(1, KAIFA_LAYOUTS[KaifaMultiFrame]);
+    Bytes second = build_telegram(2, secondLayout);
+
+    stubs::publish_cost() = ESPDM_PUBLISH_BUDGET;
+
+    TelegramStates telegrams[2] = { publish_alone(first), publish_alone(second) };
+    TestComponent component;
+
+    component.send(first);
+
+    // The second telegram arrives right after the first state of the first one went out
+    size_t calls = 0;
+
+    for(; calls < MAX_CALLS && component.publishes() == 0; calls++)
+        component.loop();
+
+    CHECK_EQUAL(1, component.publishes());
+    component.send(second);
+
+    size_t history[SENSOR_COUNT + 1][3] = {}; // Publishes per sensor and telegram
+    bool secondSeen = false;
+    bool mixed = false;
+
+    for(size_t i = 0; i <= SENSOR_COUNT; i++) // The one state already published
+    {
+        size_t publishes = i < SENSOR_COUNT ? component.sensors[i].publishes : component.timestamp.publishes;
+        history[i][telegram_of(telegrams, i, component)] += publishes;
+    }
+
+    for(; calls < MAX_CALLS; calls++)
+    {
+        size_t before[SENSOR_COUNT + 1];
+
+        for(size_t i = 0; i < SENSOR_COUNT; i++)
+            before[i] = component.sensors[i].publishes;
+
+        before[SENSOR_COUNT] = component.timestamp.publishes;
+
+        component.loop();
+
+        for(size_t i = 0; i <= SENSOR_COUNT; i++)
+        {
+            size_t publishes = (i < SENSOR_COUNT ? component.sensors[i].publishes : component.timestamp.publishes) - before[i];
+
+            if(publishes == 0)
+                continue;
+
+            CHECK_EQUAL(1, publishes);
+
+            int telegram = telegram_of(telegrams, i, component);
+            history[i][telegram]++;
+
+            // Once the second telegram is being published, states of the first one only go out for values it did not carry
+            if(telegram == 1 && secondSeen && telegrams[1].has[i])
+                mixed = true;
+
+            if(telegram == 2)
+                secondSeen = true;
+        }
+    }
+
+    CHECK(!mixed);
+
+    size_t interrupted = 0;
+
+    for(size_t i = 0; i <= SENSOR_COUNT; i++)
+    {
+        CHECK_EQUAL(0, history[i][0]); // Every state is a value of one of the telegrams
+        CHECK(history[i][1] <= 1);
+
+        if(telegrams[1].has[i])
+        {
+            // The latest value went out exactly once, the one of the first telegram at most before it
+            CHECK_EQUAL(1, history[i][2]);
+            CHECK_EQUAL(2, telegram_of(telegrams, i, component));
+
+            interrupted += history[i][1] == 0;
+        }
+        else
+        {
+            // Not in the second telegram, the state of the first one is still published
+            CHECK_EQUAL(1, history[i][1]);
+            CHECK_EQUAL(1, telegram_of(telegrams, i, component));
+        }
+    }
+
+    CHECK(interrupted > 0); // The second telegram really replaced states of the first one before they went out
+
+    printf("espdm %s: second telegram %s, %zu states of the first one replaced before they went out\n", ESPDM_VERSION, secondLayout.name, interrupted);
+}
+
+int main()
+{
+    test_second_telegram(KAIFA_LAYOUTS[KaifaMultiFrame]); // Replaces every value
+    test_second_telegram(KAIFA_LAYOUTS[KaifaSingleShort]); // Only the voltages
+
+    return test_result("test_flush");
+}
+
+#endif
@@ -0,0 +1,146 @@
+#if defined(ESPDM_HOST)
+
+/*
+ * Rejection of duplicate and stale telegrams by their frame counter, and following a meter whose
+ * counter restarted
+ */
+
+#include "espdm_test.h"
+
+using namespace esphome::espdm;
+
+static const uint8_t OTHER_SYSTEM_TITLE[] = { 0x4B, 0x46, 0x4D, 0x10, 0x20, 0x00, 0x56, 0x78 };
+
+static Bytes build_telegram(uint32_t frameCounter, const uint8_t *systemTitle = TEST_SYSTEM_TITLE)
+{
+    KaifaReading reading;
+    reading.voltage[0] = frameCounter % 10000;
+
+    return build_mbus_frames(build_dlms_message(TEST_KEY, systemTitle, frameCounter, build_kaifa_plaintext(reading, KAIFA_LAYOUTS[KaifaMultiFrame], frameCounter)));
+}
+
+/*
+ * Feeds one telegram, returns the error it was rejected with or TelegramErrorCount if it was accepted
+ */
+static TelegramError feed(TestMeter &meter, uint32_t frameCounter, const uint8_t *systemTitle = TEST_SYSTEM_TITLE)
+{
+    uint64_t telegrams = meter.listener.telegrams;
+    uint64_t errors = meter.listener.errors;
+
+    meter.feed(build_telegram(frameCounter, systemTitle));
+
+    if(meter.listener.telegrams == telegrams + 1 && meter.listener.errors == errors && meter.listener.lastFrameCounter == frameCounter)
+        return TelegramErrorCount;
+
+    if(meter.listener.errors == errors + 1)
+        return meter.listener.lastError;
+
+    return ErrorDecryption; // Neither accepted nor rejected once, never expected
+}
+
+static void test_counters()
+{
+    TestMeter meter;
+
+    CHECK_EQUAL(TelegramErrorCount, feed(meter, 100));
+    CHECK_EQUAL(ErrorDuplicate, feed(meter, 100));
+    CHECK_EQUAL(ErrorStale, feed(meter, 99));
+    CHECK_EQUAL(ErrorStale, feed(meter, 1));
+    CHECK_EQUAL(TelegramErrorCount, feed(meter, 101));
+    CHECK_EQUAL(TelegramErrorCount, feed(meter, 200)); // Gaps are fine, telegrams get lost on the line
+    CHECK_EQUAL(ErrorDuplicate, feed(meter, 200));
+}
+
+static void test_system_title()
+{
+    TestMeter meter;
+
+    CHECK_EQUAL(TelegramErrorCount, feed(meter, 100));
+
+    // Another meter has its own counter
+    CHECK_EQUAL(TelegramErrorCount, feed(meter, 5, OTHER_SYSTEM_TITLE));
+    CHECK_EQUAL(ErrorDuplicate, feed(meter, 5, OTHER_SYSTEM_TITLE));
+}
+
+static void test_set_key()
+{
+    TestMeter meter;
+
+    CHECK_EQUAL(TelegramErrorCount, feed(meter, 100));
+    CHECK_EQUAL(ErrorStale, feed(meter, 50));
+
+    // Counters seen with the old key do not apply to the new one
+    meter.decoder.set_key(TEST_KEY, sizeof(TEST_KEY));
+
+    CHECK_EQUAL(TelegramErrorCount, feed(meter, 50));
+    CHECK_EQUAL(ErrorStale, feed(meter, 49));
+}
+
+static void test_restart()
+{
+    TestMeter meter;
+
+    CHECK_EQUAL(TelegramErrorCount, feed(meter, 100000));
+
+    // The counter of the meter starts over, the first telegrams are rejected until it is clearly counting up again
+    for(uint32_t frameCounter = 1; frameCounter < ESPDM_FRAME_COUNTER_RESYNC; frameCounter++)
+        CHECK_EQUAL(ErrorStale, feed(meter, frameCounter));
+
+    CHECK_EQUAL(TelegramErrorCount, feed(meter, ESPDM_FRAME_COUNTER_RESYNC));
+    CHECK_EQUAL(TelegramErrorCount, feed(meter, ESPDM_FRAME_COUNTER_RESYNC + 1));
+
+    // And the new counter is protected like the old one
+    CHECK_EQUAL(ErrorDuplicate, feed(meter, ESPDM_FRAME_COUNTER_RESYNC + 1));
+    CHECK_EQUAL(ErrorStale, feed(meter, ESPDM_FRAME_COUNTER_RESYNC));
+}
+
+static void test_wraparound()
+{
+    TestMeter meter;
+
+    CHECK_EQUAL(TelegramErrorCount, feed(meter, 0xFFFFFFFE));
+    CHECK_EQUAL(TelegramErrorCount, feed(meter, 0xFFFFFFFF));
+
+    for(uint32_t frameCounter = 0; frameCounter < ESPDM_FRAME_COUNTER_RESYNC - 1; frameCounter++)
+        CHECK_EQUAL(ErrorStale, feed(meter, frameCounter));
+
+    CHECK_EQUAL(TelegramErrorCount, feed(meter, ESPDM_FRAME_COUNTER_RESYNC - 1));
+}
+
+static void test_no_resync()
+{
+    TestMeter meter;
+
+    CHECK_EQUAL(TelegramErrorCount, feed(meter, 100000));
+
+    // The same old telegram over and over does not count up
+    for(int i = 0; i < 2 * ESPDM_FRAME_COUNTER_RESYNC; i++)
+        CHECK_EQUAL(ErrorStale, feed(meter, 500));
+
+    // Neither do old telegrams out of order, at most two of them rise in a row
+    static const uint32_t SHUFFLED[] = { 7, 3, 8, 2, 9, 1, 6, 5, 4 };
+
+    for(uint32_t frameCounter : SHUFFLED)
+        CHECK_EQUAL(ErrorStale, feed(meter, frameCounter));
+
+    // A telegram of the running counter ends a run of stale telegrams
+    CHECK_EQUAL(ErrorStale, feed(meter, 10));
+    CHECK_EQUAL(TelegramErrorCount, feed(meter, 100001));
+
+    for(uint32_t frameCounter = 11; frameCounter < 10 + ESPDM_FRAME_COUNTER_RESYNC; frameCounter++)
+        CHECK_EQUAL(ErrorStale, feed(meter, frameCounter));
+}
+
+int main()
+{
+    test_counters();
+    test_system_title();
+    test_set_key();
+    test_restart();
+    test_wraparound();
+    test_no_resync();
+
+    return test_result("test_frame_counter");
+}
+
+#endif
@@ -0,0 +1,131 @@
+#if defined(ESPDM_HOST)
+
+/*
+ * A damaged telegram is rejected exactly once and does not take the next one with it
+ *
+ * Flips every bit of multi frame telegrams over M-Bus and HDLC one at a time and feeds two damaged
+ * telegrams followed by an intact one: each damaged one has to count as one error, the intact one
+ * has to decode. Also covers a telegram whose first frame was missed and the synthetic stream in
+ * tests/data with a corrupted start byte.
+ *
+ * Usage: test_framing STREAM
+ */
+
+#include "espdm_test.h"
+
+using namespace esphome::espdm;
+
+static const KaifaLayoutIndex TEST_LAYOUTS[] = { KaifaMultiFrame, KaifaMultiFramePadded }; // Two and three frames over M-Bus
+
+static Bytes build_frames(TransportType transport, uint32_t frameCounter, const KaifaLayout &layout)
+{
+    KaifaReading reading;
+    Bytes message = build_dlms_message(TEST_KEY, TEST_SYSTEM_TITLE, frameCounter, build_kaifa_plaintext(reading, layout, frameCounter));
+
+    return transport == TransportHdlc ? build_hdlc_frames(message) : build_mbus_frames(message);
+}
+
+static void test_bit_flips(TransportType transport)
+{
+    for(KaifaLayoutIndex index : TEST_LAYOUTS)
+    {
+        const KaifaLayout &layout = KAIFA_LAYOUTS[index];
+        TestMeter meter(transport);
+        uint32_t frameCounter = 1;
+        uint32_t miscounted = 0;
+        uint32_t lost = 0;
+
+        size_t length = build_frames(transport, frameCounter, layout).size();
+
+        for(size_t position = 0; position < length; position++)
+        {
+            for(int bit = 0; bit < 8; bit++)
+            {
+                uint32_t errors = meter.listener.errors;
+                uint32_t telegrams = meter.listener.telegrams;
+
+                // Twice in a row, the error of one damaged telegram must not hide the next one
+                for(int damagedTelegrams = 0; damagedTelegrams < 2; damagedTelegrams++)
+                {
+                    Bytes damaged = build_frames(transport, frameCounter++, layout);
+                    damaged[position] ^= 1 << bit;
+                    meter.feed(damaged);
+                }
+
+                meter.feed(build_frames(transport, frameCounter++, layout));
+
+                if(meter.listener.errors - errors != 2)
+                {
+                    if(miscounted++ < 5)
+                        fprintf(stderr, "%s %s: Bit %d of byte %zu gave %u errors for two telegrams\n", transport == TransportHdlc ? "HDLC" : "M-Bus", layout.name, bit, position, (unsigned) (meter.listener.errors - errors));
+                }
+
+                lost += meter.listener.telegrams - telegrams != 1;
+            }
+        }
+
+        CHECK_EQUAL(0, miscounted);
+        CHECK_EQUAL(0, lost);
+    }
+}
+
+static void test_missed_first_frame()
+{
+    TestMeter meter(TransportMbus);
+    Bytes frames = build_frames(TransportMbus, 1, KAIFA_LAYOUTS[KaifaMultiFrame]);
+    size_t secondFrame = MBUS_HEADER_INTRO_LENGTH + frames[MBUS_LENGTH1_OFFSET] + MBUS_FOOTER_LENGTH;
+
+    // Started listening in the middle of the telegram, the continuation frame alone is not an error
+    meter.feed(Bytes(frames.begin() + secondFrame, frames.end()));
+    meter.feed(build_frames(TransportMbus, 2, KAIFA_LAYOUTS[KaifaMultiFrame]));
+
+    CHECK_EQUAL(0, meter.listener.errors);
+    CHECK_EQUAL(1, meter.listener.telegrams);
+}
+
+static void test_stream(const char *path)
+{
+    std::vector<CaptureChunk> capture;
+
+    if(!read_capture(path, capture))
+    {
+        CHECK(!"Capture could not be read");
+        return;
+    }
+
+    TestMeter intact(TransportMbus);
+    TestMeter corrupted(TransportMbus);
+
+    for(size_t i = 0; i < capture.size(); i++)
+    {
+        intact.feed(capture[i].data);
+
+        Bytes chunk = capture[i].data;
+
+        if(i == 0)
+            chunk[0] ^= 0x01; // Start byte of the first frame
+
+        corrupted.feed(chunk);
+    }
+
+    CHECK_EQUAL(intact.listener.errors + 1, corrupted.listener.errors);
+    CHECK_EQUAL(intact.listener.telegrams - 1, corrupted.listener.telegrams);
+}
+
+int main(int argc, char **argv)
+{
+    if(argc != 2)
+    {
+        fprintf(stderr, "Usage: test_framing STREAM\n");
+        return 2;
+    }
+
+    test_bit_flips(TransportMbus);
+    test_bit_flips(TransportHdlc);
+    test_missed_first_frame();
+    test_stream(argv[1]);
+
+    return test_result("test_framing");
+}
+
+#endif
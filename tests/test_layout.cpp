@@ -0,0 +1,329 @@
+#if defined(ESPDM_HOST)
+
+/*
+ * Layout cache: values read at the cached offsets are the same as a full decode, and any change
+ * of the bytes around the values falls back to the full decode and learns the layout again
+ */
+
+#include "espdm_layout.h"
+#include "espdm_test.h"
+
+using namespace esphome::espdm;
+
+/*
+ * Everything a listener can see of one value, comparable after the buffer is gone
+ */
+struct DecodedValue
+{
+    Bytes obis;
+    uint8_t type;
+    size_t offset;
+    Bytes data;
+    bool numeric;
+    int64_t raw;
+    float value;
+    bool hasScaler;
+    int8_t scaler;
+    uint8_t unit;
+    const ObisEntry *entry;
+
+    DecodedValue(const ObisValue &value, const ObisEntry *entry) :
+        obis(value.obis, value.obis + OBIS_CODE_LENGTH), type(value.type), offset(value.offset), data(value.data, value.data + value.length),
+        numeric(value.numeric), raw(value.raw), value(value.value), hasScaler(value.hasScaler), scaler(value.scaler), unit(value.unit), entry(entry) {}
+
+    bool operator==(const DecodedValue &other) const
+    {
+        // Not finite values never show up here, the synthetic telegrams only hold integers
+        return obis == other.obis && type == other.type && offset == other.offset && data == other.data && numeric == other.numeric &&
+               raw == other.raw && value == other.value && hasScaler == other.hasScaler && scaler == other.scaler && unit == other.unit && entry == other.entry;
+    }
+};
+
+typedef std::vector<DecodedValue> DecodedValues;
+
+/*
+ * Collects the values of a full decode and records them into a layout cache as MeterDecoder does
+ */
+class RecordingVisitor : public ObisVisitor, public MeterListener
+{
+    public:
+        RecordingVisitor(const ByteView *view = NULL, LayoutCache *layout = NULL) : view(view), layout(layout) {}
+
+        void on_value(const ObisValue &value) override
+        {
+            const ObisEntry *entry = find_obis_entry(value.obis);
+
+            if(this->layout != NULL)
+                this->layout->record(*this->view, value, entry);
+
+            on_value(value, entry);
+        }
+
+        void on_value(const ObisValue &value, const ObisEntry *entry) override
+        {
+            this->values.push_back(DecodedValue(value, entry));
+        }
+
+        DecodedValues values;
+
+    private:
+        const ByteView *view;
+        LayoutCache *layout;
+};
+
+static bool full_decode(const Bytes &plaintext, DecodedValues &values)
+{
+    ByteView view(plaintext.data(), plaintext.size());
+    AxdrDecoder decoder;
+    RecordingVisitor visitor;
+
+    bool ok = decoder.decode(view, DECODER_START_OFFSET, visitor) == AxdrOk;
+    values = visitor.values;
+
+    return ok;
+}
+
+/*
+ * Decodes like MeterDecoder: at the cached offsets if the layout matches, otherwise fully while learning it
+ */
+static bool cached_decode(LayoutCache &layout, const Bytes &plaintext, DecodedValues &values, bool &cached)
+{
+    ByteView view(plaintext.data(), plaintext.size());
+    RecordingVisitor visitor(&view, &layout);
+
+    cached = layout.matches(view, DECODER_START_OFFSET);
+
+    if(cached)
+    {
+        ObisValue value;
+        const ObisEntry *entry;
+
+        for(size_t i = 0; i < layout.size(); i++)
+        {
+            if(!layout.read(view, i, value, entry))
+                return false;
+
+            visitor.on_value(value, entry);
+        }
+    }
+    else
+    {
+        AxdrDecoder decoder;
+        layout.learn();
+
+        if(decoder.decode(view, DECODER_START_OFFSET, visitor) != AxdrOk)
+            return false;
+
+        layout.commit(view, DECODER_START_OFFSET);
+    }
+
+    values = visitor.values;
+
+    return true;
+}
+
+/*
+ * Decodes with the cache and checks every value against a full decode, returns whether the cache was used
+ */
+static bool check_equivalent(const char *name, LayoutCache &layout, const Bytes &plaintext)
+{
+    DecodedValues expected, actual;
+    bool cached = false;
+
+    CHECK(full_decode(plaintext, expected));
+    CHECK(cached_decode(layout, plaintext, actual, cached));
+    CHECK(!expected.empty());
+
+    if(actual != expected)
+    {
+        fprintf(stderr, "%s: %s decode differs, %zu values instead of %zu\n", name, cached ? "Cached" : "Full", actual.size(), expected.size());
+
+        for(size_t i = 0; i < actual.size() && i < expected.size(); i++)
+        {
+            if(!(actual[i] == expected[i]))
+                fprintf(stderr, "  value %zu: raw %lld value %g, expected raw %lld value %g\n", i, (long long) actual[i].raw, actual[i].value, (long long) expected[i].raw, expected[i].value);
+        }
+
+        CHECK(actual == expected);
+    }
+
+    return cached;
+}
+
+static KaifaReading make_reading(uint32_t seed)
+{
+    KaifaReading reading;
+
+    reading.second = seed % 60;
+
+    for(int phase = 0; phase < 3; phase++)
+    {
+        reading.voltage[phase] = 2200 + (seed * 7 + phase) % 200;
+        reading.current[phase] = (seed * 13 + phase) % 6000;
+    }
+
+    reading.activePowerPlus = seed * 31 % 20000;
+    reading.activeEnergyPlus = 4531200 + seed;
+    reading.reactiveEnergyMinus = seed % 2 == 0 ? 0 : 0xFFFFFFFF; // Full range of the type
+
+    return reading;
+}
+
+static Bytes build_plaintext(uint32_t seed, const KaifaLayout &layout)
+{
+    return build_kaifa_plaintext(make_reading(seed), layout, seed);
+}
+
+static void test_layouts()
+{
+    for(const KaifaLayout &kaifaLayout : KAIFA_LAYOUTS)
+    {
+        LayoutCache layout;
+
+        CHECK(!check_equivalent(kaifaLayout.name, layout, build_plaintext(1, kaifaLayout)));
+
+        for(uint32_t seed = 2; seed < 50; seed++)
+        {
+            bool cached = check_equivalent(kaifaLayout.name, layout, build_plaintext(seed, kaifaLayout));
+
+            // The padded layout has more values than ESPDM_LAYOUT_MAX_FIELDS and is always fully decoded
+            CHECK(cached == (kaifaLayout.valueCount + kaifaLayout.fillerCount + 1 <= ESPDM_LAYOUT_MAX_FIELDS));
+        }
+    }
+}
+
+/*
+ * Index of the first byte after pattern in data
+ */
+static size_t find_after(const Bytes &data, const char *hex)
+{
+    Bytes pattern;
+    parse_hex(hex, pattern);
+
+    Bytes::const_iterator found = std::search(data.begin(), data.end(), pattern.begin(), pattern.end());
+
+    CHECK(found != data.end());
+
+    return found - data.begin() + pattern.size();
+}
+
+struct Mutation
+{
+    const char *name;
+    const char *pattern;
+    int offset; // Of the changed byte from the end of pattern
+    uint8_t value;
+};
+
+static const Mutation MUTATIONS[] =
+{
+    { "type", "0906 0100200700FF", 0, 0x10 }, // Voltage L1 as Long instead of LongUnsigned
+    { "type_current", "0906 01001F0700FF", 0, 0x10 },
+    { "obis", "0906 0100200700FF", -4, 0x1F }, // Voltage L1 reported as current L1
+    { "obis_unsupported", "0906 0100200700FF", -3, 0x63 },
+    { "scaler", "0906 0100200700FF 12", 5, 0xFE }, // After the value and 0202 0F
+    { "unit", "0906 0100200700FF 12", 7, 0x1B }
+};
+
+static void test_mutations()
+{
+    const KaifaLayout &kaifaLayout = KAIFA_LAYOUTS[KaifaMultiFrame];
+
+    for(const Mutation &mutation : MUTATIONS)
+    {
+        LayoutCache layout;
+
+        check_equivalent(mutation.name, layout, build_plaintext(1, kaifaLayout));
+        CHECK(check_equivalent(mutation.name, layout, build_plaintext(2, kaifaLayout)));
+
+        for(uint32_t seed = 3; seed < 6; seed++)
+        {
+            Bytes plaintext = build_plaintext(seed, kaifaLayout);
+            size_t position = find_after(plaintext, mutation.pattern) + mutation.offset;
+
+            CHECK(plaintext[position] != mutation.value);
+            plaintext[position] = mutation.value;
+
+            // The first changed telegram of the same length falls back to the full decode, the next one uses the new layout
+            bool cached = check_equivalent(mutation.name, layout, plaintext);
+            CHECK(cached == (seed > 3));
+        }
+
+        // And the original layout is learned again
+        CHECK(!check_equivalent(mutation.name, layout, build_plaintext(6, kaifaLayout)));
+        CHECK(check_equivalent(mutation.name, layout, build_plaintext(7, kaifaLayout)));
+    }
+}
+
+static void test_field_limit()
+{
+    // Timestamp, 12 values and fillers up to the limit are cached, one more is not
+    for(size_t fillers = 0; fillers < 6; fillers++)
+    {
+        KaifaLayout kaifaLayout = { "fields", 12, fillers };
+        LayoutCache layout;
+        bool fits = 1 + 12 + fillers <= ESPDM_LAYOUT_MAX_FIELDS;
+
+        check_equivalent("fields", layout, build_plaintext(1, kaifaLayout));
+        CHECK_EQUAL(fits ? 1 + 12 + fillers : 0, layout.size());
+        CHECK(check_equivalent("fields", layout, build_plaintext(2, kaifaLayout)) == fits);
+    }
+}
+
+static void test_skeleton_limit()
+{
+    // A string outside of any OBIS element is never reported, it is part of the skeleton and does not fit
+    LayoutCache layout;
+    Bytes plaintext = build_plaintext(1, KAIFA_LAYOUTS[KaifaSingleShort]);
+    Bytes filler;
+
+    parse_hex("0A 820100", filler);
+    filler.resize(filler.size() + ESPDM_LAYOUT_MAX_SKELETON, 'x');
+    plaintext.insert(plaintext.end(), filler.begin(), filler.end());
+
+    CHECK(!check_equivalent("skeleton", layout, plaintext));
+    CHECK_EQUAL(0, layout.size());
+    CHECK(!check_equivalent("skeleton", layout, plaintext));
+}
+
+static void test_decoder()
+{
+    // The same through MeterDecoder, every telegram after the first one is read from its layout cache
+    TestMeter cachedMeter;
+    RecordingVisitor cachedValues;
+    cachedMeter.decoder.set_listener(&cachedValues);
+
+    for(uint32_t frameCounter = 1; frameCounter < 20; frameCounter++)
+    {
+        Bytes plaintext = build_plaintext(frameCounter, KAIFA_LAYOUTS[KaifaMultiFrame]);
+
+        if(frameCounter == 10)
+            plaintext[find_after(plaintext, "0906 0100200700FF")] = 0x10;
+
+        Bytes frames = build_mbus_frames(build_dlms_message(TEST_KEY, TEST_SYSTEM_TITLE, frameCounter, plaintext));
+
+        TestMeter fullMeter; // Fresh decoder, no cached layout
+        RecordingVisitor fullValues;
+        fullMeter.decoder.set_listener(&fullValues);
+
+        cachedValues.values.clear();
+        cachedMeter.feed(frames);
+        fullMeter.feed(frames);
+
+        CHECK_EQUAL(13, fullValues.values.size());
+        CHECK(cachedValues.values == fullValues.values);
+    }
+}
+
+int main()
+{
+    test_layouts();
+    test_mutations();
+    test_field_limit();
+    test_skeleton_limit();
+    test_decoder();
+
+    return test_result("test_layout");
+}
+
+#endif
@@ -0,0 +1,184 @@
+#if defined(ESPDM_HOST)
+
+/*
+ * DlmsMeter::loop() must not block the ESPHome main loop
+ *
+ * Runs the ESPHome component against the stubs in tests/stubs: a simulated Kaifa MA309M sends
+ * telegrams at 2400 baud into the UART while loop() is called every few milliseconds, every sensor
+ * state costs simulated time to publish. MQTT goes down for a while so readings are stored and
+ * flushed, and the raw tap is switched on. Checks that a single loop() call
+ *   - reads at most ESPDM_READ_CHUNK_SIZE bytes,
+ *   - handles at most one telegram and publishes no sensor states in the same call,
+ *   - stops publishing sensor states once ESPDM_PUBLISH_BUDGET is used up,
+ *   - and takes at most ESPDM_PUBLISH_BUDGET plus one publish in simulated time, and a few
+ *     milliseconds of CPU time (not wall time, so a busy CI machine does not fail the test),
+ * and that every telegram still ends up in the sensors and in MQTT.
+ */
+
+#include "espdm.h"
+#include "espdm_test.h"
+#include <cinttypes>
+#include <ctime>
+
+using namespace esphome::espdm;
+
+static const uint32_t LOOP_INTERVAL = 8000; // Time between two loop() calls in us, ESPHome runs them back to back when busy
+static const uint32_t STALL_INTERVAL = 400000; // Every STALL_EVERY calls another component blocks, so more than a chunk piles up in the UART
+static const size_t STALL_EVERY = 50;
+static const uint32_t PUBLISH_COST = 3000; // Simulated time per sensor state in us
+static const uint32_t TELEGRAM_INTERVAL = 5000000; // us
+static const double BYTE_TIME = 11 * 1000000.0 / 2400; // 8E1 at 2400 baud in us
+static const size_t TELEGRAM_COUNT = 60;
+static const uint64_t OUTAGE_START = 100000000; // MQTT is down between these times in us
+static const uint64_t OUTAGE_END = 160000000;
+static const double MAX_CPU_LOOP_TIME = 0.02; // Decoding a telegram takes well below a millisecond on a host, in s
+
+/*
+ * Bytes of all telegrams with the time they arrive at the UART
+ */
+struct SimulatedLine
+{
+    std::vector<uint8_t> bytes;
+    std::vector<uint64_t> arrival;
+    size_t position = 0;
+
+    void deliver(uart::UARTComponent &uart, uint64_t now)
+    {
+        while(this->position < this->bytes.size() && this->arrival[this->position] <= now)
+            uart.received.push_back(this->bytes[this->position++]);
+    }
+};
+
+static double thread_cpu_time()
+{
+    timespec time;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time);
+
+    return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+static size_t sensor_publishes(sensor::Sensor *sensors, size_t count, text_sensor::TextSensor &timestamp)
+{
+    size_t publishes = timestamp.publishes;
+
+    for(size_t i = 0; i < count; i++)
+        publishes += sensors[i].publishes;
+
+    return publishes;
+}
+
+int main()
+{
+    uart::UARTComponent uart;
+    mqtt::MQTTClientComponent mqtt;
+    sensor::Sensor sensors[12];
+    sensor::Sensor diagnostics[4];
+    text_sensor::TextSensor timestamp;
+    uint8_t key[sizeof(TEST_KEY)];
+
+    memcpy(key, TEST_KEY, sizeof(key));
+
+    DlmsMeter meter(&uart);
+    meter.set_key(key, sizeof(key));
+    meter.set_voltage_sensors(&sensors[0], &sensors[1], &sensors[2]);
+    meter.set_current_sensors(&sensors[3], &sensors[4], &sensors[5]);
+    meter.set_active_power_sensors(&sensors[6], &sensors[7]);
+    meter.set_active_energy_sensors(&sensors[8], &sensors[9]);
+    meter.set_reactive_energy_sensors(&sensors[10], &sensors[11]);
+    meter.set_timestamp_sensor(&timestamp);
+    meter.set_store_sensors(&diagnostics[0], &diagnostics[1]);
+    meter.set_suppressed_publish_sensors(&diagnostics[2], &diagnostics[3]);
+    meter.enable_mqtt(&mqtt, "meter");
+    meter.enable_aggregation(60000, "meter/aggregate");
+    meter.enable_store();
+    meter.enable_raw_tap("meter/raw");
+    meter.setup();
+
+    SimulatedLine line;
+
+    for(uint32_t frameCounter = 1; frameCounter <= TELEGRAM_COUNT; frameCounter++)
+    {
+        KaifaReading reading;
+        reading.voltage[0] = frameCounter;
+        reading.second = frameCounter % 60;
+
+        Bytes frames = build_mbus_frames(build_dlms_message(TEST_KEY, TEST_SYSTEM_TITLE, frameCounter, build_kaifa_plaintext(reading, KAIFA_LAYOUTS[KaifaMultiFrame], frameCounter)));
+        uint64_t start = (uint64_t) frameCounter * TELEGRAM_INTERVAL;
+
+        for(size_t i = 0; i < frames.size(); i++)
+        {
+            line.bytes.push_back(frames[i]);
+            line.arrival.push_back(start + (uint64_t) ((i + 1) * BYTE_TIME));
+        }
+    }
+
+    stubs::publish_cost() = PUBLISH_COST;
+    mqtt.receive("meter/raw/set", "both");
+
+    uint64_t end = (uint64_t) (TELEGRAM_COUNT + 2) * TELEGRAM_INTERVAL;
+    uint32_t maxLoopTime = 0;
+    double maxCpuLoopTime = 0;
+    size_t maxStatesPerCall = 0;
+    size_t loops = 0;
+
+    while(stubs::now() < end)
+    {
+        mqtt.connected = stubs::now() < OUTAGE_START || stubs::now() >= OUTAGE_END;
+        line.deliver(uart, stubs::now());
+
+        size_t readsBefore = uart.reads;
+        size_t statesBefore = sensor_publishes(sensors, 12, timestamp);
+        size_t reportsBefore = mqtt.published.size();
+
+        double cpuStart = thread_cpu_time();
+        meter.loop();
+        double cpuLoopTime = thread_cpu_time() - cpuStart;
+
+        size_t states = sensor_publishes(sensors, 12, timestamp) - statesBefore;
+        size_t reports = 0;
+        size_t tapped = 0;
+
+        for(size_t i = reportsBefore; i < mqtt.published.size(); i++)
+        {
+            if(mqtt.published[i].first == "meter")
+                reports++;
+            else if(mqtt.published[i].first.compare(0, 9, "meter/raw") == 0)
+                tapped++;
+        }
+
+        CHECK(uart.reads - readsBefore <= 1);
+        CHECK(reports <= ESPDM_STORE_FLUSH_BATCH); // A telegram, or a batch of stored readings
+        CHECK(tapped <= 2);
+        CHECK(states == 0 || (reports == 0 && tapped == 0)); // Never sensor states in the call that decoded a telegram
+
+        maxLoopTime = std::max(maxLoopTime, meter.get_max_loop_time());
+        maxCpuLoopTime = std::max(maxCpuLoopTime, cpuLoopTime);
+        maxStatesPerCall = std::max(maxStatesPerCall, states);
+        loops++;
+
+        stubs::now() += loops % STALL_EVERY == 0 ? STALL_INTERVAL : LOOP_INTERVAL;
+    }
+
+    size_t reports = 0;
+
+    for(const auto &message : mqtt.published)
+        reports += message.first == "meter";
+
+    printf("espdm %s: %zu loop() calls, longest %" PRIu32 " us simulated, %.3f ms CPU, %zu sensor states per call, %zu reports, %zu bytes read at most\n", ESPDM_VERSION, loops, maxLoopTime, maxCpuLoopTime * 1000, maxStatesPerCall, reports, uart.largestRead);
+
+    CHECK_EQUAL(ESPDM_READ_CHUNK_SIZE, uart.largestRead); // The rest stays in the UART for the next call
+    CHECK(uart.received.empty());
+    CHECK(maxLoopTime <= ESPDM_PUBLISH_BUDGET + PUBLISH_COST);
+    CHECK(maxCpuLoopTime <= MAX_CPU_LOOP_TIME);
+    CHECK(maxStatesPerCall > 1 && maxStatesPerCall < 13); // Batched, but not all at once
+
+    // Nothing was lost on the way
+    CHECK_EQUAL(TELEGRAM_COUNT, reports);
+    CHECK_EQUAL(TELEGRAM_COUNT, sensors[0].publishes);
+    CHECK_EQUAL(TELEGRAM_COUNT, (unsigned long long) (sensors[0].state * 10 + 0.5f));
+    CHECK_EQUAL(TELEGRAM_COUNT, timestamp.publishes);
+
+    return test_result("test_loop");
+}
+
+#endif
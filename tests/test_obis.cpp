@@ -0,0 +1,76 @@
+#if defined(ESPDM_HOST)
+
+/*
+ * OBIS registry: the perfect hash finds every supported code and nothing else
+ */
+
+#include "espdm_axdr.h"
+#include "espdm_obis.h"
+#include "espdm_test.h"
+
+using namespace esphome::espdm;
+
+static void code_of(const ObisEntry &entry, uint8_t *code)
+{
+    for(int i = 0; i < OBIS_CODE_LENGTH; i++)
+        code[i] = entry.key >> (8 * (OBIS_CODE_LENGTH - 1 - i));
+}
+
+static void test_registry()
+{
+    for(size_t i = 0; i < OBIS_REGISTRY_SIZE; i++)
+    {
+        uint8_t code[OBIS_CODE_LENGTH];
+        code_of(OBIS_REGISTRY[i], code);
+
+        CHECK(find_obis_entry(code) == &OBIS_REGISTRY[i]);
+
+        // Same C and D, so the same slot, but another code
+        for(int field = 0; field < OBIS_CODE_LENGTH; field++)
+        {
+            if(field == OBIS_C || field == OBIS_D)
+                continue;
+
+            uint8_t other[OBIS_CODE_LENGTH];
+            memcpy(other, code, sizeof(other));
+            other[field] ^= 0x01;
+
+            CHECK(find_obis_entry(other) == NULL);
+        }
+    }
+}
+
+static void test_unknown()
+{
+    size_t found = 0;
+
+    for(int c = 0; c < 0x100; c++)
+    {
+        for(int d = 0; d < 0x100; d++)
+        {
+            for(int medium = 0; medium < 2; medium++)
+            {
+                uint8_t code[OBIS_CODE_LENGTH] = { (uint8_t) (medium == 0 ? Medium::Abstract : Medium::Electricity), 0x00, (uint8_t) c, (uint8_t) d, 0x00, 0xFF };
+                const ObisEntry *entry = find_obis_entry(code);
+
+                if(entry != NULL)
+                {
+                    CHECK(entry->key == obis_key(code));
+                    found++;
+                }
+            }
+        }
+    }
+
+    CHECK_EQUAL(OBIS_REGISTRY_SIZE, found);
+}
+
+int main()
+{
+    test_registry();
+    test_unknown();
+
+    return test_result("test_obis");
+}
+
+#endif
@@ -0,0 +1,200 @@
+#if defined(ESPDM_HOST)
+
+/*
+ * PublishFilter: deadbands, minimum and maximum interval and publishing on change only
+ */
+
+#include "espdm_policy.h"
+#include "espdm_test.h"
+#include <cmath>
+
+using namespace esphome::espdm;
+
+static PublishPolicy policies[SensorGroupCount];
+
+static void reset_policies()
+{
+    for(PublishPolicy &policy : policies)
+        policy = PublishPolicy();
+}
+
+static void test_default()
+{
+    reset_policies();
+    PublishFilter filter(policies);
+
+    // The first value has no baseline and is always due, then every change is
+    CHECK(filter.filter(CodeType::VoltageL1, 230.0f, 0));
+    CHECK(!filter.filter(CodeType::VoltageL1, 230.0f, 1000));
+    CHECK(filter.filter(CodeType::VoltageL1, 230.1f, 2000));
+    CHECK(!filter.filter(CodeType::VoltageL1, 230.1f, 3000));
+    CHECK_EQUAL(2, filter.get_suppressed());
+
+    // Every code type has its own state
+    CHECK(filter.filter(CodeType::VoltageL2, 230.1f, 3000));
+
+    // Codes without a group like the timestamp are always due
+    CHECK(filter.filter(CodeType::Timestamp, 0, 4000));
+    CHECK(filter.filter(CodeType::Timestamp, 0, 5000));
+    CHECK_EQUAL(2, filter.get_suppressed());
+}
+
+static void test_absolute_deadband()
+{
+    reset_policies();
+    policies[GroupVoltage].absoluteDeadband = 1.0f;
+    PublishFilter filter(policies);
+
+    CHECK(filter.filter(CodeType::VoltageL1, 230.0f, 0));
+    CHECK(!filter.filter(CodeType::VoltageL1, 230.5f, 1000));
+    CHECK(!filter.filter(CodeType::VoltageL1, 229.0f, 2000)); // Exactly on the deadband is suppressed
+    CHECK(filter.filter(CodeType::VoltageL1, 231.25f, 3000));
+
+    // The deadband is around the last published value, slow drift is published once it crosses
+    CHECK(!filter.filter(CodeType::VoltageL1, 231.75f, 4000));
+    CHECK(!filter.filter(CodeType::VoltageL1, 232.25f, 5000));
+    CHECK(filter.filter(CodeType::VoltageL1, 232.5f, 6000));
+    CHECK(filter.filter(CodeType::VoltageL1, 231.0f, 7000)); // Crossing downwards
+
+    // Other groups are not affected
+    CHECK(filter.filter(CodeType::CurrentL1, 1.0f, 0));
+    CHECK(filter.filter(CodeType::CurrentL1, 1.01f, 1000));
+}
+
+static void test_relative_deadband()
+{
+    reset_policies();
+    policies[GroupActivePower].relativeDeadband = 0.1f;
+    PublishFilter filter(policies);
+
+    CHECK(filter.filter(CodeType::ActivePowerPlus, 1000.0f, 0));
+    CHECK(!filter.filter(CodeType::ActivePowerPlus, 1090.0f, 1000));
+    CHECK(filter.filter(CodeType::ActivePowerPlus, 1110.0f, 2000));
+    CHECK(!filter.filter(CodeType::ActivePowerPlus, 1000.0f, 3000)); // 10% of 1110
+    CHECK(filter.filter(CodeType::ActivePowerPlus, 990.0f, 4000));
+
+    // A relative deadband around zero lets every change through, the absolute one sets a floor
+    CHECK(filter.filter(CodeType::ActivePowerMinus, 0.0f, 0));
+    CHECK(filter.filter(CodeType::ActivePowerMinus, 1.0f, 1000));
+
+    policies[GroupActivePower].absoluteDeadband = 5.0f;
+
+    CHECK(!filter.filter(CodeType::ActivePowerMinus, 5.0f, 2000));
+    CHECK(filter.filter(CodeType::ActivePowerMinus, 7.0f, 3000));
+    CHECK(!filter.filter(CodeType::ActivePowerPlus, 1080.0f, 5000)); // The larger of both applies
+}
+
+static void test_min_interval()
+{
+    reset_policies();
+    policies[GroupCurrent].minInterval = 5000;
+    PublishFilter filter(policies);
+
+    CHECK(filter.filter(CodeType::CurrentL1, 1.0f, 10000));
+    CHECK(!filter.filter(CodeType::CurrentL1, 2.0f, 11000));
+    CHECK(!filter.filter(CodeType::CurrentL1, 3.0f, 14999));
+    CHECK(filter.filter(CodeType::CurrentL1, 3.0f, 15000));
+
+    // Once the interval passed, an unchanged value is still not due
+    CHECK(!filter.filter(CodeType::CurrentL1, 3.0f, 30000));
+    CHECK_EQUAL(3, filter.get_suppressed());
+}
+
+static void test_max_interval()
+{
+    reset_policies();
+    policies[GroupVoltage].absoluteDeadband = 10.0f;
+    policies[GroupVoltage].maxInterval = 60000;
+    PublishFilter filter(policies);
+
+    CHECK(filter.filter(CodeType::VoltageL1, 230.0f, 0));
+    CHECK(!filter.filter(CodeType::VoltageL1, 230.0f, 59999));
+    CHECK(filter.filter(CodeType::VoltageL1, 230.0f, 60000)); // Heartbeat without a change
+    CHECK(!filter.filter(CodeType::VoltageL1, 231.0f, 61000));
+    CHECK(filter.filter(CodeType::VoltageL1, 231.0f, 120000)); // Inside the deadband but due
+
+    // The heartbeat also forces a value suppressed by the minimum interval
+    policies[GroupVoltage].minInterval = 90000;
+
+    CHECK(!filter.filter(CodeType::VoltageL1, 300.0f, 170000));
+    CHECK(filter.filter(CodeType::VoltageL1, 300.0f, 180000));
+}
+
+static void test_on_change_only()
+{
+    reset_policies();
+    policies[GroupActiveEnergy].onChangeOnly = true;
+    policies[GroupActiveEnergy].absoluteDeadband = 100.0f; // Ignored for counters
+    policies[GroupActiveEnergy].maxInterval = 1000;
+    policies[GroupActiveEnergy].minInterval = 2000;
+    PublishFilter filter(policies);
+
+    CHECK(filter.filter(CodeType::ActiveEnergyPlus, 4531200.0f, 0));
+    CHECK(!filter.filter(CodeType::ActiveEnergyPlus, 4531200.0f, 10000)); // No heartbeat
+    CHECK(filter.filter(CodeType::ActiveEnergyPlus, 4531201.0f, 11000)); // Every change
+    CHECK(!filter.filter(CodeType::ActiveEnergyPlus, 4531202.0f, 12000)); // But not more often than minInterval
+    CHECK(filter.filter(CodeType::ActiveEnergyPlus, 4531202.0f, 13000));
+}
+
+static void test_check_and_commit()
+{
+    reset_policies();
+    policies[GroupVoltage].absoluteDeadband = 1.0f;
+    PublishFilter filter(policies);
+
+    // check() does not change any state, the grouped report commits all values of a reading that is due
+    CHECK(filter.check(CodeType::VoltageL1, 230.0f, 0));
+    CHECK(filter.check(CodeType::VoltageL1, 230.0f, 0));
+    filter.commit(CodeType::VoltageL1, 230.0f, 0);
+    CHECK(!filter.check(CodeType::VoltageL1, 230.5f, 1000));
+    filter.commit(CodeType::VoltageL1, 230.5f, 1000);
+    CHECK(filter.check(CodeType::VoltageL1, 231.75f, 2000));
+    CHECK_EQUAL(0, filter.get_suppressed());
+
+    filter.count_suppressed();
+    CHECK_EQUAL(1, filter.get_suppressed());
+}
+
+static void test_not_finite()
+{
+    reset_policies();
+    policies[GroupVoltage].absoluteDeadband = 1.0f;
+    PublishFilter filter(policies);
+
+    // After a value that is not a number the next value is always due
+    CHECK(filter.filter(CodeType::VoltageL1, NAN, 0));
+    CHECK(filter.filter(CodeType::VoltageL1, 230.0f, 1000));
+    CHECK(!filter.filter(CodeType::VoltageL1, 230.5f, 2000));
+}
+
+static void test_time_wraparound()
+{
+    reset_policies();
+    policies[GroupVoltage].minInterval = 5000;
+    policies[GroupVoltage].maxInterval = 60000;
+    PublishFilter filter(policies);
+
+    // millis() wraps after 49 days
+    CHECK(filter.filter(CodeType::VoltageL1, 230.0f, 0xFFFFF000));
+    CHECK(!filter.filter(CodeType::VoltageL1, 231.0f, 0xFFFFFFFF));
+    CHECK(filter.filter(CodeType::VoltageL1, 231.0f, 0x00000400)); // 5120 ms later
+    CHECK(!filter.filter(CodeType::VoltageL1, 231.0f, 0x00000400 + 59999));
+    CHECK(filter.filter(CodeType::VoltageL1, 231.0f, 0x00000400 + 60000));
+}
+
+int main()
+{
+    test_default();
+    test_absolute_deadband();
+    test_relative_deadband();
+    test_min_interval();
+    test_max_interval();
+    test_on_change_only();
+    test_check_and_commit();
+    test_not_finite();
+    test_time_wraparound();
+
+    return test_result("test_policy");
+}
+
+#endif
@@ -0,0 +1,233 @@
+#if defined(ESPDM_HOST)
+
+/*
+ * Stress test of the queue between the decode task and the main loop
+ *
+ * A producer task pushes as fast as it can while the main thread pops, first plain items through
+ * an SpscQueue, then telegrams through the same MeterDecoder and QueueingListener as background
+ * decoding on the device. Every item carries its sequence number in all of its fields, so a torn or
+ * reordered item is caught. Build with -DESPDM_SANITIZE=thread to have ThreadSanitizer check the
+ * memory ordering as well.
+ */
+
+#include "espdm_host.h"
+#include "espdm_pipeline.h"
+#include "espdm_task.h"
+#include "espdm_test.h"
+#include <algorithm>
+#include <cmath>
+
+using namespace esphome::espdm;
+
+static const uint64_t ITEM_COUNT = 200000;
+static const uint32_t TELEGRAM_COUNT = 2000;
+static const uint32_t CORRUPT_EVERY = 7; // Every 7th telegram has a flipped bit and is rejected
+
+struct Item
+{
+    uint64_t sequence;
+    uint64_t copies[7]; // sequence * (i + 1), checked by the consumer
+};
+
+typedef SpscQueue<Item, 8> ItemQueue;
+
+class ItemProducer : public Task
+{
+    public:
+        ItemProducer(ItemQueue &queue) : queue(queue) {}
+
+        ~ItemProducer()
+        {
+            stop();
+        }
+
+    protected:
+        void run() override
+        {
+            for(uint64_t sequence = 0; sequence < ITEM_COUNT && !should_stop(); sequence++)
+            {
+                Item item;
+                item.sequence = sequence;
+
+                for(size_t i = 0; i < 7; i++)
+                    item.copies[i] = sequence * (i + 1);
+
+                while(!this->queue.push(item))
+                    Task::sleep(0);
+            }
+        }
+
+    private:
+        ItemQueue &queue;
+};
+
+/*
+ * Waits for the consumer instead of dropping telegrams, like the pipelined replay
+ */
+class WaitingListener : public QueueingListener
+{
+    public:
+        WaitingListener(TelegramQueue &queue, Clock &clock) : QueueingListener(queue, clock) {}
+
+    protected:
+        bool wait_for_space() override
+        {
+            Task::sleep(0);
+            return true;
+        }
+};
+
+/*
+ * Decodes a prepared stream on its own thread, like the decode task on the ESP32
+ */
+class DecodeProducer : public Task
+{
+    public:
+        DecodeProducer(TelegramQueue &queue, const std::vector<Bytes> &telegrams) : listener(queue, clock), decoder(crypto, clock), telegrams(telegrams)
+        {
+            this->decoder.set_key(TEST_KEY, sizeof(TEST_KEY));
+            this->decoder.set_listener(&this->listener);
+        }
+
+        ~DecodeProducer()
+        {
+            stop();
+        }
+
+    protected:
+        void run() override
+        {
+            uint64_t now = 0;
+
+            for(size_t t = 0; t < this->telegrams.size() && !should_stop(); t++)
+            {
+                const Bytes &telegram = this->telegrams[t];
+
+                for(size_t i = 0; i < telegram.size(); i += 64)
+                {
+                    now += 1000;
+                    this->clock.set_micros(now);
+                    this->decoder.feed(telegram.data() + i, std::min((size_t) 64, telegram.size() - i));
+                }
+
+                // Gap between two telegrams
+                now += 200000;
+                this->clock.set_micros(now);
+                this->decoder.poll();
+            }
+        }
+
+    private:
+        OpensslGcmBackend crypto;
+        ManualClock clock;
+        WaitingListener listener;
+        MeterDecoder decoder;
+        const std::vector<Bytes> &telegrams;
+};
+
+static void test_items()
+{
+    ItemQueue queue;
+    ItemProducer producer(queue);
+
+    CHECK(producer.start("producer"));
+
+    uint64_t expected = 0;
+    uint64_t torn = 0;
+
+    while(expected < ITEM_COUNT)
+    {
+        Item item;
+
+        if(!queue.pop(item))
+        {
+            Task::sleep(0);
+            continue;
+        }
+
+        if(item.sequence != expected)
+            break;
+
+        for(size_t i = 0; i < 7; i++)
+            torn += item.copies[i] != item.sequence * (i + 1);
+
+        expected++;
+    }
+
+    producer.stop();
+
+    CHECK_EQUAL(ITEM_COUNT, expected);
+    CHECK_EQUAL(0, torn);
+    CHECK(queue.empty());
+}
+
+static void test_telegrams()
+{
+    std::vector<Bytes> telegrams;
+
+    for(uint32_t frameCounter = 1; frameCounter <= TELEGRAM_COUNT; frameCounter++)
+    {
+        KaifaReading reading;
+        reading.voltage[0] = frameCounter; // Voltage of L1 is sent by all layouts
+        reading.second = frameCounter % 60;
+
+        Bytes frames = build_mbus_frames(build_dlms_message(TEST_KEY, TEST_SYSTEM_TITLE, frameCounter, build_kaifa_plaintext(reading, KAIFA_LAYOUTS[frameCounter % KaifaLayoutCount], frameCounter)));
+
+        if(frameCounter % CORRUPT_EVERY == 0)
+            frames[frames.size() / 2] ^= 0x10;
+
+        telegrams.push_back(frames);
+    }
+
+    TelegramQueue queue;
+    DecodeProducer producer(queue, telegrams);
+
+    CHECK(producer.start("decoder"));
+
+    uint32_t accepted = 0;
+    uint32_t rejected = 0;
+    uint32_t lastFrameCounter = 0;
+    uint32_t mismatched = 0;
+
+    while(true)
+    {
+        TelegramEvent event;
+
+        if(!queue.pop(event))
+        {
+            if(!producer.is_running() && queue.empty()) // Checked in this order, the last push happened before running was cleared
+                break;
+
+            Task::sleep(0);
+            continue;
+        }
+
+        if(!event.accepted)
+        {
+            rejected++;
+            continue;
+        }
+
+        accepted++;
+        mismatched += event.frameCounter <= lastFrameCounter || event.frameCounter % CORRUPT_EVERY == 0;
+        mismatched += !event.reading.has(CodeType::VoltageL1) || lroundf(event.reading.get(CodeType::VoltageL1) * 10) != (long) event.frameCounter;
+        lastFrameCounter = event.frameCounter;
+    }
+
+    producer.stop();
+
+    CHECK_EQUAL(TELEGRAM_COUNT - TELEGRAM_COUNT / CORRUPT_EVERY, accepted);
+    CHECK(rejected >= TELEGRAM_COUNT / CORRUPT_EVERY);
+    CHECK_EQUAL(0, mismatched);
+    CHECK_EQUAL(TELEGRAM_COUNT, lastFrameCounter);
+}
+
+int main()
+{
+    test_items();
+    test_telegrams();
+
+    return test_result("test_queue");
+}
+
+#endif
@@ -0,0 +1,74 @@
+#if defined(ESPDM_HOST)
+
+/*
+ * ReportWriter: values that are not finite are written as JSON null, CBOR keeps them as floats
+ */
+
+#include "espdm_report.h"
+#include "espdm_test.h"
+#include <cmath>
+#include <string>
+
+using namespace esphome::espdm;
+
+static const uint32_t ALL_FIELDS = 0xFFFFFFFF;
+
+static std::string write_json(const MeterReading &reading)
+{
+    uint8_t buffer[ESPDM_REPORT_BUFFER_SIZE];
+    ReportWriter writer(ReportJson, buffer, sizeof(buffer));
+
+    writer.add_reading(reading, ALL_FIELDS);
+    size_t length = writer.finish();
+
+    return std::string((const char *) buffer, length);
+}
+
+static void test_json()
+{
+    MeterReading reading;
+    reading.set(CodeType::VoltageL1, 231.5f, 1);
+    reading.set(CodeType::VoltageL2, NAN, 1);
+    reading.set(CodeType::CurrentL1, INFINITY, 2);
+    reading.set(CodeType::CurrentL2, -INFINITY, 2);
+
+    std::string json = write_json(reading);
+    std::string expected = "{\"voltage_l1\":231.5,\"voltage_l2\":null,\"current_l1\":null,\"current_l2\":null}";
+
+    CHECK(json == expected);
+
+    if(json != expected)
+        fprintf(stderr, "Got %s\n", json.c_str());
+}
+
+static void test_cbor()
+{
+    MeterReading reading;
+    reading.set(CodeType::VoltageL1, NAN, 1);
+
+    uint8_t buffer[ESPDM_REPORT_BUFFER_SIZE];
+    ReportWriter writer(ReportCbor, buffer, sizeof(buffer));
+
+    writer.add_reading(reading, ALL_FIELDS);
+    size_t length = writer.finish();
+
+    // Indefinite map, key, single precision NaN, break
+    CHECK_EQUAL(1 + 1 + 5 + 1, length);
+    CHECK_EQUAL(0xFA, buffer[2]);
+
+    float value;
+    uint32_t bits = (uint32_t) buffer[3] << 24 | (uint32_t) buffer[4] << 16 | (uint32_t) buffer[5] << 8 | buffer[6];
+    memcpy(&value, &bits, sizeof(value));
+
+    CHECK(std::isnan(value));
+}
+
+int main()
+{
+    test_json();
+    test_cbor();
+
+    return test_result("test_report");
+}
+
+#endif
@@ -0,0 +1,256 @@
+#if defined(ESPDM_HOST)
+
+/*
+ * ReadingStore: order, wraparound, drop counting, retries, batched state writes and restoring from
+ * a FileBacking after a restart
+ */
+
+#include "espdm_store.h"
+#include "espdm_test.h"
+#include <cmath>
+#include <unistd.h>
+
+using namespace esphome::espdm;
+
+/*
+ * Readings carry their number in the voltage of L1
+ */
+static MeterReading make_reading(uint32_t number)
+{
+    MeterReading reading;
+    reading.set(CodeType::VoltageL1, number / 10.0f, 1);
+    reading.set(CodeType::ActiveEnergyPlus, 4531200 + number, 0);
+    snprintf(reading.timestamp, sizeof(reading.timestamp), "2021-01-25T15:%02u:%02uZ", (unsigned) (number / 60) % 60, (unsigned) number % 60);
+
+    return reading;
+}
+
+static uint32_t reading_number(const MeterReading &reading)
+{
+    return reading.has(CodeType::VoltageL1) ? lroundf(reading.get(CodeType::VoltageL1) * 10) : 0;
+}
+
+class RecordingSink : public ReadingSink
+{
+    public:
+        bool publish_reading(const MeterReading &reading) override
+        {
+            if(!this->connected)
+                return false;
+
+            this->numbers.push_back(reading_number(reading));
+            return true;
+        }
+
+        size_t flush_all(ReadingStore &store, uint32_t &now) // Flushes until the store is empty, returns the number of flushes
+        {
+            size_t flushes = 0;
+
+            while(!store.empty() && flushes < 1000)
+            {
+                now += ESPDM_STORE_FLUSH_INTERVAL;
+                store.flush(*this, now);
+                flushes++;
+            }
+
+            return flushes;
+        }
+
+        bool connected = true;
+        std::vector<uint32_t> numbers; // Delivered readings in order
+};
+
+/*
+ * Counts the writes that would go to flash
+ */
+class CountingBacking : public StoreBacking
+{
+    public:
+        bool load(uint8_t *records, size_t capacity, size_t &head, size_t &count) override { return false; }
+        bool save_record(size_t slot, const uint8_t *record) override { this->records++; return true; }
+        bool save_state(size_t head, size_t count) override { this->states++; this->count = count; return true; }
+
+        size_t records = 0;
+        size_t states = 0;
+        size_t count = 0; // Last saved count
+};
+
+static bool delivered_in_order(const std::vector<uint32_t> &numbers, uint32_t first, uint32_t last)
+{
+    if(numbers.size() != last - first + 1)
+        return false;
+
+    for(size_t i = 0; i < numbers.size(); i++)
+    {
+        if(numbers[i] != first + i)
+            return false;
+    }
+
+    return true;
+}
+
+static void test_record()
+{
+    uint8_t record[STORE_RECORD_SIZE];
+    MeterReading decoded;
+
+    encode_reading(make_reading(1234), record);
+    decode_reading(record, decoded);
+
+    CHECK_EQUAL(1234, reading_number(decoded));
+    CHECK_EQUAL(1, decoded.get_decimals(CodeType::VoltageL1));
+    CHECK(decoded.has(CodeType::ActiveEnergyPlus) && decoded.get(CodeType::ActiveEnergyPlus) == 4531200 + 1234);
+    CHECK(!decoded.has(CodeType::CurrentL1));
+    CHECK(strcmp(decoded.timestamp, "2021-01-25T15:20:34Z") == 0);
+}
+
+static void test_wraparound()
+{
+    ReadingStore store;
+    RecordingSink sink;
+    uint32_t now = 0;
+
+    for(uint32_t number = 1; number <= ESPDM_STORE_CAPACITY + 10; number++)
+        store.push(make_reading(number));
+
+    CHECK_EQUAL(ESPDM_STORE_CAPACITY, store.size());
+    CHECK_EQUAL(10, store.get_dropped());
+
+    // Batches at a bounded rate
+    now += ESPDM_STORE_FLUSH_INTERVAL;
+    CHECK_EQUAL(ESPDM_STORE_FLUSH_BATCH, store.flush(sink, now));
+    CHECK_EQUAL(0, store.flush(sink, now + ESPDM_STORE_FLUSH_INTERVAL - 1));
+
+    // A failed delivery keeps the reading for the next flush
+    sink.connected = false;
+    now += ESPDM_STORE_FLUSH_INTERVAL;
+    CHECK_EQUAL(0, store.flush(sink, now));
+    CHECK_EQUAL(ESPDM_STORE_CAPACITY - ESPDM_STORE_FLUSH_BATCH, store.size());
+    sink.connected = true;
+
+    sink.flush_all(store, now);
+
+    CHECK(store.empty());
+    CHECK(delivered_in_order(sink.numbers, 11, ESPDM_STORE_CAPACITY + 10)); // The oldest ten were overwritten
+    CHECK_EQUAL(10, store.get_dropped());
+
+    // Wraps around the end of the ring again after it was emptied
+    sink.numbers.clear();
+
+    for(uint32_t number = 100; number < 100 + ESPDM_STORE_CAPACITY / 2 + 3; number++)
+        store.push(make_reading(number));
+
+    sink.flush_all(store, now);
+    CHECK(delivered_in_order(sink.numbers, 100, 100 + ESPDM_STORE_CAPACITY / 2 + 2));
+}
+
+static void test_state_writes()
+{
+    ReadingStore store;
+    CountingBacking backing;
+    RecordingSink sink;
+    uint32_t now = 0;
+
+    store.set_backing(&backing);
+
+    size_t records = backing.records;
+    size_t states = backing.states;
+
+    for(uint32_t number = 1; number <= 4 * ESPDM_STORE_STATE_INTERVAL; number++)
+        store.push(make_reading(number));
+
+    CHECK_EQUAL(4 * ESPDM_STORE_STATE_INTERVAL, backing.records - records); // Every reading goes out right away
+    CHECK_EQUAL(4, backing.states - states); // Head and count only every ESPDM_STORE_STATE_INTERVAL readings
+    CHECK_EQUAL(4 * ESPDM_STORE_STATE_INTERVAL, backing.count);
+
+    sink.flush_all(store, now);
+
+    CHECK_EQUAL(0, backing.count); // Saved as soon as the store is empty
+}
+
+static void test_file_backing(const char *path)
+{
+    RecordingSink sink;
+    uint32_t now = 0;
+    uint32_t saved = 2 * ESPDM_STORE_STATE_INTERVAL; // Pushes covered by a saved state
+
+    unlink(path);
+
+    {
+        ReadingStore store;
+        FileBacking backing(path);
+        store.set_backing(&backing);
+
+        CHECK(store.empty());
+
+        for(uint32_t number = 1; number <= saved + ESPDM_STORE_STATE_INTERVAL - 1; number++)
+            store.push(make_reading(number));
+    } // Restart without a final save
+
+    {
+        ReadingStore store;
+        FileBacking backing(path);
+        store.set_backing(&backing);
+
+        // The last ESPDM_STORE_STATE_INTERVAL - 1 readings were written but not counted yet
+        CHECK_EQUAL(saved, store.size());
+
+        // Wrap around in the file, the full store saves its state with every ESPDM_STORE_STATE_INTERVAL readings
+        for(uint32_t number = saved + 1; number <= saved + ESPDM_STORE_CAPACITY; number++)
+            store.push(make_reading(number));
+
+        CHECK_EQUAL(ESPDM_STORE_CAPACITY, store.size());
+        CHECK_EQUAL(saved, store.get_dropped());
+    }
+
+    {
+        ReadingStore store;
+        FileBacking backing(path);
+        store.set_backing(&backing);
+
+        CHECK_EQUAL(ESPDM_STORE_CAPACITY, store.size());
+
+        sink.flush_all(store, now);
+        CHECK(delivered_in_order(sink.numbers, saved + 1, saved + ESPDM_STORE_CAPACITY));
+    }
+
+    {
+        ReadingStore store;
+        FileBacking backing(path);
+        store.set_backing(&backing);
+
+        CHECK(store.empty()); // Nothing is delivered twice once the store ran empty
+    }
+
+    // A file of another layout is not misread
+    FILE *file = fopen(path, "r+b");
+    CHECK(file != NULL);
+
+    if(file != NULL)
+    {
+        fputs("EDRS garbage", file);
+        fclose(file);
+    }
+
+    {
+        ReadingStore store;
+        FileBacking backing(path);
+        store.set_backing(&backing);
+
+        CHECK(store.empty());
+    }
+
+    unlink(path);
+}
+
+int main(int argc, char **argv)
+{
+    test_record();
+    test_wraparound();
+    test_state_writes();
+    test_file_backing(argc > 1 ? argv[1] : "test_store.bin");
+
+    return test_result("test_store");
+}
+
+#endif
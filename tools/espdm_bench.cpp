@@ -0,0 +1,765 @@
+#if defined(ESPDM_HOST)
+
+/*
+ * Telegram decode benchmark
+ *
+ * Times every stage of the pipeline separately over a corpus of synthetic Kaifa MA309M telegrams
+ * (single frame with short and extended length, multi frame) and optional captures of real meters.
+ * Results are written as JSON. The AES-GCM backends built into the host tools are compared on the
+ * Kaifa telegram, in cycles per byte of the time stamp counter where the CPU has one.
+ *
+ * Usage: espdm_bench [--iterations N] [--key HEX --capture FILE ...] [--output FILE]
+ */
+
+#include "espdm_decoder.h"
+#include "espdm_dlms.h"
+#include "espdm_host.h"
+#include "espdm_report.h"
+#include "espdm_telegram.h"
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+using namespace esphome::espdm;
+
+static const uint8_t BENCH_KEY[] = { 0x36, 0xC6, 0x66, 0x39, 0xE4, 0x8A, 0x8C, 0xA4, 0xD6, 0xBC, 0x8B, 0x28, 0x2A, 0x79, 0x3B, 0xBB };
+static const uint8_t BENCH_SYSTEM_TITLE[] = { 0x4B, 0x46, 0x4D, 0x10, 0x20, 0x00, 0x12, 0x34 };
+static const uint8_t BENCH_AUTHENTICATION_KEY[] = { 0x0F, 0x1E, 0x2D, 0x3C, 0x4B, 0x5A, 0x69, 0x78, 0x87, 0x96, 0xA5, 0xB4, 0xC3, 0xD2, 0xE1, 0xF0 };
+
+static volatile uint32_t sink; // Keeps the compiler from dropping benchmark loops
+
+struct StageResult
+{
+    const char *name;
+    double nsPerTelegram;
+    double bytesPerSecond;
+};
+
+struct CorpusEntry
+{
+    std::string name;
+    const char *source; // "synthetic" or "capture"
+    Bytes key;
+    Bytes frames; // Raw M-Bus frames of one telegram
+    Bytes plaintext; // Decrypted payload
+    Bytes systemTitle;
+    uint32_t frameCounter;
+    size_t frameCount;
+};
+
+/*
+ * Stores the values of a telegram the same way DlmsMeter does before reporting them
+ */
+class BenchVisitor : public ObisVisitor
+{
+    public:
+        void on_value(const ObisValue &value) override
+        {
+            store(value, find_obis_entry(value.obis));
+        }
+
+        void store(const ObisValue &value, const ObisEntry *entry)
+        {
+            if(entry != NULL && entry->handler == ObisHandler::NumericValue)
+                this->reading.set(entry->type, numeric_value(value, entry), value_decimals(value, entry));
+            else if(entry != NULL && entry->handler == ObisHandler::TimestampValue)
+                format_timestamp(value, this->reading.timestamp, sizeof(this->reading.timestamp));
+        }
+
+        MeterReading reading;
+};
+
+/*
+ * Records the layout of a telegram the same way MeterDecoder does
+ */
+class LayoutVisitor : public ObisVisitor
+{
+    public:
+        LayoutVisitor(const ByteView &view, LayoutCache &layout) : view(view), layout(layout) {}
+
+        void on_value(const ObisValue &value) override
+        {
+            this->layout.record(this->view, value, find_obis_entry(value.obis));
+        }
+
+    private:
+        const ByteView &view;
+        LayoutCache &layout;
+};
+
+class BenchListener : public MeterListener
+{
+    public:
+        void on_value(const ObisValue &value, const ObisEntry *entry) override { this->values++; }
+        void on_telegram(const TelegramInfo &info) override { this->telegrams++; }
+        void on_error(TelegramError error) override { this->errors++; }
+
+        uint32_t values = 0;
+        uint32_t telegrams = 0;
+        uint32_t errors = 0;
+};
+
+static size_t serialize_report(ReportFormat format, const MeterReading &reading, uint8_t *buffer, size_t size)
+{
+    ReportWriter writer(format, buffer, size);
+    writer.add_reading(reading, 0xFFFFFFFF); // All sensors configured
+#if ESPDM_ENABLE_STATS
+    writer.add_diagnostics(PipelineStats());
+#endif
+    return writer.finish();
+}
+
+template<typename F> static StageResult run_stage(const char *name, size_t iterations, size_t bytes, F body)
+{
+    for(size_t i = 0; i < iterations / 10 + 1; i++) // Warm up caches and branch predictors
+        body(i);
+
+    auto start = std::chrono::steady_clock::now();
+
+    for(size_t i = 0; i < iterations; i++)
+        body(i);
+
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+    StageResult result;
+    result.name = name;
+    result.nsPerTelegram = ns / iterations;
+    result.bytesPerSecond = ns > 0 ? (double) bytes * iterations * 1e9 / ns : 0;
+
+    return result;
+}
+
+static const double HDLC_LINE_RATE = 115200 / 10.0; // Bytes per second of a 115200 baud push meter, 8N1
+
+static bool prepare_entry(CorpusEntry &entry, OpensslGcmBackend &crypto)
+{
+    uint8_t buffer[MBUS_MAX_PAYLOAD_LENGTH];
+    MbusParser parser(buffer, sizeof(buffer));
+    bool complete = false;
+
+    for(uint8_t c : entry.frames)
+        complete = parser.feed(c) == FrameTelegramComplete;
+
+    if(!complete)
+        return false;
+
+    DlmsHeader header;
+
+    if(parse_dlms_header(parser.payload(), parser.payload_length(), header) != DlmsOk)
+        return false;
+
+    uint8_t iv[DLMS_IV_LENGTH];
+    build_dlms_iv(header, iv);
+
+    crypto.set_key(entry.key.data(), entry.key.size());
+
+    if(!crypto.decrypt(iv, sizeof(iv), NULL, 0, header.payload, header.payloadLength, NULL, 0))
+        return false;
+
+    entry.plaintext.assign(header.payload, header.payload + header.payloadLength);
+    entry.systemTitle.assign(header.systemTitle, header.systemTitle + DLMS_SYSTEM_TITLE_LENGTH);
+    entry.frameCounter = header.frameCounter;
+
+    return entry.plaintext.size() > DECODER_START_OFFSET && entry.plaintext[0] == 0x0F;
+}
+
+static void bench_entry(FILE *out, const CorpusEntry &entry, size_t iterations, bool first)
+{
+    OpensslGcmBackend crypto;
+    crypto.set_key(entry.key.data(), entry.key.size());
+
+    StageResult results[10];
+    size_t stageCount = 0;
+
+    // M-Bus framing
+
+    uint8_t buffer[MBUS_MAX_PAYLOAD_LENGTH];
+    MbusParser parser(buffer, sizeof(buffer));
+
+    results[stageCount++] = run_stage("mbus_framing", iterations, entry.frames.size(), [&](size_t)
+    {
+        for(uint8_t c : entry.frames)
+            parser.feed(c);
+
+        sink += parser.payload_length();
+        parser.reset();
+    });
+
+    for(uint8_t c : entry.frames) // Leave one telegram in the parser for the following stages
+        parser.feed(c);
+
+    Bytes payload(parser.payload(), parser.payload() + parser.payload_length());
+
+    // Same message in segmented HDLC frames, fed in chunks like the UART delivers them
+
+    Bytes hdlcFrames = build_hdlc_frames(payload);
+    uint8_t hdlcBuffer[MBUS_MAX_PAYLOAD_LENGTH];
+    HdlcParser hdlcParser(hdlcBuffer, sizeof(hdlcBuffer));
+
+    results[stageCount++] = run_stage("hdlc_framing", iterations, hdlcFrames.size(), [&](size_t)
+    {
+        for(size_t offset = 0; offset < hdlcFrames.size(); )
+        {
+            size_t consumed;
+            hdlcParser.feed(&hdlcFrames[offset], std::min((size_t) 64, hdlcFrames.size() - offset), consumed);
+            offset += consumed;
+        }
+
+        sink += hdlcParser.payload_length();
+        hdlcParser.reset();
+    });
+
+    // DLMS header validation
+
+    DlmsHeader header;
+
+    results[stageCount++] = run_stage("dlms_header", iterations, payload.size(), [&](size_t)
+    {
+        sink += parse_dlms_header(payload.data(), payload.size(), header);
+        sink += header.frameCounter;
+    });
+
+    // Decryption, runs in place so every pass turns the buffer into the other of ciphertext or plaintext
+
+    uint8_t iv[DLMS_IV_LENGTH];
+    build_dlms_iv(header, iv);
+
+    results[stageCount++] = run_stage("aes_gcm", iterations, header.payloadLength, [&](size_t)
+    {
+        crypto.decrypt(iv, sizeof(iv), NULL, 0, header.payload, header.payloadLength, NULL, 0);
+        sink += header.payload[0];
+    });
+
+    // OBIS decoding, including the registry lookup and scaling done by the listener
+
+    ByteView view(entry.plaintext.data(), entry.plaintext.size());
+    AxdrDecoder decoder;
+    BenchVisitor visitor;
+
+    results[stageCount++] = run_stage("obis_decode", iterations, entry.plaintext.size(), [&](size_t)
+    {
+        sink += decoder.decode(view, DECODER_START_OFFSET, visitor);
+    });
+
+    // Same through the layout cache, as MeterDecoder does for every telegram after the first
+
+    LayoutCache layout;
+    LayoutVisitor learner(view, layout);
+
+    layout.learn();
+    decoder.decode(view, DECODER_START_OFFSET, learner);
+    layout.commit(view, DECODER_START_OFFSET);
+
+    results[stageCount++] = run_stage("obis_decode_cached", iterations, entry.plaintext.size(), [&](size_t)
+    {
+        ObisValue value;
+        const ObisEntry *obisEntry;
+
+        if(!layout.matches(view, DECODER_START_OFFSET)) // Not cacheable, falls back to the full decode like MeterDecoder
+        {
+            sink += decoder.decode(view, DECODER_START_OFFSET, visitor);
+            return;
+        }
+
+        for(size_t i = 0; i < layout.size(); i++)
+        {
+            if(layout.read(view, i, value, obisEntry))
+                visitor.store(value, obisEntry);
+        }
+
+        sink += layout.size();
+    });
+
+    if(layout.size() == 0)
+        fprintf(stderr, "%s: Layout could not be cached, obis_decode_cached is the full decode\n", entry.name.c_str());
+
+    // MQTT report in both encodings
+
+    uint8_t report[ESPDM_REPORT_BUFFER_SIZE];
+    size_t jsonLength = serialize_report(ReportJson, visitor.reading, report, sizeof(report));
+    size_t cborLength = serialize_report(ReportCbor, visitor.reading, report, sizeof(report));
+
+    results[stageCount++] = run_stage("json_report", iterations, jsonLength, [&](size_t)
+    {
+        sink += serialize_report(ReportJson, visitor.reading, report, sizeof(report));
+    });
+
+    results[stageCount++] = run_stage("cbor_report", iterations, cborLength, [&](size_t)
+    {
+        sink += serialize_report(ReportCbor, visitor.reading, report, sizeof(report));
+    });
+
+    // Whole pipeline through MeterDecoder, every telegram needs a new frame counter to pass the replay check
+
+    size_t warmup = iterations / 10 + 1;
+    std::vector<Bytes> telegrams;
+
+    for(size_t i = 0; i < warmup + iterations; i++)
+        telegrams.push_back(build_mbus_frames(build_dlms_message(entry.key.data(), entry.systemTitle.data(), entry.frameCounter + i, entry.plaintext)));
+
+    HostClock clock;
+    MeterDecoder meterDecoder(crypto, clock);
+    BenchListener listener;
+    meterDecoder.set_listener(&listener);
+    meterDecoder.set_key(entry.key.data(), entry.key.size());
+
+    size_t next = 0;
+
+    results[stageCount++] = run_stage("end_to_end", iterations, telegrams[0].size(), [&](size_t)
+    {
+        meterDecoder.feed(telegrams[next].data(), telegrams[next].size());
+        next++;
+    });
+
+    // Same through HDLC, this is what has to keep up with a 115200 baud meter
+
+    std::vector<Bytes> hdlcTelegrams;
+
+    for(size_t i = 0; i < warmup + iterations; i++)
+        hdlcTelegrams.push_back(build_hdlc_frames(build_dlms_message(entry.key.data(), entry.systemTitle.data(), entry.frameCounter + i, entry.plaintext)));
+
+    MeterDecoder hdlcDecoder(crypto, clock);
+    hdlcDecoder.set_listener(&listener);
+    hdlcDecoder.set_transport(TransportHdlc);
+    hdlcDecoder.set_key(entry.key.data(), entry.key.size());
+
+    next = 0;
+
+    results[stageCount++] = run_stage("end_to_end_hdlc", iterations, hdlcTelegrams[0].size(), [&](size_t)
+    {
+        hdlcDecoder.feed(hdlcTelegrams[next].data(), hdlcTelegrams[next].size());
+        next++;
+    });
+
+    if(listener.errors > 0)
+        fprintf(stderr, "%s: %" PRIu32 " telegrams failed to decode\n", entry.name.c_str(), listener.errors);
+
+    fprintf(out, "%s\n    {\n", first ? "" : ",");
+    fprintf(out, "      \"name\": \"%s\",\n", entry.name.c_str());
+    fprintf(out, "      \"source\": \"%s\",\n", entry.source);
+    fprintf(out, "      \"frames\": %zu,\n", entry.frameCount);
+    fprintf(out, "      \"telegram_bytes\": %zu,\n", entry.frames.size());
+    fprintf(out, "      \"hdlc_telegram_bytes\": %zu,\n", hdlcFrames.size());
+    fprintf(out, "      \"hdlc_line_load_115200\": %.6f,\n", HDLC_LINE_RATE / results[stageCount - 1].bytesPerSecond); // Share of the CPU needed to keep up
+    fprintf(out, "      \"payload_bytes\": %zu,\n", entry.plaintext.size());
+    fprintf(out, "      \"extended_length\": %s,\n", header.extendedLength ? "true" : "false");
+    fprintf(out, "      \"values\": %" PRIu32 ",\n", listener.telegrams > 0 ? listener.values / listener.telegrams : 0);
+    fprintf(out, "      \"json_report_bytes\": %zu,\n", jsonLength);
+    fprintf(out, "      \"cbor_report_bytes\": %zu,\n", cborLength);
+    fprintf(out, "      \"stages\": {");
+
+    for(size_t i = 0; i < stageCount; i++)
+        fprintf(out, "%s\n        \"%s\": { \"ns_per_telegram\": %.1f, \"bytes_per_second\": %.0f }", i == 0 ? "" : ",", results[i].name, results[i].nsPerTelegram, results[i].bytesPerSecond);
+
+    fprintf(out, "\n      }\n    }");
+}
+
+/*
+ * OBIS lookup as it was done before the registry: a chain of comparisons on the C and D fields
+ */
+
+static const uint8_t LEGACY_TIMESTAMP[] = { 0x01, 0x00 };
+static const uint8_t LEGACY_SERIAL_NUMBER[] = { 0x60, 0x01 };
+static const uint8_t LEGACY_DEVICE_NAME[] = { 0x2A, 0x00 };
+static const uint8_t LEGACY_VOLTAGE_L1[] = { 0x20, 0x07 };
+static const uint8_t LEGACY_VOLTAGE_L2[] = { 0x34, 0x07 };
+static const uint8_t LEGACY_VOLTAGE_L3[] = { 0x48, 0x07 };
+static const uint8_t LEGACY_CURRENT_L1[] = { 0x1F, 0x07 };
+static const uint8_t LEGACY_CURRENT_L2[] = { 0x33, 0x07 };
+static const uint8_t LEGACY_CURRENT_L3[] = { 0x47, 0x07 };
+static const uint8_t LEGACY_ACTIVE_POWER_PLUS[] = { 0x01, 0x07 };
+static const uint8_t LEGACY_ACTIVE_POWER_MINUS[] = { 0x02, 0x07 };
+static const uint8_t LEGACY_ACTIVE_ENERGY_PLUS[] = { 0x01, 0x08 };
+static const uint8_t LEGACY_ACTIVE_ENERGY_MINUS[] = { 0x02, 0x08 };
+static const uint8_t LEGACY_REACTIVE_ENERGY_PLUS[] = { 0x03, 0x08 };
+static const uint8_t LEGACY_REACTIVE_ENERGY_MINUS[] = { 0x04, 0x08 };
+
+static __attribute__((noinline)) CodeType legacy_lookup(const uint8_t *code)
+{
+    if(code[OBIS_A] == Medium::Electricity)
+    {
+        if(memcmp(&code[OBIS_C], LEGACY_VOLTAGE_L1, 2) == 0)
+            return CodeType::VoltageL1;
+        else if(memcmp(&code[OBIS_C], LEGACY_VOLTAGE_L2, 2) == 0)
+            return CodeType::VoltageL2;
+        else if(memcmp(&code[OBIS_C], LEGACY_VOLTAGE_L3, 2) == 0)
+            return CodeType::VoltageL3;
+        else if(memcmp(&code[OBIS_C], LEGACY_CURRENT_L1, 2) == 0)
+            return CodeType::CurrentL1;
+        else if(memcmp(&code[OBIS_C], LEGACY_CURRENT_L2, 2) == 0)
+            return CodeType::CurrentL2;
+        else if(memcmp(&code[OBIS_C], LEGACY_CURRENT_L3, 2) == 0)
+            return CodeType::CurrentL3;
+        else if(memcmp(&code[OBIS_C], LEGACY_ACTIVE_POWER_PLUS, 2) == 0)
+            return CodeType::ActivePowerPlus;
+        else if(memcmp(&code[OBIS_C], LEGACY_ACTIVE_POWER_MINUS, 2) == 0)
+            return CodeType::ActivePowerMinus;
+        else if(memcmp(&code[OBIS_C], LEGACY_ACTIVE_ENERGY_PLUS, 2) == 0)
+            return CodeType::ActiveEnergyPlus;
+        else if(memcmp(&code[OBIS_C], LEGACY_ACTIVE_ENERGY_MINUS, 2) == 0)
+            return CodeType::ActiveEnergyMinus;
+        else if(memcmp(&code[OBIS_C], LEGACY_REACTIVE_ENERGY_PLUS, 2) == 0)
+            return CodeType::ReactiveEnergyPlus;
+        else if(memcmp(&code[OBIS_C], LEGACY_REACTIVE_ENERGY_MINUS, 2) == 0)
+            return CodeType::ReactiveEnergyMinus;
+    }
+    else if(code[OBIS_A] == Medium::Abstract)
+    {
+        if(memcmp(&code[OBIS_C], LEGACY_TIMESTAMP, 2) == 0)
+            return CodeType::Timestamp;
+        else if(memcmp(&code[OBIS_C], LEGACY_SERIAL_NUMBER, 2) == 0)
+            return CodeType::SerialNumber;
+        else if(memcmp(&code[OBIS_C], LEGACY_DEVICE_NAME, 2) == 0)
+            return CodeType::DeviceName;
+    }
+
+    return CodeType::Unknown;
+}
+
+static __attribute__((noinline)) CodeType registry_lookup(const uint8_t *code)
+{
+    const ObisEntry *entry = find_obis_entry(code);
+
+    return entry != NULL ? entry->type : CodeType::Unknown;
+}
+
+static void bench_lookup(FILE *out, size_t iterations)
+{
+    uint8_t codes[OBIS_REGISTRY_SIZE + 1][OBIS_CODE_LENGTH];
+
+    for(size_t i = 0; i < OBIS_REGISTRY_SIZE; i++)
+    {
+        for(int j = 0; j < OBIS_CODE_LENGTH; j++)
+            codes[i][j] = OBIS_REGISTRY[i].key >> (8 * (OBIS_CODE_LENGTH - 1 - j));
+    }
+
+    uint8_t unknown[OBIS_CODE_LENGTH] = { Medium::Electricity, 0x00, 0x0D, 0x07, 0x00, 0xFF }; // Power factor, not supported
+    memcpy(codes[OBIS_REGISTRY_SIZE], unknown, sizeof(unknown));
+
+    size_t codeCount = OBIS_REGISTRY_SIZE + 1;
+    size_t rounds = iterations * 10;
+
+    StageResult registry = run_stage("registry", rounds, 0, [&](size_t)
+    {
+        for(size_t i = 0; i < codeCount; i++)
+            sink += registry_lookup(codes[i]);
+    });
+
+    StageResult legacy = run_stage("memcmp_chain", rounds, 0, [&](size_t)
+    {
+        for(size_t i = 0; i < codeCount; i++)
+            sink += legacy_lookup(codes[i]);
+    });
+
+    fprintf(out, "  \"obis_lookup\": {\n");
+    fprintf(out, "    \"codes\": %zu,\n", codeCount);
+    fprintf(out, "    \"registry_ns_per_lookup\": %.2f,\n", registry.nsPerTelegram / codeCount);
+    fprintf(out, "    \"memcmp_chain_ns_per_lookup\": %.2f\n", legacy.nsPerTelegram / codeCount);
+    fprintf(out, "  },\n");
+}
+
+/*
+ * AES-GCM backends on the payload of the two frame Kaifa telegram
+ */
+
+static const char *CRYPTO_BACKEND_NAMES[] = { "", "mbedtls", "bearssl_ct", "bearssl_small", "bearssl_ct64", "openssl" }; // Indexed by ESPDM_CRYPTO_*
+
+static bool has_cycle_counter()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return true;
+#else
+    return false;
+#endif
+}
+
+static uint64_t cycle_counter() // Time stamp counter, ticks at the nominal clock and not the boost clock
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+struct CryptoRun
+{
+    const DlmsHeader *header;
+    const uint8_t *aad; // NULL to only decrypt
+    size_t aadLength;
+};
+
+static void bench_crypto_run(FILE *out, const char *name, CryptoBackend &backend, const CryptoRun &run, size_t iterations, bool last)
+{
+    uint8_t iv[DLMS_IV_LENGTH];
+    build_dlms_iv(*run.header, iv);
+
+    const uint8_t *tag = run.aad != NULL ? run.header->tag : NULL;
+    size_t length = run.header->payloadLength;
+    Bytes work(length);
+
+    // Every pass decrypts a fresh copy, the tag only matches the ciphertext
+
+    auto decrypt = [&]()
+    {
+        memcpy(work.data(), run.header->payload, length);
+        return backend.decrypt(iv, sizeof(iv), run.aad, run.aadLength, work.data(), length, tag, run.header->tagLength);
+    };
+
+    bool valid = decrypt() && work[0] == 0x0F;
+
+    for(size_t i = 0; i < iterations / 10 + 1; i++) // Warm up caches and branch predictors
+        sink += decrypt();
+
+    auto start = std::chrono::steady_clock::now();
+    uint64_t startCycles = cycle_counter();
+
+    for(size_t i = 0; i < iterations; i++)
+        sink += decrypt();
+
+    uint64_t cycles = cycle_counter() - startCycles;
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+    StageResult result;
+    result.name = name;
+    result.nsPerTelegram = ns / iterations;
+    result.bytesPerSecond = ns > 0 ? (double) length * iterations * 1e9 / ns : 0;
+
+    double cyclesPerByte = (double) cycles / iterations / length;
+
+    fprintf(out, "        \"%s\": { \"valid\": %s, \"ns_per_telegram\": %.1f, \"bytes_per_second\": %.0f, ", name, valid ? "true" : "false", result.nsPerTelegram, result.bytesPerSecond);
+
+    if(has_cycle_counter())
+        fprintf(out, "\"cycles_per_byte\": %.2f }%s\n", cyclesPerByte, last ? "" : ",");
+    else
+        fprintf(out, "\"cycles_per_byte\": null }%s\n", last ? "" : ",");
+}
+
+static void bench_crypto_backend(FILE *out, int id, CryptoBackend &backend, const CryptoRun &plain, const CryptoRun &authenticated, size_t iterations, bool first)
+{
+    backend.set_key(BENCH_KEY, sizeof(BENCH_KEY));
+
+    // A backend that accepts a broken tag must not show up as the fastest one
+
+    uint8_t iv[DLMS_IV_LENGTH];
+    build_dlms_iv(*authenticated.header, iv);
+
+    Bytes work(authenticated.header->payload, authenticated.header->payload + authenticated.header->payloadLength);
+    Bytes badTag(authenticated.header->tag, authenticated.header->tag + authenticated.header->tagLength);
+    badTag[0] ^= 0x01;
+
+    bool rejectsBadTag = !backend.decrypt(iv, sizeof(iv), authenticated.aad, authenticated.aadLength, work.data(), work.size(), badTag.data(), badTag.size());
+
+    fprintf(out, "%s\n      \"%s\": {\n", first ? "" : ",", CRYPTO_BACKEND_NAMES[id]);
+    fprintf(out, "        \"rejects_bad_tag\": %s,\n", rejectsBadTag ? "true" : "false");
+
+    bench_crypto_run(out, "decrypt", backend, plain, iterations, false);
+    bench_crypto_run(out, "decrypt_verify", backend, authenticated, iterations, true);
+
+    fprintf(out, "      }");
+}
+
+static bool bench_crypto_backends(FILE *out, size_t iterations)
+{
+    KaifaReading reading;
+    Bytes plaintext = build_kaifa_plaintext(reading, KAIFA_LAYOUTS[KaifaMultiFrame], 1);
+
+    Bytes plainMessage = build_dlms_message(BENCH_KEY, BENCH_SYSTEM_TITLE, 1, plaintext);
+    Bytes authenticatedMessage = build_dlms_message(BENCH_KEY, BENCH_SYSTEM_TITLE, 1, plaintext, BENCH_AUTHENTICATION_KEY);
+
+    DlmsHeader plainHeader;
+    DlmsHeader authenticatedHeader;
+
+    if(parse_dlms_header(plainMessage.data(), plainMessage.size(), plainHeader) != DlmsOk || parse_dlms_header(authenticatedMessage.data(), authenticatedMessage.size(), authenticatedHeader) != DlmsOk)
+    {
+        fprintf(stderr, "Synthetic telegram for the crypto backends does not parse\n");
+        return false;
+    }
+
+    uint8_t aad[1 + DLMS_AUTHENTICATION_KEY_LENGTH];
+    build_dlms_aad(authenticatedHeader, BENCH_AUTHENTICATION_KEY, aad);
+
+    CryptoRun plain = { &plainHeader, NULL, 0 };
+    CryptoRun authenticated = { &authenticatedHeader, aad, sizeof(aad) };
+
+    fprintf(out, "  \"crypto_backends\": {\n");
+    fprintf(out, "    \"payload_bytes\": %zu,\n", plainHeader.payloadLength);
+    fprintf(out, "    \"tag_bytes\": %zu,\n", authenticatedHeader.tagLength);
+    fprintf(out, "    \"cycle_counter\": %s,\n", has_cycle_counter() ? "\"tsc\"" : "null");
+    fprintf(out, "    \"default\": \"%s\",\n", CRYPTO_BACKEND_NAMES[ESPDM_CRYPTO_BACKEND]);
+    fprintf(out, "    \"backends\": {");
+
+    bool first = true;
+    size_t rounds = iterations * 10;
+
+#if defined(ESPDM_HAVE_MBEDTLS)
+    MbedtlsGcmBackend mbedtls;
+    bench_crypto_backend(out, ESPDM_CRYPTO_MBEDTLS, mbedtls, plain, authenticated, rounds, first);
+    first = false;
+#endif
+#if defined(ESPDM_HAVE_BEARSSL)
+    BearSslCtGcmBackend bearSslCt;
+    bench_crypto_backend(out, ESPDM_CRYPTO_BEARSSL_CT, bearSslCt, plain, authenticated, rounds, first);
+    first = false;
+
+    BearSslSmallGcmBackend bearSslSmall;
+    bench_crypto_backend(out, ESPDM_CRYPTO_BEARSSL_SMALL, bearSslSmall, plain, authenticated, rounds, false);
+
+    BearSslCt64GcmBackend bearSslCt64;
+    bench_crypto_backend(out, ESPDM_CRYPTO_BEARSSL_CT64, bearSslCt64, plain, authenticated, rounds, false);
+#endif
+
+    OpensslGcmBackend openssl;
+    bench_crypto_backend(out, ESPDM_CRYPTO_OPENSSL, openssl, plain, authenticated, rounds, first);
+
+    fprintf(out, "\n    }\n  }\n");
+
+    return true;
+}
+
+static void usage()
+{
+    fprintf(stderr, "Usage: espdm_bench [--iterations N] [--key HEX --capture FILE ...] [--output FILE]\n");
+}
+
+int main(int argc, char **argv)
+{
+    size_t iterations = 2000;
+    const char *outputPath = NULL;
+    const char *keyHex = NULL;
+    std::vector<const char *> captures;
+
+    for(int i = 1; i < argc; i++)
+    {
+        if(strcmp(argv[i], "--iterations") == 0 && i + 1 < argc)
+            iterations = strtoul(argv[++i], NULL, 10);
+        else if(strcmp(argv[i], "--key") == 0 && i + 1 < argc)
+            keyHex = argv[++i];
+        else if(strcmp(argv[i], "--capture") == 0 && i + 1 < argc)
+            captures.push_back(argv[++i]);
+        else if(strcmp(argv[i], "--output") == 0 && i + 1 < argc)
+            outputPath = argv[++i];
+        else
+            return usage(), 2;
+    }
+
+    if(iterations == 0 || (!captures.empty() && keyHex == NULL))
+        return usage(), 2;
+
+    OpensslGcmBackend crypto;
+    std::vector<CorpusEntry> corpus;
+
+    // Synthetic telegrams
+
+    KaifaReading reading;
+
+    for(const KaifaLayout &layout : KAIFA_LAYOUTS)
+    {
+        CorpusEntry entry;
+        entry.name = std::string("kaifa_") + layout.name;
+        entry.source = "synthetic";
+        entry.key.assign(BENCH_KEY, BENCH_KEY + sizeof(BENCH_KEY));
+
+        Bytes message = build_dlms_message(BENCH_KEY, BENCH_SYSTEM_TITLE, 1, build_kaifa_plaintext(reading, layout, 1));
+
+        entry.frames = build_mbus_frames(message);
+        entry.frameCount = (message.size() + MBUS_FRAME_PAYLOAD_LENGTH - 1) / MBUS_FRAME_PAYLOAD_LENGTH;
+
+        if(!prepare_entry(entry, crypto))
+        {
+            fprintf(stderr, "%s: Synthetic telegram does not decode\n", layout.name);
+            return 1;
+        }
+
+        corpus.push_back(entry);
+    }
+
+    // Captured telegrams, every distinct telegram length of a capture is benchmarked once
+
+    Bytes key;
+
+    if(keyHex != NULL && (!parse_hex(keyHex, key) || key.size() != 16))
+    {
+        fprintf(stderr, "Key must be 16 bytes of hex\n");
+        return 2;
+    }
+
+    for(const char *path : captures)
+    {
+        Bytes stream;
+
+        if(!read_file(path, stream))
+        {
+            fprintf(stderr, "%s: Cannot read capture\n", path);
+            return 1;
+        }
+
+        std::vector<size_t> lengths;
+
+        for(const Bytes &telegram : split_mbus_telegrams(stream))
+        {
+            bool seen = false;
+
+            for(size_t length : lengths)
+                seen = seen || length == telegram.size();
+
+            if(seen)
+                continue;
+
+            CorpusEntry entry;
+            entry.name = std::string(path) + "#" + std::to_string(lengths.size());
+            entry.source = "capture";
+            entry.key = key;
+            entry.frames = telegram;
+
+            entry.frameCount = 0;
+
+            for(size_t offset = 0; offset + 1 < telegram.size(); offset += telegram[offset + 1] + MBUS_HEADER_INTRO_LENGTH + MBUS_FOOTER_LENGTH)
+                entry.frameCount++; // Walk the length fields, the capture is already known to be well formed
+
+            if(!prepare_entry(entry, crypto))
+            {
+                fprintf(stderr, "%s: Telegram does not decode with the given key, skipped\n", entry.name.c_str());
+                continue;
+            }
+
+            lengths.push_back(telegram.size());
+            corpus.push_back(entry);
+        }
+    }
+
+    FILE *out = outputPath != NULL ? fopen(outputPath, "w") : stdout;
+
+    if(out == NULL)
+    {
+        fprintf(stderr, "%s: Cannot open output\n", outputPath);
+        return 1;
+    }
+
+    fprintf(out, "{\n  \"iterations\": %zu,\n  \"corpus\": [", iterations);
+
+    for(size_t i = 0; i < corpus.size(); i++)
+        bench_entry(out, corpus[i], iterations, i == 0);
+
+    fprintf(out, "\n  ],\n");
+
+    bench_lookup(out, iterations);
+
+    if(!bench_crypto_backends(out, iterations))
+        return 1;
+
+    fprintf(out, "}\n");
+
+    if(out != stdout)
+        fclose(out);
+
+    return 0;
+}
+
+#endif
@@ -0,0 +1,788 @@
+#if defined(ESPDM_HOST)
+
+/*
+ * Offline replay of captured UART streams
+ *
+ * Runs captures through the same MeterDecoder as the device and prints every decoded telegram as
+ * CSV or JSON lines. Telegrams are split exactly like on the device: by the final segment marker of
+ * the M-Bus frames and, for meters that do not send one, by the read timeout. --transport hdlc reads
+ * HDLC frames instead, split by their segmentation bit. The time it needs
+ * comes from the capture (timestamped format) or is derived from the baud rate (raw format).
+ *
+ * Raw captures contain the bytes as read from the UART. Timestamped captures are text, one chunk
+ * per line as "<milliseconds> <hex bytes>", lines starting with # are ignored.
+ *
+ * With --outage the MQTT connection is considered down between two replay times. Telegrams received
+ * in that time go into the same ReadingStore as on the device and are printed without frame counter
+ * once they are flushed after the outage, --store keeps the store in a file like the flash backing.
+ *
+ * --pipelined decodes on a separate thread and hands the telegrams over through the same queue as the
+ * background decoding on the device, build with -DESPDM_SANITIZE=thread to check it with TSan.
+ *
+ * --auth-key checks the GCM tag of authenticated telegrams like set_authentication_key() on the device.
+ *
+ * --tap writes the encrypted and/or decrypted telegrams to the --tap-output file, like the raw tap
+ * on the device publishes them. Every record is the TapPoint byte, the length as two bytes big endian
+ * and the telegram.
+ *
+ * Usage: espdm_replay --key HEX [--auth-key HEX] [--format csv|json] [--transport mbus|hdlc] [--timestamped] [--baud N] [--read-timeout MS]
+ *                     [--outage FROM-TO]... [--store FILE] [--pipelined] [--jobs N] [--output FILE]
+ *                     [--tap encrypted|decrypted|both --tap-output FILE]
+ *                     FILE... ("-" reads stdin)
+ */
+
+#include "espdm_decoder.h"
+#include "espdm_host.h"
+#include "espdm_pipeline.h"
+#include "espdm_report.h"
+#include "espdm_store.h"
+#include "espdm_task.h"
+#include "espdm_telegram.h"
+#include <atomic>
+#include <cinttypes>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <utility>
+
+using namespace esphome::espdm;
+
+static const size_t REPLAY_CHUNK_SIZE = 64; // Same as ESPDM_READ_CHUNK_SIZE, the most the device reads per loop
+static const uint32_t REPLAY_LOOP_INTERVAL = 16; // Typical time between two loop() calls on the device in ms
+static const size_t REPLAY_FLUSH_SIZE = 64 * 1024; // Output is written in blocks of this size when streaming
+static const int UART_BITS_PER_BYTE = 11; // M-Bus uses 8E1: start bit, 8 data bits, parity and stop bit
+
+enum OutputFormat
+{
+    FormatCsv,
+    FormatJson
+};
+
+struct ReplayOptions
+{
+    Bytes key;
+    Bytes authenticationKey; // Empty skips the tag check
+    OutputFormat format = FormatCsv;
+    TransportType transport = TransportMbus;
+    bool timestamped = false;
+    uint32_t baud = 2400;
+    uint32_t readTimeout = 100;
+    std::vector<std::pair<uint64_t, uint64_t>> outages; // MQTT is down from first to second, in ms
+    const char *storePath = NULL; // File backing of the store
+    bool pipelined = false; // Decode on a separate thread
+    uint8_t tapPoints = 0; // TapPoint bits written to tapFile
+    FILE *tapFile = NULL;
+};
+
+/*
+ * Output of one capture, either streamed to a file or collected for ordered output after a parallel run
+ */
+class ReplayOutput
+{
+    public:
+        ReplayOutput(FILE *file) : file(file) {}
+
+        void printf(const char *format, ...) __attribute__((format(printf, 2, 3)))
+        {
+            char line[1024];
+
+            va_list args;
+            va_start(args, format);
+            int length = vsnprintf(line, sizeof(line), format, args);
+            va_end(args);
+
+            if(length > 0)
+                this->buffer.append(line, (size_t) length < sizeof(line) ? length : sizeof(line) - 1);
+
+            if(this->file != NULL && this->buffer.size() >= REPLAY_FLUSH_SIZE)
+                flush();
+        }
+
+        void flush() // Only writes when streaming, collected output stays until write_to()
+        {
+            if(this->file != NULL)
+                write_to(this->file);
+        }
+
+        void write_to(FILE *file)
+        {
+            fwrite(this->buffer.data(), 1, this->buffer.size(), file);
+            this->buffer.clear();
+        }
+
+    private:
+        FILE *file; // NULL to collect everything in memory
+        std::string buffer;
+};
+
+struct ReplayResult
+{
+    ReplayOutput output;
+    uint32_t telegrams = 0;
+    uint32_t errors = 0;
+    uint32_t stored = 0; // Telegrams which went into the store
+    bool readError = false;
+
+    ReplayResult(FILE *file) : output(file) {}
+};
+
+/*
+ * Collects the values of a telegram and prints them once it was accepted, or stores them during an outage
+ */
+class ReplayListener : public MeterListener, public ReadingSink
+{
+    public:
+        ReplayListener(const char *path, const ReplayOptions &options, ManualClock &clock, ReplayResult &result) : path(path), options(options), clock(clock), result(result) {}
+
+        void on_value(const ObisValue &value, const ObisEntry *entry) override
+        {
+            if(entry == NULL)
+                return;
+
+            if(entry->handler == ObisHandler::NumericValue)
+                this->reading.set(entry->type, numeric_value(value, entry), value_decimals(value, entry));
+            else if(entry->handler == ObisHandler::TimestampValue)
+                format_timestamp(value, this->reading.timestamp, sizeof(this->reading.timestamp));
+        }
+
+        void on_telegram(const TelegramInfo &info) override
+        {
+            if(connected())
+            {
+                print(this->reading, &info.frameCounter, this->clock.get_micros() / 1000);
+            }
+            else
+            {
+                this->store.push(this->reading);
+                this->result.stored++;
+            }
+
+            this->result.telegrams++;
+            this->reading.clear();
+        }
+
+        void on_error(TelegramError error) override
+        {
+            print_error(error, this->clock.get_micros() / 1000);
+
+            this->result.errors++;
+            this->reading.clear();
+        }
+
+        void on_event(const TelegramEvent &event) // Telegram from the decoding thread, does not touch the clock
+        {
+            if(event.accepted)
+            {
+                print(event.reading, &event.frameCounter, event.time);
+                this->result.telegrams++;
+            }
+            else
+            {
+                print_error(event.error, event.time);
+                this->result.errors++;
+            }
+        }
+
+        bool publish_reading(const MeterReading &reading) override
+        {
+            if(!connected())
+                return false;
+
+            print(reading, NULL, this->clock.get_micros() / 1000);
+            return true;
+        }
+
+        void set_backing(StoreBacking *backing)
+        {
+            this->store.set_backing(backing);
+        }
+
+        void loop() // Called after every loop iteration of the device
+        {
+            if(connected())
+                this->store.flush(*this, this->clock.millis());
+        }
+
+        void drain() // Flushes what is left in the store at the end of the capture as the device would
+        {
+            while(!this->store.empty() && connected())
+            {
+                this->clock.set_micros(this->clock.get_micros() + REPLAY_LOOP_INTERVAL * 1000);
+                loop();
+            }
+        }
+
+    private:
+        bool connected() const
+        {
+            uint64_t time = this->clock.get_micros() / 1000;
+
+            for(const std::pair<uint64_t, uint64_t> &outage : this->options.outages)
+            {
+                if(time >= outage.first && time < outage.second)
+                    return false;
+            }
+
+            return true;
+        }
+
+        void print(const MeterReading &reading, const uint32_t *frameCounter, uint64_t time) // frameCounter is NULL for stored readings
+        {
+            ReplayOutput &out = this->result.output;
+
+            if(this->options.format == FormatCsv)
+            {
+                out.printf("%s,%" PRIu64 ",", this->path.c_str(), time);
+
+                if(frameCounter != NULL)
+                    out.printf("%" PRIu32, *frameCounter);
+
+                out.printf(",%s", reading.timestamp);
+
+                for(int i = CodeType::VoltageL1; i < CodeType::CodeTypeCount; i++)
+                {
+                    if(reading.has((CodeType) i))
+                        out.printf(",%.*f", reading.get_decimals((CodeType) i), reading.get((CodeType) i));
+                    else if(channel_enabled((CodeType) i))
+                        out.printf(",");
+                }
+
+                out.printf("\n");
+            }
+            else
+            {
+                out.printf("{\"file\":\"%s\",\"time\":%" PRIu64, this->path.c_str(), time);
+
+                if(frameCounter != NULL)
+                    out.printf(",\"frame_counter\":%" PRIu32, *frameCounter);
+                else
+                    out.printf(",\"stored\":true");
+
+                out.printf(",\"timestamp\":\"%s\"", reading.timestamp);
+
+                for(int i = CodeType::VoltageL1; i < CodeType::CodeTypeCount; i++)
+                {
+                    if(reading.has((CodeType) i))
+                        out.printf(",\"%s\":%.*f", CODE_TYPE_NAMES[i], reading.get_decimals((CodeType) i), reading.get((CodeType) i));
+                }
+
+                out.printf("}\n");
+            }
+        }
+
+        void print_error(TelegramError error, uint64_t time)
+        {
+            if(this->options.format == FormatJson)
+                this->result.output.printf("{\"file\":\"%s\",\"time\":%" PRIu64 ",\"error\":\"%s\"}\n", this->path.c_str(), time, telegram_error_name(error));
+        }
+
+        std::string path; // Already escaped for the output format
+        const ReplayOptions &options;
+        ManualClock &clock;
+        ReplayResult &result;
+
+        MeterReading reading; // Values of the current telegram
+        ReadingStore store; // Readings received while MQTT is down
+};
+
+/*
+ * Feeds chunks into the decoder the way the device loop does: the read timeout is checked while no
+ * data arrives, every chunk is fed at the time it was received.
+ */
+/*
+ * Writes tapped telegrams to a file, on whatever thread the decoder runs on
+ */
+class FileTap : public TelegramTap
+{
+    public:
+        FileTap(FILE *file) : file(file) {}
+
+        void on_raw_telegram(TapPoint point, const uint8_t *data, size_t length) override
+        {
+            uint8_t header[] = { (uint8_t) point, (uint8_t) (length >> 8), (uint8_t) length };
+
+            fwrite(header, 1, sizeof(header), this->file);
+            fwrite(data, 1, length, this->file);
+        }
+
+    private:
+        FILE *file;
+};
+
+class ReplaySession
+{
+    public:
+        ReplaySession(const ReplayOptions &options, ManualClock &clock, MeterDecoder &decoder, ReplayListener *listener) : options(options), clock(clock), decoder(decoder), listener(listener) {} // listener is NULL when pipelined
+
+        void feed(uint64_t time, const uint8_t *data, size_t length)
+        {
+            uint64_t timeout = (uint64_t) this->options.readTimeout * 1000;
+
+            if(this->started && time > this->lastFeed + timeout) // Device would have polled in between and hit the read timeout
+                poll_at(this->lastFeed + timeout + 1000);
+
+            this->clock.set_micros(time);
+
+            for(size_t offset = 0; offset < length; offset += REPLAY_CHUNK_SIZE)
+                this->decoder.feed(&data[offset], length - offset < REPLAY_CHUNK_SIZE ? length - offset : REPLAY_CHUNK_SIZE);
+
+            if(this->listener != NULL)
+                this->listener->loop();
+            this->lastFeed = time;
+            this->started = true;
+        }
+
+        void finish()
+        {
+            if(this->started)
+                poll_at(this->lastFeed + (uint64_t) this->options.readTimeout * 1000 + 1000);
+
+            if(this->listener != NULL)
+                this->listener->drain();
+        }
+
+    private:
+        void poll_at(uint64_t time)
+        {
+            this->clock.set_micros(time);
+            this->decoder.poll();
+            if(this->listener != NULL)
+                this->listener->loop();
+        }
+
+        const ReplayOptions &options;
+        ManualClock &clock;
+        MeterDecoder &decoder;
+        ReplayListener *listener;
+
+        uint64_t lastFeed = 0; // Time of the last chunk in microseconds
+        bool started = false;
+};
+
+static std::string escape(const char *text, OutputFormat format)
+{
+    std::string out;
+    bool quote = false;
+
+    for(const char *c = text; *c != '\0'; c++)
+    {
+        if(*c == '"' || (format == FormatJson && *c == '\\'))
+            out += format == FormatJson ? '\\' : '"';
+
+        quote = quote || *c == ',' || *c == '"';
+        out += *c;
+    }
+
+    return format == FormatCsv && quote ? "\"" + out + "\"" : out;
+}
+
+static bool replay_raw(FILE *file, const ReplayOptions &options, ReplaySession &session)
+{
+    uint8_t buffer[REPLAY_FLUSH_SIZE];
+    uint64_t bytes = 0;
+    size_t count;
+
+    // Without timestamps the bytes arrive back to back at the configured baud rate and the device picks up
+    // whatever was received since the last loop iteration
+    size_t chunkSize = (uint64_t) options.baud * REPLAY_LOOP_INTERVAL / UART_BITS_PER_BYTE / 1000;
+
+    if(chunkSize < 1)
+        chunkSize = 1;
+    else if(chunkSize > REPLAY_CHUNK_SIZE)
+        chunkSize = REPLAY_CHUNK_SIZE;
+
+    while((count = fread(buffer, 1, sizeof(buffer), file)) > 0)
+    {
+        for(size_t offset = 0; offset < count; offset += chunkSize)
+        {
+            size_t length = count - offset < chunkSize ? count - offset : chunkSize;
+
+            bytes += length;
+            session.feed(bytes * UART_BITS_PER_BYTE * 1000000 / options.baud, &buffer[offset], length);
+        }
+    }
+
+    return !ferror(file);
+}
+
+static bool replay_timestamped(FILE *file, ReplaySession &session, const char *path)
+{
+    char *line = NULL;
+    size_t capacity = 0;
+    size_t lineNumber = 0;
+    Bytes chunk;
+
+    while(getline(&line, &capacity, file) >= 0)
+    {
+        lineNumber++;
+
+        if(line[0] == '#' || line[strspn(line, " \t\r\n")] == '\0')
+            continue;
+
+        char *hex = NULL;
+        uint64_t time = strtoull(line, &hex, 10);
+
+        hex[strcspn(hex, "\r\n")] = '\0';
+
+        if(hex == line || !parse_hex(hex, chunk))
+        {
+            fprintf(stderr, "%s:%zu: Invalid chunk\n", path, lineNumber);
+            continue;
+        }
+
+        session.feed(time * 1000, chunk.data(), chunk.size());
+    }
+
+    free(line);
+
+    return !ferror(file);
+}
+
+/*
+ * Queues the decoded telegrams for the replay thread, waits instead of dropping them when the queue is full
+ */
+class PipelinedListener : public QueueingListener
+{
+    public:
+        PipelinedListener(TelegramQueue &queue, Clock &clock) : QueueingListener(queue, clock) {}
+
+    protected:
+        bool wait_for_space() override
+        {
+            Task::sleep(0);
+            return true;
+        }
+};
+
+/*
+ * Feeds a whole capture into the decoder on its own thread
+ */
+class ReplayTask : public Task
+{
+    public:
+        ReplayTask(FILE *file, const char *path, const ReplayOptions &options, ReplaySession &session) : file(file), path(path), options(options), session(session) {}
+
+        ~ReplayTask()
+        {
+            stop();
+        }
+
+        bool ok() const // Only valid once the task stopped
+        {
+            return this->readOk;
+        }
+
+    protected:
+        void run() override // Always reads the whole capture, there is no reason to stop early
+        {
+            this->readOk = this->options.timestamped ? replay_timestamped(this->file, this->session, this->path) : replay_raw(this->file, this->options, this->session);
+            this->session.finish();
+        }
+
+    private:
+        FILE *file;
+        const char *path;
+        const ReplayOptions &options;
+        ReplaySession &session;
+        bool readOk = false;
+};
+
+static bool replay_pipelined(FILE *file, const char *path, const ReplayOptions &options, ManualClock &clock, MeterDecoder &decoder, ReplayListener &listener)
+{
+    TelegramQueue queue;
+    PipelinedListener producer(queue, clock);
+    ReplaySession session(options, clock, decoder, NULL); // The clock and decoder belong to the task from here on
+    ReplayTask task(file, path, options, session);
+    TelegramEvent event;
+
+    decoder.set_listener(&producer);
+
+    if(!task.start("replay"))
+        return false;
+
+    while(true)
+    {
+        if(queue.pop(event))
+            listener.on_event(event);
+        else if(!task.is_running() && queue.empty()) // Everything was pushed before the task stopped running
+            break;
+        else
+            Task::sleep(0);
+    }
+
+    task.stop();
+
+    return task.ok();
+}
+
+static void replay(const char *path, const ReplayOptions &options, ReplayResult &result)
+{
+    FILE *file = strcmp(path, "-") == 0 ? stdin : fopen(path, options.timestamped ? "r" : "rb");
+
+    if(file == NULL)
+    {
+        result.readError = true;
+        return;
+    }
+
+    OpensslGcmBackend crypto;
+    ManualClock clock;
+    MeterDecoder decoder(crypto, clock);
+    ReplayListener listener(escape(path, options.format).c_str(), options, clock, result);
+    ReplaySession session(options, clock, decoder, &listener);
+    FileBacking *backing = options.storePath != NULL ? new FileBacking(options.storePath) : NULL;
+
+    listener.set_backing(backing);
+
+    decoder.set_listener(&listener);
+    decoder.set_transport(options.transport);
+
+    FileTap tap(options.tapFile);
+
+    if(options.tapFile != NULL)
+    {
+        decoder.set_tap(&tap);
+        decoder.set_tap_points(options.tapPoints);
+    }
+    decoder.set_key(options.key.data(), options.key.size());
+    decoder.set_authentication_key(options.authenticationKey.empty() ? NULL : options.authenticationKey.data());
+    decoder.set_read_timeout(options.readTimeout);
+
+    bool ok;
+
+    if(options.pipelined)
+    {
+        ok = replay_pipelined(file, path, options, clock, decoder, listener);
+    }
+    else
+    {
+        ok = options.timestamped ? replay_timestamped(file, session, path) : replay_raw(file, options, session);
+        session.finish();
+    }
+
+    result.readError = !ok;
+    result.output.flush();
+
+    if(file != stdin)
+        fclose(file);
+
+    delete backing;
+}
+
+static void usage()
+{
+    fprintf(stderr, "Usage: espdm_replay --key HEX [--auth-key HEX] [--format csv|json] [--transport mbus|hdlc] [--timestamped] [--baud N] [--read-timeout MS] [--outage FROM-TO]... [--store FILE] [--pipelined] [--jobs N] [--output FILE] [--tap encrypted|decrypted|both --tap-output FILE] FILE...\n");
+}
+
+int main(int argc, char **argv)
+{
+    ReplayOptions options;
+    const char *outputPath = NULL;
+    const char *tapPath = NULL;
+    size_t jobs = 1;
+    std::vector<const char *> paths;
+
+    for(int i = 1; i < argc; i++)
+    {
+        if(strcmp(argv[i], "--key") == 0 && i + 1 < argc)
+        {
+            if(!parse_hex(argv[++i], options.key) || options.key.size() != 16)
+            {
+                fprintf(stderr, "Key must be 16 bytes of hex\n");
+                return 2;
+            }
+        }
+        else if(strcmp(argv[i], "--auth-key") == 0 && i + 1 < argc)
+        {
+            if(!parse_hex(argv[++i], options.authenticationKey) || options.authenticationKey.size() != DLMS_AUTHENTICATION_KEY_LENGTH)
+            {
+                fprintf(stderr, "Authentication key must be 16 bytes of hex\n");
+                return 2;
+            }
+        }
+        else if(strcmp(argv[i], "--format") == 0 && i + 1 < argc)
+        {
+            i++;
+
+            if(strcmp(argv[i], "csv") == 0)
+                options.format = FormatCsv;
+            else if(strcmp(argv[i], "json") == 0)
+                options.format = FormatJson;
+            else
+                return usage(), 2;
+        }
+        else if(strcmp(argv[i], "--transport") == 0 && i + 1 < argc)
+        {
+            i++;
+
+            if(strcmp(argv[i], "mbus") == 0)
+                options.transport = TransportMbus;
+            else if(strcmp(argv[i], "hdlc") == 0)
+                options.transport = TransportHdlc;
+            else
+                return usage(), 2;
+        }
+        else if(strcmp(argv[i], "--timestamped") == 0)
+            options.timestamped = true;
+        else if(strcmp(argv[i], "--baud") == 0 && i + 1 < argc)
+            options.baud = strtoul(argv[++i], NULL, 10);
+        else if(strcmp(argv[i], "--read-timeout") == 0 && i + 1 < argc)
+            options.readTimeout = strtoul(argv[++i], NULL, 10);
+        else if(strcmp(argv[i], "--outage") == 0 && i + 1 < argc)
+        {
+            char *end = NULL;
+            uint64_t from = strtoull(argv[++i], &end, 10);
+
+            if(*end != '-')
+                return usage(), 2;
+
+            options.outages.push_back(std::make_pair(from, strtoull(end + 1, NULL, 10)));
+        }
+        else if(strcmp(argv[i], "--store") == 0 && i + 1 < argc)
+            options.storePath = argv[++i];
+        else if(strcmp(argv[i], "--pipelined") == 0)
+            options.pipelined = true;
+        else if(strcmp(argv[i], "--jobs") == 0 && i + 1 < argc)
+            jobs = strtoul(argv[++i], NULL, 10);
+        else if(strcmp(argv[i], "--output") == 0 && i + 1 < argc)
+            outputPath = argv[++i];
+        else if(strcmp(argv[i], "--tap") == 0 && i + 1 < argc)
+        {
+            i++;
+
+            if(strcmp(argv[i], "encrypted") == 0)
+                options.tapPoints = TapEncrypted;
+            else if(strcmp(argv[i], "decrypted") == 0)
+                options.tapPoints = TapDecrypted;
+            else if(strcmp(argv[i], "both") == 0)
+                options.tapPoints = TapEncrypted | TapDecrypted;
+            else
+                return usage(), 2;
+        }
+        else if(strcmp(argv[i], "--tap-output") == 0 && i + 1 < argc)
+            tapPath = argv[++i];
+        else if(argv[i][0] == '-' && argv[i][1] != '\0')
+            return usage(), 2;
+        else
+            paths.push_back(argv[i]);
+    }
+
+    if(options.key.empty() || paths.empty() || options.baud == 0)
+        return usage(), 2;
+
+    if(options.pipelined && (!options.outages.empty() || options.storePath != NULL))
+    {
+        fprintf(stderr, "--pipelined does not support --outage and --store\n");
+        return 2;
+    }
+
+    if(options.storePath != NULL && paths.size() > 1)
+    {
+        fprintf(stderr, "--store only works with a single capture\n");
+        return 2;
+    }
+
+    if((options.tapPoints != 0) != (tapPath != NULL))
+    {
+        fprintf(stderr, "--tap and --tap-output go together\n");
+        return 2;
+    }
+
+    if(tapPath != NULL)
+    {
+        if(jobs != 1)
+        {
+            fprintf(stderr, "--tap only works with --jobs 1\n");
+            return 2;
+        }
+
+        options.tapFile = fopen(tapPath, "wb");
+
+        if(options.tapFile == NULL)
+        {
+            fprintf(stderr, "%s: Cannot open tap output\n", tapPath);
+            return 1;
+        }
+    }
+
+    if(jobs == 0)
+        jobs = std::thread::hardware_concurrency() > 0 ? std::thread::hardware_concurrency() : 1;
+
+    if(jobs > paths.size())
+        jobs = paths.size();
+
+    FILE *out = outputPath != NULL ? fopen(outputPath, "w") : stdout;
+
+    if(out == NULL)
+    {
+        fprintf(stderr, "%s: Cannot open output\n", outputPath);
+        return 1;
+    }
+
+    if(options.format == FormatCsv)
+    {
+        fprintf(out, "file,time,frame_counter,timestamp");
+
+        for(int i = CodeType::VoltageL1; i < CodeType::CodeTypeCount; i++)
+        {
+            if(channel_enabled((CodeType) i))
+                fprintf(out, ",%s", CODE_TYPE_NAMES[i]);
+        }
+
+        fprintf(out, "\n");
+    }
+
+    // A single capture is streamed, several captures are decoded in parallel and printed in the given order
+
+    std::vector<ReplayResult *> results;
+
+    for(size_t i = 0; i < paths.size(); i++)
+        results.push_back(new ReplayResult(jobs == 1 ? out : NULL));
+
+    std::atomic<size_t> next(0);
+    std::vector<std::thread> workers;
+
+    auto work = [&]()
+    {
+        for(size_t i = next++; i < paths.size(); i = next++)
+            replay(paths[i], options, *results[i]);
+    };
+
+    for(size_t i = 1; i < jobs; i++)
+        workers.push_back(std::thread(work));
+
+    work();
+
+    for(std::thread &worker : workers)
+        worker.join();
+
+    int status = 0;
+
+    for(size_t i = 0; i < paths.size(); i++)
+    {
+        results[i]->output.write_to(out);
+
+        if(results[i]->readError)
+        {
+            fprintf(stderr, "%s: Cannot read capture\n", paths[i]);
+            status = 1;
+        }
+
+        fprintf(stderr, "%s: %" PRIu32 " telegrams, %" PRIu32 " errors, %" PRIu32 " stored\n", paths[i], results[i]->telegrams, results[i]->errors, results[i]->stored);
+
+        delete results[i];
+    }
+
+    if(out != stdout)
+        fclose(out);
+
+    if(options.tapFile != NULL)
+        fclose(options.tapFile);
+
+    return status;
+}
+
+#endif
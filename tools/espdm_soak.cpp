@@ -0,0 +1,591 @@
+#if defined(ESPDM_HOST)
+
+/*
+ * Soak test with a simulated meter
+ *
+ * A simulated Kaifa MA309M sends encrypted telegrams with an incrementing frame counter over a fake
+ * UART into the same MeterDecoder as the device. The UART has a receive buffer of the configured
+ * size that drops bytes when it is full, and it is read like DlmsMeter::loop() does: at most 64 bytes
+ * per loop iteration, poll() when nothing arrived. Time is simulated, hours of telegrams run in seconds.
+ *
+ * Disturbances, each with a probability per telegram:
+ *   --corrupt   one byte of the telegram is flipped
+ *   --drop      one byte of the telegram is lost
+ *   --burst     the next telegram follows without a gap
+ * --jitter adds up to the given time to the gaps between telegrams and loop iterations, --split-reads
+ * reads a random number of bytes per loop iteration instead of as many as possible.
+ *
+ * Every telegram carries its frame counter in the voltage of L1, so telegrams that are decoded with
+ * values of another telegram are caught. The report lists lost telegrams (sent intact but not
+ * decoded, separately if they followed a damaged one), the latency from the last byte on the line to
+ * the decoded telegram and the heap use of the decoder, counted by replacing the global operator new
+ * and delete. The exit code is 1 if an intact telegram was lost, values were mixed up, a damaged
+ * telegram was decoded or the decoder kept heap memory.
+ *
+ * Usage: espdm_soak [--hours H] [--interval MS] [--layout NAME|mixed] [--transport mbus|hdlc] [--baud N]
+ *                   [--corrupt P] [--drop P] [--burst P] [--jitter MS] [--split-reads]
+ *                   [--rx-buffer BYTES] [--loop-interval MS] [--read-timeout MS] [--seed N] [--output FILE]
+ */
+
+#include "espdm_decoder.h"
+#include "espdm_host.h"
+#include "espdm_telegram.h"
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace esphome::espdm;
+
+static const uint8_t SOAK_KEY[] = { 0x36, 0xC6, 0x66, 0x39, 0xE4, 0x8A, 0x8C, 0xA4, 0xD6, 0xBC, 0x8B, 0x28, 0x2A, 0x79, 0x3B, 0xBB };
+static const uint8_t SOAK_SYSTEM_TITLE[] = { 0x4B, 0x46, 0x4D, 0x10, 0x20, 0x00, 0x12, 0x34 };
+
+static const size_t SOAK_READ_CHUNK_SIZE = 64; // Same as ESPDM_READ_CHUNK_SIZE
+static const int MBUS_BITS_PER_BYTE = 11; // 8E1
+static const int HDLC_BITS_PER_BYTE = 10; // 8N1
+
+/*
+ * Heap accounting, allocations made while the decoder runs are counted separately
+ */
+struct HeapStats
+{
+    uint64_t allocations = 0;
+    size_t liveBytes = 0;
+    size_t peakBytes = 0;
+
+    uint64_t decoderAllocations = 0;
+    size_t decoderLiveBytes = 0; // Still allocated by the decoder
+};
+
+static HeapStats heap;
+static bool inDecoder = false; // Set around every call into the decoder
+
+struct AllocationHeader // In front of every allocation, keeps the 16 byte alignment of malloc
+{
+    size_t size;
+    size_t fromDecoder;
+};
+
+static void *counted_alloc(size_t size)
+{
+    AllocationHeader *header = (AllocationHeader *) malloc(sizeof(AllocationHeader) + size);
+
+    if(header == NULL)
+        throw std::bad_alloc();
+
+    header->size = size;
+    header->fromDecoder = inDecoder;
+
+    heap.allocations++;
+    heap.liveBytes += size;
+    heap.peakBytes = std::max(heap.peakBytes, heap.liveBytes);
+
+    if(inDecoder)
+    {
+        heap.decoderAllocations++;
+        heap.decoderLiveBytes += size;
+    }
+
+    return header + 1;
+}
+
+static void counted_free(void *pointer)
+{
+    if(pointer == NULL)
+        return;
+
+    AllocationHeader *header = (AllocationHeader *) pointer - 1;
+
+    heap.liveBytes -= header->size;
+
+    if(header->fromDecoder)
+        heap.decoderLiveBytes -= header->size;
+
+    free(header);
+}
+
+void *operator new(size_t size) { return counted_alloc(size); }
+void *operator new[](size_t size) { return counted_alloc(size); }
+void operator delete(void *pointer) noexcept { counted_free(pointer); }
+void operator delete[](void *pointer) noexcept { counted_free(pointer); }
+
+struct SoakOptions
+{
+    double hours = 24;
+    uint32_t interval = 5000; // Time between two telegrams in ms
+    int layout = -1; // Index into KAIFA_LAYOUTS, -1 picks one at random for every telegram
+    TransportType transport = TransportMbus;
+    uint32_t baud = 2400;
+    double corrupt = 0;
+    double drop = 0;
+    double burst = 0;
+    uint32_t jitter = 0; // ms
+    bool splitReads = false;
+    size_t rxBuffer = 1024; // Same as rx_buffer_size in meter01.example.yaml
+    uint32_t loopInterval = 16; // Typical time between two loop() calls on the device in ms
+    uint32_t readTimeout = 100;
+    uint32_t seed = 1;
+};
+
+/*
+ * One telegram on the line
+ */
+struct SentTelegram
+{
+    uint64_t end = 0; // Time the last byte was on the line in microseconds
+    bool damaged = false; // Corrupted or a byte was dropped, may not decode
+    bool decoded = false;
+};
+
+/*
+ * Simulated meter, produces the bytes of one telegram after another with their arrival times
+ */
+class MeterSimulator
+{
+    public:
+        MeterSimulator(const SoakOptions &options, std::mt19937 &random) : options(options), random(random)
+        {
+            this->byteTime = (options.transport == TransportHdlc ? HDLC_BITS_PER_BYTE : MBUS_BITS_PER_BYTE) * 1000000.0 / options.baud;
+            this->line.reserve(MBUS_MAX_PAYLOAD_LENGTH * 2); // Keeps the simulator itself out of the heap growth
+        }
+
+        bool next_byte(uint64_t now, uint8_t &byte) // False if no byte arrived until now
+        {
+            if(this->position == this->line.size())
+            {
+                if(this->nextStart > now)
+                    return false;
+
+                start_telegram();
+            }
+
+            if(this->start + (uint64_t) ((this->position + 1) * this->byteTime) > now)
+                return false;
+
+            byte = this->line[this->position++];
+
+            if(this->position == this->line.size())
+                this->sent.back().end = this->start + (uint64_t) (this->line.size() * this->byteTime);
+
+            return true;
+        }
+
+        std::vector<SentTelegram> sent; // Indexed by frame counter - 1
+        uint64_t corrupted = 0;
+        uint64_t dropped = 0;
+        uint64_t bursts = 0;
+        uint64_t bytes = 0;
+
+    private:
+        void start_telegram()
+        {
+            uint32_t frameCounter = this->sent.size() + 1;
+            int layout = this->options.layout >= 0 ? this->options.layout : this->random() % KaifaLayoutCount;
+
+            KaifaReading reading;
+            reading.voltage[0] = frameCounter; // Ties the decoded values to the telegram, sent by all layouts
+            reading.second = frameCounter % 60;
+
+            Bytes message = build_dlms_message(SOAK_KEY, SOAK_SYSTEM_TITLE, frameCounter, build_kaifa_plaintext(reading, KAIFA_LAYOUTS[layout], frameCounter));
+            this->line = this->options.transport == TransportHdlc ? build_hdlc_frames(message) : build_mbus_frames(message);
+
+            SentTelegram telegram;
+
+            if(chance(this->options.corrupt))
+            {
+                this->line[this->random() % this->line.size()] ^= 1 << (this->random() % 8);
+                telegram.damaged = true;
+                this->corrupted++;
+            }
+
+            if(chance(this->options.drop))
+            {
+                this->line.erase(this->line.begin() + this->random() % this->line.size());
+                telegram.damaged = true;
+                this->dropped++;
+            }
+
+            this->sent.push_back(telegram);
+            this->bytes += this->line.size();
+            this->position = 0;
+            this->start = std::max(this->nextStart, this->lastEnd);
+            this->lastEnd = this->start + (uint64_t) (this->line.size() * this->byteTime);
+
+            if(chance(this->options.burst))
+            {
+                this->nextStart = this->lastEnd; // Right behind this one
+                this->bursts++;
+            }
+            else
+            {
+                this->nextStart = this->start + (uint64_t) this->options.interval * 1000 + jitter();
+            }
+        }
+
+        bool chance(double probability)
+        {
+            return probability > 0 && std::uniform_real_distribution<double>(0, 1)(this->random) < probability;
+        }
+
+        uint64_t jitter()
+        {
+            return this->options.jitter > 0 ? this->random() % ((uint64_t) this->options.jitter * 1000) : 0;
+        }
+
+        const SoakOptions &options;
+        std::mt19937 &random;
+
+        double byteTime; // Microseconds per byte on the line
+        Bytes line; // Bytes of the current telegram
+        size_t position = 0; // Bytes of line that arrived
+        uint64_t start = 0; // First byte of the current telegram
+        uint64_t lastEnd = 0;
+        uint64_t nextStart = 0;
+};
+
+/*
+ * Receive side of a UART like uart::UARTComponent, bytes that do not fit into the buffer are lost
+ */
+class FakeUart
+{
+    public:
+        FakeUart(size_t size) : buffer(size) {}
+
+        void receive(uint8_t byte)
+        {
+            if(this->count == this->buffer.size())
+            {
+                this->overflows++;
+                return;
+            }
+
+            this->buffer[(this->head + this->count) % this->buffer.size()] = byte;
+            this->count++;
+        }
+
+        int available() const
+        {
+            return this->count;
+        }
+
+        bool read_array(uint8_t *data, size_t length)
+        {
+            if(length > this->count)
+                return false;
+
+            for(size_t i = 0; i < length; i++)
+                data[i] = this->buffer[(this->head + i) % this->buffer.size()];
+
+            this->head = (this->head + length) % this->buffer.size();
+            this->count -= length;
+
+            return true;
+        }
+
+        uint64_t overflows = 0; // Bytes lost because the buffer was full
+
+    private:
+        std::vector<uint8_t> buffer;
+        size_t head = 0;
+        size_t count = 0;
+};
+
+class SoakListener : public MeterListener
+{
+    public:
+        SoakListener(MeterSimulator &meter, ManualClock &clock) : meter(meter), clock(clock) {}
+
+        void on_value(const ObisValue &value, const ObisEntry *entry) override
+        {
+            if(entry != NULL && entry->handler == ObisHandler::NumericValue && entry->type == CodeType::VoltageL1)
+                this->tag = lroundf(numeric_value(value, entry) * 10);
+        }
+
+        void on_telegram(const TelegramInfo &info) override
+        {
+            if(info.frameCounter == 0 || info.frameCounter > this->meter.sent.size())
+            {
+                this->unknown++;
+                return;
+            }
+
+            SentTelegram &telegram = this->meter.sent[info.frameCounter - 1];
+
+            if(value_channel_enabled(CodeType::VoltageL1) && this->tag != (info.frameCounter & 0xFFFF))
+                this->mismatched++;
+
+            telegram.decoded = true;
+            this->latencies.push_back(this->clock.get_micros() - telegram.end);
+            this->tag = -1;
+        }
+
+        void on_error(TelegramError error) override
+        {
+            this->errors[error]++;
+            this->tag = -1;
+        }
+
+        std::vector<uint64_t> latencies; // Microseconds from the last byte on the line to the decoded telegram
+        uint64_t errors[TelegramErrorCount] = {};
+        uint64_t mismatched = 0; // Decoded with values of another telegram
+        uint64_t unknown = 0; // Frame counter that was never sent
+
+    private:
+        MeterSimulator &meter;
+        ManualClock &clock;
+        long tag = -1; // Voltage of L1 in 0.1 V of the telegram being decoded, the low bits of its frame counter
+};
+
+static uint64_t percentile(const std::vector<uint64_t> &sorted, double p)
+{
+    return sorted.empty() ? 0 : sorted[std::min(sorted.size() - 1, (size_t) (p * sorted.size()))];
+}
+
+static void usage()
+{
+    fprintf(stderr, "Usage: espdm_soak [--hours H] [--interval MS] [--layout single_short|single_extended|multi_frame|multi_frame_padded|mixed] [--transport mbus|hdlc] [--baud N] [--corrupt P] [--drop P] [--burst P] [--jitter MS] [--split-reads] [--rx-buffer BYTES] [--loop-interval MS] [--read-timeout MS] [--seed N] [--output FILE]\n");
+}
+
+int main(int argc, char **argv)
+{
+    SoakOptions options;
+    const char *outputPath = NULL;
+
+    for(int i = 1; i < argc; i++)
+    {
+        if(strcmp(argv[i], "--hours") == 0 && i + 1 < argc)
+            options.hours = strtod(argv[++i], NULL);
+        else if(strcmp(argv[i], "--interval") == 0 && i + 1 < argc)
+            options.interval = strtoul(argv[++i], NULL, 10);
+        else if(strcmp(argv[i], "--layout") == 0 && i + 1 < argc)
+        {
+            i++;
+            options.layout = -2;
+
+            if(strcmp(argv[i], "mixed") == 0)
+                options.layout = -1;
+
+            for(size_t l = 0; l < KaifaLayoutCount; l++)
+            {
+                if(strcmp(argv[i], KAIFA_LAYOUTS[l].name) == 0)
+                    options.layout = l;
+            }
+
+            if(options.layout == -2)
+                return usage(), 2;
+        }
+        else if(strcmp(argv[i], "--transport") == 0 && i + 1 < argc)
+        {
+            i++;
+
+            if(strcmp(argv[i], "mbus") == 0)
+                options.transport = TransportMbus;
+            else if(strcmp(argv[i], "hdlc") == 0)
+                options.transport = TransportHdlc;
+            else
+                return usage(), 2;
+        }
+        else if(strcmp(argv[i], "--baud") == 0 && i + 1 < argc)
+            options.baud = strtoul(argv[++i], NULL, 10);
+        else if(strcmp(argv[i], "--corrupt") == 0 && i + 1 < argc)
+            options.corrupt = strtod(argv[++i], NULL);
+        else if(strcmp(argv[i], "--drop") == 0 && i + 1 < argc)
+            options.drop = strtod(argv[++i], NULL);
+        else if(strcmp(argv[i], "--burst") == 0 && i + 1 < argc)
+            options.burst = strtod(argv[++i], NULL);
+        else if(strcmp(argv[i], "--jitter") == 0 && i + 1 < argc)
+            options.jitter = strtoul(argv[++i], NULL, 10);
+        else if(strcmp(argv[i], "--split-reads") == 0)
+            options.splitReads = true;
+        else if(strcmp(argv[i], "--rx-buffer") == 0 && i + 1 < argc)
+            options.rxBuffer = strtoul(argv[++i], NULL, 10);
+        else if(strcmp(argv[i], "--loop-interval") == 0 && i + 1 < argc)
+            options.loopInterval = strtoul(argv[++i], NULL, 10);
+        else if(strcmp(argv[i], "--read-timeout") == 0 && i + 1 < argc)
+            options.readTimeout = strtoul(argv[++i], NULL, 10);
+        else if(strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+            options.seed = strtoul(argv[++i], NULL, 10);
+        else if(strcmp(argv[i], "--output") == 0 && i + 1 < argc)
+            outputPath = argv[++i];
+        else
+            return usage(), 2;
+    }
+
+    if(options.hours <= 0 || options.interval == 0 || options.baud == 0 || options.rxBuffer == 0 || options.loopInterval == 0)
+        return usage(), 2;
+
+    std::mt19937 random(options.seed);
+    OpensslGcmBackend crypto;
+    ManualClock clock;
+    MeterSimulator meter(options, random);
+    FakeUart uart(options.rxBuffer);
+    SoakListener listener(meter, clock);
+
+    MeterDecoder decoder(crypto, clock);
+    decoder.set_listener(&listener);
+    decoder.set_transport(options.transport);
+    decoder.set_key(SOAK_KEY, sizeof(SOAK_KEY));
+    decoder.set_read_timeout(options.readTimeout);
+
+    // Bookkeeping grows with the number of telegrams, reserve it up front so it does not show up as heap growth
+    uint64_t duration = (uint64_t) (options.hours * 3600 * 1000000);
+    size_t expected = duration / ((uint64_t) options.interval * 1000) + 1;
+    size_t capacity = options.burst > 0 ? expected * 4 : expected + 16;
+
+    meter.sent.reserve(capacity);
+    listener.latencies.reserve(capacity);
+
+    uint8_t readBuffer[SOAK_READ_CHUNK_SIZE];
+    uint64_t loops = 0;
+    size_t liveBytesAtStart = 0;
+    size_t decoderBytesAtStart = 0;
+    bool warm = false;
+
+    auto wallStart = std::chrono::steady_clock::now();
+
+    for(uint64_t now = 0; now < duration; )
+    {
+        uint8_t byte;
+
+        while(meter.next_byte(now, byte))
+            uart.receive(byte);
+
+        clock.set_micros(now);
+
+        // Same as DlmsMeter::loop()
+        int bytesAvailable = uart.available();
+
+        inDecoder = true;
+
+        if(bytesAvailable > 0)
+        {
+            size_t chunkLength = std::min((size_t) bytesAvailable, sizeof(readBuffer));
+
+            if(options.splitReads)
+                chunkLength = 1 + random() % chunkLength;
+
+            if(uart.read_array(readBuffer, chunkLength))
+                decoder.feed(readBuffer, chunkLength);
+        }
+        else
+        {
+            decoder.poll();
+        }
+
+        inDecoder = false;
+
+        if(!warm && !listener.latencies.empty()) // Steady state from the first decoded telegram on
+        {
+            liveBytesAtStart = heap.liveBytes;
+            decoderBytesAtStart = heap.decoderLiveBytes;
+            warm = true;
+        }
+
+        loops++;
+        now += (uint64_t) options.loopInterval * 1000 + (options.jitter > 0 ? random() % ((uint64_t) options.jitter * 1000) : 0);
+    }
+
+    double wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+    size_t liveBytesAtEnd = heap.liveBytes; // Before the results below allocate
+
+    // Results
+
+    uint64_t intact = 0;
+    uint64_t lost = 0;
+    uint64_t lostAfterDamage = 0; // A damaged telegram can take the start of the next one with it
+    uint64_t damagedDecoded = 0;
+
+    for(size_t i = 0; i < meter.sent.size(); i++)
+    {
+        const SentTelegram &telegram = meter.sent[i];
+
+        if(telegram.end == 0 || telegram.end + (uint64_t) (options.readTimeout + 2 * options.loopInterval + options.jitter) * 1000 > duration)
+            continue; // Still on the line or in the buffer when the soak ended
+
+        if(telegram.damaged)
+        {
+            damagedDecoded += telegram.decoded;
+            continue;
+        }
+
+        intact++;
+
+        if(!telegram.decoded && i > 0 && meter.sent[i - 1].damaged)
+            lostAfterDamage++;
+        else if(!telegram.decoded)
+            lost++;
+    }
+
+    std::vector<uint64_t> sorted = listener.latencies;
+    std::sort(sorted.begin(), sorted.end());
+
+    FILE *out = outputPath != NULL ? fopen(outputPath, "w") : stdout;
+
+    if(out == NULL)
+    {
+        fprintf(stderr, "%s: Cannot open output\n", outputPath);
+        return 1;
+    }
+
+    fprintf(out, "{\n");
+    fprintf(out, "  \"simulated_hours\": %.2f,\n", options.hours);
+    fprintf(out, "  \"wall_seconds\": %.2f,\n", wallSeconds);
+    fprintf(out, "  \"speedup\": %.0f,\n", wallSeconds > 0 ? options.hours * 3600 / wallSeconds : 0);
+    fprintf(out, "  \"loop_iterations\": %" PRIu64 ",\n", loops);
+    fprintf(out, "  \"telegrams\": {\n");
+    fprintf(out, "    \"sent\": %zu,\n", meter.sent.size());
+    fprintf(out, "    \"bytes_sent\": %" PRIu64 ",\n", meter.bytes);
+    fprintf(out, "    \"corrupted\": %" PRIu64 ",\n", meter.corrupted);
+    fprintf(out, "    \"dropped_byte\": %" PRIu64 ",\n", meter.dropped);
+    fprintf(out, "    \"back_to_back\": %" PRIu64 ",\n", meter.bursts);
+    fprintf(out, "    \"decoded\": %zu,\n", listener.latencies.size());
+    fprintf(out, "    \"intact\": %" PRIu64 ",\n", intact);
+    fprintf(out, "    \"lost\": %" PRIu64 ",\n", lost);
+    fprintf(out, "    \"lost_after_damage\": %" PRIu64 ",\n", lostAfterDamage);
+    fprintf(out, "    \"damaged_but_decoded\": %" PRIu64 ",\n", damagedDecoded);
+    fprintf(out, "    \"mismatched_values\": %" PRIu64 ",\n", listener.mismatched);
+    fprintf(out, "    \"unknown_frame_counter\": %" PRIu64 ",\n", listener.unknown);
+    fprintf(out, "    \"uart_overflow_bytes\": %" PRIu64 "\n", uart.overflows);
+    fprintf(out, "  },\n");
+    fprintf(out, "  \"errors\": {");
+
+    bool first = true;
+
+    for(int i = 0; i < TelegramErrorCount; i++)
+    {
+        if(listener.errors[i] == 0)
+            continue;
+
+        fprintf(out, "%s\n    \"%s\": %" PRIu64, first ? "" : ",", telegram_error_name((TelegramError) i), listener.errors[i]);
+        first = false;
+    }
+
+    fprintf(out, "%s},\n", first ? "" : "\n  ");
+    fprintf(out, "  \"latency_ms\": { \"min\": %.1f, \"p50\": %.1f, \"p90\": %.1f, \"p99\": %.1f, \"max\": %.1f },\n",
+        percentile(sorted, 0) / 1000.0, percentile(sorted, 0.5) / 1000.0, percentile(sorted, 0.9) / 1000.0, percentile(sorted, 0.99) / 1000.0, percentile(sorted, 1) / 1000.0);
+    fprintf(out, "  \"heap\": {\n");
+    fprintf(out, "    \"decoder_allocations\": %" PRIu64 ",\n", heap.decoderAllocations);
+    fprintf(out, "    \"decoder_live_bytes_growth\": %lld,\n", (long long) heap.decoderLiveBytes - (long long) decoderBytesAtStart);
+    fprintf(out, "    \"live_bytes_growth\": %lld,\n", (long long) liveBytesAtEnd - (long long) liveBytesAtStart);
+    fprintf(out, "    \"peak_bytes\": %zu,\n", heap.peakBytes);
+    fprintf(out, "    \"allocations\": %" PRIu64 "\n", heap.allocations);
+    fprintf(out, "  }\n");
+    fprintf(out, "}\n");
+
+    if(out != stdout)
+        fclose(out);
+
+    // Anything the decoder should never do fails the run
+    bool failed = lost > 0 || damagedDecoded > 0 || listener.mismatched > 0 || listener.unknown > 0 || heap.decoderLiveBytes != decoderBytesAtStart;
+
+    return failed ? 1 : 0;
+}
+
+#endif
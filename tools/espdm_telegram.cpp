@@ -0,0 +1,330 @@
+#if defined(ESPDM_HOST)
+
+#include "espdm_telegram.h"
+#include "espdm_axdr.h"
+#include "espdm_dlms.h"
+#include "espdm_hdlc.h"
+#include "espdm_mbus.h"
+#include "espdm_obis.h"
+#include <openssl/evp.h>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+
+namespace esphome
+{
+    namespace espdm
+    {
+        static const uint8_t KAIFA_MBUS_HEADER[] = { 0x53, 0xFF, 0x00, 0x01, 0x67 }; // Control, address, CI (sequence number), STSAP, DTSAP
+        static const uint8_t PUSH_HDLC_HEADER[] = { 0x41, 0x03, 0x13 }; // Client address 0x20, server address 0x01, UI frame with final bit
+
+        static void append_obis(Bytes &out, uint8_t a, uint8_t b, uint8_t c, uint8_t d, uint8_t e, uint8_t f)
+        {
+            uint8_t code[] = { DataType::OctetString, OBIS_CODE_LENGTH, a, b, c, d, e, f };
+            out.insert(out.end(), code, code + sizeof(code));
+        }
+
+        static void append_date_time(Bytes &out, const KaifaReading &reading)
+        {
+            uint8_t dateTime[] = { (uint8_t) (reading.year >> 8), (uint8_t) reading.year, reading.month, reading.day, 0xFF, reading.hour, reading.minute, reading.second, 0xFF, 0x80, 0x00, 0x00 };
+            out.insert(out.end(), dateTime, dateTime + sizeof(dateTime));
+        }
+
+        static void append_numeric(Bytes &out, uint8_t c, uint8_t d, uint8_t type, uint32_t value, int8_t scaler, uint8_t unit)
+        {
+            uint8_t structure[] = { DataType::Structure, 0x03 };
+            out.insert(out.end(), structure, structure + sizeof(structure));
+
+            append_obis(out, Medium::Electricity, 0x00, c, d, 0x00, 0xFF);
+
+            out.push_back(type);
+
+            if(type == DataType::LongUnsigned)
+            {
+                out.push_back(value >> 8);
+                out.push_back(value);
+            }
+            else
+            {
+                out.push_back(value >> 24);
+                out.push_back(value >> 16);
+                out.push_back(value >> 8);
+                out.push_back(value);
+            }
+
+            uint8_t scalerUnit[] = { DataType::Structure, 0x02, DataType::Integer, (uint8_t) scaler, DataType::Enum, unit };
+            out.insert(out.end(), scalerUnit, scalerUnit + sizeof(scalerUnit));
+        }
+
+        Bytes build_kaifa_plaintext(const KaifaReading &reading, const KaifaLayout &layout, uint32_t invokeId)
+        {
+            Bytes out;
+
+            // Data notification: long-invoke-id-and-priority and date-time
+
+            out.push_back(0x0F);
+            out.push_back(invokeId >> 24);
+            out.push_back(invokeId >> 16);
+            out.push_back(invokeId >> 8);
+            out.push_back(invokeId);
+            out.push_back(0x0C);
+            append_date_time(out, reading);
+
+            // Notification body, timestamp code and value are sent flat at the top level
+
+            out.push_back(DataType::Structure);
+            out.push_back(2 + layout.valueCount + layout.fillerCount);
+
+            append_obis(out, Medium::Abstract, 0x00, 0x01, 0x00, 0x00, 0xFF);
+            out.push_back(DataType::OctetString);
+            out.push_back(12);
+            append_date_time(out, reading);
+
+            for(size_t i = 0; i < layout.valueCount && i < 12; i++)
+            {
+                switch(i)
+                {
+                    case 0: append_numeric(out, 0x20, 0x07, DataType::LongUnsigned, reading.voltage[0], -1, 0x23); break; // V
+                    case 1: append_numeric(out, 0x34, 0x07, DataType::LongUnsigned, reading.voltage[1], -1, 0x23); break;
+                    case 2: append_numeric(out, 0x48, 0x07, DataType::LongUnsigned, reading.voltage[2], -1, 0x23); break;
+                    case 3: append_numeric(out, 0x1F, 0x07, DataType::LongUnsigned, reading.current[0], -2, 0x21); break; // A
+                    case 4: append_numeric(out, 0x33, 0x07, DataType::LongUnsigned, reading.current[1], -2, 0x21); break;
+                    case 5: append_numeric(out, 0x47, 0x07, DataType::LongUnsigned, reading.current[2], -2, 0x21); break;
+                    case 6: append_numeric(out, 0x01, 0x07, DataType::DoubleLongUnsigned, reading.activePowerPlus, 0, 0x1B); break; // W
+                    case 7: append_numeric(out, 0x02, 0x07, DataType::DoubleLongUnsigned, reading.activePowerMinus, 0, 0x1B); break;
+                    case 8: append_numeric(out, 0x01, 0x08, DataType::DoubleLongUnsigned, reading.activeEnergyPlus, 0, 0x1E); break; // Wh
+                    case 9: append_numeric(out, 0x02, 0x08, DataType::DoubleLongUnsigned, reading.activeEnergyMinus, 0, 0x1E); break;
+                    case 10: append_numeric(out, 0x03, 0x08, DataType::DoubleLongUnsigned, reading.reactiveEnergyPlus, 0, 0x20); break; // varh
+                    case 11: append_numeric(out, 0x04, 0x08, DataType::DoubleLongUnsigned, reading.reactiveEnergyMinus, 0, 0x20); break;
+                }
+            }
+
+            for(size_t i = 0; i < layout.fillerCount; i++)
+            {
+                static const char deviceName[] = "KFM1200200000000";
+
+                out.push_back(DataType::Structure);
+                out.push_back(0x02);
+                append_obis(out, Medium::Abstract, 0x00, 0x2A, 0x00, 0x00, 0xFF);
+                out.push_back(DataType::OctetString);
+                out.push_back(sizeof(deviceName) - 1);
+                out.insert(out.end(), deviceName, deviceName + sizeof(deviceName) - 1);
+            }
+
+            return out;
+        }
+
+        Bytes build_dlms_message(const uint8_t *key, const uint8_t *systemTitle, uint32_t frameCounter, const Bytes &plaintext, const uint8_t *authenticationKey)
+        {
+            uint8_t securityControl = authenticationKey != NULL ? DLMS_SECURITY_CONTROL_AUTHENTICATED : DLMS_SECURITY_CONTROL;
+
+            uint8_t iv[DLMS_IV_LENGTH];
+            memcpy(iv, systemTitle, DLMS_SYSTEM_TITLE_LENGTH);
+            iv[8] = frameCounter >> 24;
+            iv[9] = frameCounter >> 16;
+            iv[10] = frameCounter >> 8;
+            iv[11] = frameCounter;
+
+            Bytes ciphertext(plaintext.size());
+            uint8_t tag[16];
+            int outLength = 0;
+
+            EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+            EVP_EncryptInit_ex(ctx, EVP_aes_128_gcm(), NULL, NULL, NULL);
+            EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_IVLEN, sizeof(iv), NULL);
+            EVP_EncryptInit_ex(ctx, NULL, NULL, key, iv);
+
+            if(authenticationKey != NULL) // Additional authenticated data is the security control byte and the key
+            {
+                EVP_EncryptUpdate(ctx, NULL, &outLength, &securityControl, 1);
+                EVP_EncryptUpdate(ctx, NULL, &outLength, authenticationKey, DLMS_AUTHENTICATION_KEY_LENGTH);
+            }
+
+            EVP_EncryptUpdate(ctx, ciphertext.data(), &outLength, plaintext.data(), plaintext.size());
+
+            if(authenticationKey != NULL)
+            {
+                EVP_EncryptFinal_ex(ctx, tag, &outLength);
+                EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, sizeof(tag), tag);
+                ciphertext.insert(ciphertext.end(), tag, tag + DLMS_TAG_LENGTH);
+            }
+
+            EVP_CIPHER_CTX_free(ctx);
+
+            Bytes out;
+            out.push_back(DLMS_GENERAL_GLO_CIPHERING);
+            out.push_back(DLMS_SYSTEM_TITLE_LENGTH);
+            out.insert(out.end(), systemTitle, systemTitle + DLMS_SYSTEM_TITLE_LENGTH);
+
+            size_t messageLength = ciphertext.size() + DLMS_LENGTH_CORRECTION;
+
+            if(messageLength > 127)
+            {
+                out.push_back(DLMS_LENGTH_EXTENDED);
+                out.push_back(messageLength >> 8);
+                out.push_back(messageLength);
+            }
+            else
+            {
+                out.push_back(messageLength);
+            }
+
+            out.push_back(securityControl);
+            out.push_back(frameCounter >> 24);
+            out.push_back(frameCounter >> 16);
+            out.push_back(frameCounter >> 8);
+            out.push_back(frameCounter);
+            out.insert(out.end(), ciphertext.begin(), ciphertext.end());
+
+            return out;
+        }
+
+        Bytes build_mbus_frames(const Bytes &message, size_t framePayloadLength)
+        {
+            Bytes out;
+            uint8_t sequence = 0;
+
+            for(size_t offset = 0; offset < message.size(); offset += framePayloadLength, sequence++)
+            {
+                size_t count = message.size() - offset < framePayloadLength ? message.size() - offset : framePayloadLength;
+                bool last = offset + count >= message.size();
+
+                Bytes body(KAIFA_MBUS_HEADER, KAIFA_MBUS_HEADER + sizeof(KAIFA_MBUS_HEADER));
+                body[MBUS_CI_OFFSET - MBUS_HEADER_INTRO_LENGTH] = sequence | (last ? MBUS_CI_FINAL_SEGMENT : 0);
+                body.insert(body.end(), message.begin() + offset, message.begin() + offset + count);
+
+                uint8_t checksum = 0;
+
+                for(uint8_t c : body)
+                    checksum += c;
+
+                out.push_back(MBUS_START_BYTE);
+                out.push_back(body.size());
+                out.push_back(body.size());
+                out.push_back(MBUS_START_BYTE);
+                out.insert(out.end(), body.begin(), body.end());
+                out.push_back(checksum);
+                out.push_back(MBUS_STOP_BYTE);
+            }
+
+            return out;
+        }
+
+        Bytes build_hdlc_frames(const Bytes &message, size_t informationLength)
+        {
+            Bytes information(HDLC_LLC_HEADER, HDLC_LLC_HEADER + sizeof(HDLC_LLC_HEADER)); // Only the first segment has the LLC header
+            information.insert(information.end(), message.begin(), message.end());
+
+            Bytes out;
+
+            for(size_t offset = 0; offset < information.size(); offset += informationLength)
+            {
+                size_t count = information.size() - offset < informationLength ? information.size() - offset : informationLength;
+                bool last = offset + count >= information.size();
+                size_t frameLength = 2 + sizeof(PUSH_HDLC_HEADER) + HDLC_CHECKSUM_LENGTH + count + HDLC_CHECKSUM_LENGTH;
+
+                Bytes frame;
+                frame.push_back(HDLC_FORMAT_TYPE | (last ? 0 : HDLC_SEGMENTATION_BIT) | (frameLength >> 8));
+                frame.push_back(frameLength);
+                frame.insert(frame.end(), PUSH_HDLC_HEADER, PUSH_HDLC_HEADER + sizeof(PUSH_HDLC_HEADER));
+
+                uint16_t hcs = hdlc_fcs(HDLC_FCS_INIT, frame.data(), frame.size()) ^ 0xFFFF;
+                frame.push_back(hcs);
+                frame.push_back(hcs >> 8);
+
+                frame.insert(frame.end(), information.begin() + offset, information.begin() + offset + count);
+
+                uint16_t fcs = hdlc_fcs(HDLC_FCS_INIT, frame.data(), frame.size()) ^ 0xFFFF;
+                frame.push_back(fcs);
+                frame.push_back(fcs >> 8);
+
+                out.push_back(HDLC_FLAG);
+                out.insert(out.end(), frame.begin(), frame.end());
+                out.push_back(HDLC_FLAG);
+            }
+
+            return out;
+        }
+
+        bool parse_hex(const char *hex, Bytes &out)
+        {
+            out.clear();
+
+            int high = -1;
+
+            for(const char *c = hex; *c != '\0'; c++)
+            {
+                if(*c == ' ' || *c == ':' || *c == '-' || *c == '.')
+                    continue;
+
+                if(!isxdigit((unsigned char) *c))
+                    return false;
+
+                int nibble = isdigit((unsigned char) *c) ? *c - '0' : (tolower((unsigned char) *c) - 'a' + 10);
+
+                if(high < 0)
+                {
+                    high = nibble;
+                }
+                else
+                {
+                    out.push_back((high << 4) | nibble);
+                    high = -1;
+                }
+            }
+
+            return high < 0;
+        }
+
+        bool read_file(const char *path, Bytes &out)
+        {
+            FILE *file = strcmp(path, "-") == 0 ? stdin : fopen(path, "rb");
+
+            if(file == NULL)
+                return false;
+
+            uint8_t buffer[4096];
+            size_t count;
+
+            while((count = fread(buffer, 1, sizeof(buffer), file)) > 0)
+                out.insert(out.end(), buffer, buffer + count);
+
+            bool ok = !ferror(file);
+
+            if(file != stdin)
+                fclose(file);
+
+            return ok;
+        }
+
+        std::vector<Bytes> split_mbus_telegrams(const Bytes &stream)
+        {
+            std::vector<Bytes> telegrams;
+            uint8_t buffer[MBUS_MAX_PAYLOAD_LENGTH];
+            MbusParser parser(buffer, sizeof(buffer));
+            size_t start = 0;
+
+            for(size_t i = 0; i < stream.size(); i++)
+            {
+                if(parser.empty())
+                    start = i; // Telegram starts with the first byte the parser keeps
+
+                FrameStatus status = parser.feed(stream[i]);
+
+                if(status == FrameTelegramComplete)
+                {
+                    telegrams.push_back(Bytes(stream.begin() + start, stream.begin() + i + 1));
+                    parser.reset();
+                }
+                else if(status != FrameNeedMore && status != FrameComplete)
+                {
+                    start = i; // Parser resyncs on a start byte after an error
+                }
+            }
+
+            return telegrams;
+        }
+    }
+}
+
+#endif
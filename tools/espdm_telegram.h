@@ -0,0 +1,82 @@
+#pragma once
+
+#if defined(ESPDM_HOST)
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace esphome
+{
+    namespace espdm
+    {
+        typedef std::vector<uint8_t> Bytes;
+
+        static const size_t MBUS_FRAME_PAYLOAD_LENGTH = 245; // DLMS bytes per M-Bus frame as sent by the Kaifa MA309M
+        static const size_t HDLC_SEGMENT_INFORMATION_LENGTH = 128; // Default maximum information field length of HDLC, including the LLC header
+
+        /*
+         * Values of one synthetic reading
+         */
+        struct KaifaReading
+        {
+            uint16_t year = 2021;
+            uint8_t month = 1;
+            uint8_t day = 25;
+            uint8_t hour = 15;
+            uint8_t minute = 33;
+            uint8_t second = 20;
+
+            uint16_t voltage[3] = { 2302, 2315, 2298 }; // 0.1 V
+            uint16_t current[3] = { 153, 87, 212 }; // 0.01 A
+            uint32_t activePowerPlus = 1120; // W
+            uint32_t activePowerMinus = 0; // W
+            uint32_t activeEnergyPlus = 4531200; // Wh
+            uint32_t activeEnergyMinus = 12; // Wh
+            uint32_t reactiveEnergyPlus = 23980; // varh
+            uint32_t reactiveEnergyMinus = 881032; // varh
+        };
+
+        /*
+         * Shape of a synthetic telegram
+         *
+         * The Kaifa MA309M sends all values in two frames with an extended length. Fewer values
+         * give the single frame variants, filler items (device name octet strings) make it longer.
+         */
+        struct KaifaLayout
+        {
+            const char *name;
+            size_t valueCount; // Number of numeric values (1-12), in the order the meter sends them
+            size_t fillerCount; // Additional octet string items
+        };
+
+        enum KaifaLayoutIndex
+        {
+            KaifaSingleShort,
+            KaifaSingleExtended,
+            KaifaMultiFrame,
+            KaifaMultiFramePadded,
+            KaifaLayoutCount
+        };
+
+        static const KaifaLayout KAIFA_LAYOUTS[KaifaLayoutCount] = // Indexed by KaifaLayoutIndex
+        {
+            { "single_short", 3, 0 }, // One frame, length below 128
+            { "single_extended", 8, 0 }, // One frame, 0x82 length
+            { "multi_frame", 12, 0 }, // Two frames, all values as sent by the MA309M
+            { "multi_frame_padded", 12, 12 } // Three frames
+        };
+
+        Bytes build_kaifa_plaintext(const KaifaReading &reading, const KaifaLayout &layout, uint32_t invokeId);
+        Bytes build_dlms_message(const uint8_t *key, const uint8_t *systemTitle, uint32_t frameCounter, const Bytes &plaintext, const uint8_t *authenticationKey = NULL); // Encrypts with AES-128-GCM, appends a tag if authenticationKey is set
+        Bytes build_mbus_frames(const Bytes &message, size_t framePayloadLength = MBUS_FRAME_PAYLOAD_LENGTH);
+        Bytes build_hdlc_frames(const Bytes &message, size_t informationLength = HDLC_SEGMENT_INFORMATION_LENGTH); // Segmented UI frames as sent by push meters
+
+        bool parse_hex(const char *hex, Bytes &out); // Accepts optional separators (space, ':', '-', '.')
+        bool read_file(const char *path, Bytes &out); // "-" reads stdin
+        std::vector<Bytes> split_mbus_telegrams(const Bytes &stream); // Raw frame bytes of every complete telegram in a capture
+    }
+}
+
+#endif